@@ -78,7 +78,7 @@ Oid   BdrReplicationSetConfigRelid = InvalidOid;
 Oid   BdrSupervisorDbOid = InvalidOid;
 
 /* GUC storage */
-static bool bdr_synchronous_commit;
+bool bdr_synchronous_commit;
 int bdr_default_apply_delay;
 int bdr_max_workers;
 int bdr_max_databases;
@@ -87,6 +87,22 @@ bool bdr_skip_ddl_locking;
 bool bdr_do_not_replicate;
 bool bdr_discard_mismatched_row_attributes;
 bool bdr_trace_replay;
+bool bdr_track_apply_timing;
+int bdr_apply_insert_batch_size;
+bool bdr_apply_insert_runs;
+bool bdr_apply_streaming;
+int bdr_apply_group_commit_size;
+int bdr_feedback_lsn_delta;
+int bdr_apply_prefetch_window;
+int bdr_apply_receive_buffer;
+int bdr_apply_idle_exit_timeout;
+int bdr_apply_relaunch_interval;
+int bdr_sequence_refill_watermark;
+bool bdr_apply_sendrecv_stable_types;
+bool bdr_apply_relmeta_cache;
+bool bdr_apply_compact_tuples;
+char *bdr_apply_compression;
+char *bdr_apply_capture_path;
 int bdr_trace_ddl_locks_level = DDL_LOCK_TRACE_STATEMENT;
 char *bdr_extra_apply_connection_options;
 bool bdr_enabled;
@@ -326,7 +342,8 @@ bdr_connect(const char *conninfo,
 /*
  * ----------
  * Create a slot on a remote node, and the corresponding local replication
- * identifier.
+ * identifier. Split into a send and a finish half so callers with several
+ * slots to make can have them all created concurrently.
  *
  * Arguments:
  *   streamConn		Connection to use for slot creation
@@ -341,43 +358,73 @@ bdr_connect(const char *conninfo,
  * ----------
  */
 /*
- * TODO we should really handle the case where the slot already exists but
- * there's no local replication identifier, by dropping and recreating the
- * slot.
+ * Dispatch the CREATE_REPLICATION_SLOT command for slot creation without
+ * waiting for the reply. The slot isn't usable until
+ * bdr_create_slot_finish() has consumed the result.
+ *
+ * This split exists so the join path can build slots on all peers
+ * concurrently: establishing the consistent decoding snapshot is the slow
+ * part of slot creation on a busy node, and once the commands are all in
+ * flight the peers build their snapshots in parallel.
  */
-static void
-bdr_create_slot(PGconn *streamConn, Name slot_name,
-				char *remote_ident, RepOriginId *replication_identifier,
-				char **snapshot)
+void
+bdr_create_slot_send(PGconn *streamConn, Name slot_name)
 {
 	StringInfoData query;
-	PGresult   *res;
 
 	initStringInfo(&query);
 
-	StartTransactionCommand();
-
-	/* we want the new identifier on stable storage immediately */
-	ForceSyncCommit();
-
-	/* acquire remote decoding slot */
-	resetStringInfo(&query);
 	appendStringInfo(&query, "CREATE_REPLICATION_SLOT \"%s\" LOGICAL %s",
 					 NameStr(*slot_name), "bdr");
 
 	elog(DEBUG3, "Sending replication command: %s", query.data);
 
-	res = PQexec(streamConn, query.data);
+	if (!PQsendQuery(streamConn, query.data))
+		elog(FATAL, "could not send replication command \"%s\": %s",
+			 query.data, PQerrorMessage(streamConn));
+
+	pfree(query.data);
+}
+
+/*
+ * Collect the reply to bdr_create_slot_send() and create the corresponding
+ * local replication identifier.
+ *
+ * A slot that already exists on the remote end is accepted: that's what a
+ * previous attempt that died between creating the slot and committing the
+ * local identifier leaves behind, and such a slot is guaranteed to retain
+ * more WAL than we need. No snapshot is available in that case.
+ */
+void
+bdr_create_slot_finish(PGconn *streamConn, Name slot_name,
+					   char *remote_ident, RepOriginId *replication_identifier,
+					   char **snapshot)
+{
+	PGresult   *res;
+
+	res = PQgetResult(streamConn);
 
 	if (PQresultStatus(res) != PGRES_TUPLES_OK)
 	{
-		/* TODO: Should test whether this error is 'already exists' and carry on */
-
-		elog(FATAL, "could not send replication command \"%s\": status %s: %s\n",
-			 query.data,
-			 PQresStatus(PQresultStatus(res)), PQresultErrorMessage(res));
+		const char *sqlstate = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+
+		/* 42710 == ERRCODE_DUPLICATE_OBJECT */
+		if (sqlstate == NULL || strcmp(sqlstate, "42710") != 0)
+			elog(FATAL, "could not create replication slot \"%s\": status %s: %s\n",
+				 NameStr(*slot_name),
+				 PQresStatus(PQresultStatus(res)), PQresultErrorMessage(res));
+
+		elog(DEBUG1, "slot %s already exists on the remote end, adopting it",
+			 NameStr(*slot_name));
+		PQclear(res);
+		res = NULL;
 	}
 
+	StartTransactionCommand();
+
+	/* we want the new identifier on stable storage immediately */
+	ForceSyncCommit();
+
 	/* acquire new local identifier, but don't commit */
 	*replication_identifier = replorigin_create(remote_ident);
 
@@ -387,9 +434,24 @@ bdr_create_slot(PGconn *streamConn, Name slot_name,
 	elog(DEBUG1, "created replication identifier %u", *replication_identifier);
 
 	if (snapshot)
-		*snapshot = pstrdup(PQgetvalue(res, 0, 2));
+		*snapshot = (res != NULL) ? pstrdup(PQgetvalue(res, 0, 2)) : NULL;
 
-	PQclear(res);
+	if (res != NULL)
+		PQclear(res);
+
+	/* drain the end-of-results marker */
+	while ((res = PQgetResult(streamConn)) != NULL)
+		PQclear(res);
+}
+
+static void
+bdr_create_slot(PGconn *streamConn, Name slot_name,
+				char *remote_ident, RepOriginId *replication_identifier,
+				char **snapshot)
+{
+	bdr_create_slot_send(streamConn, slot_name);
+	bdr_create_slot_finish(streamConn, slot_name, remote_ident,
+						   replication_identifier, snapshot);
 }
 
 /*
@@ -469,10 +531,19 @@ bdr_bgworker_init(uint32 worker_arg, BdrWorkerType worker_type)
 	SetConfigOption("search_path", "bdr, pg_catalog",
 					PGC_BACKEND, PGC_S_OVERRIDE);
 
-	/* setup synchronous commit according to the user's wishes */
-	SetConfigOption("synchronous_commit",
-					bdr_synchronous_commit ? "local" : "off",
-					PGC_BACKEND, PGC_S_OVERRIDE);	/* other context? */
+	/*
+	 * Setup synchronous commit according to the user's wishes. With replay
+	 * group commit the apply worker flushes WAL itself once per
+	 * bdr.apply_group_commit_size remote transactions, so its local commits
+	 * always run asynchronously regardless of bdr.synchronous_commit.
+	 */
+	if (worker_type == BDR_WORKER_APPLY && bdr_apply_group_commit_size > 0)
+		SetConfigOption("synchronous_commit", "off",
+						PGC_BACKEND, PGC_S_OVERRIDE);
+	else
+		SetConfigOption("synchronous_commit",
+						bdr_synchronous_commit ? "local" : "off",
+						PGC_BACKEND, PGC_S_OVERRIDE);	/* other context? */
 
 	if (worker_type == BDR_WORKER_APPLY)
 	{
@@ -779,6 +850,18 @@ _PG_init(void)
 							 0,
 							 NULL, NULL, NULL);
 
+	DefineCustomBoolVariable("bdr.relation_ddl_locks",
+							 "Scope global write locks to the target relation "
+							 "where possible",
+							 "When on, DDL against a single table blocks DML "
+							 "only against that table on peer nodes instead "
+							 "of the whole database. All nodes must run a "
+							 "BDR version that understands scoped locks.",
+							 &bdr_relation_ddl_locks,
+							 false, PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+
 	DefineCustomBoolVariable("bdr.permit_unsafe_ddl_commands",
 							 "Allow commands that might cause data or " \
 							 "replication problems under BDR to run",
@@ -846,6 +929,31 @@ _PG_init(void)
 							   0,
 							   NULL, NULL, NULL);
 
+	DefineCustomIntVariable("bdr.init_node_parallel_jobs",
+							"Number of parallel jobs for the initial dump and restore during logical join",
+							"Passed as -j to the bundled pg_dump and pg_restore when copying "
+							"the upstream database into a joining node, so large databases "
+							"dump and restore one table stream per job. The dump uses the "
+							"directory format either way; 1 keeps the load single-threaded.",
+							&bdr_init_node_parallel_jobs,
+							1, 1, 64,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("bdr.init_node_streaming_load",
+							 "Stream the initial dump directly into the restore during logical join",
+							 "When enabled, the joining node pipes the upstream dump straight "
+							 "into pg_restore instead of materializing it under "
+							 "bdr.temp_dump_directory first, so the join makes one pass over "
+							 "the data and needs no scratch space. The stream is single-job; "
+							 "bdr.init_node_parallel_jobs is ignored while this is set.",
+							 &bdr_init_node_streaming_load,
+							 false,
+							 PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
 	DefineCustomBoolVariable("bdr.do_not_replicate",
 							 "Internal. Set during local initialization from basebackup only",
 							 NULL,
@@ -874,6 +982,16 @@ _PG_init(void)
 							 0,
 							 NULL, NULL, NULL);
 
+	DefineCustomBoolVariable("bdr.track_apply_timing",
+							 "Accumulate per-table wall-clock apply time in pg_stat_bdr_tables",
+							 "Costs two clock readings per applied row, so it is off by "
+							 "default; the per-table row and conflict counters are "
+							 "collected either way.",
+							 &bdr_track_apply_timing,
+							 false, PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
 	DefineCustomEnumVariable("bdr.trace_ddl_locks_level",
 							 "Log DDL locking activity at this log level",
 							 NULL,
@@ -909,6 +1027,232 @@ _PG_init(void)
 							   PGC_SIGHUP,
 							   0, NULL, NULL, NULL);
 
+	DefineCustomIntVariable("bdr.parallel_apply_workers",
+							"Number of helper workers applying changes for each peer node",
+							"When nonzero, each apply worker dispatches remote transactions "
+							"to this many helper workers, preserving upstream commit order. "
+							"Zero disables parallel apply.",
+							&bdr_parallel_apply_workers,
+							0, 0, 64,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.apply_insert_batch_size",
+							"Maximum number of consecutive remote INSERTs applied as one multi-insert",
+							"Runs of inserts into the same relation are buffered and "
+							"written with a single heap multi-insert. A value of 1 "
+							"applies every insert individually.",
+							&bdr_apply_insert_batch_size,
+							100, 1, 10000,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("bdr.apply_insert_runs",
+							 "Request bulk streaming of insert runs from upstream nodes",
+							 "Consecutive inserts into one relation are shipped as a "
+							 "COPY-like row stream and applied in bulk. Disable when "
+							 "replicating from peers too old to know the insert_runs "
+							 "output plugin option.",
+							 &bdr_apply_insert_runs,
+							 true,
+							 PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("bdr.apply_streaming",
+							 "Request streaming of large in-progress transactions from upstream nodes",
+							 "Transactions exceeding the upstream's logical_decoding_work_mem "
+							 "are streamed before they commit and spooled locally instead of "
+							 "spilling on the upstream. Disable when replicating from peers "
+							 "too old to know the streaming output plugin option.",
+							 &bdr_apply_streaming,
+							 true,
+							 PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.apply_group_commit_size",
+							"Number of replayed transactions to commit per local WAL flush",
+							"Remote transactions are committed asynchronously and the "
+							"apply worker flushes WAL once this many have accumulated "
+							"(or the stream pauses), so small transactions replay at "
+							"CPU rate instead of fsync rate. Replay confirmation to the "
+							"upstream only ever covers flushed commits, and replication "
+							"origins advance with the commit records, so a crash "
+							"restarts from a consistent point. Zero commits and flushes "
+							"each transaction individually, honouring "
+							"bdr.synchronous_commit.",
+							&bdr_apply_group_commit_size,
+							0, 0, 10000,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.stats_flush_interval",
+							"Time between periodic flushes of the BDR statistics to disk",
+							"The counters behind pg_stat_bdr are serialized by the "
+							"supervisor this often, so a crash loses at most this much "
+							"statistics history rather than everything since the last "
+							"clean shutdown. Zero flushes only at shutdown, as before.",
+							&bdr_count_flush_interval,
+							300, 0, INT_MAX / 1000,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.feedback_lsn_delta",
+							"Replay progress that must accumulate before unsolicited feedback is sent",
+							"Standby status updates to the upstream walsender are "
+							"coalesced until the flush position has advanced this far "
+							"(or roughly a second has passed), rather than reporting "
+							"every small advance. Explicit upstream reply requests are "
+							"always answered immediately. Zero reports every change.",
+							&bdr_feedback_lsn_delta,
+							1024, 0, INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.apply_prefetch_window",
+							"Number of received changes to read ahead for index/heap prefetch",
+							"When set, the apply worker buffers up to this many incoming "
+							"messages and issues asynchronous prefetch requests for the "
+							"primary key lookups of pending UPDATEs and DELETEs, overlapping "
+							"their I/O with apply of the current change. Worthwhile mainly "
+							"when the working set exceeds shared_buffers; it costs an extra "
+							"index probe per row. Zero disables readahead.",
+							&bdr_apply_prefetch_window,
+							0, 0, 256,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.apply_receive_buffer",
+							"Amount of incoming change stream to buffer ahead of apply",
+							"When set, the apply worker greedily drains the replication "
+							"socket into an in-memory ring of up to this much raw stream "
+							"while changes are being applied, instead of reading one "
+							"message per change. This keeps the TCP window open across "
+							"momentary apply stalls, which matters on high "
+							"bandwidth-delay links; once the ring fills, reading stops "
+							"and ordinary TCP backpressure throttles the upstream. "
+							"Zero reads messages on demand only.",
+							&bdr_apply_receive_buffer,
+							0, 0, INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.apply_idle_exit_timeout",
+							"Idle time after which an apply worker detaches from its peer",
+							"When set, an apply worker that has received no changes for this "
+							"long confirms its replay position and exits, and the per-db "
+							"worker starts a replacement every bdr.apply_relaunch_interval "
+							"to poll for new changes. In a large mesh this turns the cost of "
+							"each quiet peer from a resident backend into a periodic "
+							"reconnect, at the price of replay - and so DDL locking and "
+							"global sequence voting - lagging by up to the relaunch "
+							"interval on quiet connections. Zero keeps workers resident.",
+							&bdr_apply_idle_exit_timeout,
+							0, 0, 86400,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.apply_relaunch_interval",
+							"How often a detached apply worker is restarted to poll its peer",
+							"Only meaningful with bdr.apply_idle_exit_timeout set. The "
+							"restarted worker stays resident while changes keep arriving "
+							"and detaches again once its connection has been idle for the "
+							"exit timeout.",
+							&bdr_apply_relaunch_interval,
+							300, 1, 86400,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("bdr.sequence_refill_watermark",
+							"Remaining global sequence values below which an early refill is requested",
+							"When an allocation from a global sequence leaves fewer than this "
+							"many values across its cached chunks, the sequencer is woken "
+							"immediately so a new voting round can complete before the "
+							"sequence runs dry, instead of stalling nextval() callers while "
+							"an election runs. Zero disables the early wakeup.",
+							&bdr_sequence_refill_watermark,
+							5000, 0, INT_MAX,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("bdr.apply_sendrecv_stable_types",
+							 "Request send/recv format for stable builtin types across versions",
+							 "When the upstream runs a different major version it normally "
+							 "falls back to text I/O for every column. This asks it to keep "
+							 "using the send/recv binary format for builtin types whose wire "
+							 "representation is stable across versions, such as numeric and "
+							 "the timestamp types. Disable when replicating from peers too "
+							 "old to know the sendrecv_stable_types output plugin option.",
+							 &bdr_apply_sendrecv_stable_types,
+							 true,
+							 PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("bdr.apply_relmeta_cache",
+							 "Identify relations in the change stream by cached metadata",
+							 "The upstream describes each replicated relation once per "
+							 "session and change messages then carry a compact relation ID "
+							 "instead of repeating the qualified relation name, which can "
+							 "be a large share of wire bytes for narrow tables. Disable "
+							 "when replicating from peers too old to know the relmeta_cache "
+							 "output plugin option.",
+							 &bdr_apply_relmeta_cache,
+							 true,
+							 PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("bdr.apply_compact_tuples",
+							 "Request compact tuple framing from upstream nodes",
+							 "Rows are framed with varint lengths and a null bitmap instead "
+							 "of fixed 4-byte lengths and per-column null markers, which "
+							 "for narrow rows saves more wire bytes than the data itself "
+							 "occupies. Disable when replicating from peers too old to know "
+							 "the compact_tuples output plugin option.",
+							 &bdr_apply_compact_tuples,
+							 true,
+							 PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomStringVariable("bdr.apply_compression",
+							   "Compression of the replication stream received from upstream nodes",
+							   "Valid values are \"none\", \"lz4\" and \"zstd\". Anything but "
+							   "\"none\" requires upstreams new enough to know the compression "
+							   "output plugin option and built with the matching library; "
+							   "compression stays off by default for that reason.",
+							   &bdr_apply_compression,
+							   "none",
+							   PGC_SIGHUP,
+							   0,
+							   NULL, NULL, NULL);
+
+	DefineCustomStringVariable("bdr.apply_capture_path",
+							   "File to append received apply protocol messages to",
+							   "Each apply worker appends the decoded change stream it "
+							   "replays - the exact bytes handed to the apply machinery, "
+							   "after decompression - to this path with the worker pid "
+							   "appended. Such a capture can be replayed and timed with "
+							   "bdr.bdr_apply_replay(). Debug/benchmark facility, off (empty) "
+							   "by default.",
+							   &bdr_apply_capture_path,
+							   "",
+							   PGC_SIGHUP,
+							   0,
+							   NULL, NULL, NULL);
+
 	DefineCustomBoolVariable("bdr.check_local_ip",
 							   "Stop applying changes if this node's conn_dsn gives wrong IP address",
 							   NULL,
@@ -1371,7 +1715,7 @@ bdr_skip_changes_upto(PG_FUNCTION_ARGS)
 		{
 			int ret = WaitLatch(&MyProc->procLatch,
 							WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-							500, PG_WAIT_EXTENSION);
+							500, WAIT_EVENT_BGWORKER_SHUTDOWN);
 
 			if (ret & WL_POSTMASTER_DEATH)
 				proc_exit(1);
@@ -12,6 +12,7 @@
 
 #include "access/attnum.h"
 #include "access/xlogdefs.h"
+#include "port/atomics.h"
 #include "access/xlog.h"
 #include "nodes/execnodes.h"
 #include "postmaster/bgworker.h"
@@ -152,6 +153,14 @@ typedef struct BDRConflictHandler
 	Oid			handler_oid;
 	BdrConflictType handler_type;
 	uint64		timeframe;
+
+	/*
+	 * Resolved call information, looked up once when the handler list is
+	 * built and reused for every conflict until the relcache entry is
+	 * invalidated.
+	 */
+	FmgrInfo	handler_fmgrinfo;
+	TupleDesc	handler_retdesc;
 }	BDRConflictHandler;
 
 /* How detailed logging of DDL locks is */
@@ -172,6 +181,32 @@ enum BdrDDLLockTraceLevel {
  * This structure is for caching relation specific information, such as
  * conflict handlers.
  */
+/*
+ * Per-attribute cache of type I/O information, hung off BDRRelation so it
+ * lives as long as the relcache entry. Both the output plugin and apply
+ * fill in the parts they use lazily, on first contact with a column; the
+ * FmgrInfo lookups and pg_type syscache access otherwise happen once per
+ * datum, which shows up badly on wide or I/O-function-heavy tables.
+ */
+typedef struct BDRAttrIOCache
+{
+	/* type facts, for decide_datum_transfer() in the output plugin */
+	bool		type_cached;
+	char		typtype;
+	Oid			typelem;
+	bool		has_recv;		/* type has send/recv functions */
+	FmgrInfo	send_fn;		/* valid if has_recv */
+	FmgrInfo	out_fn;
+
+	/* apply side */
+	bool		recv_valid;
+	FmgrInfo	recv_fn;
+	Oid			recv_typioparam;
+	bool		in_valid;
+	FmgrInfo	in_fn;
+	Oid			in_typioparam;
+} BDRAttrIOCache;
+
 typedef struct BDRRelation
 {
 	/* hash key */
@@ -188,11 +223,32 @@ typedef struct BDRRelation
 	char	  **replication_sets;
 	/* -1 for no configured set */
 	int			num_replication_sets;
+	/* sets borrowed from the label parse memo, don't free on invalidation */
+	bool		sets_interned;
+
+	/*
+	 * Table declared free of cross-node write conflicts (e.g. single writer
+	 * per table by design); apply skips conflict detection for it.
+	 */
+	bool		conflict_free;
+
+	/* lazily built per-attribute type I/O cache, or NULL */
+	BDRAttrIOCache *att_io_cache;
 
 	bool		computed_repl_valid;
 	bool		computed_repl_insert;
 	bool		computed_repl_update;
 	bool		computed_repl_delete;
+
+	/*
+	 * Bitmap of which of the decoding session's configured replication sets
+	 * contain this relation; bit i corresponds to the i'th entry of the
+	 * session's sorted set list. Unlike computed_repl_*, membership depends
+	 * only on the relation's own options, so it stays valid across
+	 * bdr_replication_set_config changes.
+	 */
+	bool		computed_membership_valid;
+	uint64		computed_set_membership;
 } BDRRelation;
 
 typedef struct BDRTupleData
@@ -202,6 +258,25 @@ typedef struct BDRTupleData
 	bool		changed[MaxTupleAttributeNumber];
 } BDRTupleData;
 
+/*
+ * Latency histograms over replayed actions, kept per apply worker. Actions
+ * are classed by their wire action byte; each class gets power-of-two
+ * microsecond buckets, bucket i counting actions that took less than 2^i
+ * microseconds (and at least 2^(i-1) for i > 0).
+ */
+typedef enum BdrApplyHistAction
+{
+	BDR_APPLY_HIST_BEGIN = 0,
+	BDR_APPLY_HIST_INSERT,
+	BDR_APPLY_HIST_UPDATE,
+	BDR_APPLY_HIST_DELETE,
+	BDR_APPLY_HIST_COMMIT,
+	BDR_APPLY_HIST_OTHER
+}	BdrApplyHistAction;
+
+#define BDR_APPLY_HIST_ACTIONS	(BDR_APPLY_HIST_OTHER + 1)
+#define BDR_APPLY_HIST_BUCKETS	32
+
 /*
  * BdrApplyWorker describes a BDR worker connection.
  *
@@ -239,6 +314,32 @@ typedef struct BdrApplyWorker
 	 * Must only be accessed with the bdr worker shmem control segment lock held.
 	 */
 	Latch			*proclatch;
+
+	/*
+	 * If nonzero, the worker detached because its connection was idle (see
+	 * bdr.apply_idle_exit_timeout) and its bgworker has been unregistered.
+	 * The perdb worker registers a new bgworker for this slot once this
+	 * time arrives.
+	 *
+	 * Must only be accessed with the bdr worker shmem control segment lock held.
+	 */
+	TimestampTz		idle_until;
+
+	/*
+	 * Replay progress published for bdr.bdr_node_lag(). Only the apply
+	 * worker itself writes these; they're atomics so pollers read untorn
+	 * values without taking the worker control lock on the replay path.
+	 */
+	pg_atomic_uint64 last_applied_lsn;		/* remote end-of-commit of last applied tx */
+	pg_atomic_uint64 last_applied_committs;	/* its remote commit timestamp (TimestampTz) */
+	pg_atomic_uint64 received_lsn;			/* latest remote position received */
+	pg_atomic_uint64 apply_rate;			/* remote WAL bytes applied per second */
+
+	/*
+	 * Action latency histograms, see BdrApplyHistAction. As above, only
+	 * the apply worker writes these and the atomics are for untorn reads.
+	 */
+	pg_atomic_uint64 action_hist[BDR_APPLY_HIST_ACTIONS][BDR_APPLY_HIST_BUCKETS];
 } BdrApplyWorker;
 
 /*
@@ -374,9 +475,12 @@ extern int	bdr_default_apply_delay;
 extern int bdr_max_workers;
 extern int bdr_max_databases;
 extern char *bdr_temp_dump_directory;
+extern int bdr_init_node_parallel_jobs;
+extern bool bdr_init_node_streaming_load;
 extern bool bdr_log_conflicts_to_table;
 extern bool bdr_conflict_logging_include_tuples;
 extern bool bdr_permit_ddl_locking;
+extern bool bdr_relation_ddl_locks;
 extern bool bdr_permit_unsafe_commands;
 extern bool bdr_skip_ddl_locking;
 extern bool bdr_skip_ddl_replication;
@@ -385,10 +489,39 @@ extern bool bdr_discard_mismatched_row_attributes;
 extern int bdr_max_ddl_lock_delay;
 extern int bdr_ddl_lock_timeout;
 extern bool bdr_trace_replay;
+extern bool bdr_track_apply_timing;
 extern int bdr_trace_ddl_locks_level;
 extern char *bdr_extra_apply_connection_options;
 extern bool bdr_check_lsn_mismatch;
 extern bool bdr_check_local_ip;
+extern int bdr_parallel_apply_workers;
+extern int bdr_apply_insert_batch_size;
+extern bool bdr_apply_insert_runs;
+extern bool bdr_synchronous_commit;
+extern bool bdr_apply_streaming;
+extern int bdr_apply_group_commit_size;
+extern int bdr_feedback_lsn_delta;
+extern int bdr_apply_prefetch_window;
+extern int bdr_apply_receive_buffer;
+extern int bdr_apply_idle_exit_timeout;
+extern int bdr_apply_relaunch_interval;
+extern int bdr_sequence_refill_watermark;
+extern bool bdr_apply_sendrecv_stable_types;
+extern bool bdr_apply_relmeta_cache;
+extern bool bdr_apply_compact_tuples;
+extern char *bdr_apply_compression;
+extern char *bdr_apply_capture_path;
+
+/*
+ * Compression of the logical replication stream, negotiated with the
+ * compression output plugin option (see bdr.apply_compression).
+ */
+typedef enum BdrCompressionType
+{
+	BDR_COMPRESSION_NONE,
+	BDR_COMPRESSION_LZ4,
+	BDR_COMPRESSION_ZSTD
+} BdrCompressionType;
 
 static const char * const bdr_default_apply_connection_options =
         "connect_timeout=30 "
@@ -415,6 +548,10 @@ typedef struct BdrWorkerControl
 	bool		worker_management_paused;
 	/* Latch for the supervisor worker */
 	Latch		*supervisor_latch;
+	/* Bumped (under lock) with each request for a supervisor db rescan */
+	uint32		perdb_rescan_generation;
+	/* Where bdr_worker_shmem_alloc starts looking for a free slot */
+	int			first_free_hint;
 	/* Array members, of size bdr_max_workers */
 	BdrWorker    slots[FLEXIBLE_ARRAY_MEMBER];
 } BdrWorkerControl;
@@ -485,9 +622,17 @@ extern void build_index_scan_keys(ResultRelInfo *relInfo,
 extern bool build_index_scan_key(struct ScanKeyData *skey, Relation rel,
 								 Relation idxrel,
 								 BDRTupleData *tup);
+extern struct ScanKeyData **build_index_scan_key_templates(ResultRelInfo *relinfo);
+extern void build_index_scan_key_template(struct ScanKeyData *skey, Relation rel,
+										  Relation idxrel);
+extern bool refresh_index_scan_key(struct ScanKeyData *skey, Relation idxrel,
+								   BDRTupleData *tup);
 extern bool find_pkey_tuple(struct ScanKeyData *skey, BDRRelation *rel,
-							Relation idxrel, struct TupleTableSlot *slot,
+							Relation idxrel, struct IndexScanDescData **scan_cache,
+							struct TupleTableSlot *slot,
 							bool lock, enum LockTupleMode mode);
+extern void prefetch_pkey_tuple(struct ScanKeyData *skey, BDRRelation *rel,
+								Relation idxrel);
 
 /* conflict logging (usable in apply only) */
 
@@ -535,6 +680,8 @@ extern BdrApplyConflict * bdr_make_apply_conflict(BdrConflictType conflict_type,
 
 extern void bdr_conflict_log_serverlog(BdrApplyConflict *conflict);
 extern void bdr_conflict_log_table(BdrApplyConflict *conflict);
+extern void bdr_conflict_log_flush(void);
+extern void bdr_conflict_log_discard(void);
 
 extern void tuple_to_stringinfo(StringInfo s, TupleDesc tupdesc, HeapTuple tuple);
 
@@ -550,6 +697,22 @@ extern void bdr_count_update_conflict(void);
 extern void bdr_count_delete(void);
 extern void bdr_count_delete_conflict(void);
 extern void bdr_count_disconnect(void);
+extern void bdr_count_decode_attach(const BDRNodeId * const peer);
+extern void bdr_count_decode_txn(void);
+extern void bdr_count_decode_change(void);
+extern void bdr_count_decode_filtered_origin(void);
+extern void bdr_count_decode_filtered_relation(void);
+extern void bdr_count_decode_bytes(int64 nbytes);
+extern void bdr_count_maybe_flush(void);
+extern void bdr_count_table_insert(Oid relid);
+extern void bdr_count_table_insert_conflict(Oid relid);
+extern void bdr_count_table_update(Oid relid);
+extern void bdr_count_table_update_conflict(Oid relid);
+extern void bdr_count_table_delete(Oid relid);
+extern void bdr_count_table_delete_conflict(Oid relid);
+extern void bdr_count_table_apply_time(Oid relid, uint64 time_us);
+
+extern int bdr_count_flush_interval;
 
 /* compat check functions */
 extern bool bdr_get_float4byval(void);
@@ -573,6 +736,7 @@ extern void bdr_worker_shmem_acquire(BdrWorkerType worker_type,
 									 bool free_at_rel);
 extern void bdr_worker_shmem_release(void);
 
+extern void bdr_dbcache_shmem_init(void);
 extern bool bdr_is_bdr_activated_db(Oid dboid);
 extern BdrWorker *bdr_worker_get_entry(const BDRNodeId * nodeid,
 									   BdrWorkerType worker_type);
@@ -593,10 +757,31 @@ extern void bdr_capture_ddl(Node *parsetree, const char *queryString,
                                                        DestReceiver *dest, const char *completionTag);
 
 extern void bdr_locks_shmem_init(void);
-extern void bdr_locks_check_dml(void);
+extern void bdr_locks_check_dml(List *target_relids);
+
+/* apply protocol processing, shared with parallel apply helpers */
+extern void bdr_process_remote_action(StringInfo s);
+extern void bdr_apply_helper_attach(pid_t leader_pid);
+extern void bdr_apply_abort_replay_transaction(void);
+
+/* parallel apply (bdr_apply_parallel.c) */
+extern bool bdr_apply_parallel_enabled(void);
+extern void bdr_apply_parallel_startup(RepOriginId origin_id);
+extern void bdr_apply_parallel_dispatch(StringInfo s);
+extern void bdr_apply_parallel_drain(void);
+extern bool bdr_apply_parallel_flush_position(XLogRecPtr *write,
+											  XLogRecPtr *flush);
+extern bool bdr_apply_parallel_wait_for_ticket(uint64 ticket);
+extern void bdr_apply_parallel_retry_transaction(void);
+extern void bdr_apply_parallel_confirm_commit(uint64 ticket,
+											  XLogRecPtr remote_end,
+											  XLogRecPtr local_end);
+extern uint64 bdr_apply_parallel_current_ticket;
 
 /* background workers and supporting functions for them */
 PGDLLEXPORT extern void bdr_apply_main(Datum main_arg);
+PGDLLEXPORT extern void bdr_apply_parallel_main(Datum main_arg);
+PGDLLEXPORT extern void bdr_apply_replay_main(Datum main_arg);
 PGDLLEXPORT extern void bdr_perdb_worker_main(Datum main_arg);
 PGDLLEXPORT extern void bdr_supervisor_worker_main(Datum main_arg);
 
@@ -627,6 +812,8 @@ extern BDRNodeInfo * bdr_nodes_get_local_info(const BDRNodeId * const node);
 extern void bdr_bdr_node_free(BDRNodeInfo *node);
 extern void bdr_nodes_set_local_status(BdrNodeStatus status, BdrNodeStatus oldstatus);
 extern void bdr_nodes_set_local_attrs(BdrNodeStatus status, BdrNodeStatus oldstatus, const int *seq_id);
+extern void bdr_nodes_set_local_init_catchup_lsn(XLogRecPtr target_lsn);
+extern XLogRecPtr bdr_nodes_get_local_init_catchup_lsn(void);
 extern List* bdr_read_connection_configs(void);
 
 /* return a node name or (none) if unknown for given nodeid */
@@ -656,10 +843,15 @@ bdr_copytable(PGconn *copyfrom_conn, PGconn *copyto_conn,
 		const char * copyfrom_query, const char *copyto_query);
 
 /* local node info cache (bdr_nodecache.c) */
+extern void bdr_nodecache_shmem_init(void);
 extern void bdr_nodecache_invalidate(void);
 extern bool bdr_local_node_read_only(void);
 extern char bdr_local_node_status(void);
 extern int32 bdr_local_node_seq_id(void);
+extern BdrNodeStatus bdr_nodeid_status(const BDRNodeId * const node);
+
+/* bdr_seq2.c */
+extern void global_seq_invalidate_nodeid(void);
 extern const char *bdr_local_node_name(void);
 
 extern void bdr_node_set_read_only_internal(char *node_name, bool read_only, bool force);
@@ -672,6 +864,12 @@ extern const char * bdr_get_my_cached_remote_name(const BDRNodeId * const remote
 extern struct pg_conn* bdr_connect(const char *conninfo, Name appname,
 								   BDRNodeId * out_nodeid);
 
+extern void bdr_create_slot_send(struct pg_conn *streamConn, Name slot_name);
+extern void bdr_create_slot_finish(struct pg_conn *streamConn, Name slot_name,
+								   char *remote_ident,
+								   RepOriginId *replication_identifier,
+								   char **snapshot);
+
 extern struct pg_conn *
 bdr_establish_connection_and_slot(const char *dsn,
 								  const char *application_name_suffix,
@@ -688,12 +886,15 @@ extern void bdr_cleanup_conn_close(int code, Datum offset);
 
 /* use instead of heap_open()/heap_close() */
 extern BDRRelation *bdr_heap_open(Oid reloid, LOCKMODE lockmode);
+extern bool bdr_relation_excluded_cached(Oid reloid);
 extern void bdr_heap_close(BDRRelation * rel, LOCKMODE lockmode);
 extern void bdr_heap_compute_replication_settings(
 	BDRRelation *rel,
 	int			num_replication_sets,
 	char	  **replication_sets);
 extern void BDRRelcacheHashInvalidateCallback(Datum arg, Oid relid);
+extern void BDRRelcacheInvalidateReplicationSetConfig(void);
+extern BDRAttrIOCache *bdr_relation_att_io_cache(BDRRelation *rel, int attoff);
 
 extern void bdr_parse_relation_options(const char *label, BDRRelation *rel);
 extern void bdr_parse_database_options(const char *label, bool *is_active);
@@ -755,5 +956,7 @@ extern bool bdr_nodeid_eq(const BDRNodeId * const left, const BDRNodeId * const
 extern void bdr_getmsg_nodeid(StringInfo message, BDRNodeId * const nodeid, bool expect_empty_nodename);
 extern void bdr_send_nodeid(StringInfo s, const BDRNodeId * const nodeid, bool include_empty_nodename);
 extern void bdr_sendint64(int64 i, char *buf);
+extern void bdr_sendvarint(StringInfo s, uint32 val);
+extern uint32 bdr_getmsgvarint(StringInfo message);
 
 #endif   /* BDR_H */
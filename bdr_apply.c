@@ -17,6 +17,7 @@
 #include "bdr.h"
 #include "bdr_locks.h"
 #include "bdr_messaging.h"
+#include "bdr_probes.h"
 
 #include "funcapi.h"
 #include "libpq-fe.h"
@@ -47,9 +48,13 @@
 
 #include "parser/parse_type.h"
 
+#include "portability/instr_time.h"
+#include "port/pg_bitutils.h"
+
 #include "replication/logical.h"
 #include "replication/origin.h"
 
+#include "storage/fd.h"
 #include "storage/ipc.h"
 #include "storage/lmgr.h"
 #include "storage/lockdefs.h"
@@ -72,6 +77,13 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <ifaddrs.h>
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
 #endif
 
 /* Useful for development:
@@ -116,6 +128,89 @@ static BdrConnectionConfig *bdr_apply_config = NULL;
 
 dlist_head bdr_lsn_association = DLIST_STATIC_INIT(bdr_lsn_association);
 
+/*
+ * Pending run of remote INSERTs into a single relation, applied with one
+ * heap multi-insert when the run ends. See process_remote_insert.
+ */
+static MemoryContext insert_batch_context = NULL;
+static Oid			insert_batch_relid = InvalidOid;
+static HeapTuple   *insert_batch_tuples = NULL;
+static int			insert_batch_capacity = 0;
+static int			insert_batch_ntuples = 0;
+
+/*
+ * A queued DDL command extracted from a bdr.bdr_queued_commands row.
+ *
+ * Migration scripts arrive as long runs of inserts into the queue table,
+ * one per statement. Instead of executing each at the moment its row is
+ * applied, consecutive commands are collected here (strings allocated in
+ * MessageContext) and executed together, with one teardown of the cached
+ * relation handles and one setup of the DDL execution environment for the
+ * whole run. See flush_queued_ddl_batch().
+ */
+typedef struct BdrQueuedDdlCommand
+{
+	char	   *perpetrator;
+	char	   *search_path;
+	char	   *cmdstr;
+} BdrQueuedDdlCommand;
+
+static List *queued_ddl_batch = NIL;
+static bool queued_ddl_batch_started_tx = false;
+
+/*
+ * Arena for the datums decoded by read_tuple_parts(). Type input and
+ * receive functions can allocate freely, and MessageContext is only reset
+ * at commit, so decoding into MessageContext makes memory usage grow with
+ * transaction size. Instead we decode into this context and reset it (the
+ * context itself is reused, not recreated) before each row action, once
+ * the previous row's datums have been formed into a self-contained tuple.
+ */
+static MemoryContext apply_row_context = NULL;
+
+/*
+ * Streamed in-progress transactions ('b'/'x'/'e'/'a'/'c' actions).
+ *
+ * When the upstream streams a large transaction before its outcome is
+ * known we cannot apply the changes right away: BDR's conflict resolution
+ * needs the remote commit timestamp, which doesn't exist yet, and the
+ * transaction may yet abort. So streamed changes are spooled to a local
+ * temporary file per upstream (toplevel) xid, moving the spill cost off
+ * the upstream and overlapping the network transfer with the upstream
+ * transaction. When the streamed commit arrives the spool is replayed
+ * through the regular action handlers; a streamed abort just discards it.
+ *
+ * Aborted subtransactions are handled by remembering the spool offset at
+ * which each subxact's first change landed and truncating back to it;
+ * everything after that offset belongs to the subxact or its children.
+ */
+typedef struct BdrStreamedSubxact
+{
+	TransactionId subxid;
+	off_t		start_offset;	/* spool length before its first change */
+} BdrStreamedSubxact;
+
+typedef struct BdrStreamedTxn
+{
+	TransactionId xid;			/* hash key: upstream toplevel xid */
+	File		spool_fd;
+	off_t		spool_size;
+	int			nsubxacts;
+	int			subxacts_size;
+	BdrStreamedSubxact *subxacts;	/* allocated in TopMemoryContext */
+} BdrStreamedTxn;
+
+static HTAB *streamed_txns = NULL;
+/* streamed transaction owning the currently open 'b' ... 'e' segment */
+static BdrStreamedTxn *cur_streamed_txn = NULL;
+
+/*
+ * Replay group commit: number of asynchronously committed remote
+ * transactions whose WAL hasn't been explicitly flushed yet. See
+ * bdr.apply_group_commit_size.
+ */
+static int	group_commit_pending = 0;
+
 struct ActionErrCallbackArg
 {
 	const char * action_name;
@@ -125,8 +220,79 @@ struct ActionErrCallbackArg
 	bool suppress_output;
 };
 
-static BDRRelation *read_rel(StringInfo s, LOCKMODE mode, struct ActionErrCallbackArg *cbarg);
+/*
+ * Cached per-relation apply state, keyed by the remote's schema and
+ * relation names and kept for the life of the replayed transaction: the
+ * open BDRRelation, executor state, slots, open indexes and scan key
+ * templates. Saves a catalog name lookup, executor setup and index
+ * open/close cycle per row. Rebuilt when the relcache invalidation
+ * callback in bdr_relcache.c marks the underlying BDRRelation invalid;
+ * released at commit.
+ */
+typedef struct BdrApplyRelHandleKey
+{
+	char		nspname[NAMEDATALEN];
+	char		relname[NAMEDATALEN];
+} BdrApplyRelHandleKey;
+
+typedef struct BdrApplyRelHandle
+{
+	BdrApplyRelHandleKey key;
+	BDRRelation *rel;			/* NULL if the handle is released */
+	EState	   *estate;
+	ResultRelInfo *relinfo;		/* indexes are open */
+	TupleTableSlot *newslot;
+	TupleTableSlot *oldslot;
+	ScanKey	   *index_keys;		/* conflict-scan templates, per open index */
+	IndexScanDesc *conflict_scans;	/* cached scans paired with index_keys */
+	Relation	idxrel;			/* replica identity index, if any */
+	ScanKeyData idx_skey[INDEX_MAX_KEYS];	/* template for idxrel */
+	IndexScanDesc idx_scan;		/* cached find_pkey_tuple scan on idxrel */
+} BdrApplyRelHandle;
+
+static HTAB *apply_rel_handles = NULL;
+
+/*
+ * Remote relation metadata received in 'r' messages when the relmeta_cache
+ * startup option was negotiated with the upstream. Change messages then
+ * identify their relation by the upstream's oid instead of repeating the
+ * qualified relation name; read_rel_handle() resolves it here.
+ */
+typedef struct BdrRemoteRelMeta
+{
+	Oid			remote_relid;
+	char		nspname[NAMEDATALEN];
+	char		relname[NAMEDATALEN];
+} BdrRemoteRelMeta;
+
+static HTAB *remote_relmeta = NULL;
+
+/* did we negotiate relmeta_cache for the current connection? */
+static bool relmeta_cache_active = false;
+
+/*
+ * Compression negotiated for the current connection with the compression
+ * startup option; see bdr.apply_compression.
+ */
+static BdrCompressionType apply_compression = BDR_COMPRESSION_NONE;
+#ifdef USE_ZSTD
+static ZSTD_DStream *zstd_in = NULL;
+#endif
+
+/*
+ * State for an insert run streamed by the upstream ('S'/'R'/'E' actions):
+ * rows between run start and end all target this relation.
+ */
+static BdrApplyRelHandle *insert_run_handle = NULL;
+static struct ActionErrCallbackArg insert_run_cbarg;
+
+static BdrApplyRelHandle *read_rel_handle(StringInfo s, LOCKMODE mode,
+										  struct ActionErrCallbackArg *cbarg);
+static void release_apply_rel_handle(BdrApplyRelHandle *handle);
+static void release_apply_rel_handles(void);
+static void forget_apply_rel_handles(void);
 static void read_tuple_parts(StringInfo s, BDRRelation *rel, BDRTupleData *tup);
+static void prefetch_remote_action(char *buf, int len);
 
 static void check_apply_update(BdrConflictType conflict_type,
 							   RepOriginId local_node_id, TimestampTz local_ts,
@@ -137,14 +303,32 @@ static void check_apply_update(BdrConflictType conflict_type,
 
 static void check_bdr_wakeups(BDRRelation *rel);
 static HeapTuple process_queued_drop(HeapTuple cmdtup);
-static void process_queued_ddl_command(HeapTuple cmdtup, bool tx_just_started);
+static void buffer_queued_ddl_command(HeapTuple cmdtup, bool tx_just_started);
+static void flush_queued_ddl_batch(void);
 static bool bdr_performing_work(void);
 
+static bool insert_batching_allowed(BDRRelation *rel);
+static void buffer_remote_insert(BDRRelation *rel, HeapTuple tup);
+static void flush_insert_batch(void);
+
+static void process_remote_insert_run_start(StringInfo s);
+static void process_remote_insert_run_row(StringInfo s);
+static void process_remote_insert_run_end(void);
+
 static void process_remote_begin(StringInfo s);
 static void process_remote_commit(StringInfo s);
 static void process_remote_insert(StringInfo s);
 static void process_remote_update(StringInfo s);
 static void process_remote_delete(StringInfo s);
+static void process_remote_stream_start(StringInfo s);
+static void process_remote_stream_change(StringInfo s);
+static void process_remote_stream_stop(void);
+static void process_remote_stream_abort(StringInfo s);
+static void process_remote_stream_commit(StringInfo s);
+static void process_remote_relmeta(StringInfo s);
+
+static PGconn *bdr_apply_connect_stream(RepOriginId *replication_identifier,
+										bool reconnect);
 
 static void get_local_tuple_origin(HeapTuple tuple,
 								   TimestampTz *commit_ts,
@@ -219,6 +403,155 @@ action_error_callback(void *arg)
 	}
 }
 
+/*
+ * If we're in catchup mode, see if this transaction is relayed from
+ * elsewhere and prepare to advance the appropriate replication origin.
+ *
+ * Expects remote_origin to have been read from the wire already; sets
+ * remote_origin_id.
+ */
+static void
+lookup_forwarded_origin(void)
+{
+	char remote_ident[256];
+	NameData replication_name;
+	MemoryContext old_ctx;
+	BDRNodeId my_nodeid;
+	bdr_make_my_nodeid(&my_nodeid);
+
+	if (bdr_nodeid_eq(&remote_origin, &my_nodeid))
+	{
+		/*
+		 * This might not have to be an error condition, but we don't cope
+		 * with it for now and it shouldn't arise for use of catchup mode
+		 * for init_replica.
+		 */
+		ereport(ERROR,
+				(errmsg("Replication loop in catchup mode"),
+				 errdetail("Received a transaction from the remote node that originated on this node")));
+	}
+
+	/* replication_name is currently unused in bdr */
+	NameStr(replication_name)[0] = '\0';
+
+	/*
+	 * To determine whether the commit was forwarded by the upstream from
+	 * another node, we need to get the local RepOriginId for that node based
+	 * on the (sysid, timelineid, dboid) supplied in catchup mode.
+	 */
+	snprintf(remote_ident, sizeof(remote_ident),
+			BDR_REPORIGIN_ID_FORMAT,
+			remote_origin.sysid, remote_origin.timeline, remote_origin.dboid, MyDatabaseId,
+			NameStr(replication_name));
+
+	old_ctx = CurrentMemoryContext;
+	StartTransactionCommand();
+	remote_origin_id = replorigin_by_name(remote_ident, false);
+	CommitTransactionCommand();
+	(void) MemoryContextSwitchTo(old_ctx);
+}
+
+/*
+ * Honour bdr.default_apply_delay/apply_delay by sleeping until the remote
+ * commit timestamp in replorigin_session_origin_timestamp is far enough in
+ * the past.
+ */
+static void
+apply_delay_sleep(void)
+{
+	int			apply_delay;
+
+	/*
+	 * Parallel apply helpers and bdr.bdr_apply_replay() have no upstream
+	 * connection config of their own; any configured delay is enforced by
+	 * the leader (or is meaningless for a canned replay).
+	 */
+	if (bdr_apply_config == NULL)
+		return;
+
+	apply_delay = bdr_apply_config->apply_delay;
+
+	if (apply_delay == -1)
+		apply_delay = bdr_default_apply_delay;
+
+	/* don't want the overhead otherwise */
+	if (apply_delay <= 0)
+		return;
+
+	/* loop in case we're woken early in a sleep by an interrupt */
+	while (true)
+	{
+		long		sec;
+		int			usec;
+		int			ret;
+		long		delay_ms;
+		TimestampTz		current;
+
+		current = GetCurrentTimestamp();
+
+		/*
+		 * Some amount of clock drift/skew is normal, so
+		 * we must handle remote commits that are in the future
+		 * according to our local clock.
+		 */
+		if (current < replorigin_session_origin_timestamp)
+		{
+			TimestampDifference(replorigin_session_origin_timestamp, current,
+								&sec, &usec);
+
+			/* ignore small skews */
+			if (sec > 1)
+				ereport(WARNING,
+						(errmsg("clock skew detected: node "BDR_NODEID_FORMAT_WITHNAME" clock is ahead of local clock by at least %ld.%03d seconds",
+								BDR_NODEID_FORMAT_WITHNAME_ARGS(origin), sec,
+								usec / 1000)));
+
+			/*
+			 * Now clamp the delay to max apply delay. If we're woken
+			 * mid-sleep this could mean we repeat the warning and wait
+			 * longer than apply_delay but ... don't have your clocks
+			 * ahead, then!
+			 */
+			delay_ms = apply_delay;
+		}
+		else
+		{
+			current = TimestampTzPlusMilliseconds(current,
+												  -apply_delay);
+
+			TimestampDifference(current, replorigin_session_origin_timestamp,
+								&sec, &usec);
+
+			/*
+			 * WaitLatch doesn't support > INT_MAX ms, including any us component,
+			 * and we have to guard against overflow anyway.
+			 */
+			if (sec >= (INT_MAX/1000 - 1000))
+			{
+				elog(WARNING, "ignoring absurd remote commit timestamp and/or apply_delay");
+				delay_ms = 0;
+			}
+			else
+				delay_ms = sec * 1000 + usec / 1000L;
+
+			/* TimestampDifference returns 0 if start >= end, so: */
+			if (delay_ms == 0)
+				break;
+		}
+
+		ret = WaitLatch(&MyProc->procLatch,
+						WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						delay_ms, WAIT_EVENT_RECOVERY_APPLY_DELAY);
+
+		if (ret & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		ResetLatch(&MyProc->procLatch);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
 static void
 process_remote_begin(StringInfo s)
 {
@@ -226,12 +559,14 @@ process_remote_begin(StringInfo s)
 	TimestampTz		committime;
 	TransactionId	remote_xid;
 	char			statbuf[100];
-	int				apply_delay = bdr_apply_config->apply_delay;
 	int				flags = 0;
 	ErrorContextCallback errcallback;
 	struct ActionErrCallbackArg cbarg;
 
-	Assert(bdr_apply_worker != NULL);
+	/*
+	 * bdr_apply_worker may be NULL here: parallel apply helpers and
+	 * bdr.bdr_apply_replay() drive this path without a worker slot of their own.
+	 */
 
 	xact_action_counter = 1;
 	memset(&cbarg, 0, sizeof(struct ActionErrCallbackArg));
@@ -256,6 +591,8 @@ process_remote_begin(StringInfo s)
 	committime = pq_getmsgint64(s);
 	remote_xid = pq_getmsgint(s, 4);
 
+	BDR_TRACE_APPLY_TXN_START(remote_xid, commit_afterend_lsn);
+
 	if (flags & BDR_OUTPUT_TRANSACTION_HAS_ORIGIN)
 	{
 		bdr_getmsg_nodeid(s, &remote_origin, false);
@@ -296,52 +633,8 @@ process_remote_begin(StringInfo s)
 
 	pgstat_report_activity(STATE_RUNNING, statbuf);
 
-	if (apply_delay == -1)
-		apply_delay = bdr_default_apply_delay;
-
-	/*
-	 * If we're in catchup mode, see if this transaction is relayed from
-	 * elsewhere and prepare to advance the appropriate replication origin.
-	 */
 	if (flags & BDR_OUTPUT_TRANSACTION_HAS_ORIGIN)
-	{
-		char remote_ident[256];
-		NameData replication_name;
-		MemoryContext old_ctx;
-		BDRNodeId my_nodeid;
-		bdr_make_my_nodeid(&my_nodeid);
-
-		if (bdr_nodeid_eq(&remote_origin, &my_nodeid))
-		{
-			/*
-			 * This might not have to be an error condition, but we don't cope
-			 * with it for now and it shouldn't arise for use of catchup mode
-			 * for init_replica.
-			 */
-			ereport(ERROR,
-					(errmsg("Replication loop in catchup mode"),
-					 errdetail("Received a transaction from the remote node that originated on this node")));
-		}
-
-		/* replication_name is currently unused in bdr */
-		NameStr(replication_name)[0] = '\0';
-
-		/*
-		 * To determine whether the commit was forwarded by the upstream from
-		 * another node, we need to get the local RepOriginId for that node based
-		 * on the (sysid, timelineid, dboid) supplied in catchup mode.
-		 */
-		snprintf(remote_ident, sizeof(remote_ident),
-				BDR_REPORIGIN_ID_FORMAT,
-				remote_origin.sysid, remote_origin.timeline, remote_origin.dboid, MyDatabaseId,
-				NameStr(replication_name));
-
-		old_ctx = CurrentMemoryContext;
-		StartTransactionCommand();
-		remote_origin_id = replorigin_by_name(remote_ident, false);
-		CommitTransactionCommand();
-		(void) MemoryContextSwitchTo(old_ctx);
-	}
+		lookup_forwarded_origin();
 
 	if (bdr_trace_replay)
 	{
@@ -354,135 +647,36 @@ process_remote_begin(StringInfo s)
 		pfree(si.data);
 	}
 
-	/* don't want the overhead otherwise */
-	if (apply_delay > 0)
-	{
-		/* loop in case we're woken early in a sleep by an interrupt */
-		while (true)
-		{
-			long		sec;
-			int			usec;
-			int			ret;
-			long		delay_ms;
-			TimestampTz		current;
-
-			current = GetCurrentTimestamp();
-
-			/*
-			 * Some amount of clock drift/skew is normal, so
-			 * we must handle remote commits that are in the future
-			 * according to our local clock.
-			 */
-			if (current < replorigin_session_origin_timestamp)
-			{
-				TimestampDifference(replorigin_session_origin_timestamp, current,
-									&sec, &usec);
-				
-				/* ignore small skews */
-				if (sec > 1)
-					ereport(WARNING,
-							(errmsg("clock skew detected: node "BDR_NODEID_FORMAT_WITHNAME" clock is ahead of local clock by at least %ld.%03d seconds",
-									BDR_NODEID_FORMAT_WITHNAME_ARGS(origin), sec,
-									usec / 1000)));
-
-				/*
-				 * Now clamp the delay to max apply delay. If we're woken
-				 * mid-sleep this could mean we repeat the warning and wait
-				 * longer than apply_delay but ... don't have your clocks
-				 * ahead, then!
-				 */
-				delay_ms = apply_delay;
-			}
-			else
-			{
-				current = TimestampTzPlusMilliseconds(current,
-													  -apply_delay);
-
-				TimestampDifference(current, replorigin_session_origin_timestamp,
-									&sec, &usec);
-
-				/*
-				 * WaitLatch doesn't support > INT_MAX ms, including any us component,
-				 * and we have to guard against overflow anyway.
-				 */
-				if (sec >= (INT_MAX/1000 - 1000))
-				{
-					elog(WARNING, "ignoring absurd remote commit timestamp and/or apply_delay");
-					delay_ms = 0;
-				}
-				else
-					delay_ms = sec * 1000 + usec / 1000L;
-
-				/* TimestampDifference returns 0 if start >= end, so: */
-				if (delay_ms == 0)
-					break;
-			}
-
-			ret = WaitLatch(&MyProc->procLatch,
-							WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-							delay_ms, PG_WAIT_EXTENSION);
-
-			if (ret & WL_POSTMASTER_DEATH)
-				proc_exit(1);
-
-			ResetLatch(&MyProc->procLatch);
-
-			CHECK_FOR_INTERRUPTS();
-		}
-	}
+	apply_delay_sleep();
 
 	if (error_context_stack == &errcallback)
 		error_context_stack = errcallback.previous;
 }
 
 /*
- * Process a commit message from the output plugin, advance replication
- * identifiers, commit the local transaction, and determine whether replay
- * should continue.
+ * Advance replication identifiers, commit the local transaction, and
+ * determine whether replay should continue. Common tail of the 'C' and
+ * streamed 'c' commit actions; the caller has already parsed the message
+ * and set up the replication origin session state.
  */
 static void
-process_remote_commit(StringInfo s)
+finish_remote_commit(XLogRecPtr commit_lsn, XLogRecPtr commit_afterend_lsn)
 {
-	XLogRecPtr		commit_lsn;
-	TimestampTz		committime PG_USED_FOR_ASSERTS_ONLY;
-	TimestampTz		commit_afterend_lsn;
-	int				flags;
-	ErrorContextCallback errcallback;
-	struct ActionErrCallbackArg cbarg;
-
-	Assert(bdr_apply_worker != NULL);
-
-	xact_action_counter++;
-	memset(&cbarg, 0, sizeof(struct ActionErrCallbackArg));
-	cbarg.action_name = "COMMIT";
-	errcallback.callback = action_error_callback;
-	errcallback.arg = &cbarg;
-	errcallback.previous = error_context_stack;
-	error_context_stack = &errcallback;
-
-	flags = pq_getmsgint(s, 4);
-
-	if (flags != 0)
-		elog(ERROR, "Commit flags are currently unused, but flags was set to %i", flags);
-
-	/* order of access to fields after flags is important */
-	commit_lsn = pq_getmsgint64(s);	/* start of commit record; not used anymore */
-	commit_afterend_lsn = pq_getmsgint64(s);	/* end of commit record + 1 */
-	committime = pq_getmsgint64(s);
-
-	if (bdr_trace_replay)
+	/*
+	 * In a parallel apply helper, local commits must happen in upstream
+	 * commit order; wait until all earlier-ticketed transactions have
+	 * committed. If the wait detects a lock cycle with an earlier
+	 * transaction instead, abort and re-apply this transaction serially;
+	 * the retry replays the commit message again, so everything this
+	 * function would do has happened by the time the retry returns.
+	 */
+	if (bdr_apply_parallel_current_ticket != 0 &&
+		!bdr_apply_parallel_wait_for_ticket(bdr_apply_parallel_current_ticket))
 	{
-		StringInfoData si;
-		initStringInfo(&si);
-		format_action_description(&si, "COMMIT", NULL, NULL, false);
-		cbarg.suppress_output = true;
-		elog(LOG, "TRACE: %s", si.data);
-		cbarg.suppress_output = false;
-		pfree(si.data);
+		bdr_apply_parallel_retry_transaction();
+		return;
 	}
 
-	Assert(committime == replorigin_session_origin_timestamp);
-
 	Assert(replorigin_session_origin_lsn == commit_afterend_lsn /* bdr 2.0 msg */
 		|| replorigin_session_origin_lsn == commit_lsn); /* bdr 1.0 msg */
 
@@ -499,10 +693,19 @@ process_remote_commit(StringInfo s)
 	if (replorigin_session_origin_lsn == commit_lsn)
 		replorigin_session_origin_lsn += 1;
 
+	/* any queued DDL still batched up must run inside the transaction */
+	flush_queued_ddl_batch();
+
+	/* close cached relation handles before the transaction goes away */
+	release_apply_rel_handles();
+
 	if (started_transaction)
 	{
 		BdrFlushPosition *flushpos;
 
+		/* batch-insert any conflicts spooled during this transaction */
+		bdr_conflict_log_flush();
+
 		CommitTransactionCommand();
 		(void) MemoryContextSwitchTo(MessageContext);
 
@@ -520,8 +723,26 @@ process_remote_commit(StringInfo s)
 
 		/* report stats, only relevant if something was actually written */
 		pgstat_report_stat(false);
+
+		/*
+		 * In group commit mode individual commits don't flush WAL; flush
+		 * once enough remote commits have accumulated so confirming the
+		 * batch upstream isn't left to the walwriter's cadence.
+		 */
+		if (bdr_apply_group_commit_size > 0 &&
+			++group_commit_pending >= bdr_apply_group_commit_size)
+		{
+			XLogFlush(XactLastCommitEnd);
+			group_commit_pending = 0;
+		}
 	}
 
+	/* let the leader and later-ticketed transactions proceed */
+	if (bdr_apply_parallel_current_ticket != 0)
+		bdr_apply_parallel_confirm_commit(bdr_apply_parallel_current_ticket,
+										  replorigin_session_origin_lsn,
+										  XactLastCommitEnd);
+
 	pgstat_report_activity(STATE_IDLE, NULL);
 
 	/*
@@ -552,6 +773,46 @@ process_remote_commit(StringInfo s)
 
 	bdr_count_commit();
 
+	BDR_TRACE_APPLY_TXN_COMMIT(commit_afterend_lsn);
+
+	/*
+	 * Publish replay progress for bdr.bdr_node_lag(). The rate is
+	 * recomputed over roughly ten second windows of remote WAL progress,
+	 * so it reads as zero until the first window closes. Parallel apply
+	 * helpers and bdr.bdr_apply_replay() have no worker slot to publish into.
+	 */
+	if (bdr_apply_worker != NULL)
+	{
+		static TimestampTz rate_window_start = 0;
+		static XLogRecPtr rate_window_lsn = InvalidXLogRecPtr;
+		TimestampTz now = GetCurrentTimestamp();
+
+		pg_atomic_write_u64(&bdr_apply_worker->last_applied_lsn,
+							commit_afterend_lsn);
+		pg_atomic_write_u64(&bdr_apply_worker->last_applied_committs,
+							(uint64) replorigin_session_origin_timestamp);
+
+		if (rate_window_start == 0)
+		{
+			rate_window_start = now;
+			rate_window_lsn = commit_afterend_lsn;
+		}
+		else if (TimestampDifferenceExceeds(rate_window_start, now, 10000))
+		{
+			long		secs;
+			int			usecs;
+			double		elapsed;
+
+			TimestampDifference(rate_window_start, now, &secs, &usecs);
+			elapsed = secs + usecs / 1000000.0;
+			if (elapsed > 0 && commit_afterend_lsn >= rate_window_lsn)
+				pg_atomic_write_u64(&bdr_apply_worker->apply_rate,
+									(uint64) ((commit_afterend_lsn - rate_window_lsn) / elapsed));
+			rate_window_start = now;
+			rate_window_lsn = commit_afterend_lsn;
+		}
+	}
+
 	replication_origin_xid = InvalidTransactionId;
 	replorigin_session_origin_lsn = InvalidXLogRecPtr;
 	replorigin_session_origin_timestamp = 0;
@@ -563,7 +824,8 @@ process_remote_commit(StringInfo s)
 	 * last record we're supposed to process. Since the end lsn points to the
 	 * start of the next record, we should stop if replay equals it.
 	 */
-	if (bdr_apply_worker->replay_stop_lsn != InvalidXLogRecPtr
+	if (bdr_apply_worker != NULL
+			&& bdr_apply_worker->replay_stop_lsn != InvalidXLogRecPtr
 			&& bdr_apply_worker->replay_stop_lsn <= commit_afterend_lsn)
 	{
 		ereport(LOG,
@@ -583,99 +845,78 @@ process_remote_commit(StringInfo s)
 		/* Stop gracefully */
 		proc_exit(0);
 	}
-
-	if (error_context_stack == &errcallback)
-		error_context_stack = errcallback.previous;
 }
 
+/*
+ * Process a commit message from the output plugin, advance replication
+ * identifiers, commit the local transaction, and determine whether replay
+ * should continue.
+ */
 static void
-process_remote_insert(StringInfo s)
+process_remote_commit(StringInfo s)
 {
-	char		action;
-	EState	   *estate;
-	BDRTupleData new_tuple;
-	TupleTableSlot *newslot;
-	TupleTableSlot *oldslot;
-        HeapTuple conflicting_htuple;
-        HeapTuple new_htuple;
-	BDRRelation	*rel;
-	bool		started_tx;
-	ResultRelInfo *relinfo;
-	ItemPointer conflicts;
-	bool		conflict = false;
-	ScanKey	   *index_keys;
-	int			i;
-	ItemPointerData conflicting_tid;
+	XLogRecPtr		commit_lsn;
+	TimestampTz		committime PG_USED_FOR_ASSERTS_ONLY;
+	XLogRecPtr		commit_afterend_lsn;
+	int				flags;
 	ErrorContextCallback errcallback;
 	struct ActionErrCallbackArg cbarg;
 
-	ItemPointerSetInvalid(&conflicting_tid);
-
 	xact_action_counter++;
 	memset(&cbarg, 0, sizeof(struct ActionErrCallbackArg));
-	cbarg.action_name = "INSERT";
+	cbarg.action_name = "COMMIT";
 	errcallback.callback = action_error_callback;
 	errcallback.arg = &cbarg;
 	errcallback.previous = error_context_stack;
 	error_context_stack = &errcallback;
 
-	started_tx = bdr_performing_work();
+	flags = pq_getmsgint(s, 4);
 
-	Assert(bdr_apply_worker != NULL);
+	if (flags != 0)
+		elog(ERROR, "Commit flags are currently unused, but flags was set to %i", flags);
 
-	rel = read_rel(s, RowExclusiveLock, &cbarg);
+	/* order of access to fields after flags is important */
+	commit_lsn = pq_getmsgint64(s);	/* start of commit record; not used anymore */
+	commit_afterend_lsn = pq_getmsgint64(s);	/* end of commit record + 1 */
+	committime = pq_getmsgint64(s);
 
 	if (bdr_trace_replay)
 	{
 		StringInfoData si;
 		initStringInfo(&si);
-		format_action_description(&si, "INSERT",
-				cbarg.remote_nspname, cbarg.remote_relname, false);
+		format_action_description(&si, "COMMIT", NULL, NULL, false);
 		cbarg.suppress_output = true;
 		elog(LOG, "TRACE: %s", si.data);
 		cbarg.suppress_output = false;
 		pfree(si.data);
 	}
 
-	action = pq_getmsgbyte(s);
-	if (action != 'N')
-		elog(ERROR, "expected new tuple but got %d",
-			 action);
-
-	estate = CreateExecutorState();
-	newslot = ExecInitExtraTupleSlot(estate, NULL, &TTSOpsHeapTuple);
-	oldslot = ExecInitExtraTupleSlot(estate, NULL, table_slot_callbacks(rel->rel));
-	ExecSetSlotDescriptor(newslot, RelationGetDescr(rel->rel));
-	ExecSetSlotDescriptor(oldslot, RelationGetDescr(rel->rel));
-
-	read_tuple_parts(s, rel, &new_tuple);
-	{
-		HeapTuple tup;
-		tup = heap_form_tuple(RelationGetDescr(rel->rel),
-							  new_tuple.values, new_tuple.isnull);
-		ExecStoreHeapTuple(tup, newslot, true);
-	}
+	Assert(committime == replorigin_session_origin_timestamp);
 
-	if (rel->rel->rd_rel->relkind != RELKIND_RELATION)
-		elog(ERROR, "unexpected relkind '%c' rel \"%s\"",
-			 rel->rel->rd_rel->relkind, RelationGetRelationName(rel->rel));
+	finish_remote_commit(commit_lsn, commit_afterend_lsn);
 
-	/* debug output */
-#ifdef VERBOSE_INSERT
-	log_tuple("INSERT:%s", RelationGetDescr(rel->rel), newslot->tts_tuple);
-#endif
+	if (error_context_stack == &errcallback)
+		error_context_stack = errcallback.previous;
+}
 
-	/*
-	 * Search for conflicting tuples.
-	 */
-        relinfo = bdr_create_result_rel_info(rel->rel);
-	ExecOpenIndices(relinfo, false);
-	index_keys = palloc0(relinfo->ri_NumIndices * sizeof(ScanKeyData*));
-	conflicts = palloc0(relinfo->ri_NumIndices * sizeof(ItemPointerData));
+/*
+ * Do a SnapshotDirty search for a local tuple conflicting with the remote
+ * tuple on any unique, non-expression index.
+ *
+ * Returns the conflicting tuple, stored in oldslot and locked for update,
+ * or NULL if there is none.
+ */
+static HeapTuple
+find_conflicting_insert(BDRRelation *rel, ResultRelInfo *relinfo,
+						ScanKey *index_keys, IndexScanDesc *conflict_scans,
+						TupleTableSlot *oldslot, BDRTupleData *tup)
+{
+	HeapTuple	conflicting_htuple = NULL;
+	ItemPointerData conflicting_tid;
+	int			i;
 
-	build_index_scan_keys(relinfo, index_keys, &new_tuple);
+	ItemPointerSetInvalid(&conflicting_tid);
 
-	/* do a SnapshotDirty search for conflicting tuples */
 	for (i = 0; i < relinfo->ri_NumIndices; i++)
 	{
 		IndexInfo  *ii = relinfo->ri_IndexRelationInfo[i];
@@ -683,10 +924,8 @@ process_remote_insert(StringInfo s)
 
 		/*
 		 * Only unique indexes are of interest here, and we can't deal with
-		 * expression indexes so far. FIXME: predicates should be handled
-		 * better.
-		 *
-		 * NB: Needs to match expression in build_index_scan_key
+		 * expression indexes so far; those have no scan key template. FIXME:
+		 * predicates should be handled better.
 		 */
 		if (!ii->ii_Unique || ii->ii_Expressions != NIL)
 			continue;
@@ -696,9 +935,15 @@ process_remote_insert(StringInfo s)
 
 		Assert(ii->ii_Expressions == NIL);
 
+		/* a key containing NULLs can't conflict */
+		if (refresh_index_scan_key(index_keys[i],
+								   relinfo->ri_IndexRelationDescs[i], tup))
+			continue;
+
 		/* if conflict: wait */
 		found = find_pkey_tuple(index_keys[i],
 								rel, relinfo->ri_IndexRelationDescs[i],
+								&conflict_scans[i],
 								oldslot, true, LockTupleExclusive);
 
 		/* alert if there's more than one conflicting unique key */
@@ -719,203 +964,1010 @@ process_remote_insert(StringInfo s)
 					    "local tuple")));
 
 			ItemPointerCopy(&conflicting_htuple->t_self, &conflicting_tid);
-			conflict = true;
 			break;
 		}
-		else
-			ItemPointerSetInvalid(&conflicts[i]);
 
 		CHECK_FOR_INTERRUPTS();
 	}
 
-	PushActiveSnapshot(GetTransactionSnapshot());
-
-        new_htuple = newslot->tts_ops->get_heap_tuple(newslot);
+	return conflicting_htuple;
+}
 
-	/*
-	 * If there's a conflict use the version created later, otherwise do a
-	 * plain insert.
-	 */
-	if (conflict)
+/*
+ * An INSERT arrived for a tuple that already exists locally: decide which
+ * version to retain via conflict triggers and/or last-update-wins, apply
+ * the result, and log the conflict as configured.
+ *
+ * The caller must have pushed an active snapshot.
+ */
+static void
+resolve_insert_insert_conflict(BDRRelation *rel, EState *estate,
+							   ResultRelInfo *relinfo,
+							   TupleTableSlot *newslot,
+							   TupleTableSlot *oldslot,
+							   HeapTuple conflicting_htuple)
+{
+	TimestampTz local_ts;
+	RepOriginId	local_node_id;
+	bool		apply_update;
+	bool		log_update;
+	HeapTuple	new_htuple;
+	HeapTuple	user_tuple = NULL;
+	BdrApplyConflict *apply_conflict = NULL; /* Mute compiler */
+	BdrConflictResolution resolution;
+	TU_UpdateIndexes updateIndices;
+
+	new_htuple = newslot->tts_ops->get_heap_tuple(newslot);
+
+	if (rel->conflict_free)
 	{
-		TimestampTz local_ts;
-		RepOriginId	local_node_id;
-		bool		apply_update;
-		bool		log_update;
-		HeapTuple	user_tuple = NULL;
-		BdrApplyConflict *apply_conflict = NULL; /* Mute compiler */
-		BdrConflictResolution resolution;
-		TU_UpdateIndexes updateIndices;
-
+		/* check_apply_update() takes the overwrite fast path */
+		local_ts = 0;
+		local_node_id = InvalidRepOriginId;
+	}
+	else
 		get_local_tuple_origin(conflicting_htuple, &local_ts, &local_node_id);
 
-		/*
-		 * Use conflict triggers and/or last-update-wins to decide which tuple
-		 * to retain.
-		 */
-		check_apply_update(BdrConflictType_InsertInsert,
-						   local_node_id, local_ts, rel,
-						   conflicting_htuple, new_htuple, &user_tuple,
-						   &apply_update, &log_update, &resolution);
+	/*
+	 * Use conflict triggers and/or last-update-wins to decide which tuple
+	 * to retain.
+	 */
+	check_apply_update(BdrConflictType_InsertInsert,
+					   local_node_id, local_ts, rel,
+					   conflicting_htuple, new_htuple, &user_tuple,
+					   &apply_update, &log_update, &resolution);
 
-		/*
-		 * Log conflict to server log.
-		 */
-		if (log_update)
-		{
-			apply_conflict = bdr_make_apply_conflict(
-				BdrConflictType_InsertInsert, resolution,
-				replication_origin_xid, rel, oldslot, local_node_id,
-				newslot, local_ts, NULL /*no error*/);
+	/*
+	 * Log conflict to server log.
+	 */
+	if (log_update)
+	{
+		apply_conflict = bdr_make_apply_conflict(
+			BdrConflictType_InsertInsert, resolution,
+			replication_origin_xid, rel, oldslot, local_node_id,
+			newslot, local_ts, NULL /*no error*/);
 
-			bdr_conflict_log_serverlog(apply_conflict);
+		bdr_conflict_log_serverlog(apply_conflict);
 
-			bdr_count_insert_conflict();
-		}
+		bdr_count_insert_conflict();
+		bdr_count_table_insert_conflict(RelationGetRelid(rel->rel));
+	}
 
+	/*
+	 * Finally, apply the update.
+	 */
+	if (apply_update)
+	{
 		/*
-		 * Finally, apply the update.
+		 * User specified conflict handler provided a new tuple; form it to
+		 * a bdr tuple.
 		 */
-		if (apply_update)
+		if (user_tuple)
 		{
-			/*
-			 * User specified conflict handler provided a new tuple; form it to
-			 * a bdr tuple.
-			 */
-			if (user_tuple)
-			{
 #ifdef VERBOSE_INSERT
-				log_tuple("USER tuple:%s", RelationGetDescr(rel->rel), user_tuple);
+			log_tuple("USER tuple:%s", RelationGetDescr(rel->rel), user_tuple);
 #endif
-				ExecStoreHeapTuple(user_tuple, newslot, true);
-			}
-
-			simple_table_tuple_update(rel->rel,
-							   &conflicting_htuple->t_self,
-							   newslot, InvalidSnapshot, &updateIndices);
-			/* races will be resolved by abort/retry */
-			UserTableUpdateOpenIndexes(estate, relinfo, newslot, true, updateIndices == TU_Summarizing);
-
-			bdr_count_insert();
+			ExecStoreHeapTuple(user_tuple, newslot, true);
 		}
 
-		/* Log conflict to table */
-		if (log_update)
-		{
-			bdr_conflict_log_table(apply_conflict);
-			bdr_conflict_logging_cleanup();
-		}
+		simple_table_tuple_update(rel->rel,
+						   &conflicting_htuple->t_self,
+						   newslot, InvalidSnapshot, &updateIndices);
+		/* races will be resolved by abort/retry */
+		UserTableUpdateOpenIndexes(estate, relinfo, newslot, true, updateIndices == TU_Summarizing);
+
+		bdr_count_insert();
+		bdr_count_table_insert(RelationGetRelid(rel->rel));
 	}
-	else
+
+	/* Log conflict to table */
+	if (log_update)
 	{
-		simple_table_tuple_insert(rel->rel, newslot);
-		UserTableUpdateOpenIndexes(estate, relinfo, newslot, false, false);
-		bdr_count_insert();
+		bdr_conflict_log_table(apply_conflict);
+		bdr_conflict_logging_cleanup();
 	}
+}
 
-	PopActiveSnapshot();
+/*
+ * May this relation's inserts be accumulated into a multi-insert batch?
+ *
+ * Anything in the bdr schema has side effects on apply (queued DDL, queued
+ * drops, worker wakeups) that must happen in-order, so those are always
+ * applied individually.
+ */
+static bool
+insert_batching_allowed(BDRRelation *rel)
+{
+	if (bdr_apply_insert_batch_size <= 1)
+		return false;
 
-	ExecCloseIndices(relinfo);
+	if (RelationGetNamespace(rel->rel) == BdrSchemaOid)
+		return false;
 
-	check_bdr_wakeups(rel);
+	return true;
+}
+
+/*
+ * Stash a remote tuple for a later multi-insert instead of inserting it
+ * immediately. The caller has already checked for unique conflicts with a
+ * dirty scan; tuples within one batch can't conflict with each other since
+ * they were inserted by a single remote transaction.
+ */
+static void
+buffer_remote_insert(BDRRelation *rel, HeapTuple tup)
+{
+	MemoryContext oldcontext;
+
+	if (insert_batch_context == NULL)
+		insert_batch_context = AllocSetContextCreate(TopMemoryContext,
+													 "bdr insert batch",
+													 ALLOCSET_DEFAULT_SIZES);
+
+	oldcontext = MemoryContextSwitchTo(insert_batch_context);
 
-	/* execute DDL if insertion was into the ddl command queue */
-	if (RelationGetRelid(rel->rel) == QueuedDDLCommandsRelid ||
-		RelationGetRelid(rel->rel) == QueuedDropsRelid)
+	if (insert_batch_tuples == NULL)
 	{
-		HeapTuple ht;
-		LockRelId	lockid = rel->rel->rd_lockInfo.lockRelId;
-		TransactionId oldxid = GetTopTransactionId();
-		Oid relid = RelationGetRelid(rel->rel);
-		Relation qrel;
+		insert_batch_capacity = bdr_apply_insert_batch_size;
+		insert_batch_tuples = palloc(insert_batch_capacity * sizeof(HeapTuple));
+		insert_batch_relid = RelationGetRelid(rel->rel);
+	}
 
-		/* there never should be conflicts on these */
-		Assert(!conflict);
+	Assert(insert_batch_relid == RelationGetRelid(rel->rel));
 
-		cbarg.is_ddl_or_drop = true;
+	insert_batch_tuples[insert_batch_ntuples++] = heap_copytuple(tup);
 
-		/*
-		 * Release transaction bound resources for CONCURRENTLY support.
-		 */
-		MemoryContextSwitchTo(MessageContext);
-		ht = heap_copytuple(new_htuple);
+	MemoryContextSwitchTo(oldcontext);
 
-		LockRelationIdForSession(&lockid, RowExclusiveLock);
-		bdr_heap_close(rel, NoLock);
+	if (insert_batch_ntuples >= insert_batch_capacity)
+		flush_insert_batch();
+}
 
-		ExecResetTupleTable(estate->es_tupleTable, true);
-		FreeExecutorState(estate);
+/*
+ * Apply all buffered inserts with a single heap multi-insert, then maintain
+ * the indexes. This amortizes executor setup, index descent and WAL record
+ * overhead over the whole run; heap_multi_insert emits one WAL record per
+ * filled page instead of one per tuple.
+ *
+ * Must be called before any action that could observe the buffered tuples:
+ * any non-INSERT action, an INSERT into another relation, and commit.
+ */
+/*
+ * Wall-clock timing of row apply for pg_stat_bdr_tables. Only measured
+ * when bdr.track_apply_timing is on; begin returns a zeroed timestamp
+ * otherwise and end does nothing with one.
+ */
+static instr_time
+apply_timing_begin(void)
+{
+	instr_time	start;
 
-		if (relid == QueuedDDLCommandsRelid)
-		{
-			cbarg.action_name = "QUEUED_DDL";
-			process_queued_ddl_command(ht, started_tx);
-		}
-		if (relid == QueuedDropsRelid)
-		{
-			cbarg.action_name = "QUEUED_DROP";
-			process_queued_drop(ht);
-		}
+	INSTR_TIME_SET_ZERO(start);
+	if (bdr_track_apply_timing)
+		INSTR_TIME_SET_CURRENT(start);
+	return start;
+}
 
-		qrel = table_open(QueuedDDLCommandsRelid, RowExclusiveLock);
+static void
+apply_timing_end(instr_time start, Oid relid)
+{
+	instr_time	end;
 
-		UnlockRelationIdForSession(&lockid, RowExclusiveLock);
+	if (!bdr_track_apply_timing || INSTR_TIME_IS_ZERO(start))
+		return;
 
-		table_close(qrel, NoLock);
+	INSTR_TIME_SET_CURRENT(end);
+	INSTR_TIME_SUBTRACT(end, start);
+	bdr_count_table_apply_time(relid, (uint64) INSTR_TIME_GET_MICROSEC(end));
+}
 
-		if (oldxid != GetTopTransactionId())
-		{
-			CommitTransactionCommand();
-			(void) MemoryContextSwitchTo(MessageContext);
-			started_transaction = false;
-		}
+static void
+flush_insert_batch(void)
+{
+	Relation	rel;
+	EState	   *estate;
+	ResultRelInfo *relinfo;
+	TupleTableSlot **slots;
+	BulkInsertState bistate;
+	int			i;
+	instr_time	apply_start;
+
+	if (insert_batch_ntuples == 0)
+		return;
+
+	apply_start = apply_timing_begin();
+
+	Assert(IsTransactionState());
+
+	rel = table_open(insert_batch_relid, RowExclusiveLock);
+
+	estate = CreateExecutorState();
+	relinfo = bdr_create_result_rel_info(rel);
+	ExecOpenIndices(relinfo, false);
+
+	slots = palloc(insert_batch_ntuples * sizeof(TupleTableSlot *));
+	for (i = 0; i < insert_batch_ntuples; i++)
+	{
+		slots[i] = ExecInitExtraTupleSlot(estate, NULL, &TTSOpsHeapTuple);
+		ExecSetSlotDescriptor(slots[i], RelationGetDescr(rel));
+		ExecStoreHeapTuple(insert_batch_tuples[i], slots[i], false);
 	}
-	else
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	bistate = GetBulkInsertState();
+	table_multi_insert(rel, slots, insert_batch_ntuples,
+					   GetCurrentCommandId(true), 0, bistate);
+	FreeBulkInsertState(bistate);
+
+	for (i = 0; i < insert_batch_ntuples; i++)
 	{
-		bdr_heap_close(rel, NoLock);
-		ExecResetTupleTable(estate->es_tupleTable, true);
-		FreeExecutorState(estate);
+		UserTableUpdateOpenIndexes(estate, relinfo, slots[i], false, false);
+		bdr_count_insert();
+		bdr_count_table_insert(insert_batch_relid);
 	}
 
+	PopActiveSnapshot();
+
+	ExecCloseIndices(relinfo);
+	ExecResetTupleTable(estate->es_tupleTable, true);
+	FreeExecutorState(estate);
+	table_close(rel, NoLock);
+
 	CommandCounterIncrement();
 
-	if (error_context_stack == &errcallback)
-		error_context_stack = errcallback.previous;
+	apply_timing_end(apply_start, insert_batch_relid);
+
+	insert_batch_relid = InvalidOid;
+	insert_batch_tuples = NULL;
+	insert_batch_capacity = 0;
+	insert_batch_ntuples = 0;
+	MemoryContextReset(insert_batch_context);
 }
 
 static void
-process_remote_update(StringInfo s)
+process_remote_insert(StringInfo s)
 {
 	char		action;
 	EState	   *estate;
+	BDRTupleData new_tuple;
 	TupleTableSlot *newslot;
 	TupleTableSlot *oldslot;
-	HeapTuple new_htuple;
-        HeapTuple old_htuple;
-	bool		pkey_sent;
-	bool		found_tuple;
-	BDRTupleData old_tuple;
-	BDRTupleData new_tuple;
-	Oid			idxoid;
+        HeapTuple conflicting_htuple;
+        HeapTuple new_htuple;
 	BDRRelation	*rel;
-	Relation	idxrel;
-	ScanKeyData skey[INDEX_MAX_KEYS];
-	HeapTuple	user_tuple = NULL,
-				remote_tuple = NULL;
+	bool		started_tx;
+	ResultRelInfo *relinfo;
+	BdrApplyRelHandle *handle;
 	ErrorContextCallback errcallback;
 	struct ActionErrCallbackArg cbarg;
+	instr_time	apply_start;
+	Oid			apply_relid;
 
 	xact_action_counter++;
 	memset(&cbarg, 0, sizeof(struct ActionErrCallbackArg));
-	cbarg.action_name = "UPDATE";
+	cbarg.action_name = "INSERT";
 	errcallback.callback = action_error_callback;
 	errcallback.arg = &cbarg;
 	errcallback.previous = error_context_stack;
 	error_context_stack = &errcallback;
 
-	bdr_performing_work();
+	started_tx = bdr_performing_work();
 
-	rel = read_rel(s, RowExclusiveLock, &cbarg);
+	handle = read_rel_handle(s, RowExclusiveLock, &cbarg);
+	rel = handle->rel;
+
+	if (bdr_trace_replay)
+	{
+		StringInfoData si;
+		initStringInfo(&si);
+		format_action_description(&si, "INSERT",
+				cbarg.remote_nspname, cbarg.remote_relname, false);
+		cbarg.suppress_output = true;
+		elog(LOG, "TRACE: %s", si.data);
+		cbarg.suppress_output = false;
+		pfree(si.data);
+	}
+
+	/* a pending batch for another relation must be applied first */
+	if (insert_batch_ntuples > 0 &&
+		insert_batch_relid != RelationGetRelid(rel->rel))
+		flush_insert_batch();
+
+	/* rel may be closed on the queued-DDL path, so note the oid now */
+	apply_relid = RelationGetRelid(rel->rel);
+	apply_start = apply_timing_begin();
+
+	action = pq_getmsgbyte(s);
+	if (action != 'N')
+		elog(ERROR, "expected new tuple but got %d",
+			 action);
+
+	estate = handle->estate;
+	newslot = handle->newslot;
+	oldslot = handle->oldslot;
+
+	read_tuple_parts(s, rel, &new_tuple);
+	{
+		HeapTuple tup;
+		tup = heap_form_tuple(RelationGetDescr(rel->rel),
+							  new_tuple.values, new_tuple.isnull);
+		ExecStoreHeapTuple(tup, newslot, true);
+	}
+
+	if (rel->rel->rd_rel->relkind != RELKIND_RELATION)
+		elog(ERROR, "unexpected relkind '%c' rel \"%s\"",
+			 rel->rel->rd_rel->relkind, RelationGetRelationName(rel->rel));
+
+	/* debug output */
+#ifdef VERBOSE_INSERT
+	log_tuple("INSERT:%s", RelationGetDescr(rel->rel), newslot->tts_tuple);
+#endif
+
+	/*
+	 * Search for conflicting tuples.
+	 */
+	relinfo = handle->relinfo;
+
+	conflicting_htuple = find_conflicting_insert(rel, relinfo,
+												 handle->index_keys,
+												 handle->conflict_scans,
+												 oldslot, &new_tuple);
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+        new_htuple = newslot->tts_ops->get_heap_tuple(newslot);
+
+	/*
+	 * If there's a conflict use the version created later, otherwise do a
+	 * plain insert.
+	 */
+	if (conflicting_htuple != NULL)
+		resolve_insert_insert_conflict(rel, estate, relinfo, newslot, oldslot,
+									   conflicting_htuple);
+	else if (insert_batching_allowed(rel))
+	{
+		/* no conflict, defer the insert in the hope of batching a run */
+		buffer_remote_insert(rel, new_htuple);
+	}
+	else
+	{
+		simple_table_tuple_insert(rel->rel, newslot);
+		UserTableUpdateOpenIndexes(estate, relinfo, newslot, false, false);
+		bdr_count_insert();
+		bdr_count_table_insert(RelationGetRelid(rel->rel));
+	}
+
+	PopActiveSnapshot();
+
+	check_bdr_wakeups(rel);
+
+	/* batch up DDL if insertion was into the ddl command queue */
+	if (RelationGetRelid(rel->rel) == QueuedDDLCommandsRelid)
+	{
+		HeapTuple ht;
+
+		/* there never should be conflicts on these */
+		Assert(conflicting_htuple == NULL);
+
+		cbarg.is_ddl_or_drop = true;
+		cbarg.action_name = "QUEUED_DDL";
+
+		/*
+		 * Don't execute the command yet. Migration scripts arrive as long
+		 * runs of consecutive queued commands; the whole run is executed in
+		 * one go, with a single teardown of the cached relation handles and
+		 * a single DDL environment setup, as soon as any other action needs
+		 * to see its effects (see flush_queued_ddl_batch). The handle stays
+		 * cached meanwhile.
+		 */
+		MemoryContextSwitchTo(MessageContext);
+		ht = heap_copytuple(new_htuple);
+		buffer_queued_ddl_command(ht, started_tx);
+
+		ExecClearTuple(newslot);
+	}
+	else if (RelationGetRelid(rel->rel) == QueuedDropsRelid)
+	{
+		HeapTuple ht;
+		LockRelId	lockid = rel->rel->rd_lockInfo.lockRelId;
+		TransactionId oldxid = GetTopTransactionId();
+		Relation qrel;
+
+		/* there never should be conflicts on these */
+		Assert(conflicting_htuple == NULL);
+
+		cbarg.is_ddl_or_drop = true;
+		cbarg.action_name = "QUEUED_DROP";
+
+		/* read_rel_handle flushed any pending queued-DDL batch already */
+		Assert(queued_ddl_batch == NIL);
+
+		/*
+		 * Release transaction bound resources for CONCURRENTLY support.
+		 * Queued drops may commit the transaction mid-stream, so all cached
+		 * relation handles must go, not just this one.
+		 */
+		MemoryContextSwitchTo(MessageContext);
+		ht = heap_copytuple(new_htuple);
+
+		LockRelationIdForSession(&lockid, RowExclusiveLock);
+		bdr_heap_close(rel, NoLock);
+
+		release_apply_rel_handles();
+
+		process_queued_drop(ht);
+
+		qrel = table_open(QueuedDDLCommandsRelid, RowExclusiveLock);
+
+		UnlockRelationIdForSession(&lockid, RowExclusiveLock);
+
+		table_close(qrel, NoLock);
+
+		if (oldxid != GetTopTransactionId())
+		{
+			CommitTransactionCommand();
+			(void) MemoryContextSwitchTo(MessageContext);
+			started_transaction = false;
+		}
+	}
+	else
+	{
+		/* the handle, including the open relation, stays cached until commit */
+		ExecClearTuple(newslot);
+	}
+
+	CommandCounterIncrement();
+
+	apply_timing_end(apply_start, apply_relid);
+
+	if (error_context_stack == &errcallback)
+		error_context_stack = errcallback.previous;
+}
+
+/*
+ * Start of an insert run ('S'): the upstream detected consecutive INSERTs
+ * into one relation and will stream the rows header-less ('R') until the
+ * run's end ('E'). The relation handle (executor state, open indexes, scan
+ * key templates) comes from the per-transaction cache, so the per-row work
+ * is just reading the tuple, the conflict pre-check and buffering into the
+ * multi-insert batch.
+ *
+ * The upstream never opens runs for relations in the bdr schema, so no
+ * queued-DDL/drops or wakeup handling is needed on this path.
+ */
+static void
+process_remote_insert_run_start(StringInfo s)
+{
+	struct ActionErrCallbackArg cbarg;
+
+	Assert(insert_run_handle == NULL);
+
+	xact_action_counter++;
+
+	bdr_performing_work();
+
+	memset(&cbarg, 0, sizeof(struct ActionErrCallbackArg));
+	cbarg.action_name = "INSERT (bulk)";
+
+	insert_run_handle = read_rel_handle(s, RowExclusiveLock, &cbarg);
+
+	if (insert_run_handle->rel->rel->rd_rel->relkind != RELKIND_RELATION)
+		elog(ERROR, "unexpected relkind '%c' rel \"%s\"",
+			 insert_run_handle->rel->rel->rd_rel->relkind,
+			 RelationGetRelationName(insert_run_handle->rel->rel));
+
+	Assert(RelationGetNamespace(insert_run_handle->rel->rel) != BdrSchemaOid);
+
+	if (bdr_trace_replay)
+		elog(LOG, "TRACE: INSERT RUN START %s.%s",
+			 cbarg.remote_nspname, cbarg.remote_relname);
+
+	/*
+	 * The names read by read_rel_handle point into the message buffer, which is
+	 * gone by the time the next row arrives; keep copies for row error
+	 * context. MessageContext lives until commit, past the run's end.
+	 */
+	memset(&insert_run_cbarg, 0, sizeof(struct ActionErrCallbackArg));
+	insert_run_cbarg.action_name = "INSERT (bulk)";
+	insert_run_cbarg.remote_nspname = pstrdup(cbarg.remote_nspname);
+	insert_run_cbarg.remote_relname = pstrdup(cbarg.remote_relname);
+
+	/* a pending batch for another relation must be applied first */
+	if (insert_batch_ntuples > 0 &&
+		insert_batch_relid != RelationGetRelid(insert_run_handle->rel->rel))
+		flush_insert_batch();
+}
+
+/*
+ * One row of an insert run ('R'): just the tuple, no relation header.
+ */
+static void
+process_remote_insert_run_row(StringInfo s)
+{
+	BDRTupleData new_tuple;
+	HeapTuple	new_htuple;
+	HeapTuple	conflicting_htuple;
+	BDRRelation *rel;
+	ErrorContextCallback errcallback;
+
+	if (insert_run_handle == NULL)
+		elog(ERROR, "insert run row received outside an insert run");
+
+	rel = insert_run_handle->rel;
+
+	xact_action_counter++;
+
+	errcallback.callback = action_error_callback;
+	errcallback.arg = &insert_run_cbarg;
+	errcallback.previous = error_context_stack;
+	error_context_stack = &errcallback;
+
+	read_tuple_parts(s, rel, &new_tuple);
+	new_htuple = heap_form_tuple(RelationGetDescr(rel->rel),
+								 new_tuple.values, new_tuple.isnull);
+	ExecStoreHeapTuple(new_htuple, insert_run_handle->newslot, true);
+
+	conflicting_htuple = find_conflicting_insert(rel,
+												 insert_run_handle->relinfo,
+												 insert_run_handle->index_keys,
+												 insert_run_handle->conflict_scans,
+												 insert_run_handle->oldslot,
+												 &new_tuple);
+
+	if (conflicting_htuple != NULL)
+	{
+		/*
+		 * Conflicts can't involve tuples buffered earlier in this run (a
+		 * single remote transaction wrote them all), so the batch may stay
+		 * pending while this row is resolved in place.
+		 */
+		PushActiveSnapshot(GetTransactionSnapshot());
+		resolve_insert_insert_conflict(rel, insert_run_handle->estate,
+									   insert_run_handle->relinfo,
+									   insert_run_handle->newslot,
+									   insert_run_handle->oldslot,
+									   conflicting_htuple);
+		PopActiveSnapshot();
+		CommandCounterIncrement();
+	}
+	else
+		buffer_remote_insert(rel, new_htuple);
+
+	ExecClearTuple(insert_run_handle->newslot);
+
+	if (error_context_stack == &errcallback)
+		error_context_stack = errcallback.previous;
+}
+
+/*
+ * End of an insert run ('E'): apply whatever is still buffered. The
+ * relation handle stays cached for the rest of the transaction.
+ */
+static void
+process_remote_insert_run_end(void)
+{
+	if (insert_run_handle == NULL)
+		elog(ERROR, "insert run end received outside an insert run");
+
+	xact_action_counter++;
+
+	flush_insert_batch();
+
+	if (bdr_trace_replay)
+		elog(LOG, "TRACE: INSERT RUN END %s.%s",
+			 insert_run_cbarg.remote_nspname, insert_run_cbarg.remote_relname);
+
+	insert_run_handle = NULL;
+
+	CommandCounterIncrement();
+}
+
+/*
+ * Append a chunk to a streamed transaction's spool file.
+ */
+static void
+streamed_txn_spool_write(BdrStreamedTxn *txn, const void *buf, Size len)
+{
+	int			written;
+
+	written = FileWrite(txn->spool_fd, buf, len, txn->spool_size,
+						WAIT_EVENT_BUFFILE_WRITE);
+	if (written != len)
+	{
+		if (written >= 0)
+			errno = ENOSPC;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to spool file for streamed transaction %u: %m",
+						txn->xid)));
+	}
+
+	txn->spool_size += len;
+}
+
+/*
+ * Drop a streamed transaction's spool; the temporary file is deleted on
+ * close.
+ */
+static void
+streamed_txn_discard(BdrStreamedTxn *txn)
+{
+	TransactionId xid = txn->xid;
+
+	FileClose(txn->spool_fd);
+	if (txn->subxacts != NULL)
+		pfree(txn->subxacts);
+
+	if (cur_streamed_txn == txn)
+		cur_streamed_txn = NULL;
+
+	hash_search(streamed_txns, &xid, HASH_REMOVE, NULL);
+}
+
+/*
+ * Start of a streamed transaction segment ('b').
+ */
+static void
+process_remote_stream_start(StringInfo s)
+{
+	TransactionId	xid;
+	bool			first_segment;
+	BdrStreamedTxn *txn;
+	bool			found;
+
+	xid = pq_getmsgint(s, 4);
+	first_segment = pq_getmsgbyte(s);
+
+	if (cur_streamed_txn != NULL)
+		elog(ERROR, "segment of streamed transaction %u started while a segment of %u is open",
+			 xid, cur_streamed_txn->xid);
+
+	if (streamed_txns == NULL)
+	{
+		HASHCTL		ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(TransactionId);
+		ctl.entrysize = sizeof(BdrStreamedTxn);
+		ctl.hcxt = TopMemoryContext;
+
+		streamed_txns = hash_create("bdr streamed transactions", 8, &ctl,
+									HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	txn = hash_search(streamed_txns, &xid, HASH_ENTER, &found);
+
+	if (found && first_segment)
+	{
+		/*
+		 * The upstream restarted decoding and is re-streaming this
+		 * transaction from scratch; whatever we spooled the first time
+		 * round is a duplicate.
+		 */
+		elog(DEBUG1, "discarding stale spool of re-streamed transaction %u", xid);
+		streamed_txn_discard(txn);
+		txn = hash_search(streamed_txns, &xid, HASH_ENTER, &found);
+		found = false;
+	}
+
+	if (!found)
+	{
+		if (!first_segment)
+			elog(ERROR, "received continuation segment of streamed transaction %u without its start",
+				 xid);
+
+		txn->spool_fd = OpenTemporaryFile(true);
+		txn->spool_size = 0;
+		txn->nsubxacts = 0;
+		txn->subxacts_size = 0;
+		txn->subxacts = NULL;
+	}
+
+	cur_streamed_txn = txn;
+
+	if (bdr_trace_replay)
+		elog(LOG, "TRACE: STREAM START xid %u%s", xid,
+			 first_segment ? " (first segment)" : "");
+}
+
+/*
+ * A change within a streamed transaction segment ('x'): spool the wrapped
+ * action, remembering where each subtransaction's changes begin so an
+ * aborted subtransaction can be truncated away again.
+ */
+static void
+process_remote_stream_change(StringInfo s)
+{
+	BdrStreamedTxn *txn = cur_streamed_txn;
+	TransactionId	subxid;
+	uint32			len;
+
+	if (txn == NULL)
+		elog(ERROR, "streamed change received outside a stream segment");
+
+	subxid = pq_getmsgint(s, 4);
+
+	if (subxid != txn->xid)
+	{
+		int			i;
+
+		for (i = 0; i < txn->nsubxacts; i++)
+			if (txn->subxacts[i].subxid == subxid)
+				break;
+
+		if (i == txn->nsubxacts)
+		{
+			if (txn->nsubxacts == txn->subxacts_size)
+			{
+				txn->subxacts_size = Max(2 * txn->subxacts_size, 16);
+				if (txn->subxacts == NULL)
+					txn->subxacts = MemoryContextAlloc(TopMemoryContext,
+							txn->subxacts_size * sizeof(BdrStreamedSubxact));
+				else
+					txn->subxacts = repalloc(txn->subxacts,
+							txn->subxacts_size * sizeof(BdrStreamedSubxact));
+			}
+			txn->subxacts[txn->nsubxacts].subxid = subxid;
+			txn->subxacts[txn->nsubxacts].start_offset = txn->spool_size;
+			txn->nsubxacts++;
+		}
+	}
+
+	len = s->len - s->cursor;
+	streamed_txn_spool_write(txn, &len, sizeof(len));
+	streamed_txn_spool_write(txn, s->data + s->cursor, len);
+}
+
+/*
+ * End of a streamed transaction segment ('e').
+ */
+static void
+process_remote_stream_stop(void)
+{
+	if (cur_streamed_txn == NULL)
+		elog(ERROR, "stream segment end received outside a stream segment");
+
+	if (bdr_trace_replay)
+		elog(LOG, "TRACE: STREAM STOP xid %u, %u bytes spooled",
+			 cur_streamed_txn->xid, (uint32) cur_streamed_txn->spool_size);
+
+	cur_streamed_txn = NULL;
+}
+
+/*
+ * Abort of a streamed transaction or one of its subtransactions ('a').
+ */
+static void
+process_remote_stream_abort(StringInfo s)
+{
+	TransactionId	xid;
+	TransactionId	subxid;
+	BdrStreamedTxn *txn;
+
+	xid = pq_getmsgint(s, 4);
+	subxid = pq_getmsgint(s, 4);
+
+	txn = streamed_txns ? hash_search(streamed_txns, &xid, HASH_FIND, NULL) : NULL;
+	if (txn == NULL)
+		elog(ERROR, "received abort of unknown streamed transaction %u", xid);
+
+	if (bdr_trace_replay)
+		elog(LOG, "TRACE: STREAM ABORT xid %u subxid %u", xid, subxid);
+
+	if (subxid == xid)
+	{
+		streamed_txn_discard(txn);
+		return;
+	}
+
+	{
+		int			i;
+
+		for (i = 0; i < txn->nsubxacts; i++)
+		{
+			if (txn->subxacts[i].subxid != subxid)
+				continue;
+
+			/*
+			 * Everything spooled from the subxact's first change onwards
+			 * belongs to the subxact or to subxacts nested within it, so
+			 * cutting the spool back to that point discards exactly the
+			 * aborted work.
+			 */
+			if (FileTruncate(txn->spool_fd, txn->subxacts[i].start_offset,
+							 WAIT_EVENT_BUFFILE_TRUNCATE) < 0)
+				ereport(ERROR,
+						(errcode_for_file_access(),
+						 errmsg("could not truncate spool file for streamed transaction %u: %m",
+								xid)));
+
+			txn->spool_size = txn->subxacts[i].start_offset;
+			txn->nsubxacts = i;
+			return;
+		}
+
+		/* none of the subxact's changes reached us; nothing to discard */
+	}
+}
+
+/*
+ * Commit of a streamed transaction ('c').
+ *
+ * Carries everything 'B' and 'C' normally would, since neither was sent
+ * for a streamed transaction. Sets up the origin session state the way
+ * process_remote_begin does, replays the spooled actions through
+ * bdr_process_remote_action, and finishes like process_remote_commit.
+ */
+static void
+process_remote_stream_commit(StringInfo s)
+{
+	TransactionId	xid;
+	int				flags;
+	XLogRecPtr		commit_lsn;
+	XLogRecPtr		commit_afterend_lsn;
+	TimestampTz		committime;
+	BdrStreamedTxn *txn;
+	off_t			offset = 0;
+	StringInfoData	msg;
+	char		   *buf = NULL;
+	Size			buflen = 0;
+	ErrorContextCallback errcallback;
+	struct ActionErrCallbackArg cbarg;
+
+	Assert(cur_streamed_txn == NULL);
+
+	xact_action_counter = 1;
+	memset(&cbarg, 0, sizeof(struct ActionErrCallbackArg));
+	cbarg.action_name = "STREAM COMMIT";
+	errcallback.callback = action_error_callback;
+	errcallback.arg = &cbarg;
+	errcallback.previous = error_context_stack;
+	error_context_stack = &errcallback;
+
+	started_transaction = false;
+	remote_origin_id = InvalidRepOriginId;
+
+	xid = pq_getmsgint(s, 4);
+	flags = pq_getmsgint(s, 4);
+	commit_lsn = pq_getmsgint64(s);	/* start of commit record */
+	commit_afterend_lsn = pq_getmsgint64(s);	/* end of commit record + 1 */
+	committime = pq_getmsgint64(s);
+
+	if (flags & BDR_OUTPUT_TRANSACTION_HAS_ORIGIN)
+	{
+		bdr_getmsg_nodeid(s, &remote_origin, false);
+		remote_origin_lsn = pq_getmsgint64(s);
+	}
+	else
+	{
+		/* Transaction originated directly from remote node */
+		remote_origin.sysid = 0;
+		remote_origin.timeline = 0;
+		remote_origin.dboid = InvalidOid;
+		remote_origin_lsn = InvalidXLogRecPtr;
+	}
+
+	txn = streamed_txns ? hash_search(streamed_txns, &xid, HASH_FIND, NULL) : NULL;
+	if (txn == NULL)
+		elog(ERROR, "received commit of unknown streamed transaction %u", xid);
+
+	/* set up commit and conflict detection state as process_remote_begin does */
+	replorigin_session_origin_lsn = commit_afterend_lsn;
+	replorigin_session_origin_timestamp = committime;
+	replication_origin_xid = xid;
+
+	if (flags & BDR_OUTPUT_TRANSACTION_HAS_ORIGIN)
+		lookup_forwarded_origin();
+
+	if (bdr_trace_replay)
+	{
+		StringInfoData si;
+		initStringInfo(&si);
+		format_action_description(&si, "STREAM COMMIT", NULL, NULL, false);
+		cbarg.suppress_output = true;
+		elog(LOG, "TRACE: %s", si.data);
+		cbarg.suppress_output = false;
+		pfree(si.data);
+	}
+
+	apply_delay_sleep();
+
+	/*
+	 * Replay the spooled actions. Each record is the body of a regular
+	 * action message, so the normal dispatch does all the work, including
+	 * multi-insert batching of insert-heavy stretches.
+	 */
+	while (offset < txn->spool_size)
+	{
+		uint32		len;
+
+		if (FileRead(txn->spool_fd, &len, sizeof(len), offset,
+					 WAIT_EVENT_BUFFILE_READ) != sizeof(len))
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read from spool file for streamed transaction %u: %m",
+							xid)));
+		offset += sizeof(len);
+
+		if (buflen < len)
+		{
+			buflen = Max(len, 8192);
+			if (buf == NULL)
+				buf = palloc(buflen);
+			else
+				buf = repalloc(buf, buflen);
+		}
+
+		if (FileRead(txn->spool_fd, buf, len, offset,
+					 WAIT_EVENT_BUFFILE_READ) != len)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read from spool file for streamed transaction %u: %m",
+							xid)));
+		offset += len;
+
+		msg.data = buf;
+		msg.len = len;
+		msg.maxlen = -1;
+		msg.cursor = 0;
+
+		bdr_process_remote_action(&msg);
+
+		MemoryContextSwitchTo(MessageContext);
+	}
+
+	if (buf != NULL)
+		pfree(buf);
+
+	flush_insert_batch();
+
+	streamed_txn_discard(txn);
+
+	xact_action_counter++;
+
+	Assert(committime == replorigin_session_origin_timestamp);
+
+	finish_remote_commit(commit_lsn, commit_afterend_lsn);
+
+	if (error_context_stack == &errcallback)
+		error_context_stack = errcallback.previous;
+}
+
+static void
+process_remote_update(StringInfo s)
+{
+	char		action;
+	EState	   *estate;
+	TupleTableSlot *newslot;
+	TupleTableSlot *oldslot;
+	HeapTuple new_htuple;
+        HeapTuple old_htuple;
+	bool		pkey_sent;
+	bool		found_tuple;
+	BDRTupleData old_tuple;
+	BDRTupleData new_tuple;
+	BDRRelation	*rel;
+	Relation	idxrel;
+	ScanKey		skey;
+	BdrApplyRelHandle *handle;
+	HeapTuple	user_tuple = NULL,
+				remote_tuple = NULL;
+	ErrorContextCallback errcallback;
+	struct ActionErrCallbackArg cbarg;
+	instr_time	apply_start;
+
+	xact_action_counter++;
+	memset(&cbarg, 0, sizeof(struct ActionErrCallbackArg));
+	cbarg.action_name = "UPDATE";
+	errcallback.callback = action_error_callback;
+	errcallback.arg = &cbarg;
+	errcallback.previous = error_context_stack;
+	error_context_stack = &errcallback;
+
+	bdr_performing_work();
+
+	handle = read_rel_handle(s, RowExclusiveLock, &cbarg);
+	rel = handle->rel;
 
 	if (bdr_trace_replay)
 	{
@@ -929,6 +1981,8 @@ process_remote_update(StringInfo s)
 		pfree(si.data);
 	}
 
+	apply_start = apply_timing_begin();
+
 	action = pq_getmsgbyte(s);
 
 	/* old key present, identifying key changed */
@@ -936,11 +1990,9 @@ process_remote_update(StringInfo s)
 		elog(ERROR, "expected action 'N' or 'K', got %c",
 			 action);
 
-	estate = CreateExecutorState();
-	oldslot = ExecInitExtraTupleSlot(estate, NULL, table_slot_callbacks(rel->rel));
-	ExecSetSlotDescriptor(oldslot, RelationGetDescr(rel->rel));
-	newslot = ExecInitExtraTupleSlot(estate, NULL, &TTSOpsHeapTuple);
-	ExecSetSlotDescriptor(newslot, RelationGetDescr(rel->rel));
+	estate = handle->estate;
+	oldslot = handle->oldslot;
+	newslot = handle->newslot;
 
 	if (action == 'K')
 	{
@@ -963,30 +2015,27 @@ process_remote_update(StringInfo s)
 	/* read new tuple */
 	read_tuple_parts(s, rel, &new_tuple);
 
-	/* lookup index to build scankey */
-	if (rel->rel->rd_indexvalid == 0)
-		RelationGetIndexList(rel->rel);
-	idxoid = rel->rel->rd_replidindex;
-	if (!OidIsValid(idxoid))
+	/* the replica identity index and its scan key template come cached */
+	idxrel = handle->idxrel;
+	if (idxrel == NULL)
 	{
 		elog(ERROR, "could not find primary key for table with oid %u",
 			 RelationGetRelid(rel->rel));
 		return;
 	}
 
-	/* open index, so we can build scan key for row */
-	idxrel = index_open(idxoid, RowExclusiveLock);
-
 	Assert(idxrel->rd_index->indisunique);
 
 	/* Use columns from the new tuple if the key didn't change. */
-	build_index_scan_key(skey, rel->rel, idxrel,
-						 pkey_sent ? &old_tuple : &new_tuple);
+	skey = handle->idx_skey;
+	refresh_index_scan_key(skey, idxrel,
+						   pkey_sent ? &old_tuple : &new_tuple);
 
 	PushActiveSnapshot(GetTransactionSnapshot());
 
 	/* look for tuple identified by the (old) primary key */
-	found_tuple = find_pkey_tuple(skey, rel, idxrel, oldslot, true,
+	found_tuple = find_pkey_tuple(skey, rel, idxrel, &handle->idx_scan,
+						oldslot, true,
 						pkey_sent ? LockTupleExclusive : LockTupleNoKeyExclusive);
 
 	if (found_tuple)
@@ -1020,7 +2069,14 @@ process_remote_update(StringInfo s)
 		}
 #endif
 
-		get_local_tuple_origin(old_htuple, &local_ts, &local_node_id);
+		if (rel->conflict_free)
+		{
+			/* check_apply_update() takes the overwrite fast path */
+			local_ts = 0;
+			local_node_id = InvalidRepOriginId;
+		}
+		else
+			get_local_tuple_origin(old_htuple, &local_ts, &local_node_id);
 
 		/*
 		 * Use conflict triggers and/or last-update-wins to decide which tuple
@@ -1045,11 +2101,11 @@ process_remote_update(StringInfo s)
 			bdr_conflict_log_serverlog(apply_conflict);
 
 			bdr_count_update_conflict();
+			bdr_count_table_update_conflict(RelationGetRelid(rel->rel));
 		}
 
 		if (apply_update)
 		{
-			ResultRelInfo *relinfo = bdr_create_result_rel_info(rel->rel);
 			TU_UpdateIndexes updateIndexes;
 			/*
 			 * User specified conflict handler provided a new tuple; form it to
@@ -1064,8 +2120,9 @@ process_remote_update(StringInfo s)
 			}
 
 			simple_table_tuple_update(rel->rel, &old_htuple->t_self, newslot, InvalidSnapshot, &updateIndexes);
-			UserTableUpdateIndexes(estate, relinfo, newslot, true, updateIndexes == TU_Summarizing);
+			UserTableUpdateOpenIndexes(estate, handle->relinfo, newslot, true, updateIndexes == TU_Summarizing);
 			bdr_count_update();
+			bdr_count_table_update(RelationGetRelid(rel->rel));
 		}
 
 		/* Log conflict to table */
@@ -1099,6 +2156,7 @@ process_remote_update(StringInfo s)
 												   0, &skip);
 
 		bdr_count_update_conflict();
+		bdr_count_table_update_conflict(RelationGetRelid(rel->rel));
 
 		if (skip)
 			resolution = BdrConflictResolution_ConflictTriggerSkipChange;
@@ -1120,13 +2178,12 @@ process_remote_update(StringInfo s)
 		 */
 		if (resolution == BdrConflictResolution_ConflictTriggerReturnedTuple)
 		{
-			ResultRelInfo *relinfo = bdr_create_result_rel_info(rel->rel);
 #ifdef VERBOSE_UPDATE
 			log_tuple("USER tuple:%s", RelationGetDescr(rel->rel), user_tuple);
 #endif
 			simple_heap_insert(rel->rel, user_tuple);
 			ExecStoreHeapTuple(user_tuple, newslot, true);
-			UserTableUpdateOpenIndexes(estate, relinfo, newslot, false, false);
+			UserTableUpdateOpenIndexes(estate, handle->relinfo, newslot, false, false);
 		}
 
 		bdr_conflict_log_table(apply_conflict);
@@ -1137,15 +2194,14 @@ process_remote_update(StringInfo s)
 
 	check_bdr_wakeups(rel);
 
-	/* release locks upon commit */
-	index_close(idxrel, NoLock);
-	bdr_heap_close(rel, NoLock);
-
-	ExecResetTupleTable(estate->es_tupleTable, true);
-	FreeExecutorState(estate);
+	/* locks and the cached handle are released at commit */
+	ExecClearTuple(newslot);
+	ExecClearTuple(oldslot);
 
 	CommandCounterIncrement();
 
+	apply_timing_end(apply_start, RelationGetRelid(rel->rel));
+
 	if (error_context_stack == &errcallback)
 		error_context_stack = errcallback.previous;
 }
@@ -1154,19 +2210,17 @@ static void
 process_remote_delete(StringInfo s)
 {
 	char		action;
-	EState	   *estate;
 	BDRTupleData oldtup;
 	TupleTableSlot *oldslot;
 	HeapTuple old_htuple;
-	Oid			idxoid;
 	BDRRelation	*rel;
 	Relation	idxrel;
-	ScanKeyData skey[INDEX_MAX_KEYS];
+	ScanKey		skey;
+	BdrApplyRelHandle *handle;
 	bool		found_old;
 	ErrorContextCallback errcallback;
 	struct ActionErrCallbackArg cbarg;
-
-	Assert(bdr_apply_worker != NULL);
+	instr_time	apply_start;
 
 	xact_action_counter++;
 	memset(&cbarg, 0, sizeof(struct ActionErrCallbackArg));
@@ -1178,7 +2232,8 @@ process_remote_delete(StringInfo s)
 
 	bdr_performing_work();
 
-	rel = read_rel(s, RowExclusiveLock, &cbarg);
+	handle = read_rel_handle(s, RowExclusiveLock, &cbarg);
+	rel = handle->rel;
 
 	if (bdr_trace_replay)
 	{
@@ -1192,6 +2247,8 @@ process_remote_delete(StringInfo s)
 		pfree(si.data);
 	}
 
+	apply_start = apply_timing_begin();
+
 	action = pq_getmsgbyte(s);
 
 	if (action != 'K' && action != 'E')
@@ -1200,30 +2257,22 @@ process_remote_delete(StringInfo s)
 	if (action == 'E')
 	{
 		elog(WARNING, "got delete without pkey");
-		bdr_heap_close(rel, NoLock);
 		return;
 	}
 
-	estate = CreateExecutorState();
-	oldslot = ExecInitExtraTupleSlot(estate, NULL, table_slot_callbacks(rel->rel));
-	ExecSetSlotDescriptor(oldslot, RelationGetDescr(rel->rel));
+	oldslot = handle->oldslot;
 
 	read_tuple_parts(s, rel, &oldtup);
 
-	/* lookup index to build scankey */
-	if (rel->rel->rd_indexvalid == 0)
-		RelationGetIndexList(rel->rel);
-	idxoid = rel->rel->rd_replidindex;
-	if (!OidIsValid(idxoid))
+	/* the replica identity index and its scan key template come cached */
+	idxrel = handle->idxrel;
+	if (idxrel == NULL)
 	{
 		elog(ERROR, "could not find primary key for table with oid %u",
 			 RelationGetRelid(rel->rel));
 		return;
 	}
 
-	/* Now open the primary key index */
-	idxrel = index_open(idxoid, RowExclusiveLock);
-
 	if (rel->rel->rd_rel->relkind != RELKIND_RELATION)
 		elog(ERROR, "unexpected relkind '%c' rel \"%s\"",
 			 rel->rel->rd_rel->relkind, RelationGetRelationName(rel->rel));
@@ -1240,16 +2289,19 @@ process_remote_delete(StringInfo s)
 
 	PushActiveSnapshot(GetTransactionSnapshot());
 
-	build_index_scan_key(skey, rel->rel, idxrel, &oldtup);
+	skey = handle->idx_skey;
+	refresh_index_scan_key(skey, idxrel, &oldtup);
 
 	/* try to find tuple via a (candidate|primary) key */
-	found_old = find_pkey_tuple(skey, rel, idxrel, oldslot, true, LockTupleExclusive);
+	found_old = find_pkey_tuple(skey, rel, idxrel, &handle->idx_scan, oldslot,
+								true, LockTupleExclusive);
 
 	if (found_old)
 	{
 		old_htuple = oldslot->tts_ops->get_heap_tuple(oldslot);
 		simple_table_tuple_delete(rel->rel, &old_htuple->t_self, InvalidSnapshot);
 		bdr_count_delete();
+		bdr_count_table_delete(RelationGetRelid(rel->rel));
 	}
 	else
 	{
@@ -1273,6 +2325,7 @@ process_remote_delete(StringInfo s)
 		BdrApplyConflict *apply_conflict;
 
 		bdr_count_delete_conflict();
+		bdr_count_table_delete_conflict(RelationGetRelid(rel->rel));
 
 		/* Since the local tuple is missing, fill slot from the received data. */
 		remote_tuple = heap_form_tuple(RelationGetDescr(rel->rel),
@@ -1316,18 +2369,37 @@ process_remote_delete(StringInfo s)
 
 	check_bdr_wakeups(rel);
 
-	index_close(idxrel, NoLock);
-	bdr_heap_close(rel, NoLock);
-
-	ExecResetTupleTable(estate->es_tupleTable, true);
-	FreeExecutorState(estate);
+	/* locks and the cached handle are released at commit */
+	ExecClearTuple(oldslot);
 
 	CommandCounterIncrement();
 
+	apply_timing_end(apply_start, RelationGetRelid(rel->rel));
+
 	if (error_context_stack == &errcallback)
 		error_context_stack = errcallback.previous;
 }
 
+/*
+ * Small cache of xid -> (commit timestamp, origin), replaced round-robin.
+ *
+ * Under a conflict storm the same few recently committed local transactions
+ * get looked up over and over; the mapping for a committed xid never
+ * changes, so cached entries can't go stale and repeats cost a scan of
+ * this array instead of a commit-ts SLRU access.
+ */
+#define TUPLE_ORIGIN_CACHE_SIZE 16
+
+typedef struct TupleOriginCacheEntry
+{
+	TransactionId	xid;
+	TimestampTz		commit_ts;
+	RepOriginId		node_id;
+} TupleOriginCacheEntry;
+
+static TupleOriginCacheEntry tuple_origin_cache[TUPLE_ORIGIN_CACHE_SIZE];
+static int tuple_origin_cache_next = 0;
+
 /*
  * Get commit timestamp and origin of the tuple
  */
@@ -1336,12 +2408,35 @@ get_local_tuple_origin(HeapTuple tuple, TimestampTz *commit_ts, RepOriginId *nod
 {
 	TransactionId	xmin;
 	RepOriginId	node_id_raw;
+	TupleOriginCacheEntry *entry;
+	int			i;
 
 	/* refetch tuple, check for old commit ts & origin */
 	xmin = HeapTupleHeaderGetXmin(tuple->t_data);
 
+	for (i = 0; i < TUPLE_ORIGIN_CACHE_SIZE; i++)
+	{
+		entry = &tuple_origin_cache[i];
+
+		if (TransactionIdIsValid(entry->xid) &&
+			TransactionIdEquals(entry->xid, xmin))
+		{
+			*commit_ts = entry->commit_ts;
+			*node_id = entry->node_id;
+			return;
+		}
+	}
+
 	TransactionIdGetCommitTsData(xmin, commit_ts, &node_id_raw);
 	*node_id = node_id_raw;
+
+	entry = &tuple_origin_cache[tuple_origin_cache_next];
+	tuple_origin_cache_next =
+		(tuple_origin_cache_next + 1) % TUPLE_ORIGIN_CACHE_SIZE;
+
+	entry->xid = xmin;
+	entry->commit_ts = *commit_ts;
+	entry->node_id = node_id_raw;
 }
 
 /*
@@ -1459,6 +2554,19 @@ check_apply_update(BdrConflictType conflict_type,
 
 	*log_update = false;
 
+	if (rel->conflict_free)
+	{
+		/*
+		 * The table is declared conflict-free (single writer per table by
+		 * design), so two versions of a row can't race: just overwrite with
+		 * the remote tuple, without firing conflict triggers or looking at
+		 * commit timestamps. The caller skipped the commit-ts lookup, so
+		 * local_ts/local_node_id aren't meaningful here.
+		 */
+		*perform_update = true;
+		return;
+	}
+
 	if (local_node_id == replorigin_session_origin)
 	{
 		/*
@@ -1505,6 +2613,7 @@ check_apply_update(BdrConflictType conflict_type,
 			*log_update = true;
 			*perform_update = false;
 			*resolution = BdrConflictResolution_ConflictTriggerSkipChange;
+			BDR_TRACE_CONFLICT_RESOLVED(conflict_type, *resolution);
 			return;
 		}
 		else if (*new_tuple)
@@ -1513,6 +2622,7 @@ check_apply_update(BdrConflictType conflict_type,
 			*log_update = true;
 			*perform_update = true;
 			*resolution = BdrConflictResolution_ConflictTriggerReturnedTuple;
+			BDR_TRACE_CONFLICT_RESOLVED(conflict_type, *resolution);
 			return;
 		}
 
@@ -1529,6 +2639,8 @@ check_apply_update(BdrConflictType conflict_type,
 								  replorigin_session_origin_timestamp,
 								  perform_update, log_update,
 								  resolution);
+
+	BDR_TRACE_CONFLICT_RESOLVED(conflict_type, *resolution);
 }
 
 static void
@@ -1537,95 +2649,115 @@ queued_command_error_callback(void *arg)
 	errcontext("during DDL replay of ddl statement: %s", (char *) arg);
 }
 
-void
-bdr_execute_ddl_command(char *cmdstr, char *perpetrator, char *search_path,
-						bool tx_just_started)
+/*
+ * Execute a run of queued DDL commands with a single setup and teardown of
+ * the DDL execution environment: one GUC nest level and one error context
+ * entry are shared by the whole run instead of being rebuilt per command.
+ *
+ * The commands are executed in queue order, so later commands see the
+ * effects of earlier ones just as they did when each was executed at the
+ * moment its queue row was applied.
+ */
+static void
+bdr_execute_ddl_commands(List *ddl_commands, bool tx_just_started)
 {
-	List	   *commands;
-	ListCell   *command_i;
-	bool		isTopLevel;
+	ListCell   *ddl_command_i;
 	MemoryContext oldcontext;
 	ErrorContextCallback errcallback;
 	int			guc_nestlevel;
-
-	oldcontext = MemoryContextSwitchTo(MessageContext);
+	bool		first_command = true;
 
 	errcallback.callback = queued_command_error_callback;
-	errcallback.arg = cmdstr;
+	errcallback.arg = NULL;
 	errcallback.previous = error_context_stack;
 	error_context_stack = &errcallback;
 
 	guc_nestlevel = NewGUCNestLevel();
 
-    /* Force everything in the query to be fully qualified. */
-	(void) set_config_option("search_path", search_path,
-							 PGC_USERSET, PGC_S_SESSION,
-							 GUC_ACTION_SAVE, true, 0
+	foreach(ddl_command_i, ddl_commands)
+	{
+		BdrQueuedDdlCommand *ddl = lfirst(ddl_command_i);
+		char	   *cmdstr = ddl->cmdstr;
+		List	   *commands;
+		ListCell   *command_i;
+		bool		isTopLevel;
+
+		errcallback.arg = cmdstr;
+
+		oldcontext = MemoryContextSwitchTo(MessageContext);
+
+	    /* Force everything in the query to be fully qualified. */
+		(void) set_config_option("search_path", ddl->search_path,
+								 PGC_USERSET, PGC_S_SESSION,
+								 GUC_ACTION_SAVE, true, 0
 #if PG_VERSION_NUM >= 90500
-							 , false
+								 , false
 #endif
-							 );
+								 );
 
-	commands = pg_parse_query(cmdstr);
+		commands = pg_parse_query(cmdstr);
 
-	MemoryContextSwitchTo(oldcontext);
+		MemoryContextSwitchTo(oldcontext);
 
-	/*
-	 * Do a limited amount of safety checking against CONCURRENTLY commands
-	 * executed in situations where they aren't allowed. The sender side should
-	 * provide protection, but better be safe than sorry.
-	 */
-	isTopLevel = (list_length(commands) == 1) && tx_just_started;
+		/*
+		 * Do a limited amount of safety checking against CONCURRENTLY commands
+		 * executed in situations where they aren't allowed. The sender side should
+		 * provide protection, but better be safe than sorry.
+		 */
+		isTopLevel = first_command && (list_length(commands) == 1) &&
+			tx_just_started;
+		first_command = false;
 
-	foreach(command_i, commands)
-	{
-		List	   *plantree_list;
-		List	   *querytree_list;
-		RawStmt	   *command = lfirst_node(RawStmt, command_i);
-		CommandTag commandTag;
-		Portal		portal;
-		DestReceiver *receiver;
+		foreach(command_i, commands)
+		{
+			List	   *plantree_list;
+			List	   *querytree_list;
+			RawStmt	   *command = lfirst_node(RawStmt, command_i);
+			CommandTag commandTag;
+			Portal		portal;
+			DestReceiver *receiver;
 
-		/* temporarily push snapshot for parse analysis/planning */
-		PushActiveSnapshot(GetTransactionSnapshot());
+			/* temporarily push snapshot for parse analysis/planning */
+			PushActiveSnapshot(GetTransactionSnapshot());
 
-		oldcontext = MemoryContextSwitchTo(MessageContext);
+			oldcontext = MemoryContextSwitchTo(MessageContext);
 
-		/*
-		 * Set the current role to the user that executed the command on the
-		 * origin server.
-		 */
-		SetConfigOption("role", perpetrator, PGC_INTERNAL, PGC_S_OVERRIDE);
+			/*
+			 * Set the current role to the user that executed the command on the
+			 * origin server.
+			 */
+			SetConfigOption("role", ddl->perpetrator, PGC_INTERNAL, PGC_S_OVERRIDE);
 
-		commandTag = CreateCommandTag(command->stmt);
+			commandTag = CreateCommandTag(command->stmt);
 
-		querytree_list = pg_analyze_and_rewrite_fixedparams(
-			command, cmdstr, NULL, 0, NULL);
+			querytree_list = pg_analyze_and_rewrite_fixedparams(
+				command, cmdstr, NULL, 0, NULL);
 
-		plantree_list = pg_plan_queries(
-					querytree_list, cmdstr, 0, NULL);
+			plantree_list = pg_plan_queries(
+						querytree_list, cmdstr, 0, NULL);
 
-		PopActiveSnapshot();
+			PopActiveSnapshot();
 
-		portal = CreatePortal("bdr", true, true);
-		PortalDefineQuery(portal, NULL,
-						  cmdstr, commandTag,
-						  plantree_list, NULL);
-		PortalStart(portal, NULL, 0, InvalidSnapshot);
+			portal = CreatePortal("bdr", true, true);
+			PortalDefineQuery(portal, NULL,
+							  cmdstr, commandTag,
+							  plantree_list, NULL);
+			PortalStart(portal, NULL, 0, InvalidSnapshot);
 
-		receiver = CreateDestReceiver(DestNone);
+			receiver = CreateDestReceiver(DestNone);
 
-		(void) PortalRun(portal, FETCH_ALL,
-						 isTopLevel, true,
-						 receiver, receiver,
-						 NULL);
-		(*receiver->rDestroy) (receiver);
+			(void) PortalRun(portal, FETCH_ALL,
+							 isTopLevel, true,
+							 receiver, receiver,
+							 NULL);
+			(*receiver->rDestroy) (receiver);
 
-		PortalDrop(portal, false);
+			PortalDrop(portal, false);
 
-		CommandCounterIncrement();
+			CommandCounterIncrement();
 
-		MemoryContextSwitchTo(oldcontext);
+			MemoryContextSwitchTo(oldcontext);
+		}
 	}
 
 	/*
@@ -1639,10 +2771,30 @@ bdr_execute_ddl_command(char *cmdstr, char *perpetrator, char *search_path,
 	AtEOXact_GUC(false, guc_nestlevel);
 }
 
+void
+bdr_execute_ddl_command(char *cmdstr, char *perpetrator, char *search_path,
+						bool tx_just_started)
+{
+	BdrQueuedDdlCommand ddl;
+	List	   *ddl_commands;
+
+	ddl.cmdstr = cmdstr;
+	ddl.perpetrator = perpetrator;
+	ddl.search_path = search_path;
+
+	ddl_commands = list_make1(&ddl);
+	bdr_execute_ddl_commands(ddl_commands, tx_just_started);
+	list_free(ddl_commands);
+}
+
 #include <unistd.h>
 
+/*
+ * Decode a bdr.bdr_queued_commands row and append it to the pending DDL
+ * batch. The command isn't executed here; see flush_queued_ddl_batch().
+ */
 static void
-process_queued_ddl_command(HeapTuple cmdtup, bool tx_just_started)
+buffer_queued_ddl_command(HeapTuple cmdtup, bool tx_just_started)
 {
 	Relation	cmdsrel;
 	Datum		datum;
@@ -1651,16 +2803,9 @@ process_queued_ddl_command(HeapTuple cmdtup, bool tx_just_started)
 	bool		isnull;
 	char       *perpetrator;
 	char	   *search_path;
+	BdrQueuedDdlCommand *ddl;
 	MemoryContext oldcontext;
 
-	/* ----
-	 * We can't use spi here, because it implicitly assumes a transaction
-	 * context. As we want to be able to replicate CONCURRENTLY commands,
-	 * that's not going to work...
-	 * So instead do all the work manually, being careful about managing the
-	 * lifecycle of objects.
-	 * ----
-	 */
 	oldcontext = MemoryContextSwitchTo(MessageContext);
 
 	cmdsrel = table_open(QueuedDDLCommandsRelid, AccessShareLock);
@@ -1707,8 +2852,16 @@ process_queued_ddl_command(HeapTuple cmdtup, bool tx_just_started)
 	else
 		search_path = TextDatumGetCString(datum);
 
-	/* close relation, command execution might end/start xact */
-	table_close(cmdsrel, NoLock);
+	table_close(cmdsrel, AccessShareLock);
+
+	ddl = palloc(sizeof(BdrQueuedDdlCommand));
+	ddl->cmdstr = cmdstr;
+	ddl->perpetrator = perpetrator;
+	ddl->search_path = search_path;
+
+	if (queued_ddl_batch == NIL)
+		queued_ddl_batch_started_tx = tx_just_started;
+	queued_ddl_batch = lappend(queued_ddl_batch, ddl);
 
 	MemoryContextSwitchTo(oldcontext);
 
@@ -1717,8 +2870,72 @@ process_queued_ddl_command(HeapTuple cmdtup, bool tx_just_started)
 		elog(LOG, "TRACE: QUEUED_DDL: [%s] with search_path [%s]",
 			 cmdstr, search_path);
 	}
+}
+
+/*
+ * Execute the pending run of queued DDL commands.
+ *
+ * Called as soon as any action other than a further insert into the command
+ * queue has to be processed, and at commit, so every other action still sees
+ * the queued commands' effects exactly as it did when each command ran at
+ * the moment its queue row was applied.
+ *
+ * ----
+ * We can't use spi here, because it implicitly assumes a transaction
+ * context. As we want to be able to replicate CONCURRENTLY commands,
+ * that's not going to work...
+ * So instead do all the work manually, being careful about managing the
+ * lifecycle of objects.
+ * ----
+ */
+static void
+flush_queued_ddl_batch(void)
+{
+	List	   *ddl_commands = queued_ddl_batch;
+	bool		tx_just_started = queued_ddl_batch_started_tx;
+	LockRelId	lockid;
+	TransactionId oldxid;
+	Relation	qrel;
+
+	if (queued_ddl_batch == NIL)
+		return;
+
+	queued_ddl_batch = NIL;
+
+	/* make sure a transaction is open; the commands' strings survive it */
+	(void) bdr_performing_work();
+
+	/* buffered inserts must reach the heap before DDL can touch their table */
+	flush_insert_batch();
+
+	/*
+	 * Release transaction bound resources for CONCURRENTLY support.
+	 * Queued DDL may commit the transaction mid-stream, so all cached
+	 * relation handles must go, not just the command queue's.
+	 */
+	release_apply_rel_handles();
+
+	qrel = table_open(QueuedDDLCommandsRelid, AccessShareLock);
+	lockid = qrel->rd_lockInfo.lockRelId;
+	LockRelationIdForSession(&lockid, RowExclusiveLock);
+	table_close(qrel, NoLock);
+
+	oldxid = GetTopTransactionId();
+
+	bdr_execute_ddl_commands(ddl_commands, tx_just_started);
 
-	bdr_execute_ddl_command(cmdstr, perpetrator, search_path, tx_just_started);
+	qrel = table_open(QueuedDDLCommandsRelid, RowExclusiveLock);
+
+	UnlockRelationIdForSession(&lockid, RowExclusiveLock);
+
+	table_close(qrel, NoLock);
+
+	if (oldxid != GetTopTransactionId())
+	{
+		CommitTransactionCommand();
+		(void) MemoryContextSwitchTo(MessageContext);
+		started_transaction = false;
+	}
 }
 
 
@@ -2065,16 +3282,45 @@ read_tuple_parts(StringInfo s, BDRRelation *rel, BDRTupleData *tup)
 	int			i;
 	int			rnatts;
 	char		action;
+	bool		compact;
+	const uint8 *nullbitmap = NULL;
+	MemoryContext oldcontext;
 
 	action = pq_getmsgbyte(s);
 
-	if (action != 'T')
+	if (action != 'T' && action != 'C')
 		elog(ERROR, "expected TUPLE, got %c", action);
+	compact = (action == 'C');
 
 	memset(tup->isnull, 1, sizeof(tup->isnull));
 	memset(tup->changed, 1, sizeof(tup->changed));
 
-	rnatts = pq_getmsgint(s, 4);
+	if (compact)
+	{
+		/*
+		 * Compact tuple framing (negotiated with the compact_tuples
+		 * startup option): varint attribute count, a null bitmap instead
+		 * of per-column 'n' markers, varint datum lengths. The marker
+		 * byte distinguishes the formats, so no per-connection state is
+		 * needed here.
+		 */
+		rnatts = bdr_getmsgvarint(s);
+		nullbitmap = (const uint8 *) pq_getmsgbytes(s, (rnatts + 7) / 8);
+	}
+	else
+		rnatts = pq_getmsgint(s, 4);
+
+	if (apply_row_context == NULL)
+		apply_row_context = AllocSetContextCreate(TopMemoryContext,
+												  "bdr apply row data",
+												  ALLOCSET_DEFAULT_SIZES);
+
+	/*
+	 * Decode the column values into the per-row arena. The datums only need
+	 * to live until the caller has formed and applied the row's tuple;
+	 * bdr_process_remote_action resets the arena before the next row.
+	 */
+	oldcontext = MemoryContextSwitchTo(apply_row_context);
 
 	/* FIXME: unaligned data accesses */
 
@@ -2086,6 +3332,13 @@ read_tuple_parts(StringInfo s, BDRRelation *rel, BDRTupleData *tup)
 		const char *data;
 		int			len;
 
+		if (compact && (nullbitmap[i / 8] & (1 << (i % 8))))
+		{
+			/* null column; carries no kind byte in compact framing */
+			tup->values[i] = 0xdeadbeef;
+			continue;
+		}
+
 		kind = pq_getmsgbyte(s);
 
 		switch (kind)
@@ -2095,6 +3348,13 @@ read_tuple_parts(StringInfo s, BDRRelation *rel, BDRTupleData *tup)
 				tup->values[i] = 0xdeadbeef;
 				break;
 			case 'u': /* unchanged column */
+
+				/*
+				 * The upstream suppressed an unchanged toasted value; the
+				 * heap_modify_tuple() call in process_remote_update() keeps
+				 * the local datum for columns not marked changed, so the
+				 * wide value never crosses the wire.
+				 */
 				tup->isnull[i] = true;
 				tup->changed[i] = false;
 				tup->values[i] = 0xdeadbeef; /* make bad usage more obvious */
@@ -2103,7 +3363,8 @@ read_tuple_parts(StringInfo s, BDRRelation *rel, BDRTupleData *tup)
 
 			case 'b': /* binary format */
 				tup->isnull[i] = false;
-				len = pq_getmsgint(s, 4); /* read length */
+				len = compact ? (int) bdr_getmsgvarint(s) :
+					pq_getmsgint(s, 4); /* read length */
 
 				data = pq_getmsgbytes(s, len);
 
@@ -2115,23 +3376,32 @@ read_tuple_parts(StringInfo s, BDRRelation *rel, BDRTupleData *tup)
 				break;
 			case 's': /* send/recv format */
 				{
-					Oid typreceive;
-					Oid typioparam;
+					BDRAttrIOCache *io = bdr_relation_att_io_cache(rel, i);
 					StringInfoData buf;
 
 					tup->isnull[i] = false;
-					len = pq_getmsgint(s, 4); /* read length */
+					len = compact ? (int) bdr_getmsgvarint(s) :
+						pq_getmsgint(s, 4); /* read length */
 
-					getTypeBinaryInputInfo(att->atttypid,
-										   &typreceive, &typioparam);
+					if (!io->recv_valid)
+					{
+						Oid			typreceive;
+
+						getTypeBinaryInputInfo(att->atttypid, &typreceive,
+											   &io->recv_typioparam);
+						fmgr_info_cxt(typreceive, &io->recv_fn,
+									  CacheMemoryContext);
+						io->recv_valid = true;
+					}
 
 					/* create StringInfo pointing into the bigger buffer */
 					initStringInfo(&buf);
 					/* and data */
 					buf.data = (char *) pq_getmsgbytes(s, len);
 					buf.len = len;
-					tup->values[i] = OidReceiveFunctionCall(
-						typreceive, &buf, typioparam, att->atttypmod);
+					tup->values[i] = ReceiveFunctionCall(&io->recv_fn, &buf,
+														 io->recv_typioparam,
+														 att->atttypmod);
 
 					if (buf.len != buf.cursor)
 						ereport(ERROR,
@@ -2141,17 +3411,29 @@ read_tuple_parts(StringInfo s, BDRRelation *rel, BDRTupleData *tup)
 				}
 			case 't': /* text format */
 				{
-					Oid typinput;
-					Oid typioparam;
+					BDRAttrIOCache *io = bdr_relation_att_io_cache(rel, i);
 
 					tup->isnull[i] = false;
-					len = pq_getmsgint(s, 4); /* read length */
+					len = compact ? (int) bdr_getmsgvarint(s) :
+						pq_getmsgint(s, 4); /* read length */
+
+					if (!io->in_valid)
+					{
+						Oid			typinput;
+
+						getTypeInputInfo(att->atttypid, &typinput,
+										 &io->in_typioparam);
+						fmgr_info_cxt(typinput, &io->in_fn,
+									  CacheMemoryContext);
+						io->in_valid = true;
+					}
 
-					getTypeInputInfo(att->atttypid, &typinput, &typioparam);
 					/* and data */
 					data = (char *) pq_getmsgbytes(s, len);
-					tup->values[i] = OidInputFunctionCall(
-						typinput, (char *) data, typioparam, att->atttypmod);
+					tup->values[i] = InputFunctionCall(&io->in_fn,
+													   (char *) data,
+													   io->in_typioparam,
+													   att->atttypmod);
 				}
 				break;
 			default:
@@ -2162,6 +3444,8 @@ read_tuple_parts(StringInfo s, BDRRelation *rel, BDRTupleData *tup)
 			elog(ERROR, "data for dropped column");
 	}
 
+	MemoryContextSwitchTo(oldcontext);
+
 	/*
 	 * Handle some remote rows that are narrower than the local table. Hotfix
 	 * for RT#61148 and other schema de-sync issues; see RM#2814
@@ -2244,38 +3528,395 @@ read_tuple_parts(StringInfo s, BDRRelation *rel, BDRTupleData *tup)
 		}
 	}
 
-	/* Don't test pq_getmsgend, there might be another message chunk */
-}
+	/* Don't test pq_getmsgend, there might be another message chunk */
+}
+
+/*
+ * Release the resources of one apply relation handle, marking it reusable.
+ */
+static void
+release_apply_rel_handle(BdrApplyRelHandle *handle)
+{
+	if (handle->rel == NULL)
+		return;
+
+	/* cached index scans must be shut down before their indexes close */
+	if (handle->idx_scan != NULL)
+		index_endscan(handle->idx_scan);
+	if (handle->conflict_scans != NULL)
+	{
+		int			i;
+
+		for (i = 0; i < handle->relinfo->ri_NumIndices; i++)
+		{
+			if (handle->conflict_scans[i] != NULL)
+				index_endscan(handle->conflict_scans[i]);
+		}
+	}
+
+	if (handle->idxrel != NULL)
+		index_close(handle->idxrel, NoLock);
+	ExecCloseIndices(handle->relinfo);
+	ExecResetTupleTable(handle->estate->es_tupleTable, true);
+	FreeExecutorState(handle->estate);
+
+	/*
+	 * The underlying relation may already have been closed behind our back,
+	 * e.g. by the queued DDL path or an insert run ending.
+	 */
+	if (handle->rel->rel != NULL)
+		bdr_heap_close(handle->rel, NoLock);
+
+	handle->rel = NULL;
+	handle->estate = NULL;
+	handle->relinfo = NULL;
+	handle->newslot = NULL;
+	handle->oldslot = NULL;
+	handle->index_keys = NULL;
+	handle->conflict_scans = NULL;
+	handle->idxrel = NULL;
+	handle->idx_scan = NULL;
+}
+
+/*
+ * Release all cached relation handles. Must be called before the replayed
+ * transaction commits (the executor states live in MessageContext) and
+ * before anything that ends the local transaction mid-stream, such as
+ * queued DDL replay.
+ */
+static void
+release_apply_rel_handles(void)
+{
+	HASH_SEQ_STATUS status;
+	BdrApplyRelHandle *handle;
+
+	if (apply_rel_handles == NULL)
+		return;
+
+	hash_seq_init(&status, apply_rel_handles);
+	while ((handle = (BdrApplyRelHandle *) hash_seq_search(&status)) != NULL)
+		release_apply_rel_handle(handle);
+
+	insert_run_handle = NULL;
+}
+
+/*
+ * Forget all cached relation handles without releasing their resources,
+ * for use after a transaction abort: the abort has already released the
+ * locks, relcache references and executor state the handles point at, so
+ * the stale pointers must be dropped, not closed.
+ */
+static void
+forget_apply_rel_handles(void)
+{
+	HASH_SEQ_STATUS status;
+	BdrApplyRelHandle *handle;
+
+	if (apply_rel_handles == NULL)
+		return;
+
+	hash_seq_init(&status, apply_rel_handles);
+	while ((handle = (BdrApplyRelHandle *) hash_seq_search(&status)) != NULL)
+	{
+		handle->rel = NULL;
+		handle->estate = NULL;
+		handle->relinfo = NULL;
+		handle->newslot = NULL;
+		handle->oldslot = NULL;
+		handle->index_keys = NULL;
+		handle->conflict_scans = NULL;
+		handle->idxrel = NULL;
+		handle->idx_scan = NULL;
+	}
+
+	insert_run_handle = NULL;
+}
+
+/*
+ * Abort the remote transaction currently being applied and reset the apply
+ * state that normally carries through to commit, so the same transaction
+ * can be applied again from scratch. Used by parallel apply helpers to back
+ * out of a lock cycle with an earlier-ticketed transaction; see
+ * bdr_apply_parallel_retry_transaction().
+ */
+void
+bdr_apply_abort_replay_transaction(void)
+{
+	forget_apply_rel_handles();
+
+	/* throw away any batched inserts along with their memory */
+	insert_batch_ntuples = 0;
+	insert_batch_relid = InvalidOid;
+	insert_batch_tuples = NULL;
+	insert_batch_capacity = 0;
+	if (insert_batch_context != NULL)
+		MemoryContextReset(insert_batch_context);
+
+	/* conflicts spooled by the aborted attempt would be logged twice */
+	bdr_conflict_log_discard();
+
+	queued_ddl_batch = NIL;
+
+	AbortCurrentTransaction();
+	started_transaction = false;
+
+	CurrentResourceOwner = bdr_saved_resowner;
+	(void) MemoryContextSwitchTo(MessageContext);
+}
+
+/*
+ * Read the target relation of a row action and return the cached apply
+ * state for it, setting it up on first use within the transaction.
+ *
+ * A hit costs a hash lookup on the remote names instead of a catalog name
+ * resolution, relation open, executor setup and index open per row. The
+ * locks taken on first use are held until commit, as before, so cached
+ * name-to-relation mappings can't go stale underneath us mid-transaction;
+ * handles whose BDRRelation was invalidated by the relcache callback are
+ * torn down and rebuilt.
+ */
+/*
+ * Relation metadata ('r') message: remember the upstream oid -> name
+ * mapping for subsequent change messages. Sent once per relation per
+ * decoding session, and again whenever the upstream's relcache entry is
+ * invalidated, so an existing entry is simply overwritten.
+ */
+static void
+process_remote_relmeta(StringInfo s)
+{
+	Oid			remote_relid;
+	int			nspnamelen;
+	const char *nspname;
+	int			relnamelen;
+	const char *relname;
+	BdrRemoteRelMeta *meta;
+	bool		found;
+
+	remote_relid = pq_getmsgint(s, 4);
+
+	nspnamelen = pq_getmsgint(s, 2);
+	nspname = pq_getmsgbytes(s, nspnamelen);
+	relnamelen = pq_getmsgint(s, 2);
+	relname = pq_getmsgbytes(s, relnamelen);
+
+	if (remote_relmeta == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(BdrRemoteRelMeta);
+		ctl.hcxt = TopMemoryContext;
+
+		remote_relmeta = hash_create("bdr remote relation metadata", 32, &ctl,
+									 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	meta = hash_search(remote_relmeta, &remote_relid, HASH_ENTER, &found);
+	strlcpy(meta->nspname, nspname, NAMEDATALEN);
+	strlcpy(meta->relname, relname, NAMEDATALEN);
+
+	if (bdr_trace_replay)
+		elog(LOG, "TRACE: RELMETA remote relation %u is %s.%s%s",
+			 remote_relid, meta->nspname, meta->relname,
+			 found ? " (refreshed)" : "");
+}
+
+static BdrApplyRelHandle *
+read_rel_handle(StringInfo s, LOCKMODE mode, struct ActionErrCallbackArg *cbarg)
+{
+	int			relnamelen;
+	int			nspnamelen;
+	const char *nspname;
+	const char *relname;
+	BdrApplyRelHandleKey key;
+	BdrApplyRelHandle *handle;
+	bool		found;
+	BDRRelation *rel;
+	Oid			idxoid;
+
+	if (relmeta_cache_active)
+	{
+		Oid			remote_relid = pq_getmsgint(s, 4);
+		BdrRemoteRelMeta *meta;
+
+		meta = remote_relmeta ? hash_search(remote_relmeta, &remote_relid,
+											HASH_FIND, NULL) : NULL;
+		if (meta == NULL)
+			elog(ERROR, "no metadata received for remote relation %u",
+				 remote_relid);
+
+		nspname = meta->nspname;
+		relname = meta->relname;
+	}
+	else
+	{
+		nspnamelen = pq_getmsgint(s, 2);
+		nspname = pq_getmsgbytes(s, nspnamelen);
+
+		relnamelen = pq_getmsgint(s, 2);
+		relname = pq_getmsgbytes(s, relnamelen);
+	}
+	cbarg->remote_nspname = nspname;
+	cbarg->remote_relname = relname;
+
+	/*
+	 * A pending run of queued DDL must execute before any other relation is
+	 * resolved or touched - this very relation may be created or altered by
+	 * it. A further insert into the command queue extends the run instead.
+	 */
+	if (queued_ddl_batch != NIL &&
+		!(strcmp(nspname, "bdr") == 0 &&
+		  strcmp(relname, "bdr_queued_commands") == 0))
+	{
+		flush_queued_ddl_batch();
+		(void) bdr_performing_work();
+	}
+
+	if (apply_rel_handles == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(BdrApplyRelHandleKey);
+		ctl.entrysize = sizeof(BdrApplyRelHandle);
+		ctl.hcxt = TopMemoryContext;
+
+		apply_rel_handles = hash_create("bdr apply relation handles", 8, &ctl,
+										HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	memset(&key, 0, sizeof(key));
+	strlcpy(key.nspname, nspname, NAMEDATALEN);
+	strlcpy(key.relname, relname, NAMEDATALEN);
+
+	handle = hash_search(apply_rel_handles, &key, HASH_ENTER, &found);
+
+	if (found && handle->rel != NULL)
+	{
+		/* invalidated or closed behind our back? rebuild below */
+		if (handle->rel->valid && handle->rel->rel != NULL)
+		{
+			if (isBdrGlobalSeqRelId(RelationGetRelid(handle->rel->rel)))
+				bdr_sequencer_lock();
+			return handle;
+		}
+
+		release_apply_rel_handle(handle);
+	}
+	else if (!found)
+		handle->rel = NULL;
+
+	/* first use in this transaction: resolve, lock and set everything up */
+	{
+		RangeVar   *rv = makeNode(RangeVar);
+		Oid			relid;
+
+		rv->schemaname = (char *) nspname;
+		rv->relname = (char *) relname;
+
+		relid = RangeVarGetRelidExtended(rv, mode, 0, NULL, NULL);
+
+		/*
+		 * Acquire sequencer lock if any of the sequencer relations are
+		 * modified. We used to rely on relation locks, but that had problems
+		 * with deadlocks and interrupting auto-analyze/vacuum.
+		 */
+		if (isBdrGlobalSeqRelId(relid))
+			bdr_sequencer_lock();
+
+		handle->rel = bdr_heap_open(relid, AccessShareLock);
+	}
+
+	rel = handle->rel;
 
-static BDRRelation *
-read_rel(StringInfo s, LOCKMODE mode, struct ActionErrCallbackArg *cbarg)
-{
-	int			relnamelen;
-	int			nspnamelen;
-	RangeVar*	rv;
-	Oid			relid;
+	handle->estate = CreateExecutorState();
+	handle->newslot = ExecInitExtraTupleSlot(handle->estate, NULL,
+											 &TTSOpsHeapTuple);
+	handle->oldslot = ExecInitExtraTupleSlot(handle->estate, NULL,
+											 table_slot_callbacks(rel->rel));
+	ExecSetSlotDescriptor(handle->newslot, RelationGetDescr(rel->rel));
+	ExecSetSlotDescriptor(handle->oldslot, RelationGetDescr(rel->rel));
 
-	rv = makeNode(RangeVar);
+	handle->relinfo = bdr_create_result_rel_info(rel->rel);
+	ExecOpenIndices(handle->relinfo, false);
+	handle->index_keys = build_index_scan_key_templates(handle->relinfo);
+	handle->conflict_scans = palloc0(Max(handle->relinfo->ri_NumIndices, 1) *
+									 sizeof(IndexScanDesc));
 
-	nspnamelen = pq_getmsgint(s, 2);
-	rv->schemaname = (char *) pq_getmsgbytes(s, nspnamelen);
-	cbarg->remote_nspname = rv->schemaname;
+	/* the replica identity index, used by UPDATE and DELETE */
+	if (rel->rel->rd_indexvalid == 0)
+		RelationGetIndexList(rel->rel);
+	idxoid = rel->rel->rd_replidindex;
+	if (OidIsValid(idxoid))
+	{
+		handle->idxrel = index_open(idxoid, RowExclusiveLock);
+		Assert(handle->idxrel->rd_index->indisunique);
+		build_index_scan_key_template(handle->idx_skey, rel->rel,
+									  handle->idxrel);
+	}
+	else
+		handle->idxrel = NULL;
 
-	relnamelen = pq_getmsgint(s, 2);
-	rv->relname = (char *) pq_getmsgbytes(s, relnamelen);
-	cbarg->remote_relname = rv->relname;
+	/* scans are begun lazily by find_pkey_tuple on first lookup */
+	handle->idx_scan = NULL;
 
-	relid = RangeVarGetRelidExtended(rv, mode, 0, NULL, NULL);
+	return handle;
+}
 
-	/*
-	 * Acquire sequencer lock if any of the sequencer relations are
-	 * modified. We used to rely on relation locks, but that had problems with
-	 * deadlocks and interrupting auto-analyze/vacuum.
-	 */
-	if (isBdrGlobalSeqRelId(relid))
-		bdr_sequencer_lock();
+/*
+ * Record one replayed action in this worker's latency histogram. The
+ * bucket index is just the bit length of the elapsed microseconds, so the
+ * whole thing is two clock readings and a few ALU instructions per action
+ * - cheap enough to stay on in production.
+ */
+static void
+bdr_apply_hist_record(char action, instr_time start)
+{
+	instr_time	duration;
+	uint64		us;
+	int			bucket;
+	BdrApplyHistAction class;
+	pg_atomic_uint64 *cell;
+
+	/* parallel apply helpers have no worker slot of their own */
+	if (bdr_apply_worker == NULL)
+		return;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	us = (uint64) INSTR_TIME_GET_MICROSEC(duration);
+
+	switch (action)
+	{
+		case 'B':
+			class = BDR_APPLY_HIST_BEGIN;
+			break;
+		case 'I':
+		case 'R':
+			class = BDR_APPLY_HIST_INSERT;
+			break;
+		case 'U':
+			class = BDR_APPLY_HIST_UPDATE;
+			break;
+		case 'D':
+			class = BDR_APPLY_HIST_DELETE;
+			break;
+		case 'C':
+		case 'c':
+			class = BDR_APPLY_HIST_COMMIT;
+			break;
+		default:
+			class = BDR_APPLY_HIST_OTHER;
+			break;
+	}
 
-	return bdr_heap_open(relid, AccessShareLock);
+	bucket = us == 0 ? 0 : pg_leftmost_one_pos64(us) + 1;
+	if (bucket >= BDR_APPLY_HIST_BUCKETS)
+		bucket = BDR_APPLY_HIST_BUCKETS - 1;
+
+	cell = &bdr_apply_worker->action_hist[class][bucket];
+	pg_atomic_write_u64(cell, pg_atomic_read_u64(cell) + 1);
 }
 
 /*
@@ -2283,11 +3924,47 @@ read_rel(StringInfo s, LOCKMODE mode, struct ActionErrCallbackArg *cbarg)
  *
  * May set got_SIGTERM to stop processing before next record.
  */
-static void
+void
 bdr_process_remote_action(StringInfo s)
 {
 	char action = pq_getmsgbyte(s);
+	instr_time	hist_start;
+
 	Assert(CurrentMemoryContext == MessageContext);
+
+	INSTR_TIME_SET_CURRENT(hist_start);
+
+	/*
+	 * Any action other than a further INSERT ends a batched insert run;
+	 * updates, deletes, messages and the commit itself must see the
+	 * buffered tuples on disk. (A no-op if nothing is buffered. Relation
+	 * metadata doesn't touch the relation, so it may interleave with a
+	 * run without ending the batch.)
+	 */
+	if (action != 'I' && action != 'S' && action != 'R' && action != 'E' &&
+		action != 'r')
+		flush_insert_batch();
+
+	/*
+	 * Global message processing may start and end transactions of its own;
+	 * queued DDL must run first and cached relation handles must not
+	 * survive across that.
+	 */
+	if (action == 'M')
+	{
+		flush_queued_ddl_batch();
+		release_apply_rel_handles();
+	}
+
+	/*
+	 * The previous row's decoded datums have been applied (or copied into
+	 * the insert batch) by now, so the per-row arena can be recycled before
+	 * we decode another row.
+	 */
+	if (apply_row_context != NULL &&
+		(action == 'I' || action == 'U' || action == 'D' || action == 'R'))
+		MemoryContextReset(apply_row_context);
+
 	switch (action)
 	{
 			/* BEGIN */
@@ -2302,6 +3979,18 @@ bdr_process_remote_action(StringInfo s)
 		case 'I':
 			process_remote_insert(s);
 			break;
+			/* INSERT run start */
+		case 'S':
+			process_remote_insert_run_start(s);
+			break;
+			/* INSERT run row */
+		case 'R':
+			process_remote_insert_run_row(s);
+			break;
+			/* INSERT run end */
+		case 'E':
+			process_remote_insert_run_end();
+			break;
 			/* UPDATE */
 		case 'U':
 			process_remote_update(s);
@@ -2313,12 +4002,34 @@ bdr_process_remote_action(StringInfo s)
 		case 'M':
 			bdr_process_remote_message(s);
 			break;
+			/* relation metadata */
+		case 'r':
+			process_remote_relmeta(s);
+			break;
+			/* streamed in-progress transactions */
+		case 'b':
+			process_remote_stream_start(s);
+			break;
+		case 'x':
+			process_remote_stream_change(s);
+			break;
+		case 'e':
+			process_remote_stream_stop();
+			break;
+		case 'a':
+			process_remote_stream_abort(s);
+			break;
+		case 'c':
+			process_remote_stream_commit(s);
+			break;
 		default:
 			elog(ERROR, "unknown action of type %c", action);
 	}
 	Assert(CurrentMemoryContext == MessageContext);
 
-	if (action == 'C')
+	bdr_apply_hist_record(action, hist_start);
+
+	if (action == 'C' || action == 'c')
 	{
 		/*
 		 * We clobber MessageContext on commit. It doesn't matter much when we
@@ -2349,6 +4060,13 @@ bdr_get_flush_position(XLogRecPtr *write, XLogRecPtr *flush)
 	dlist_mutable_iter iter;
 	XLogRecPtr	local_flush = GetFlushRecPtr(NULL);
 
+	/*
+	 * With parallel apply the helpers commit the transactions, so the
+	 * lsn association list in this process is empty; ask the pool instead.
+	 */
+	if (bdr_apply_parallel_enabled())
+		return bdr_apply_parallel_flush_position(write, flush);
+
 	*write = InvalidXLogRecPtr;
 	*flush = InvalidXLogRecPtr;
 
@@ -2397,6 +4115,7 @@ bdr_send_feedback(PGconn *conn, XLogRecPtr recvpos, int64 now, bool force)
 	static XLogRecPtr last_recvpos = InvalidXLogRecPtr;
 	static XLogRecPtr last_writepos = InvalidXLogRecPtr;
 	static XLogRecPtr last_flushpos = InvalidXLogRecPtr;
+	static TimestampTz last_send_time = 0;
 
 	XLogRecPtr writepos;
 	XLogRecPtr flushpos;
@@ -2426,6 +4145,20 @@ bdr_send_feedback(PGconn *conn, XLogRecPtr recvpos, int64 now, bool force)
 		flushpos == last_flushpos)
 		return true;
 
+	/*
+	 * Coalesce small advances. Unless the walsender asked for a reply, sit
+	 * on the update until replay has progressed bdr.feedback_lsn_delta past
+	 * what we last reported; under high change rates this saves a flood of
+	 * tiny status messages. Cap the delay at a second so upstream resource
+	 * release (and synchronous commit confirmation) isn't held up when
+	 * traffic trickles.
+	 */
+	if (!force && bdr_feedback_lsn_delta > 0 &&
+		writepos < last_writepos + (XLogRecPtr) bdr_feedback_lsn_delta * 1024 &&
+		flushpos < last_flushpos + (XLogRecPtr) bdr_feedback_lsn_delta * 1024 &&
+		!TimestampDifferenceExceeds(last_send_time, now, 1000))
+		return true;
+
 	replybuf[len] = 'r';
 	len += 1;
 	bdr_sendint64(recvpos, &replybuf[len]);			/* write */
@@ -2462,10 +4195,50 @@ bdr_send_feedback(PGconn *conn, XLogRecPtr recvpos, int64 now, bool force)
 		last_writepos = writepos;
 	if (flushpos > last_flushpos)
 		last_flushpos = flushpos;
+	last_send_time = now;
 
 	return true;
 }
 
+/*
+ * Handle a walsender keepalive/feedback message. We'll get these both while
+ * idle and while we're replaying a transaction data stream, to ensure the
+ * walsender knows we're alive and kicking.  There's no need for us to
+ * schedule our own keepalives, the walsender will send one with
+ * reply-requested when needed, even in the middle of sending a single big
+ * row or Datum.
+ *
+ * Keepalives are also sent by the upstream when the server is making changes
+ * that don't result in logical decoding activity, so that it can advance the
+ * catalog_xmin and restart_lsn of idle slots. It's also important for
+ * synchronous replication so the upstream can confirm commits since our
+ * reply tells the upstream we've flushed anything we needed to.
+ *
+ * See:  WalSndKeepaliveIfNecessary(...), WalSndWriteData(...)
+ * in walsender.c .
+ *
+ * 's' is positioned just past the message type byte.
+ */
+static void
+process_remote_keepalive(PGconn *streamConn, StringInfo s)
+{
+	XLogRecPtr	endpos;
+	bool		reply_requested;
+
+	endpos = pq_getmsgint64(s);
+	/* timestamp = */ pq_getmsgint64(s);
+	reply_requested = pq_getmsgbyte(s);
+
+	if (endpos > (XLogRecPtr)
+		pg_atomic_read_u64(&bdr_apply_worker->received_lsn))
+		pg_atomic_write_u64(&bdr_apply_worker->received_lsn,
+							endpos);
+
+	bdr_send_feedback(streamConn, endpos,
+					  GetCurrentTimestamp(),
+					  reply_requested);
+}
+
 /*
  * abs_timestamp_difference -- convert the difference between two timestamps
  *		into integer seconds and microseconds
@@ -2503,73 +4276,392 @@ log_tuple(const char *format, TupleDesc desc, HeapTuple tup)
 {
 	StringInfoData o;
 
-	initStringInfo(&o);
-	tuple_to_stringinfo(&o, desc, tup);
-	elog(DEBUG1, format, o.data);
-	resetStringInfo(&o);
+	initStringInfo(&o);
+	tuple_to_stringinfo(&o, desc, tup);
+	elog(DEBUG1, format, o.data);
+	resetStringInfo(&o);
+
+}
+#endif
+
+/*
+ * When the apply worker's latch is set it reloads its configuration
+ * from the database, checking for new replication sets, connection
+ * strings, etc.
+ *
+ * At this time many changes simply force the apply worker to exit and restart,
+ * since we'd have to reconnect to apply most kinds of change anyway.
+ */
+static void
+bdr_apply_reload_config()
+{
+	BdrConnectionConfig *new_apply_config;
+
+	/* Fetch our config from the DB */
+	new_apply_config = bdr_get_connection_config(
+		&bdr_apply_worker->remote_node,
+		false);
+
+	Assert(bdr_nodeid_eq(&new_apply_config->remote_node, &bdr_apply_worker->remote_node));
+
+	/*
+	 * Got default remote connection info, read also local defaults.
+	 * Otherwise we would be using replication sets and apply delay from the
+	 * remote node instead of the local one.
+	 *
+	 * Note: this is slightly hacky and we should probably use the bdr_nodes
+	 * for this instead.
+	 */
+	if (!new_apply_config->origin_is_my_id)
+	{
+		BdrConnectionConfig *cfg = bdr_get_my_connection_config(false);
+
+		new_apply_config->apply_delay = cfg->apply_delay;
+		pfree(new_apply_config->replication_sets);
+		new_apply_config->replication_sets = pstrdup(cfg->replication_sets);
+		bdr_free_connection_config(cfg);
+	}
+
+	if (bdr_apply_config == NULL)
+	{
+		/* First run, carry on loading */
+		bdr_apply_config = new_apply_config;
+	}
+	else
+	{
+		/* If the DSN or replication sets changed we must restart */
+		if (strcmp(bdr_apply_config->dsn, new_apply_config->dsn) != 0)
+		{
+			elog(DEBUG1, "Apply worker exiting to apply new DSN configuration");
+			proc_exit(1);
+		}
+
+		if (strcmp(bdr_apply_config->replication_sets, new_apply_config->replication_sets) != 0)
+		{
+			elog(DEBUG1, "Apply worker exiting to apply new replication set configuration");
+			proc_exit(1);
+		}
+
+	}
+}
+
+/*
+ * Attach a parallel apply helper to its leader's shmem state so that the
+ * normal apply path (connection config, replay tracing, error context)
+ * works unchanged in the helper.
+ */
+void
+bdr_apply_helper_attach(pid_t leader_pid)
+{
+	int			i;
+
+	Assert(bdr_apply_worker == NULL);
+
+	LWLockAcquire(BdrWorkerCtl->lock, LW_SHARED);
+	for (i = 0; i < bdr_max_workers; i++)
+	{
+		BdrWorker  *w = &BdrWorkerCtl->slots[i];
+
+		if (w->worker_type == BDR_WORKER_APPLY && w->worker_pid == leader_pid)
+		{
+			bdr_apply_worker = &w->data.apply;
+			break;
+		}
+	}
+	LWLockRelease(BdrWorkerCtl->lock);
+
+	if (bdr_apply_worker == NULL)
+		elog(ERROR, "could not find leader apply worker with pid %d",
+			 leader_pid);
+
+	bdr_nodeid_cpy(&origin, &bdr_apply_worker->remote_node);
+
+	StartTransactionCommand();
+	bdr_setup_cached_remote_name(&bdr_apply_worker->remote_node);
+	CommitTransactionCommand();
+
+	bdr_apply_reload_config();
+}
+
+/*
+ * Peek at a received but not-yet-applied copy message and, if it is an
+ * UPDATE or DELETE against a relation we already hold an apply handle for,
+ * start the I/O for its pkey lookup early. See bdr.apply_prefetch_window.
+ *
+ * This must not change any state the later apply of the message depends on:
+ * we only parse out the key columns (into apply_row_context, which isn't
+ * reset until the next row action is dispatched) and refresh the handle's
+ * scan key template, which every lookup refreshes again before use anyway.
+ * Relations not yet touched in this transaction are skipped; opening and
+ * locking them ahead of time would change the lock acquisition order.
+ */
+static void
+prefetch_remote_action(char *buf, int len)
+{
+	StringInfoData s;
+	char		action;
+	int			nspnamelen;
+	int			relnamelen;
+	BdrApplyRelHandleKey key;
+	BdrApplyRelHandle *handle;
+	BDRTupleData keytup;
+
+	if (!IsTransactionState() || apply_rel_handles == NULL)
+		return;
+
+	s.data = buf;
+	s.len = len;
+	s.maxlen = -1;
+	s.cursor = 0;
+
+	if (pq_getmsgbyte(&s) != 'w')
+		return;
+	pq_getmsgint64(&s);			/* start_lsn */
+	pq_getmsgint64(&s);			/* end_lsn */
+	pq_getmsgint64(&s);			/* sendTime */
+
+	action = pq_getmsgbyte(&s);
+	if (action != 'U' && action != 'D')
+		return;
+
+	memset(&key, 0, sizeof(key));
+	if (relmeta_cache_active)
+	{
+		Oid			remote_relid = pq_getmsgint(&s, 4);
+		BdrRemoteRelMeta *meta;
+
+		meta = remote_relmeta ? hash_search(remote_relmeta, &remote_relid,
+											HASH_FIND, NULL) : NULL;
+		if (meta == NULL)
+			return;
+		strlcpy(key.nspname, meta->nspname, NAMEDATALEN);
+		strlcpy(key.relname, meta->relname, NAMEDATALEN);
+	}
+	else
+	{
+		nspnamelen = pq_getmsgint(&s, 2);
+		strlcpy(key.nspname, pq_getmsgbytes(&s, nspnamelen), NAMEDATALEN);
+		relnamelen = pq_getmsgint(&s, 2);
+		strlcpy(key.relname, pq_getmsgbytes(&s, relnamelen), NAMEDATALEN);
+	}
+
+	handle = hash_search(apply_rel_handles, &key, HASH_FIND, NULL);
+	if (handle == NULL || handle->rel == NULL || !handle->rel->valid ||
+		handle->rel->rel == NULL || handle->idxrel == NULL)
+		return;
+
+	/*
+	 * For UPDATE the old key is sent separately ('K') only when it changed,
+	 * otherwise the key columns are part of the new tuple ('N'). DELETE
+	 * sends 'K', or 'E' when there is nothing to look up.
+	 */
+	action = pq_getmsgbyte(&s);
+	if (action != 'K' && action != 'N')
+		return;
+
+	read_tuple_parts(&s, handle->rel, &keytup);
+
+	if (refresh_index_scan_key(handle->idx_skey, handle->idxrel, &keytup))
+		return;					/* NULL in a key column, nothing will match */
+
+	prefetch_pkey_tuple(handle->idx_skey, handle->rel, handle->idxrel);
+}
+
+/*
+ * Rewrite a compressed copy message received from the upstream into its
+ * uncompressed form.
+ *
+ * The walsender's framing ('w', three LSN/timestamp fields) is never
+ * compressed; after it the upstream sends the uncompressed payload length
+ * followed by the compressed bytes. With zstd the messages have to be fed
+ * to the shared decompression context exactly once and in receive order,
+ * which is why this runs when a message is pulled out of libpq, not when
+ * the readahead ring gets around to applying it.
+ *
+ * The replacement buffer is allocated in TopMemoryContext -- like the
+ * libpq buffer it replaces it has to outlive the MessageContext resets of
+ * the transactions applied while it waits in the ring -- and the original
+ * is freed here. Non-'w' traffic (keepalives) is copied verbatim so the
+ * ring only ever holds one kind of allocation per connection; the caller
+ * frees ring entries with pfree() instead of PQfreemem() whenever
+ * compression is active.
+ */
+static char *
+decompress_remote_message(char *copybuf, int *len)
+{
+	StringInfoData s;
+	char	   *buf;
+	int			hdrlen = 1 + 8 + 8 + 8;
+	int			rawlen;
+	int			clen;
+
+	if (*len < 1 || copybuf[0] != 'w')
+	{
+		buf = MemoryContextAlloc(TopMemoryContext, *len);
+		memcpy(buf, copybuf, *len);
+		PQfreemem(copybuf);
+		return buf;
+	}
+
+	s.data = copybuf;
+	s.len = *len;
+	s.maxlen = -1;
+	s.cursor = 0;
+
+	pq_getmsgbyte(&s);			/* 'w' */
+	pq_getmsgint64(&s);			/* start_lsn */
+	pq_getmsgint64(&s);			/* end_lsn */
+	pq_getmsgint64(&s);			/* sendTime */
+
+	rawlen = pq_getmsgint(&s, 4);
+	clen = s.len - s.cursor;
+	if (rawlen < 0 || clen < 0)
+		elog(ERROR, "corrupt compressed message of length %d", *len);
+
+	buf = MemoryContextAlloc(TopMemoryContext, hdrlen + rawlen);
+	memcpy(buf, copybuf, hdrlen);
+
+	if (apply_compression == BDR_COMPRESSION_LZ4)
+	{
+#ifdef USE_LZ4
+		int			got;
+
+		got = LZ4_decompress_safe(s.data + s.cursor, buf + hdrlen,
+								  clen, rawlen);
+		if (got != rawlen)
+			elog(ERROR, "lz4 decompression failed: expected %d bytes, got %d",
+				 rawlen, got);
+#endif
+	}
+	else
+	{
+#ifdef USE_ZSTD
+		ZSTD_inBuffer in;
+		ZSTD_outBuffer out;
+
+		Assert(apply_compression == BDR_COMPRESSION_ZSTD);
+
+		in.src = s.data + s.cursor;
+		in.size = clen;
+		in.pos = 0;
+		out.dst = buf + hdrlen;
+		out.size = rawlen;
+		out.pos = 0;
+
+		while (in.pos < in.size)
+		{
+			size_t		res;
+
+			res = ZSTD_decompressStream(zstd_in, &out, &in);
+			if (ZSTD_isError(res))
+				elog(ERROR, "zstd decompression failed: %s",
+					 ZSTD_getErrorName(res));
+		}
+		if (out.pos != (size_t) rawlen)
+			elog(ERROR, "zstd decompression failed: expected %d bytes, got %zu",
+				 rawlen, out.pos);
+#endif
+	}
+
+	PQfreemem(copybuf);
+	*len = hdrlen + rawlen;
+	return buf;
+}
+
+/* upper limit of bdr.apply_prefetch_window */
+#define BDR_APPLY_READAHEAD_MAX 256
+
+/*
+ * Append one decoded change-stream message to the bdr.apply_capture_path
+ * file, for later replay with bdr.bdr_apply_replay(). The StringInfo is
+ * positioned at the action byte; we record from there to the end - exactly
+ * the bytes bdr_process_remote_action() will consume, after decompression.
+ *
+ * Each message is prefixed with its length as a host-endian uint32; the
+ * capture is a local profiling artifact, not a portable format. The file
+ * handle sticks to the path first seen by this worker; change the GUC and
+ * restart the workers to capture elsewhere.
+ */
+static void
+apply_capture_message(StringInfo s)
+{
+	static FILE *capture_file = NULL;
+	uint32		len = (uint32) (s->len - s->cursor);
+
+	if (capture_file == NULL)
+	{
+		char		path[MAXPGPATH];
+
+		snprintf(path, MAXPGPATH, "%s.%d", bdr_apply_capture_path, MyProcPid);
+		capture_file = AllocateFile(path, PG_BINARY_A);
+		if (capture_file == NULL)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not open apply capture file \"%s\": %m",
+							path)));
+	}
 
+	if (fwrite(&len, sizeof(len), 1, capture_file) != 1 ||
+		fwrite(s->data + s->cursor, 1, len, capture_file) != len ||
+		fflush(capture_file) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to apply capture file \"%s\": %m",
+						bdr_apply_capture_path)));
 }
-#endif
 
 /*
- * When the apply worker's latch is set it reloads its configuration
- * from the database, checking for new replication sets, connection
- * strings, etc.
+ * Detach from an idle peer connection: confirm everything we've applied,
+ * note in our shmem slot when the perdb worker should launch a replacement,
+ * and exit without requesting a bgworker restart.
  *
- * At this time many changes simply force the apply worker to exit and restart,
- * since we'd have to reconnect to apply most kinds of change anyway.
+ * A big mesh runs an apply worker per peer per database, and on most of them
+ * nothing ever arrives; a resident backend per quiet connection adds up to
+ * hundreds of processes cluster-wide. Detaching trades that for a periodic
+ * reconnect, at the price of changes - including DDL lock and global
+ * sequence voting messages - from that peer waiting out the remainder of
+ * bdr.apply_relaunch_interval.
  */
 static void
-bdr_apply_reload_config()
+bdr_apply_idle_exit(PGconn *streamConn, XLogRecPtr last_received)
 {
-	BdrConnectionConfig *new_apply_config;
+	BdrWorker  *perdb;
 
-	/* Fetch our config from the DB */
-	new_apply_config = bdr_get_connection_config(
-		&bdr_apply_worker->remote_node,
-		false);
+	/* Wait out any dispatched parallel work so the final feedback is honest */
+	if (bdr_apply_parallel_enabled())
+		bdr_apply_parallel_drain();
 
-	Assert(bdr_nodeid_eq(&new_apply_config->remote_node, &bdr_apply_worker->remote_node));
+	if (group_commit_pending > 0)
+	{
+		XLogFlush(XactLastCommitEnd);
+		group_commit_pending = 0;
+	}
+
+	bdr_send_feedback(streamConn, last_received, GetCurrentTimestamp(), true);
 
 	/*
-	 * Got default remote connection info, read also local defaults.
-	 * Otherwise we would be using replication sets and apply delay from the
-	 * remote node instead of the local one.
-	 *
-	 * Note: this is slightly hacky and we should probably use the bdr_nodes
-	 * for this instead.
+	 * Flag the slot for relaunch and poke the perdb worker so it recomputes
+	 * its sleep. The latch pointer is cleared because this process is going
+	 * away; the relaunched worker publishes its own.
 	 */
-	if (!new_apply_config->origin_is_my_id)
-	{
-		BdrConnectionConfig *cfg = bdr_get_my_connection_config(false);
-
-		new_apply_config->apply_delay = cfg->apply_delay;
-		pfree(new_apply_config->replication_sets);
-		new_apply_config->replication_sets = pstrdup(cfg->replication_sets);
-		bdr_free_connection_config(cfg);
-	}
+	LWLockAcquire(BdrWorkerCtl->lock, LW_EXCLUSIVE);
+	bdr_apply_worker->idle_until =
+		TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+									bdr_apply_relaunch_interval * 1000L);
+	bdr_apply_worker->proclatch = NULL;
+	perdb = bdr_apply_worker->perdb;
+	if (perdb->data.perdb.proclatch != NULL)
+		SetLatch(perdb->data.perdb.proclatch);
+	LWLockRelease(BdrWorkerCtl->lock);
 
-	if (bdr_apply_config == NULL)
-	{
-		/* First run, carry on loading */
-		bdr_apply_config = new_apply_config;
-	}
-	else
-	{
-		/* If the DSN or replication sets changed we must restart */
-		if (strcmp(bdr_apply_config->dsn, new_apply_config->dsn) != 0)
-		{
-			elog(DEBUG1, "Apply worker exiting to apply new DSN configuration");
-			proc_exit(1);
-		}
+	elog(LOG, "apply worker for "BDR_NODEID_FORMAT" idle for %ds, detaching for up to %ds",
+		 BDR_NODEID_FORMAT_ARGS(bdr_apply_worker->remote_node),
+		 bdr_apply_idle_exit_timeout, bdr_apply_relaunch_interval);
 
-		if (strcmp(bdr_apply_config->replication_sets, new_apply_config->replication_sets) != 0)
-		{
-			elog(DEBUG1, "Apply worker exiting to apply new replication set configuration");
-			proc_exit(1);
-		}
+	PQfinish(streamConn);
 
-	}
+	/* exit code 0 unregisters the bgworker; only the perdb worker revives us */
+	proc_exit(0);
 }
 
 /*
@@ -2581,7 +4673,17 @@ bdr_apply_work(PGconn* streamConn)
 	int			fd;
 	char	   *copybuf = NULL;
 	XLogRecPtr	last_received = InvalidXLogRecPtr;
+	XLogRecPtr	prev_received = InvalidXLogRecPtr;
+	TimestampTz	last_activity = GetCurrentTimestamp();
 	WaitEventSet *eventSet;
+	bool		conn_lost = false;
+
+	/* readahead ring of raw copy messages; max window plus the current one */
+	char	   *ra_buf[BDR_APPLY_READAHEAD_MAX + 1];
+	int			ra_len[BDR_APPLY_READAHEAD_MAX + 1];
+	int			ra_head = 0;
+	int			ra_count = 0;
+	Size		ra_bytes = 0;
 
 	fd = PQsocket(streamConn);
 
@@ -2604,6 +4706,70 @@ bdr_apply_work(PGconn* streamConn)
 		int			rc;
 		int			r;
 		WaitEvent		event;
+		TimestampTz	now;
+
+		/*
+		 * If the upstream connection dropped between transactions, reconnect
+		 * in place rather than exiting: a full worker restart throws away
+		 * every session cache we've warmed up (relcache, syscache, the BDR
+		 * relation and relmeta caches, the parallel helper pool) and costs
+		 * the bgworker restart interval on top. Mid-transaction drops still
+		 * take the exit path, since replay state can't simply be resumed on
+		 * a fresh connection.
+		 */
+		if (conn_lost || PQstatus(streamConn) == CONNECTION_BAD)
+		{
+			RepOriginId	ident;
+
+			bdr_count_disconnect();
+
+			if (IsTransactionState() || cur_streamed_txn != NULL)
+				elog(ERROR, "connection to other side has died");
+
+			/*
+			 * Wait out any dispatched-but-uncommitted parallel apply work
+			 * first, so nothing is applied twice when the stream resumes
+			 * from the origin progress.
+			 */
+			if (bdr_apply_parallel_enabled())
+				bdr_apply_parallel_drain();
+
+			/*
+			 * Everything past the origin progress gets re-sent by the
+			 * upstream, so any readahead we buffered is stale.
+			 */
+			while (ra_count > 0)
+			{
+				if (apply_compression != BDR_COMPRESSION_NONE)
+					pfree(ra_buf[ra_head]);
+				else
+					PQfreemem(ra_buf[ra_head]);
+				ra_head = (ra_head + 1) % lengthof(ra_buf);
+				ra_count--;
+			}
+			ra_bytes = 0;
+
+			elog(LOG, "connection to other side has died, reconnecting in place");
+
+			PQfinish(streamConn);
+			streamConn = bdr_apply_connect_stream(&ident, true);
+			conn_lost = false;
+			last_received = InvalidXLogRecPtr;
+
+			/*
+			 * Wait event sets can't retarget a socket, so rebuild ours
+			 * around the new connection's fd. CurrentMemoryContext is
+			 * MessageContext by now, hence the explicit parent.
+			 */
+			FreeWaitEventSet(eventSet);
+			fd = PQsocket(streamConn);
+			eventSet = CreateWaitEventSet(TopMemoryContext, 3);
+			AddWaitEventToSet(eventSet, WL_LATCH_SET, PGINVALID_SOCKET, &MyProc->procLatch, NULL);
+			AddWaitEventToSet(eventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+			AddWaitEventToSet(eventSet, WL_SOCKET_READABLE, fd, NULL, NULL);
+
+			continue;
+		}
 
 		/*
 		 * Background workers mustn't call usleep() or any direct equivalent:
@@ -2611,7 +4777,8 @@ bdr_apply_work(PGconn* streamConn)
 		 * necessary, but is awakened if postmaster dies.  That way the
 		 * background process goes away immediately in an emergency.
 		 */
-		rc = WaitEventSetWait(eventSet, 1000L, &event, 1, PG_WAIT_EXTENSION);
+		rc = WaitEventSetWait(eventSet, 1000L, &event, 1,
+							  WAIT_EVENT_LOGICAL_APPLY_MAIN);
 
 		ResetLatch(&MyProc->procLatch);
 
@@ -2621,12 +4788,6 @@ bdr_apply_work(PGconn* streamConn)
 		if (rc && event.events & WL_POSTMASTER_DEATH)
 			proc_exit(1);
 
-		if (PQstatus(streamConn) == CONNECTION_BAD)
-		{
-			bdr_count_disconnect();
-			elog(ERROR, "connection to other side has died");
-		}
-
 		if (got_SIGHUP)
 		{
 			got_SIGHUP = false;
@@ -2652,31 +4813,128 @@ bdr_apply_work(PGconn* streamConn)
 			if (got_SIGTERM)
 				break;
 
-			if (copybuf != NULL)
+			/*
+			 * Top up the readahead ring. With both bdr.apply_prefetch_window
+			 * and bdr.apply_receive_buffer at their default of zero this
+			 * degenerates to fetching exactly the one message we're about to
+			 * process. The prefetch window bounds, in messages, how far we
+			 * look ahead for pkey prefetch; the receive buffer bounds, in
+			 * bytes, how much raw stream we additionally pull off the socket
+			 * between changes so the TCP window stays open while apply is
+			 * busy. Messages are still applied strictly in receive order
+			 * below.
+			 */
 			{
-				PQfreemem(copybuf);
-				copybuf = NULL;
-			}
+				bool	drained_socket = false;
 
-			r = PQgetCopyData(streamConn, &copybuf, 1);
+				while (ra_count < lengthof(ra_buf) &&
+					   (ra_count <= bdr_apply_prefetch_window ||
+						ra_bytes < (Size) bdr_apply_receive_buffer * 1024))
+				{
+					r = PQgetCopyData(streamConn, &copybuf, 1);
+
+					if (r == -1)
+					{
+						elog(LOG, "data stream ended");
+						conn_lost = true;
+						break;
+					}
+					else if (r == -2)
+					{
+						elog(LOG, "could not read COPY data: %s",
+							 PQerrorMessage(streamConn));
+						conn_lost = true;
+						break;
+					}
+					else if (r < 0)
+						elog(ERROR, "invalid COPY status %d", r);
+					else if (r == 0)
+					{
+						/*
+						 * libpq's buffer is dry. When receive buffering is
+						 * enabled, pull in whatever the kernel accumulated
+						 * while we were applying the last change, rather
+						 * than letting the socket back up until the outer
+						 * loop's next wait. One read() per applied message
+						 * is enough to keep pace with the link.
+						 */
+						if (!drained_socket && bdr_apply_receive_buffer > 0)
+						{
+							if (!PQconsumeInput(streamConn))
+							{
+								elog(LOG, "could not receive data: %s",
+									 PQerrorMessage(streamConn));
+								conn_lost = true;
+								break;
+							}
+							drained_socket = true;
+							continue;
+						}
+						break;		/* drained libpq's buffer */
+					}
+
+					if (apply_compression != BDR_COMPRESSION_NONE)
+						copybuf = decompress_remote_message(copybuf, &r);
 
-			if (r == -1)
-			{
-				elog(ERROR, "data stream ended");
-			}
-			else if (r == -2)
-			{
-				elog(ERROR, "could not read COPY data: %s",
-					 PQerrorMessage(streamConn));
+					/*
+					 * Answer walsender keepalives at receive time instead of
+					 * queueing them behind buffered changes; a reply request
+					 * mustn't wait for apply to chew through the ring, or
+					 * wal_sender_timeout can fire while we're merely busy.
+					 */
+					if (copybuf[0] == 'k')
+					{
+						StringInfoData ks;
+
+						initStringInfo(&ks);
+						ks.data = copybuf;
+						ks.len = r;
+						ks.maxlen = -1;
+						ks.cursor = 1;	/* past the message type byte */
+
+						process_remote_keepalive(streamConn, &ks);
+
+						if (apply_compression != BDR_COMPRESSION_NONE)
+							pfree(copybuf);
+						else
+							PQfreemem(copybuf);
+						copybuf = NULL;
+						continue;
+					}
+
+					/*
+					 * Only messages that have to wait their turn are worth
+					 * prefetching; the head of an empty ring is processed
+					 * immediately anyway. When only the receive buffer is
+					 * configured, don't pay the extra index probe per row.
+					 */
+					if (ra_count > 0 && bdr_apply_prefetch_window > 0)
+						prefetch_remote_action(copybuf, r);
+
+					ra_buf[(ra_head + ra_count) % lengthof(ra_buf)] = copybuf;
+					ra_len[(ra_head + ra_count) % lengthof(ra_buf)] = r;
+					ra_count++;
+					ra_bytes += r;
+					copybuf = NULL;
+				}
 			}
-			else if (r < 0)
-				elog(ERROR, "invalid COPY status %d", r);
-			else if (r == 0)
+
+			/* reconnect is handled at the top of the outer loop */
+			if (conn_lost)
+				break;
+
+			if (ra_count == 0)
 			{
 				/* need to wait for new data */
 				break;
 			}
-			else
+
+			copybuf = ra_buf[ra_head];
+			r = ra_len[ra_head];
+			ra_head = (ra_head + 1) % lengthof(ra_buf);
+			ra_count--;
+			ra_bytes -= r;
+
 			{
 				int c;
 				StringInfoData s;
@@ -2694,6 +4952,7 @@ bdr_apply_work(PGconn* streamConn)
 				{
 					XLogRecPtr	start_lsn;
 					XLogRecPtr	end_lsn;
+					char		action;
 
 					start_lsn = pq_getmsgint64(&s);
 					end_lsn = pq_getmsgint64(&s);
@@ -2705,50 +4964,89 @@ bdr_apply_work(PGconn* streamConn)
 					if (last_received < end_lsn)
 						last_received = end_lsn;
 
-					bdr_process_remote_action(&s);
-				}
-				else if (c == 'k')
-				{
-					XLogRecPtr endpos;
-					bool reply_requested;
+					pg_atomic_write_u64(&bdr_apply_worker->received_lsn,
+										last_received);
 
-					/*
-					 * Walsender keepalive/feedback message. We'll get these
-					 * both while idle and while we're replaying a transaction
-					 * data stream, to ensure the walsender knows we're alive
-					 * and kicking.  There's no need for us to schedule our own
-					 * keepalives, the walsender will send one with
-					 * reply-requested when needed, even in the middle of sending
-					 * a single big row or Datum.
-					 *
-					 * Keepalives are also sent by the upstream when the server
-					 * is making changes that don't result in logical decoding
-					 * activity, so that it can advance the catalog_xmin and
-					 * restart_lsn of idle slots. It's also important for
-					 * synchronous replication so the upstream can confirm
-					 * commits since our reply tells the upstream we've flushed
-					 * anything we needed to.
-					 *
-					 * See:  WalSndKeepaliveIfNecessary(...), WalSndWriteData(...)
-					 * in walsender.c .
-					 */
+					/* Peek at the action byte; consumed by the handlers. */
+					action = s.data[s.cursor];
 
-					endpos = pq_getmsgint64(&s);
-					/* timestamp = */ pq_getmsgint64(&s);
-					reply_requested = pq_getmsgbyte(&s);
+					if (bdr_apply_capture_path != NULL &&
+						bdr_apply_capture_path[0] != '\0')
+						apply_capture_message(&s);
 
-					bdr_send_feedback(streamConn, endpos,
-									  GetCurrentTimestamp(),
-									  reply_requested);
+					if (bdr_apply_parallel_enabled())
+						bdr_apply_parallel_dispatch(&s);
+					else
+						bdr_process_remote_action(&s);
+
+					/*
+					 * A commit can move the reportable flush position a long
+					 * way. Offer feedback right away rather than waiting for
+					 * the stream to drain; bdr_send_feedback() swallows the
+					 * update unless bdr.feedback_lsn_delta has been crossed,
+					 * so a busy stream doesn't flood the walsender.
+					 */
+					if (action == 'C' || action == 'c')
+						bdr_send_feedback(streamConn, last_received,
+										  GetCurrentTimestamp(), false);
+				}
+				else if (c == 'k')
+				{
+					/* handled at receive time these days, but harmless here */
+					process_remote_keepalive(streamConn, &s);
 				}
 				/* other message types are purposefully ignored */
 			}
 
+			if (apply_compression != BDR_COMPRESSION_NONE)
+				pfree(copybuf);
+			else
+				PQfreemem(copybuf);
+			copybuf = NULL;
+		}
+
+		/*
+		 * A pause in the stream ends the current group commit window; flush
+		 * now so the feedback below can confirm everything we've applied.
+		 */
+		if (group_commit_pending > 0)
+		{
+			XLogFlush(XactLastCommitEnd);
+			group_commit_pending = 0;
+		}
+
+		now = GetCurrentTimestamp();
+
+		/* changes advance last_received; keepalives alone don't count as work */
+		if (last_received != prev_received)
+		{
+			prev_received = last_received;
+			last_activity = now;
 		}
 
 		/* confirm all writes at once */
-		bdr_send_feedback(streamConn, last_received,
-						  GetCurrentTimestamp(), false);
+		bdr_send_feedback(streamConn, last_received, now, false);
+
+		/*
+		 * A quiet connection doesn't justify keeping this backend around.
+		 * With bdr.apply_idle_exit_timeout set, hand the peer back to the
+		 * perdb worker's relaunch schedule once nothing has arrived for that
+		 * long. Catchup-mode workers (replay_stop_lsn set, changeset
+		 * forwarding) have another backend waiting on their progress, so
+		 * they always stay resident; so does a paused worker, which has to
+		 * keep a latch around for pg_bdr_apply_resume() to set.
+		 */
+		if (bdr_apply_idle_exit_timeout > 0 &&
+			!conn_lost &&
+			!IsTransactionState() &&
+			cur_streamed_txn == NULL &&
+			ra_count == 0 &&
+			!BdrWorkerCtl->pause_apply &&
+			bdr_apply_worker->replay_stop_lsn == InvalidXLogRecPtr &&
+			!bdr_apply_worker->forward_changesets &&
+			TimestampDifferenceExceeds(last_activity, now,
+									   bdr_apply_idle_exit_timeout * 1000))
+			bdr_apply_idle_exit(streamConn, last_received);
 
 		/*
 		 * If the user has paused replication with bdr_apply_pause(), we
@@ -2765,7 +5063,7 @@ bdr_apply_work(PGconn* streamConn)
 			ResetLatch(&MyProc->procLatch);
 			rc = WaitLatch(&MyProc->procLatch,
 						   WL_TIMEOUT | WL_LATCH_SET | WL_POSTMASTER_DEATH,
-						   300000L, PG_WAIT_EXTENSION);
+						   300000L, WAIT_EVENT_RECOVERY_PAUSE);
 
 			if (rc & WL_POSTMASTER_DEATH)
 				proc_exit(1);
@@ -2848,69 +5146,256 @@ ensure_local_ip_valid()
 	char	*mydsn, *myip = NULL, *err_msg = NULL;
 	PQconninfoOption	*conn_opt, *conn_opts = NULL;
 
-	if (!myconfig)
-	{
-		elog(DEBUG1,
-			"No entry in bdr_connections for local node found - skipping IP check");
-		return;
-	}
+	if (!myconfig)
+	{
+		elog(DEBUG1,
+			"No entry in bdr_connections for local node found - skipping IP check");
+		return;
+	}
+
+	mydsn = myconfig->dsn;
+	conn_opts = PQconninfoParse(mydsn, &err_msg);
+	if (conn_opts == NULL)
+	{
+		elog(DEBUG1,
+			"Could not parse local node's bdr_connections dsn - skipping IP check");
+		bdr_free_connection_config(myconfig);
+		return;
+	}
+
+	for (conn_opt = conn_opts; conn_opt->keyword != NULL; conn_opt++)
+	{
+		if (strcmp(conn_opt->keyword, "host") == 0)
+		{
+			myip = conn_opt->val;
+			break;
+		}
+	}
+
+	if (myip)
+	{
+		bool abort_connection = false;
+		if (strchr(myip, ':'))
+		{
+			/* probably an IPv6 address */
+			struct in6_addr addr;
+			if (inet_pton(AF_INET6, myip, &addr) != 1)
+				elog(DEBUG1,
+					"Local IP %s could not be parsed as an IPv6 address",
+					myip);
+			else if (!is_local_ip_address(&addr, AF_INET6))
+				abort_connection = true;
+		}
+		else
+		{
+			/* assume an IPv4 address by default */
+			struct in_addr addr;
+			if (inet_pton(AF_INET, myip, &addr) != 1)
+				elog(DEBUG1,
+					"Local IP %s could not be parsed as an IPv4 address",
+					myip);
+			else if (!is_local_ip_address(&addr, AF_INET))
+				abort_connection = true;
+		}
+
+		if (abort_connection)
+			elog(ERROR,
+				"This node's DSN specifies an invalid local IP address %s!",
+				myip);
+	}
+
+	PQconninfoFree(conn_opts);
+	bdr_free_connection_config(myconfig);
+}
+#endif
+
+
+/*
+ * Establish (or re-establish) the replication connection to our remote
+ * node and issue START_REPLICATION from wherever the replication origin
+ * says we got to.
+ *
+ * On reconnect the one-time session setup -- the stats node registration
+ * and the replication origin session -- is already in place and is
+ * skipped; everything derived from the connection itself (start position,
+ * negotiated options, compression state) is recomputed per call.
+ *
+ * Returns the connection in COPY BOTH mode, ready for the apply loop.
+ */
+static PGconn *
+bdr_apply_connect_stream(RepOriginId *replication_identifier, bool reconnect)
+{
+	PGconn	   *streamConn;
+	PGresult   *res;
+	StringInfoData query;
+	char	   *sqlstate;
+	XLogRecPtr	start_from;
+	NameData	slot_name;
+
+	initStringInfo(&query);
+
+	/*
+	 * Form an application_name string to send to the remote end. From the
+	 * remote's perspective this is a send connection.
+	 */
+	appendStringInfoString(&query, "send");
+
+	if (bdr_apply_worker->forward_changesets)
+		appendStringInfoString(&query, " catchup");
+
+	if (bdr_apply_worker->replay_stop_lsn != InvalidXLogRecPtr)
+		appendStringInfo(&query, " up to %X/%X",
+						 (uint32)(bdr_apply_worker->replay_stop_lsn >> 32),
+						 (uint32)bdr_apply_worker->replay_stop_lsn);
+
+	/* Make the replication connection to the remote end */
+	streamConn = bdr_establish_connection_and_slot(bdr_apply_config->dsn,
+		query.data, &slot_name, &origin, replication_identifier, NULL);
+
+	if (!reconnect)
+	{
+		/* initialize stat subsystem, our id won't change further */
+		bdr_count_set_current_node(*replication_identifier);
+
+		/*
+		 * tell replication_identifier.c about our identifier so it can cache
+		 * the search in shared memory.
+		 */
+		replorigin_session_setup(*replication_identifier, 0);
+	}
+
+	/*
+	 * Check whether we already replayed something so we don't replay it
+	 * multiple times.
+	 *
+	 * The replication origin will contain the end of the last flushed
+	 * commit record + 1, which is the startpoint we want for the
+	 * (inclusive) argument to START_REPLICATION.
+	 */
+	start_from = replorigin_session_get_progress(false);
+
+	elog(INFO, "starting up replication from %u at %X/%X (inclusive)",
+		 *replication_identifier,
+		 (uint32) (start_from >> 32), (uint32) start_from);
+
+	resetStringInfo(&query);
+	appendStringInfo(&query, "START_REPLICATION SLOT \"%s\" LOGICAL %X/%X (",
+					 NameStr(slot_name), (uint32) (start_from >> 32),
+					 (uint32) start_from);
+	appendStringInfo(&query, "pg_version '%u'", PG_VERSION_NUM);
+	appendStringInfo(&query, ", pg_catversion '%u'", CATALOG_VERSION_NO);
+	appendStringInfo(&query, ", bdr_version '%u'", BDR_VERSION_NUM);
+	appendStringInfo(&query, ", bdr_variant '%s'", BDR_VARIANT);
+	appendStringInfo(&query, ", min_bdr_version '%u'", BDR_MIN_REMOTE_VERSION_NUM);
+	appendStringInfo(&query, ", sizeof_int '%zu'", sizeof(int));
+	appendStringInfo(&query, ", sizeof_long '%zu'", sizeof(long));
+	appendStringInfo(&query, ", sizeof_datum '%zu'", sizeof(Datum));
+	appendStringInfo(&query, ", maxalign '%d'", MAXIMUM_ALIGNOF);
+	appendStringInfo(&query, ", float4_byval '%d'", bdr_get_float4byval());
+	appendStringInfo(&query, ", float8_byval '%d'", bdr_get_float8byval());
+	appendStringInfo(&query, ", integer_datetimes '%d'", bdr_get_integer_timestamps());
+	appendStringInfo(&query, ", bigendian '%d'", bdr_get_bigendian());
+	if (bdr_apply_sendrecv_stable_types)
+		appendStringInfo(&query, ", sendrecv_stable_types 't'");
+	appendStringInfo(&query, ", db_encoding '%s'", GetDatabaseEncodingName());
+	if (bdr_apply_config->replication_sets != NULL &&
+		bdr_apply_config->replication_sets[0] != 0)
+		appendStringInfo(&query, ", replication_sets '%s'",
+						 bdr_apply_config->replication_sets);
+
+	appendStringInfo(&query, ", db_encoding '%s'", GetDatabaseEncodingName());
+	if (bdr_apply_worker->forward_changesets)
+		appendStringInfo(&query, ", forward_changesets 't'");
+	if (bdr_apply_insert_runs)
+		appendStringInfo(&query, ", insert_runs 't'");
+	/*
+	 * Streamed transactions are replayed whole at their streamed commit, so
+	 * there's nothing to gain from also routing them through the parallel
+	 * apply pool, and the dispatcher doesn't know the stream actions.
+	 */
+	if (bdr_apply_streaming && !bdr_apply_parallel_enabled())
+		appendStringInfo(&query, ", streaming 't'");
+	/*
+	 * Relation metadata caching shares streaming's incompatibility with
+	 * parallel apply: the 'r' messages are session-global, but helper
+	 * workers only see the transactions dispatched to them.
+	 */
+	relmeta_cache_active = bdr_apply_relmeta_cache &&
+		!bdr_apply_parallel_enabled();
+	if (relmeta_cache_active)
+		appendStringInfo(&query, ", relmeta_cache 't'");
+	/*
+	 * Compact tuples are marker-dispatched ('C' vs 'T') in
+	 * read_tuple_parts(), so unlike streaming or relmeta_cache they need
+	 * no per-connection state downstream and stay parallel-apply safe.
+	 */
+	if (bdr_apply_compact_tuples)
+		appendStringInfo(&query, ", compact_tuples 't'");
 
-	mydsn = myconfig->dsn;
-	conn_opts = PQconninfoParse(mydsn, &err_msg);
-	if (conn_opts == NULL)
+	/*
+	 * Stream compression is pure opt-in, unlike the other negotiated
+	 * options: upstreams too old to know the option, or built without the
+	 * requested library, refuse it outright, so the default stays "none"
+	 * and the DBA enables it per node once the whole group supports it.
+	 */
+	apply_compression = BDR_COMPRESSION_NONE;
+	if (strcmp(bdr_apply_compression, "lz4") == 0)
 	{
-		elog(DEBUG1,
-			"Could not parse local node's bdr_connections dsn - skipping IP check");
-		bdr_free_connection_config(myconfig);
-		return;
+#ifdef USE_LZ4
+		apply_compression = BDR_COMPRESSION_LZ4;
+#else
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("bdr.apply_compression is \"lz4\", but this build has no lz4 support")));
+#endif
 	}
-
-	for (conn_opt = conn_opts; conn_opt->keyword != NULL; conn_opt++)
+	else if (strcmp(bdr_apply_compression, "zstd") == 0)
 	{
-		if (strcmp(conn_opt->keyword, "host") == 0)
+#ifdef USE_ZSTD
+		apply_compression = BDR_COMPRESSION_ZSTD;
+		if (zstd_in == NULL)
 		{
-			myip = conn_opt->val;
-			break;
+			zstd_in = ZSTD_createDStream();
+			if (zstd_in == NULL)
+				elog(ERROR, "out of memory");
 		}
+		ZSTD_initDStream(zstd_in);
+#else
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("bdr.apply_compression is \"zstd\", but this build has no zstd support")));
+#endif
 	}
+	else if (strcmp(bdr_apply_compression, "none") != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unrecognized bdr.apply_compression value \"%s\"",
+						bdr_apply_compression)));
+	if (apply_compression != BDR_COMPRESSION_NONE)
+		appendStringInfo(&query, ", compression '%s'", bdr_apply_compression);
 
-	if (myip)
-	{
-		bool abort_connection = false;
-		if (strchr(myip, ':'))
-		{
-			/* probably an IPv6 address */
-			struct in6_addr addr;
-			if (inet_pton(AF_INET6, myip, &addr) != 1)
-				elog(DEBUG1,
-					"Local IP %s could not be parsed as an IPv6 address",
-					myip);
-			else if (!is_local_ip_address(&addr, AF_INET6))
-				abort_connection = true;
-		}
-		else
-		{
-			/* assume an IPv4 address by default */
-			struct in_addr addr;
-			if (inet_pton(AF_INET, myip, &addr) != 1)
-				elog(DEBUG1,
-					"Local IP %s could not be parsed as an IPv4 address",
-					myip);
-			else if (!is_local_ip_address(&addr, AF_INET))
-				abort_connection = true;
-		}
+	/* for sanity checks in output plugin */
+	appendStringInfo(&query, ", current_lsn '" UINT64_FORMAT "'", GetXLogInsertRecPtr());
 
-		if (abort_connection)
-			elog(ERROR,
-				"This node's DSN specifies an invalid local IP address %s!",
-				myip);
+	appendStringInfoChar(&query, ')');
+
+	elog(DEBUG3, "Sending replication command: %s", query.data);
+
+	res = PQexec(streamConn, query.data);
+
+	sqlstate = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+
+	if (PQresultStatus(res) != PGRES_COPY_BOTH)
+	{
+		elog(FATAL, "could not send replication command \"%s\": %s\n, sqlstate: %s",
+			 query.data, PQresultErrorMessage(res), sqlstate);
 	}
+	PQclear(res);
 
-	PQconninfoFree(conn_opts);
-	bdr_free_connection_config(myconfig);
-}
-#endif
+	pfree(query.data);
 
+	return streamConn;
+}
 
 /*
  * Entry point for a BDR apply worker.
@@ -2922,12 +5407,8 @@ void
 bdr_apply_main(Datum main_arg)
 {
 	PGconn	   *streamConn;
-	PGresult   *res;
 	StringInfoData query;
-	char	   *sqlstate;
 	RepOriginId	replication_identifier;
-	XLogRecPtr	start_from;
-	NameData	slot_name;
 	char		status;
 
 	bdr_bgworker_init(DatumGetInt32(main_arg), BDR_WORKER_APPLY);
@@ -2955,14 +5436,12 @@ bdr_apply_main(Datum main_arg)
 	LWLockRelease(BdrWorkerCtl->lock);
 
 	/*
-	 * Check if we decided to kill off this connection
+	 * Check if we decided to kill off this connection. The nodecache read
+	 * avoids spinning up SPI just for this one-row lookup; the cache is
+	 * cold in a fresh worker, so the status is read from the catalogs.
 	 */
 	StartTransactionCommand();
-	SPI_connect();
-        PushActiveSnapshot(GetTransactionSnapshot());
-	status = bdr_nodes_get_local_status(&bdr_apply_worker->remote_node);
-        PopActiveSnapshot();
-	SPI_finish();
+	status = bdr_nodeid_status(&bdr_apply_worker->remote_node);
 	CommitTransactionCommand();
 	if (status == BDR_NODE_STATUS_KILLED)
 	{
@@ -3000,93 +5479,18 @@ bdr_apply_main(Datum main_arg)
 #endif
 
 	/*
-	 * Form an application_name string to send to the remote end. From the
-	 * remote's perspective this is a send connection.
+	 * Make the replication connection to the remote end and start streaming
+	 * from wherever the replication origin says we got to.
 	 */
-	resetStringInfo(&query);
-	appendStringInfoString(&query, "send");
-
-	if (bdr_apply_worker->forward_changesets)
-		appendStringInfoString(&query, " catchup");
-
-	if (bdr_apply_worker->replay_stop_lsn != InvalidXLogRecPtr)
-		appendStringInfo(&query, " up to %X/%X",
-						 (uint32)(bdr_apply_worker->replay_stop_lsn >> 32),
-						 (uint32)bdr_apply_worker->replay_stop_lsn);
-
-	/* Make the replication connection to the remote end */
-	streamConn = bdr_establish_connection_and_slot(bdr_apply_config->dsn,
-		query.data, &slot_name, &origin, &replication_identifier, NULL);
-
+	streamConn = bdr_apply_connect_stream(&replication_identifier, false);
 
-	/* initialize stat subsystem, our id won't change further */
-	bdr_count_set_current_node(replication_identifier);
-
-	/*
-	 * tell replication_identifier.c about our identifier so it can cache the
-	 * search in shared memory.
-	 */
-	replorigin_session_setup(replication_identifier, 0);
+	replorigin_session_origin = replication_identifier;
 
 	/*
-	 * Check whether we already replayed something so we don't replay it
-	 * multiple times.
-	 *
-	 * The replication origin will contain the end of the last flushed
-	 * commit record + 1, which is the startpoint we want for the
-	 * (inclusive) argument to START_REPLICATION.
+	 * If parallel apply is configured, launch the helper pool now that our
+	 * origin session exists for the helpers to share.
 	 */
-	start_from = replorigin_session_get_progress(false);
-
-	elog(INFO, "starting up replication from %u at %X/%X (inclusive)",
-		 replication_identifier,
-		 (uint32) (start_from >> 32), (uint32) start_from);
-
-	resetStringInfo(&query);
-	appendStringInfo(&query, "START_REPLICATION SLOT \"%s\" LOGICAL %X/%X (",
-					 NameStr(slot_name), (uint32) (start_from >> 32),
-					 (uint32) start_from);
-	appendStringInfo(&query, "pg_version '%u'", PG_VERSION_NUM);
-	appendStringInfo(&query, ", pg_catversion '%u'", CATALOG_VERSION_NO);
-	appendStringInfo(&query, ", bdr_version '%u'", BDR_VERSION_NUM);
-	appendStringInfo(&query, ", bdr_variant '%s'", BDR_VARIANT);
-	appendStringInfo(&query, ", min_bdr_version '%u'", BDR_MIN_REMOTE_VERSION_NUM);
-	appendStringInfo(&query, ", sizeof_int '%zu'", sizeof(int));
-	appendStringInfo(&query, ", sizeof_long '%zu'", sizeof(long));
-	appendStringInfo(&query, ", sizeof_datum '%zu'", sizeof(Datum));
-	appendStringInfo(&query, ", maxalign '%d'", MAXIMUM_ALIGNOF);
-	appendStringInfo(&query, ", float4_byval '%d'", bdr_get_float4byval());
-	appendStringInfo(&query, ", float8_byval '%d'", bdr_get_float8byval());
-	appendStringInfo(&query, ", integer_datetimes '%d'", bdr_get_integer_timestamps());
-	appendStringInfo(&query, ", bigendian '%d'", bdr_get_bigendian());
-	appendStringInfo(&query, ", db_encoding '%s'", GetDatabaseEncodingName());
-	if (bdr_apply_config->replication_sets != NULL &&
-		bdr_apply_config->replication_sets[0] != 0)
-		appendStringInfo(&query, ", replication_sets '%s'",
-						 bdr_apply_config->replication_sets);
-
-	appendStringInfo(&query, ", db_encoding '%s'", GetDatabaseEncodingName());
-	if (bdr_apply_worker->forward_changesets)
-		appendStringInfo(&query, ", forward_changesets 't'");
-	/* for sanity checks in output plugin */
-	appendStringInfo(&query, ", current_lsn '" UINT64_FORMAT "'", GetXLogInsertRecPtr());
-
-	appendStringInfoChar(&query, ')');
-
-	elog(DEBUG3, "Sending replication command: %s", query.data);
-
-	res = PQexec(streamConn, query.data);
-
-	sqlstate = PQresultErrorField(res, PG_DIAG_SQLSTATE);
-
-	if (PQresultStatus(res) != PGRES_COPY_BOTH)
-	{
-		elog(FATAL, "could not send replication command \"%s\": %s\n, sqlstate: %s",
-			 query.data, PQresultErrorMessage(res), sqlstate);
-	}
-	PQclear(res);
-
-	replorigin_session_origin = replication_identifier;
+	bdr_apply_parallel_startup(replication_identifier);
 
 	bdr_conflict_logging_startup();
 
@@ -3114,3 +5518,227 @@ IsBdrApplyWorker(void)
 {
 	return bdr_apply_worker != NULL;
 }
+
+/*
+ * Apply-path microbenchmark: replay a change stream captured with
+ * bdr.apply_capture_path straight into bdr_process_remote_action().
+ *
+ * bdr.bdr_apply_replay(path) launches a one-shot background worker that reads
+ * the length-prefixed messages back and applies them with no walsender,
+ * network or readahead in the way, timing each action. This lets changes
+ * to tuple decoding, the pkey lookup and conflict handling be profiled in
+ * isolation and at memory speed; the per-action timing summary goes to the
+ * server log when the replay completes.
+ *
+ * The replayed transactions commit locally like any applied transaction,
+ * but with no replication origin session their progress is not tracked -
+ * replay into a throwaway node, not a production one. Captures containing
+ * global ('M') messages interact with the whole node group and are best
+ * trimmed to plain DML before replay.
+ */
+
+typedef struct BdrApplyReplayArgs
+{
+	Oid			dboid;
+	Oid			roleoid;
+	char		path[120];
+} BdrApplyReplayArgs;
+
+void
+bdr_apply_replay_main(Datum main_arg)
+{
+	BdrApplyReplayArgs args;
+	FILE	   *stream;
+	uint64		action_count[128];
+	uint64		action_us[128];
+	uint64		total_actions = 0;
+	instr_time	wall_start;
+	instr_time	wall_duration;
+	int			i;
+
+	memcpy(&args, MyBgworkerEntry->bgw_extra, sizeof(args));
+
+	pqsignal(SIGHUP, bdr_sighup);
+	pqsignal(SIGTERM, bdr_sigterm);
+	BackgroundWorkerUnblockSignals();
+
+	BackgroundWorkerInitializeConnectionByOid(args.dboid, args.roleoid, 0);
+
+	/*
+	 * Like a parallel apply helper, we drive the apply machinery without a
+	 * worker slot or upstream connection config of our own;
+	 * bdr_apply_worker and bdr_apply_config stay NULL.
+	 */
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "bdr apply replay");
+	bdr_saved_resowner = CurrentResourceOwner;
+
+	/* same apply-time settings as a regular apply worker */
+	SetConfigOption("search_path", "bdr, pg_catalog",
+					PGC_BACKEND, PGC_S_OVERRIDE);
+	SetConfigOption("synchronous_commit",
+					bdr_synchronous_commit ? "local" : "off",
+					PGC_BACKEND, PGC_S_OVERRIDE);
+	SetConfigOption("session_replication_role", "replica",
+					PGC_SUSET, PGC_S_OVERRIDE);
+	SetConfigOption("check_function_bodies", "off",
+					PGC_INTERNAL, PGC_S_OVERRIDE);
+
+	StartTransactionCommand();
+	bdr_maintain_schema(false);
+	bdr_setup_my_cached_node_names();
+	CommitTransactionCommand();
+
+	MessageContext = AllocSetContextCreate(TopMemoryContext,
+										   "MessageContext",
+										   ALLOCSET_DEFAULT_MINSIZE,
+										   ALLOCSET_DEFAULT_INITSIZE,
+										   ALLOCSET_DEFAULT_MAXSIZE);
+
+	bdr_conflict_logging_startup();
+
+	stream = AllocateFile(args.path, PG_BINARY_R);
+	if (stream == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open apply capture file \"%s\": %m",
+						args.path)));
+
+	memset(action_count, 0, sizeof(action_count));
+	memset(action_us, 0, sizeof(action_us));
+
+	elog(LOG, "bdr apply replay of \"%s\" starting", args.path);
+
+	INSTR_TIME_SET_CURRENT(wall_start);
+
+	for (;;)
+	{
+		uint32		len;
+		size_t		nread;
+		char	   *data;
+		StringInfoData s;
+		unsigned char action;
+		instr_time	action_start;
+		instr_time	action_duration;
+
+		nread = fread(&len, 1, sizeof(len), stream);
+		if (nread == 0 && feof(stream))
+			break;
+		if (nread != sizeof(len) || len == 0)
+			ereport(ERROR,
+					(errmsg("malformed apply capture file \"%s\" after " UINT64_FORMAT " actions",
+							args.path, total_actions)));
+
+		MemoryContextSwitchTo(MessageContext);
+
+		data = palloc(len);
+		if (fread(data, 1, len, stream) != len)
+			ereport(ERROR,
+					(errmsg("truncated apply capture file \"%s\" after " UINT64_FORMAT " actions",
+							args.path, total_actions)));
+
+		initStringInfo(&s);
+		s.data = data;
+		s.len = len;
+		s.maxlen = -1;
+
+		action = (unsigned char) data[0];
+
+		INSTR_TIME_SET_CURRENT(action_start);
+		bdr_process_remote_action(&s);
+		INSTR_TIME_SET_CURRENT(action_duration);
+		INSTR_TIME_SUBTRACT(action_duration, action_start);
+
+		if (action < lengthof(action_count))
+		{
+			action_count[action]++;
+			action_us[action] += (uint64) INSTR_TIME_GET_MICROSEC(action_duration);
+		}
+		total_actions++;
+
+		CHECK_FOR_INTERRUPTS();
+		if (got_SIGTERM)
+			break;
+	}
+
+	FreeFile(stream);
+
+	INSTR_TIME_SET_CURRENT(wall_duration);
+	INSTR_TIME_SUBTRACT(wall_duration, wall_start);
+
+	ereport(LOG,
+			(errmsg("bdr apply replay of \"%s\" done: " UINT64_FORMAT " actions in %.3f s",
+					args.path, total_actions,
+					INSTR_TIME_GET_DOUBLE(wall_duration))));
+
+	for (i = 0; i < (int) lengthof(action_count); i++)
+	{
+		if (action_count[i] == 0)
+			continue;
+		ereport(LOG,
+				(errmsg("bdr apply replay: action '%c': count " UINT64_FORMAT ", total %.3f ms, avg %.1f us",
+						(char) i, action_count[i],
+						action_us[i] / 1000.0,
+						(double) action_us[i] / action_count[i])));
+	}
+
+	proc_exit(0);
+}
+
+PG_FUNCTION_INFO_V1(bdr_apply_replay);
+
+Datum
+bdr_apply_replay(PG_FUNCTION_ARGS)
+{
+	const char *path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	BdrApplyReplayArgs args;
+	BackgroundWorker bgw;
+	BackgroundWorkerHandle *handle;
+	BgwHandleStatus status;
+	pid_t		pid;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("only superusers may replay captured apply streams")));
+
+	memset(&args, 0, sizeof(args));
+	args.dboid = MyDatabaseId;
+	args.roleoid = GetUserId();
+	if (strlcpy(args.path, path, sizeof(args.path)) >= sizeof(args.path))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("apply capture file path may be at most %zu bytes",
+						sizeof(args.path) - 1)));
+
+	memset(&bgw, 0, sizeof(bgw));
+	bgw.bgw_flags = BGWORKER_SHMEM_ACCESS |
+		BGWORKER_BACKEND_DATABASE_CONNECTION;
+	bgw.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	bgw.bgw_restart_time = BGW_NEVER_RESTART;
+	strncpy(bgw.bgw_library_name, BDR_LIBRARY_NAME, BGW_MAXLEN);
+	strncpy(bgw.bgw_function_name, "bdr_apply_replay_main", BGW_MAXLEN);
+	snprintf(bgw.bgw_name, BGW_MAXLEN, "bdr apply replay");
+	snprintf(bgw.bgw_type, BGW_MAXLEN, "bdr apply replay");
+	bgw.bgw_main_arg = (Datum) 0;
+	bgw.bgw_notify_pid = MyProcPid;
+	StaticAssertStmt(sizeof(args) <= BGW_EXTRALEN,
+					 "apply replay args too large for bgw_extra");
+	memcpy(bgw.bgw_extra, &args, sizeof(args));
+
+	if (!RegisterDynamicBackgroundWorker(&bgw, &handle))
+		ereport(ERROR,
+				(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+				 errmsg("could not register bdr apply replay worker, increase max_worker_processes")));
+
+	status = WaitForBackgroundWorkerStartup(handle, &pid);
+	if (status != BGWH_STARTED)
+		ereport(ERROR,
+				(errmsg("could not start bdr apply replay worker")));
+
+	status = WaitForBackgroundWorkerShutdown(handle);
+	if (status != BGWH_STOPPED)
+		ereport(ERROR,
+				(errmsg("bdr apply replay worker did not shut down cleanly")));
+
+	PG_RETURN_VOID();
+}
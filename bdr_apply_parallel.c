@@ -0,0 +1,756 @@
+/* -------------------------------------------------------------------------
+ *
+ * bdr_apply_parallel.c
+ *		Parallel apply of remote transactions
+ *
+ * A single apply worker per upstream peer saturates one CPU core long
+ * before network or disk limits are reached. When bdr.parallel_apply_workers
+ * is set to a nonzero value the apply worker for a peer becomes a leader
+ * that launches a pool of helper workers and dispatches whole decoded
+ * transactions to them over shm_mq queues.
+ *
+ * Transactions are partitioned by remote xid, so all changes of one remote
+ * transaction are always applied by the same helper. Upstream commit order
+ * is preserved by handing each transaction a commit ticket at dispatch time;
+ * a helper applies changes as they arrive but waits for all transactions
+ * with earlier tickets to commit locally before committing its own.
+ *
+ * Because changes are applied as they arrive, a later-ticketed transaction
+ * can take a row lock before an earlier-ticketed one on another helper
+ * reaches the same row. The earlier one then blocks in the lock manager on
+ * the later one's uncommitted xmax, while the later one sits in the ticket
+ * wait - a latch loop the deadlock detector can't see - and apply would
+ * wedge. The ticket wait therefore doubles as a watchdog: if anyone is
+ * blocked on our transaction's xid while we still wait for earlier commits,
+ * we assume such a cycle, abort, and re-apply the transaction from a copy
+ * kept by the helper once all earlier tickets have committed. The end state
+ * is the same as serial apply, since the retried transaction then applies
+ * against the committed effects of everything that preceded it upstream.
+ *
+ * Transactions that touch the bdr schema (queued DDL, node management) are
+ * applied under a serialization barrier: the leader drains all other helpers
+ * first and dispatches nothing further until the transaction has committed.
+ *
+ * Copyright (C) 2012-2015, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		bdr_apply_parallel.c
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "bdr.h"
+
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include "access/transam.h"
+#include "access/xact.h"
+
+#include "libpq/pqformat.h"
+
+#include "port/atomics.h"
+
+#include "postmaster/bgworker.h"
+
+#include "replication/origin.h"
+
+#include "storage/dsm.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lock.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+
+/* GUC */
+int			bdr_parallel_apply_workers;
+
+/*
+ * Nonzero while a helper is applying a dispatched message; used by
+ * process_remote_commit() to order local commits by ticket.
+ */
+uint64		bdr_apply_parallel_current_ticket = 0;
+
+#define BDR_PARALLEL_APPLY_QUEUE_SIZE	(1024 * 1024)
+
+/*
+ * Shared state at the start of the pool's dsm segment, followed by the
+ * shm_mq ring buffers.
+ */
+typedef struct BdrParallelApplyShared
+{
+	/* Ticket of the transaction that committed most recently, 0 if none. */
+	pg_atomic_uint64 last_committed_ticket;
+
+	/* Per-helper progress, indexed by helper number. */
+	struct
+	{
+		/* remote end-of-commit lsn of the last transaction committed */
+		pg_atomic_uint64 remote_end;
+		/* corresponding local end-of-commit lsn */
+		pg_atomic_uint64 local_end;
+		/* ticket of the last transaction committed by this helper */
+		pg_atomic_uint64 ticket;
+	}			helpers[FLEXIBLE_ARRAY_MEMBER];
+} BdrParallelApplyShared;
+
+/* Arguments passed to each helper via bgw_extra */
+typedef struct BdrParallelApplyHelperArgs
+{
+	dsm_handle	seg_handle;
+	int			helper_idx;
+	Oid			dboid;
+	RepOriginId	origin_id;
+	pid_t		leader_pid;
+} BdrParallelApplyHelperArgs;
+
+/* Leader-side state for one helper */
+typedef struct BdrParallelApplyHelper
+{
+	shm_mq	   *mq;
+	shm_mq_handle *mqh;
+	BackgroundWorkerHandle *bgwhandle;
+	/* ticket of the newest transaction dispatched to this helper */
+	uint64		last_dispatched_ticket;
+} BdrParallelApplyHelper;
+
+/* Leader-side pool state */
+static dsm_segment *pa_seg = NULL;
+static BdrParallelApplyShared *pa_shared = NULL;
+static BdrParallelApplyHelper *pa_helpers = NULL;
+static int	pa_nhelpers = 0;
+
+/* dispatch state for the transaction currently in flight, if any */
+static int	pa_current_helper = -1;
+static uint64 pa_next_ticket = 1;
+static bool pa_current_needs_barrier = false;
+
+/* Helper-side state */
+static shm_mq_handle *pa_worker_mqh = NULL;
+static BdrParallelApplyShared *pa_worker_shared = NULL;
+static int	pa_worker_idx = -1;
+
+/*
+ * Copy of the current transaction's messages, so it can be re-applied
+ * after a deadlock-watchdog abort; see bdr_apply_parallel_retry_transaction().
+ */
+static MemoryContext pa_worker_txn_context = NULL;
+static List *pa_worker_txn_msgs = NIL;
+
+PGDLLEXPORT void bdr_apply_parallel_main(Datum main_arg);
+
+static void bdr_apply_parallel_wait_for(BdrParallelApplyHelper *helper,
+										uint64 ticket);
+
+static Size
+bdr_apply_parallel_shared_size(int nworkers)
+{
+	return offsetof(BdrParallelApplyShared, helpers) +
+		nworkers * sizeof(((BdrParallelApplyShared *) 0)->helpers[0]);
+}
+
+bool
+bdr_apply_parallel_enabled(void)
+{
+	return pa_nhelpers > 0;
+}
+
+/*
+ * Create the pool's dsm segment and launch the helper workers.
+ *
+ * Called by the apply worker (leader) after the replication origin session
+ * has been set up, since helpers attach to the same origin using our pid.
+ */
+void
+bdr_apply_parallel_startup(RepOriginId origin_id)
+{
+	Size		segsize;
+	char	   *ptr;
+	int			i;
+
+	Assert(bdr_worker_type == BDR_WORKER_APPLY);
+
+	if (bdr_parallel_apply_workers <= 0)
+		return;
+
+	pa_nhelpers = bdr_parallel_apply_workers;
+
+	segsize = add_size(MAXALIGN(bdr_apply_parallel_shared_size(pa_nhelpers)),
+					   mul_size(pa_nhelpers, BDR_PARALLEL_APPLY_QUEUE_SIZE));
+
+	pa_seg = dsm_create(segsize, 0);
+	/* keep the segment for the whole worker lifetime */
+	dsm_pin_mapping(pa_seg);
+
+	ptr = dsm_segment_address(pa_seg);
+	pa_shared = (BdrParallelApplyShared *) ptr;
+	memset(pa_shared, 0, bdr_apply_parallel_shared_size(pa_nhelpers));
+	pg_atomic_init_u64(&pa_shared->last_committed_ticket, 0);
+	for (i = 0; i < pa_nhelpers; i++)
+	{
+		pg_atomic_init_u64(&pa_shared->helpers[i].remote_end, 0);
+		pg_atomic_init_u64(&pa_shared->helpers[i].local_end, 0);
+		pg_atomic_init_u64(&pa_shared->helpers[i].ticket, 0);
+	}
+
+	ptr += MAXALIGN(bdr_apply_parallel_shared_size(pa_nhelpers));
+
+	pa_helpers = MemoryContextAllocZero(TopMemoryContext,
+										pa_nhelpers * sizeof(BdrParallelApplyHelper));
+
+	for (i = 0; i < pa_nhelpers; i++)
+	{
+		BackgroundWorker bgw;
+		BdrParallelApplyHelperArgs args;
+
+		pa_helpers[i].mq = shm_mq_create(ptr + i * BDR_PARALLEL_APPLY_QUEUE_SIZE,
+										 BDR_PARALLEL_APPLY_QUEUE_SIZE);
+		shm_mq_set_sender(pa_helpers[i].mq, MyProc);
+		pa_helpers[i].mqh = shm_mq_attach(pa_helpers[i].mq, pa_seg, NULL);
+
+		memset(&bgw, 0, sizeof(bgw));
+		bgw.bgw_flags = BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+		bgw.bgw_start_time = BgWorkerStart_RecoveryFinished;
+		bgw.bgw_restart_time = BGW_NEVER_RESTART;
+		strncpy(bgw.bgw_library_name, BDR_LIBRARY_NAME, BGW_MAXLEN);
+		strncpy(bgw.bgw_function_name, "bdr_apply_parallel_main", BGW_MAXLEN);
+		snprintf(bgw.bgw_name, BGW_MAXLEN, "bdr parallel apply helper %d", i);
+		snprintf(bgw.bgw_type, BGW_MAXLEN, "bdr parallel apply helper");
+		bgw.bgw_main_arg = (Datum) 0;
+		bgw.bgw_notify_pid = MyProcPid;
+
+		args.seg_handle = dsm_segment_handle(pa_seg);
+		args.helper_idx = i;
+		args.dboid = MyDatabaseId;
+		args.origin_id = origin_id;
+		args.leader_pid = MyProcPid;
+		StaticAssertStmt(sizeof(args) <= BGW_EXTRALEN,
+						 "parallel apply helper args too large for bgw_extra");
+		memcpy(bgw.bgw_extra, &args, sizeof(args));
+
+		if (!RegisterDynamicBackgroundWorker(&bgw, &pa_helpers[i].bgwhandle))
+			ereport(ERROR,
+					(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+					 errmsg("could not register bdr parallel apply helper, increase max_worker_processes")));
+	}
+
+	elog(DEBUG1, "bdr parallel apply: launched %d helpers", pa_nhelpers);
+}
+
+/*
+ * Pick the helper that should apply the transaction with the given remote
+ * xid. All changes of one transaction must go to the same helper.
+ */
+static int
+bdr_apply_parallel_target(TransactionId remote_xid)
+{
+	return remote_xid % pa_nhelpers;
+}
+
+/*
+ * Send one raw protocol message, prefixed with the commit ticket of the
+ * transaction it belongs to, to the given helper. Blocks if the queue is
+ * full.
+ */
+static void
+bdr_apply_parallel_send(BdrParallelApplyHelper *helper, uint64 ticket,
+						const char *data, Size len)
+{
+	shm_mq_iovec iov[2];
+	shm_mq_result res;
+
+	iov[0].data = (const char *) &ticket;
+	iov[0].len = sizeof(ticket);
+	iov[1].data = data;
+	iov[1].len = len;
+
+	res = shm_mq_sendv(helper->mqh, iov, 2, false, true);
+	if (res != SHM_MQ_SUCCESS)
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg("bdr parallel apply helper exited unexpectedly")));
+}
+
+/*
+ * Wait until the given helper has committed all transactions up to and
+ * including 'ticket'.
+ */
+static void
+bdr_apply_parallel_wait_for(BdrParallelApplyHelper *helper, uint64 ticket)
+{
+	int			helper_idx = helper - pa_helpers;
+
+	while (pg_atomic_read_u64(&pa_shared->helpers[helper_idx].ticket) < ticket)
+	{
+		int			rc;
+		pid_t		pid;
+
+		if (GetBackgroundWorkerPid(helper->bgwhandle, &pid) == BGWH_STOPPED)
+			ereport(ERROR,
+					(errcode(ERRCODE_INTERNAL_ERROR),
+					 errmsg("bdr parallel apply helper exited unexpectedly")));
+
+		rc = WaitLatch(&MyProc->procLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   100L, WAIT_EVENT_LOGICAL_PARALLEL_APPLY_STATE_CHANGE);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		ResetLatch(&MyProc->procLatch);
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+/*
+ * Drain the whole pool: wait until every dispatched transaction has been
+ * committed by its helper.
+ */
+void
+bdr_apply_parallel_drain(void)
+{
+	int			i;
+
+	for (i = 0; i < pa_nhelpers; i++)
+		bdr_apply_parallel_wait_for(&pa_helpers[i],
+									pa_helpers[i].last_dispatched_ticket);
+}
+
+/*
+ * Peek into a DML message to see whether it targets the bdr schema. The
+ * message layout (see read_rel in bdr_apply.c) starts with the action byte
+ * followed by nspname length and nspname.
+ */
+static bool
+bdr_apply_parallel_message_needs_barrier(StringInfo s)
+{
+	int			save_cursor = s->cursor;
+	char		action = s->data[s->cursor];
+	bool		needs_barrier = false;
+
+	if (action == 'I' || action == 'U' || action == 'D' || action == 'S')
+	{
+		int			nspnamelen;
+		const char *nspname;
+
+		s->cursor++;			/* action */
+		nspnamelen = pq_getmsgint(s, 2);
+		nspname = pq_getmsgbytes(s, nspnamelen);
+		needs_barrier = (strncmp(nspname, "bdr", nspnamelen) == 0);
+	}
+	else if (action == 'M')
+	{
+		/* global messages (locks, sequencer) must be fully serialized */
+		needs_barrier = true;
+	}
+
+	s->cursor = save_cursor;
+	return needs_barrier;
+}
+
+/*
+ * Dispatch one remote action to the helper pool.
+ *
+ * The StringInfo is positioned at the action byte, exactly as
+ * bdr_process_remote_action() expects.
+ */
+void
+bdr_apply_parallel_dispatch(StringInfo s)
+{
+	char		action = s->data[s->cursor];
+
+	Assert(bdr_apply_parallel_enabled());
+
+	if (action == 'B')
+	{
+		TransactionId remote_xid;
+		int			save_cursor = s->cursor;
+
+		/* peek at flags(4), lsn(8), committime(8), then xid(4) */
+		s->cursor += 1 + 4 + 8 + 8;
+		remote_xid = pq_getmsgint(s, 4);
+		s->cursor = save_cursor;
+
+		Assert(pa_current_helper == -1);
+		pa_current_helper = bdr_apply_parallel_target(remote_xid);
+		pa_current_needs_barrier = false;
+	}
+	else if (action == 'M')
+	{
+		/*
+		 * Global messages arrive outside transaction boundaries. Serialize
+		 * against everything and process them in the leader.
+		 */
+		bdr_apply_parallel_drain();
+		bdr_process_remote_action(s);
+		return;
+	}
+
+	if (pa_current_helper == -1)
+		elog(ERROR, "bdr parallel apply: change message outside a transaction");
+
+	if (!pa_current_needs_barrier &&
+		bdr_apply_parallel_message_needs_barrier(s))
+	{
+		/*
+		 * This transaction touches the bdr schema. Everything dispatched
+		 * before it must commit first, and nothing may be dispatched after it
+		 * until it has committed, so replay of queued DDL sees a quiesced
+		 * database.
+		 */
+		pa_current_needs_barrier = true;
+		bdr_apply_parallel_drain();
+	}
+
+	bdr_apply_parallel_send(&pa_helpers[pa_current_helper], pa_next_ticket,
+							s->data + s->cursor, s->len - s->cursor);
+
+	if (action == 'C')
+	{
+		BdrParallelApplyHelper *helper = &pa_helpers[pa_current_helper];
+
+		helper->last_dispatched_ticket = pa_next_ticket;
+
+		if (pa_current_needs_barrier)
+			bdr_apply_parallel_wait_for(helper, pa_next_ticket);
+
+		pa_next_ticket++;
+		pa_current_helper = -1;
+		pa_current_needs_barrier = false;
+	}
+}
+
+/*
+ * Report the remote/local flush position pair for feedback purposes.
+ *
+ * Returns the oldest remote commit lsn not yet locally flushed in *write,
+ * and the newest remote commit lsn whose local commit has been flushed in
+ * *flush. Returns true if all dispatched transactions are flushed.
+ */
+bool
+bdr_apply_parallel_flush_position(XLogRecPtr *write, XLogRecPtr *flush)
+{
+	XLogRecPtr	local_flush = GetFlushRecPtr(NULL);
+	XLogRecPtr	min_unflushed_remote = InvalidXLogRecPtr;
+	XLogRecPtr	max_flushed_remote = InvalidXLogRecPtr;
+	bool		all_flushed = true;
+	int			i;
+
+	for (i = 0; i < pa_nhelpers; i++)
+	{
+		XLogRecPtr	remote_end = pg_atomic_read_u64(&pa_shared->helpers[i].remote_end);
+		XLogRecPtr	local_end = pg_atomic_read_u64(&pa_shared->helpers[i].local_end);
+
+		if (remote_end == InvalidXLogRecPtr)
+			continue;
+
+		if (local_end <= local_flush)
+		{
+			if (remote_end > max_flushed_remote)
+				max_flushed_remote = remote_end;
+		}
+		else
+		{
+			all_flushed = false;
+			if (min_unflushed_remote == InvalidXLogRecPtr ||
+				remote_end < min_unflushed_remote)
+				min_unflushed_remote = remote_end;
+		}
+	}
+
+	*write = all_flushed ? max_flushed_remote : min_unflushed_remote;
+	*flush = max_flushed_remote;
+
+	return all_flushed;
+}
+
+/*
+ * Helper side: wait until all transactions with tickets before ours have
+ * committed, so our local commit order matches upstream commit order.
+ *
+ * Returns true when it is our turn to commit. Returns false if the watchdog
+ * decided we are (probably) the later transaction in a lock cycle: another
+ * backend is blocked on our xid while the transactions we wait for haven't
+ * committed. The earlier-ticketed transaction blocked on one of our row
+ * locks can't be distinguished from an unrelated local backend here, but a
+ * spurious abort-and-retry is merely wasted work, while a missed cycle
+ * would wedge apply permanently. The caller must abort and re-apply via
+ * bdr_apply_parallel_retry_transaction().
+ */
+bool
+bdr_apply_parallel_wait_for_ticket(uint64 ticket)
+{
+	if (pa_worker_shared == NULL)
+		return true;
+
+	while (pg_atomic_read_u64(&pa_worker_shared->last_committed_ticket)
+		   != ticket - 1)
+	{
+		int			rc;
+		TransactionId xid;
+
+		rc = WaitLatch(&MyProc->procLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   100L, WAIT_EVENT_LOGICAL_PARALLEL_APPLY_STATE_CHANGE);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		ResetLatch(&MyProc->procLatch);
+		CHECK_FOR_INTERRUPTS();
+
+		/*
+		 * Deadlock watchdog. If we made no progress over the wait and
+		 * somebody is queued on our transaction's xid lock, they hold a row
+		 * we can't see past while we hold a row they may need; bail out and
+		 * retry behind them. A transaction that never got an xid wrote
+		 * nothing and can't be part of a cycle.
+		 */
+		xid = GetTopTransactionIdIfAny();
+		if ((rc & WL_TIMEOUT) && TransactionIdIsValid(xid))
+		{
+			LOCKTAG		tag;
+
+			SET_LOCKTAG_TRANSACTION(tag, xid);
+			if (LockWaiterCount(&tag) > 0)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Helper side: the watchdog in bdr_apply_parallel_wait_for_ticket() decided
+ * we deadlocked with an earlier-ticketed transaction. Abort what we applied
+ * so far, releasing our row locks so the earlier transaction can finish,
+ * then re-apply the whole transaction from the buffered copy once every
+ * earlier ticket has committed. The re-applied commit then passes the
+ * ticket wait immediately.
+ */
+void
+bdr_apply_parallel_retry_transaction(void)
+{
+	uint64		ticket = bdr_apply_parallel_current_ticket;
+	ListCell   *lc;
+
+	Assert(pa_worker_shared != NULL);
+	Assert(pa_worker_txn_msgs != NIL);
+
+	elog(DEBUG1, "bdr parallel apply: aborting transaction with ticket "
+		 UINT64_FORMAT " to break a lock cycle, retrying serially", ticket);
+
+	bdr_apply_abort_replay_transaction();
+	bdr_count_rollback();
+
+	/* We hold no locks anymore, so waiting our turn out is now safe. */
+	while (pg_atomic_read_u64(&pa_worker_shared->last_committed_ticket)
+		   != ticket - 1)
+	{
+		int			rc;
+
+		rc = WaitLatch(&MyProc->procLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   100L, WAIT_EVENT_LOGICAL_PARALLEL_APPLY_STATE_CHANGE);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		ResetLatch(&MyProc->procLatch);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	foreach(lc, pa_worker_txn_msgs)
+	{
+		StringInfo	msg = lfirst(lc);
+		StringInfoData s;
+
+		s.data = msg->data;
+		s.len = msg->len;
+		s.maxlen = -1;
+		s.cursor = 0;
+
+		bdr_process_remote_action(&s);
+	}
+}
+
+/*
+ * Helper side: record a completed local commit so the leader can report
+ * feedback and later-ticketed transactions may commit.
+ */
+void
+bdr_apply_parallel_confirm_commit(uint64 ticket, XLogRecPtr remote_end,
+								  XLogRecPtr local_end)
+{
+	if (pa_worker_shared == NULL)
+		return;
+
+	pg_atomic_write_u64(&pa_worker_shared->helpers[pa_worker_idx].remote_end,
+						remote_end);
+	pg_atomic_write_u64(&pa_worker_shared->helpers[pa_worker_idx].local_end,
+						local_end);
+	pg_atomic_write_u64(&pa_worker_shared->helpers[pa_worker_idx].ticket,
+						ticket);
+	pg_atomic_write_u64(&pa_worker_shared->last_committed_ticket, ticket);
+}
+
+/*
+ * Entry point for a parallel apply helper.
+ *
+ * Attaches to the leader's dsm segment and replication origin session, then
+ * applies protocol messages from its queue until the leader detaches.
+ */
+void
+bdr_apply_parallel_main(Datum main_arg)
+{
+	BdrParallelApplyHelperArgs args;
+	dsm_segment *seg;
+	char	   *ptr;
+	shm_mq	   *mq;
+	uint64		current_ticket = 0;
+
+	memcpy(&args, MyBgworkerEntry->bgw_extra, sizeof(args));
+
+	pqsignal(SIGHUP, bdr_sighup);
+	pqsignal(SIGTERM, bdr_sigterm);
+	BackgroundWorkerUnblockSignals();
+
+	BackgroundWorkerInitializeConnectionByOid(args.dboid, InvalidOid, 0);
+
+	seg = dsm_attach(args.seg_handle);
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not attach to bdr parallel apply dsm segment")));
+	dsm_pin_mapping(seg);
+
+	ptr = dsm_segment_address(seg);
+	pa_worker_shared = (BdrParallelApplyShared *) ptr;
+	pa_worker_idx = args.helper_idx;
+
+	ptr += MAXALIGN(bdr_apply_parallel_shared_size(bdr_parallel_apply_workers));
+	mq = (shm_mq *) (ptr + args.helper_idx * BDR_PARALLEL_APPLY_QUEUE_SIZE);
+	shm_mq_set_receiver(mq, MyProc);
+	pa_worker_mqh = shm_mq_attach(mq, seg, NULL);
+
+	CurrentResourceOwner = ResourceOwnerCreate(NULL,
+											   "bdr parallel apply helper");
+	bdr_saved_resowner = CurrentResourceOwner;
+
+	/* same apply-time settings as a regular apply worker */
+	SetConfigOption("search_path", "bdr, pg_catalog",
+					PGC_BACKEND, PGC_S_OVERRIDE);
+	if (bdr_apply_group_commit_size > 0)
+		SetConfigOption("synchronous_commit", "off",
+						PGC_BACKEND, PGC_S_OVERRIDE);
+	else
+		SetConfigOption("synchronous_commit",
+						bdr_synchronous_commit ? "local" : "off",
+						PGC_BACKEND, PGC_S_OVERRIDE);
+	SetConfigOption("session_replication_role", "replica",
+					PGC_SUSET, PGC_S_OVERRIDE);
+	SetConfigOption("check_function_bodies", "off",
+					PGC_INTERNAL, PGC_S_OVERRIDE);
+
+	StartTransactionCommand();
+	bdr_maintain_schema(false);
+	bdr_setup_my_cached_node_names();
+	CommitTransactionCommand();
+
+	bdr_apply_helper_attach(args.leader_pid);
+
+	/* Share the leader's origin session so commit timestamps are stamped. */
+	replorigin_session_setup(args.origin_id, args.leader_pid);
+	replorigin_session_origin = args.origin_id;
+
+	/*
+	 * Count into the same stats slot as the leader; bdr_count_bump() is an
+	 * atomic add, so sharing a slot between the pool's workers is safe.
+	 */
+	bdr_count_set_current_node(args.origin_id);
+
+	MessageContext = AllocSetContextCreate(TopMemoryContext,
+										   "MessageContext",
+										   ALLOCSET_DEFAULT_MINSIZE,
+										   ALLOCSET_DEFAULT_INITSIZE,
+										   ALLOCSET_DEFAULT_MAXSIZE);
+
+	bdr_conflict_logging_startup();
+
+	for (;;)
+	{
+		shm_mq_result res;
+		Size		nbytes;
+		void	   *data;
+		StringInfoData s;
+		StringInfo	buffered;
+		MemoryContext oldcontext;
+		char		action;
+		uint64		ticket;
+
+		res = shm_mq_receive(pa_worker_mqh, &nbytes, &data, false);
+
+		if (res == SHM_MQ_DETACHED)
+			break;
+		if (res != SHM_MQ_SUCCESS)
+			elog(ERROR, "unexpected shm_mq receive result %d", res);
+
+		Assert(nbytes > sizeof(uint64));
+		memcpy(&ticket, data, sizeof(uint64));
+		current_ticket = ticket;
+
+		MemoryContextSwitchTo(MessageContext);
+
+		s.data = (char *) data + sizeof(uint64);
+		s.len = nbytes - sizeof(uint64);
+		s.maxlen = -1;
+		s.cursor = 0;
+
+		action = s.data[0];
+
+		/*
+		 * Keep a copy of the transaction's messages; the shm_mq buffer is
+		 * transient and the deadlock watchdog may need to re-apply the
+		 * whole transaction after aborting it at commit time.
+		 */
+		if (pa_worker_txn_context == NULL)
+			pa_worker_txn_context = AllocSetContextCreate(TopMemoryContext,
+														  "bdr parallel apply txn buffer",
+														  ALLOCSET_DEFAULT_MINSIZE,
+														  ALLOCSET_DEFAULT_INITSIZE,
+														  ALLOCSET_DEFAULT_MAXSIZE);
+		oldcontext = MemoryContextSwitchTo(pa_worker_txn_context);
+		buffered = palloc(sizeof(StringInfoData));
+		buffered->data = palloc(s.len);
+		memcpy(buffered->data, s.data, s.len);
+		buffered->len = s.len;
+		buffered->maxlen = -1;
+		buffered->cursor = 0;
+		pa_worker_txn_msgs = lappend(pa_worker_txn_msgs, buffered);
+		MemoryContextSwitchTo(oldcontext);
+
+		bdr_apply_parallel_current_ticket = current_ticket;
+		bdr_process_remote_action(&s);
+		bdr_apply_parallel_current_ticket = 0;
+
+		/* transaction done, drop the retry copy */
+		if (action == 'C')
+		{
+			pa_worker_txn_msgs = NIL;
+			MemoryContextReset(pa_worker_txn_context);
+		}
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (got_SIGTERM)
+			break;
+	}
+
+	proc_exit(0);
+}
@@ -40,6 +40,7 @@
 #include "utils/fmgroids.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
+#include "utils/pg_lsn.h"
 #include "utils/rel.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
@@ -375,6 +376,130 @@ bdr_nodes_set_local_attrs(BdrNodeStatus status, BdrNodeStatus oldstatus, const i
 		CommitTransactionCommand();
 }
 
+/*
+ * Record the catchup target LSN on the local bdr.bdr_nodes entry, or clear it
+ * again when passed InvalidXLogRecPtr.
+ *
+ * The per-db worker sets this when it first computes the target it must
+ * replay to in catchup mode during init, so that a restarted worker resumes
+ * toward the original target instead of the join target's current (and ever
+ * advancing) position. It is cleared once catchup completes.
+ */
+void
+bdr_nodes_set_local_init_catchup_lsn(XLogRecPtr target_lsn)
+{
+	int			spi_ret;
+	Oid			argtypes[] = { LSNOID, TEXTOID, OIDOID, OIDOID };
+	char		nulls[] = {' ', ' ', ' ', ' '};
+	Datum		values[4];
+	char		sysid_str[33];
+	bool		tx_started = false;
+	BDRNodeId	myid;
+
+	bdr_make_my_nodeid(&myid);
+
+	/* Cannot have replication apply state set in this tx */
+	Assert(replorigin_session_origin == InvalidRepOriginId);
+
+	if (!IsTransactionState())
+	{
+		tx_started = true;
+		StartTransactionCommand();
+	}
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	snprintf(sysid_str, sizeof(sysid_str), UINT64_FORMAT,
+			 myid.sysid);
+	sysid_str[sizeof(sysid_str)-1] = '\0';
+
+	if (target_lsn != InvalidXLogRecPtr)
+		values[0] = LSNGetDatum(target_lsn);
+	else
+		nulls[0] = 'n';
+	values[1] = CStringGetTextDatum(sysid_str);
+	values[2] = ObjectIdGetDatum(myid.timeline);
+	values[3] = ObjectIdGetDatum(myid.dboid);
+
+	spi_ret = SPI_execute_with_args(
+							   "UPDATE bdr.bdr_nodes"
+							   "   SET node_init_catchup_lsn = $1"
+							   " WHERE node_sysid = $2"
+							   "   AND node_timeline = $3"
+							   "   AND node_dboid = $4;",
+							   4, argtypes, values, nulls, false, 0);
+
+	if (spi_ret != SPI_OK_UPDATE)
+		elog(ERROR, "Unable to set node_init_catchup_lsn of row (node_sysid="
+					UINT64_FORMAT ", node_timeline=%u, node_dboid=%u) "
+					"in bdr.bdr_nodes: SPI error %d",
+					myid.sysid, myid.timeline, myid.dboid, spi_ret);
+
+	SPI_finish();
+	PopActiveSnapshot();
+	if (tx_started)
+		CommitTransactionCommand();
+}
+
+/*
+ * Fetch the catchup target LSN recorded on the local bdr.bdr_nodes entry,
+ * or InvalidXLogRecPtr if none was recorded (no row, or NULL column).
+ */
+XLogRecPtr
+bdr_nodes_get_local_init_catchup_lsn(void)
+{
+	int			spi_ret;
+	Oid			argtypes[] = { TEXTOID, OIDOID, OIDOID };
+	Datum		values[3];
+	bool		isnull;
+	Datum		lsn_datum;
+	XLogRecPtr	target_lsn = InvalidXLogRecPtr;
+	char		sysid_str[33];
+	bool		tx_started = false;
+	BDRNodeId	myid;
+
+	bdr_make_my_nodeid(&myid);
+
+	if (!IsTransactionState())
+	{
+		tx_started = true;
+		StartTransactionCommand();
+	}
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	snprintf(sysid_str, sizeof(sysid_str), UINT64_FORMAT,
+			 myid.sysid);
+	sysid_str[sizeof(sysid_str)-1] = '\0';
+
+	values[0] = CStringGetTextDatum(sysid_str);
+	values[1] = ObjectIdGetDatum(myid.timeline);
+	values[2] = ObjectIdGetDatum(myid.dboid);
+
+	spi_ret = SPI_execute_with_args(
+			"SELECT node_init_catchup_lsn FROM bdr.bdr_nodes "
+			"WHERE node_sysid = $1 AND node_timeline = $2 AND node_dboid = $3",
+			3, argtypes, values, NULL, false, 1);
+
+	if (spi_ret != SPI_OK_SELECT)
+		elog(ERROR, "Unable to query bdr.bdr_nodes, SPI error %d", spi_ret);
+
+	if (SPI_processed != 0)
+	{
+		lsn_datum = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
+								  1, &isnull);
+		if (!isnull)
+			target_lsn = DatumGetLSN(lsn_datum);
+	}
+
+	SPI_finish();
+	PopActiveSnapshot();
+	if (tx_started)
+		CommitTransactionCommand();
+
+	return target_lsn;
+}
+
 /*
  * Given a node's local RepOriginId, get its globally unique identifier (sysid,
  * timeline id, database oid). Ignore identifiers local to databases other than
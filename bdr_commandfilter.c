@@ -725,6 +725,69 @@ statement_affects_only_nonpermanent(Node *parsetree)
 	return false;
 }
 
+/*
+ * How much of the command filter a given utility statement needs.
+ *
+ * BDR_FILTER_NONE statements are purely local, are never replicated, never
+ * restricted on read-only nodes and never take the global DDL lock, so the
+ * hook has nothing to do for them beyond the supervisor database check.
+ * They're the statements connection poolers and ORMs issue constantly (SET,
+ * SHOW, FETCH, EXPLAIN, ...), so bdr_commandfilter() lets them straight
+ * through without touching the node cache or taking any locks.
+ *
+ * BDR_FILTER_TXN is transaction control, which is equally a no-op unless
+ * we're inside bdr.replicate_ddl_command.
+ *
+ * Everything else gets BDR_FILTER_FULL and pays the full inspection cost.
+ *
+ * The switch compiles down to a per-NodeTag lookup table; keep it in sync
+ * with the skip list and allowed_on_read_only_node() below - a tag may only
+ * be BDR_FILTER_NONE if the full path provably does nothing for it.
+ */
+typedef enum BdrFilterClass
+{
+	BDR_FILTER_FULL = 0,
+	BDR_FILTER_NONE,
+	BDR_FILTER_TXN
+} BdrFilterClass;
+
+static BdrFilterClass
+bdr_filter_classify(NodeTag tag)
+{
+	switch (tag)
+	{
+		case T_PlannedStmt:
+		case T_ClosePortalStmt:
+		case T_FetchStmt:
+		case T_PrepareStmt:
+		case T_ExecuteStmt:
+		case T_DeallocateStmt:
+		case T_DeclareCursorStmt:
+		case T_NotifyStmt:
+		case T_ListenStmt:
+		case T_UnlistenStmt:
+		case T_LoadStmt:
+		case T_ExplainStmt:
+		case T_VariableSetStmt:
+		case T_VariableShowStmt:
+		case T_DiscardStmt:
+		case T_LockStmt:
+		case T_ConstraintsSetStmt:
+		case T_CheckPointStmt:
+		case T_ReindexStmt:
+		case T_VacuumStmt:
+		case T_ClusterStmt:
+		case T_DoStmt:
+			return BDR_FILTER_NONE;
+
+		case T_TransactionStmt:
+			return BDR_FILTER_TXN;
+
+		default:
+			return BDR_FILTER_FULL;
+	}
+}
+
 static bool
 allowed_on_read_only_node(Node *parsetree, const char **tag)
 {
@@ -897,20 +960,41 @@ bdr_commandfilter(PlannedStmt *pstmt,
 	bool incremented_nestlevel = false;
 	bool affects_only_nonpermanent;
 	bool entered_extension = false;
+	BdrFilterClass	fclass;
 
 	/* take strongest lock by default. */
 	BDRLockType	lock_type = BDR_LOCK_WRITE;
 
-        elog(DEBUG2, "processing %s: %s in statement %s", context == PROCESS_UTILITY_TOPLEVEL ? "toplevel" : "query", CreateCommandName(parsetree), queryString);
+	/* relation to scope the lock to, if the command targets just one */
+	RangeVar   *lock_relation = NULL;
 
 	/* don't filter in single user mode */
 	if (!IsUnderPostmaster)
 		goto done;
 
+	/*
+	 * Fast path: statements the filter can never have anything to do for
+	 * leave immediately, paying only the supervisor database check. On the
+	 * supervisor database we fall through so the full path can reject
+	 * everything but VACUUM as usual.
+	 */
+	fclass = bdr_filter_classify(nodeTag(parsetree));
+	if (fclass != BDR_FILTER_FULL)
+	{
+		if (BdrSupervisorDbOid == InvalidOid)
+			BdrSupervisorDbOid = bdr_get_supervisordb_oid(true);
+
+		if (MyDatabaseId != BdrSupervisorDbOid &&
+			(fclass == BDR_FILTER_NONE || !in_bdr_replicate_ddl_command))
+			goto done;
+	}
+
+        elog(DEBUG2, "processing %s: %s in statement %s", context == PROCESS_UTILITY_TOPLEVEL ? "toplevel" : "query", CreateCommandName(parsetree), queryString);
+
 	/* Permit only VACUUM on the supervisordb, if it exists */
 	if (BdrSupervisorDbOid == InvalidOid)
 		BdrSupervisorDbOid = bdr_get_supervisordb_oid(true);
-		
+
 	if (BdrSupervisorDbOid != InvalidOid
 		&& MyDatabaseId == BdrSupervisorDbOid
 		&& nodeTag(parsetree) != T_VacuumStmt)
@@ -1132,6 +1216,7 @@ bdr_commandfilter(PlannedStmt *pstmt,
 
 		case T_AlterTableStmt:
 			filter_AlterTableStmt(parsetree, queryString, &lock_type);
+			lock_relation = castNode(AlterTableStmt, parsetree)->relation;
 			break;
 
 		case T_AlterDomainStmt:
@@ -1200,6 +1285,8 @@ bdr_commandfilter(PlannedStmt *pstmt,
 				if (!stmt->unique && stmt->concurrent)
 					lock_type = BDR_LOCK_DDL;
 
+				lock_relation = stmt->relation;
+
 				break;
 			}
 		case T_CreateExtensionStmt:
@@ -1386,7 +1473,7 @@ bdr_commandfilter(PlannedStmt *pstmt,
 	affects_only_nonpermanent = statement_affects_only_nonpermanent(parsetree);
 	if (!bdr_skip_ddl_locking && !affects_only_nonpermanent
 		&& lock_type != BDR_LOCK_NOLOCK)
-		bdr_acquire_ddl_lock(lock_type);
+		bdr_acquire_ddl_lock(lock_type, lock_relation);
 
 	/*
 	 * Many top level DDL statements trigger subsequent actions that also invoke
@@ -589,6 +589,9 @@ bdr_get_conflict_handlers(BDRRelation * rel)
 
 		for (i = 0; i < SPI_processed; ++i)
 		{
+			HeapTuple	fun_tup;
+			MemoryContext oldcontext;
+
 			spi_row = SPI_tuptable->vals[i];
 
 			dat = SPI_getbinval(spi_row, SPI_tuptable->tupdesc, fun_col_no,
@@ -603,6 +606,34 @@ bdr_get_conflict_handlers(BDRRelation * rel)
 
 			rel->conflict_handlers[i].handler_oid = DatumGetObjectId(dat);
 
+			/*
+			 * Resolve the handler function and its result tupdesc now, so
+			 * each conflict resolves via the cached FmgrInfo rather than
+			 * repeating the fmgr and syscache work per invocation. Both live
+			 * in CacheMemoryContext alongside the handler array and are
+			 * released with it when the entry is invalidated.
+			 */
+			fmgr_info_cxt(rel->conflict_handlers[i].handler_oid,
+						  &rel->conflict_handlers[i].handler_fmgrinfo,
+						  CacheMemoryContext);
+
+			fun_tup = SearchSysCache1(PROCOID,
+				ObjectIdGetDatum(rel->conflict_handlers[i].handler_oid));
+			if (!HeapTupleIsValid(fun_tup))
+				elog(ERROR, "cache lookup failed for function %u",
+					 rel->conflict_handlers[i].handler_oid);
+
+			oldcontext = MemoryContextSwitchTo(CacheMemoryContext);
+			rel->conflict_handlers[i].handler_retdesc =
+				build_function_result_tupdesc_t(fun_tup);
+			MemoryContextSwitchTo(oldcontext);
+
+			ReleaseSysCache(fun_tup);
+
+			if (rel->conflict_handlers[i].handler_retdesc == NULL)
+				elog(ERROR, "conflict handler %u has no OUT arguments",
+					 rel->conflict_handlers[i].handler_oid);
+
 			dat = SPI_getbinval(spi_row, SPI_tuptable->tupdesc, type_col_no,
 								&isnull);
 
@@ -675,6 +706,29 @@ bdr_conflict_handlers_event_type_name(BdrConflictType event_type)
 
 	return "(unknown)";
 }
+
+/*
+ * Look up the bdr.bdr_conflict_type enum oid for an event type, caching the
+ * result; pg_enum oids never change for the life of the type, so one lookup
+ * per backend suffices instead of one per conflict.
+ */
+static Oid
+bdr_conflict_handlers_event_type_oid(BdrConflictType event_type)
+{
+	static Oid	event_type_oids[BdrConflictType_UnhandledTxAbort + 1];
+
+	Assert(event_type >= 0 &&
+		   event_type <= BdrConflictType_UnhandledTxAbort);
+
+	if (event_type_oids[event_type] == InvalidOid)
+		event_type_oids[event_type] =
+			GetSysCacheOidError2(ENUMTYPOIDNAME,
+								 Anum_pg_enum_oid,
+								 bdr_conflict_handler_type_oid,
+								 CStringGetDatum(bdr_conflict_handlers_event_type_name(event_type)));
+
+	return event_type_oids[event_type];
+}
 #endif
 
 /*
@@ -687,31 +741,23 @@ bdr_conflict_handlers_resolve(BDRRelation * rel, const HeapTuple local,
 							  BdrConflictType event_type,
 							  uint64 timeframe, bool *skip)
 {
-/* Removed by default because initializing FunctionCallInfoData directly is deprecated and we
- * don't need custom conflict handlers anyway
- */
+/* Removed by default because we don't need custom conflict handlers anyway */
 #ifdef BDR_CONFLICT_HANDLERS
 	size_t		i;
 	Datum		retval;
-	FunctionCallInfoData fcinfo;
-	FmgrInfo	finfo;
-	HeapTuple	fun_tup;
+	LOCAL_FCINFO(fcinfo, 5);
 	HeapTupleData result_tup;
 	HeapTupleHeader tup_header;
 	TupleDesc	retdesc;
 	Datum		val;
 	bool		isnull;
 	Oid			event_oid;
-	const char *event = bdr_conflict_handlers_event_type_name(event_type);
 
 	*skip = false;
 
 	bdr_get_conflict_handlers(rel);
 
-	event_oid = GetSysCacheOidError2(ENUMTYPOIDNAME,
-									 Anum_pg_enum_oid,
-									 bdr_conflict_handler_type_oid,
-									 CStringGetDatum(event));
+	event_oid = bdr_conflict_handlers_event_type_oid(event_type);
 
 	for (i = 0; i < rel->conflict_handlers_len; ++i)
 	{
@@ -724,52 +770,48 @@ bdr_conflict_handlers_resolve(BDRRelation * rel, const HeapTuple local,
 			 rel->conflict_handlers[i].timeframe < timeframe))
 			continue;
 
-		fmgr_info(rel->conflict_handlers[i].handler_oid, &finfo);
-		InitFunctionCallInfoData(fcinfo, &finfo, 5, InvalidOid, NULL, NULL);
+		InitFunctionCallInfoData(*fcinfo,
+								 &rel->conflict_handlers[i].handler_fmgrinfo,
+								 5, InvalidOid, NULL, NULL);
 
 		if (local != NULL)
 		{
-			fcinfo.arg[0] =
+			fcinfo->args[0].value =
 				heap_copy_tuple_as_datum(local, RelationGetDescr(rel->rel));
-			fcinfo.argnull[0] = false;
+			fcinfo->args[0].isnull = false;
 		}
 		else
-			fcinfo.argnull[0] = true;
+			fcinfo->args[0].isnull = true;
 
 		if (remote != NULL)
 		{
-			fcinfo.arg[1] =
+			fcinfo->args[1].value =
 				heap_copy_tuple_as_datum(remote, RelationGetDescr(rel->rel));
-			fcinfo.argnull[1] = false;
+			fcinfo->args[1].isnull = false;
 		}
 		else
-			fcinfo.argnull[1] = true;
+			fcinfo->args[1].isnull = true;
 
-		fcinfo.arg[2] = CStringGetTextDatum(command_tag);
-		fcinfo.arg[3] = ObjectIdGetDatum(RelationGetRelid(rel->rel));
-		fcinfo.arg[4] = event_oid;
+		fcinfo->args[2].value = CStringGetTextDatum(command_tag);
+		fcinfo->args[2].isnull = false;
+		fcinfo->args[3].value = ObjectIdGetDatum(RelationGetRelid(rel->rel));
+		fcinfo->args[3].isnull = false;
+		fcinfo->args[4].value = event_oid;
+		fcinfo->args[4].isnull = false;
 
-		retval = FunctionCallInvoke(&fcinfo);
+		retval = FunctionCallInvoke(fcinfo);
 
-		if (!fcinfo.argnull[0])
-			heap_freetuple((HeapTuple) DatumGetPointer(fcinfo.arg[0]));
-		if (!fcinfo.argnull[1])
-			heap_freetuple((HeapTuple) DatumGetPointer(fcinfo.arg[1]));
+		if (!fcinfo->args[0].isnull)
+			heap_freetuple((HeapTuple) DatumGetPointer(fcinfo->args[0].value));
+		if (!fcinfo->args[1].isnull)
+			heap_freetuple((HeapTuple) DatumGetPointer(fcinfo->args[1].value));
 
-		if (fcinfo.isnull)
+		if (fcinfo->isnull)
 			elog(ERROR, "handler return value is NULL");
 
 		tup_header = DatumGetHeapTupleHeader(retval);
 
-		fun_tup = SearchSysCache1(PROCOID,
-					ObjectIdGetDatum(rel->conflict_handlers[i].handler_oid));
-		if (!HeapTupleIsValid(fun_tup))
-			elog(ERROR, "cache lookup failed for function %u",
-				 rel->conflict_handlers[i].handler_oid);
-
-		retdesc = build_function_result_tupdesc_t(fun_tup);
-
-		ReleaseSysCache(fun_tup);
+		retdesc = rel->conflict_handlers[i].handler_retdesc;
 
 		result_tup.t_len = HeapTupleHeaderGetDatumLength(tup_header);
 		ItemPointerSetInvalid(&(result_tup.t_self));
@@ -58,6 +58,13 @@ static Oid BdrConflictHistorySeqId = InvalidOid;
 /* We want our own memory ctx to clean up easily & reliably */
 MemoryContext conflict_log_context;
 
+/*
+ * Conflicts queued for insertion into bdr.bdr_conflict_history at commit
+ * time. The records (and the list cells) live in conflict_log_context and
+ * are released by bdr_conflict_log_flush().
+ */
+static List *conflict_log_spool = NIL;
+
 /*
  * Perform syscache lookups etc for BDR conflict logging.
  *
@@ -100,7 +107,12 @@ bdr_conflict_logging_startup()
 void
 bdr_conflict_logging_cleanup(void)
 {
-	if (conflict_log_context)
+	/*
+	 * Conflicts spooled for bdr.bdr_conflict_history live in this context
+	 * until bdr_conflict_log_flush() writes them out at commit, so we can
+	 * only reclaim the context when the spool is empty.
+	 */
+	if (conflict_log_context && conflict_log_spool == NIL)
 		MemoryContextResetAndDeleteChildren(conflict_log_context);
 }
 
@@ -349,22 +361,18 @@ bdr_conflict_strtodatum(bool *nulls, Datum *values, int idx,
 }
 
 /*
- * Log a BDR apply conflict to the bdr.bdr_conflict_history table.
+ * Form a bdr.bdr_conflict_history tuple from the conflict info in 'conflict'.
  *
- * The change will then be replicated to other nodes.
+ * The enum syscache lookups and json rendering of the tuples happen here,
+ * at flush time, not on the apply path that queued the conflict.
  */
-void
-bdr_conflict_log_table(BdrApplyConflict *conflict)
+static void
+bdr_conflict_history_form_tuple(BdrApplyConflict *conflict,
+								Datum *values, bool *nulls)
 {
-	Datum		 	values[BDR_CONFLICT_HISTORY_COLS];
-	bool			nulls[BDR_CONFLICT_HISTORY_COLS];
 	int				attno;
 	int				object_schema_attno, object_name_attno;
 	char			sqlstate[12];
-	Relation		log_rel;
-	HeapTuple		log_tup;
-	TupleTableSlot *log_slot;
-	EState		   *log_estate;
 	char			local_sysid[SYSID_DIGITS];
 	char			remote_sysid[SYSID_DIGITS];
 	char			origin_sysid[SYSID_DIGITS];
@@ -372,16 +380,6 @@ bdr_conflict_log_table(BdrApplyConflict *conflict)
 
 	bdr_make_my_nodeid(&myid);
 
-	if (IsAbortedTransactionBlockState())
-		elog(ERROR, "bdr: attempt to log conflict in aborted transaction");
-
-	if (!IsTransactionState())
-		elog(ERROR, "bdr: attempt to log conflict without surrounding transaction");
-
-	if (!bdr_log_conflicts_to_table)
-		/* No logging enabled and we don't own any memory, just bail */
-		return;
-
 	/* Pg has no uint64 SQL type so we have to store all them as text */
 	snprintf(local_sysid, sizeof(local_sysid), UINT64_FORMAT,
 			 myid.sysid);
@@ -548,27 +546,108 @@ bdr_conflict_log_table(BdrApplyConflict *conflict)
 
 	/* Make sure assignments match allocated tuple size */
 	Assert(attno == BDR_CONFLICT_HISTORY_COLS);
+}
+
+/*
+ * Queue a BDR apply conflict for insertion into bdr.bdr_conflict_history.
+ *
+ * The insert itself is deferred to bdr_conflict_log_flush() at commit time
+ * so a conflict storm pays for opening the history table, the executor
+ * state for its index updates and the json rendering of the conflicting
+ * tuples once per transaction rather than once per conflict; the apply
+ * path only keeps the counter bump and this list append.
+ *
+ * The rows still go in as part of the apply transaction, so they are
+ * replicated to other nodes (and vanish with the transaction if it
+ * aborts), exactly as when they were inserted eagerly.
+ */
+void
+bdr_conflict_log_table(BdrApplyConflict *conflict)
+{
+	MemoryContext	old_context;
+
+	if (IsAbortedTransactionBlockState())
+		elog(ERROR, "bdr: attempt to log conflict in aborted transaction");
+
+	if (!IsTransactionState())
+		elog(ERROR, "bdr: attempt to log conflict without surrounding transaction");
+
+	if (!bdr_log_conflicts_to_table)
+		/* No logging enabled and we don't own any memory, just bail */
+		return;
+
+	old_context = MemoryContextSwitchTo(conflict_log_context);
+	conflict_log_spool = lappend(conflict_log_spool, conflict);
+	MemoryContextSwitchTo(old_context);
+}
+
+/*
+ * Insert all queued conflicts into bdr.bdr_conflict_history in one batch.
+ *
+ * Called from the apply worker just before it commits; must run inside the
+ * apply transaction. The changes will then be replicated to other nodes.
+ */
+void
+bdr_conflict_log_flush(void)
+{
+	Relation		log_rel;
+	TupleTableSlot *log_slot;
+	EState		   *log_estate;
+	ResultRelInfo  *log_relinfo;
+	ListCell	   *lc;
+
+	if (conflict_log_spool == NIL)
+		return;
+
+	Assert(IsTransactionState());
 
-	/*
-	 * Construct a bdr.bdr_conflict_history tuple from the conflict info we've
-	 * been passed and insert it into bdr.bdr_conflict_history.
-	 */
 	log_rel = table_open(BdrConflictHistoryRelId, RowExclusiveLock);
 
 	/* Prepare executor state for index updates */
 	log_estate = CreateExecutorState();
 	log_slot = ExecInitExtraTupleSlot(log_estate, NULL, &TTSOpsHeapTuple);
 	ExecSetSlotDescriptor(log_slot, RelationGetDescr(log_rel));
-	/* Construct the tuple and insert it */
-	log_tup = heap_form_tuple(RelationGetDescr(log_rel), values, nulls);
-	simple_heap_insert(log_rel, log_tup);
-	ExecStoreHeapTuple(log_tup, log_slot, true);
-	/* Then do any index maintanence required */
-	UserTableUpdateIndexes(log_estate, bdr_create_result_rel_info(log_rel), log_slot, false, false);
+	log_relinfo = bdr_create_result_rel_info(log_rel);
+
+	foreach(lc, conflict_log_spool)
+	{
+		BdrApplyConflict *conflict = lfirst(lc);
+		Datum		values[BDR_CONFLICT_HISTORY_COLS];
+		bool		nulls[BDR_CONFLICT_HISTORY_COLS];
+		HeapTuple	log_tup;
+
+		bdr_conflict_history_form_tuple(conflict, values, nulls);
+
+		/* Construct the tuple and insert it */
+		log_tup = heap_form_tuple(RelationGetDescr(log_rel), values, nulls);
+		simple_heap_insert(log_rel, log_tup);
+		ExecStoreHeapTuple(log_tup, log_slot, true);
+		/* Then do any index maintanence required */
+		UserTableUpdateIndexes(log_estate, log_relinfo, log_slot, false, false);
+	}
+
 	/* and finish up */
 	table_close(log_rel, RowExclusiveLock);
 	ExecResetTupleTable(log_estate->es_tupleTable, true);
 	FreeExecutorState(log_estate);
+
+	conflict_log_spool = NIL;
+	MemoryContextResetAndDeleteChildren(conflict_log_context);
+}
+
+/*
+ * Throw away queued conflicts without writing them out, because the apply
+ * transaction that produced them has been rolled back. The conflicts would
+ * be queued again if the transaction is re-applied.
+ */
+void
+bdr_conflict_log_discard(void)
+{
+	if (conflict_log_spool == NIL)
+		return;
+
+	conflict_log_spool = NIL;
+	MemoryContextResetAndDeleteChildren(conflict_log_context);
 }
 
 /*
@@ -666,7 +745,13 @@ bdr_make_apply_conflict(BdrConflictType conflict_type,
 	}
 	else
 	{
-		conflict->object_name = RelationGetRelationName(conflict_relation->rel);
+		/*
+		 * Copy the name; the record may be spooled until commit, by which
+		 * time the relation has been closed and its relcache entry may have
+		 * been rebuilt.
+		 */
+		conflict->object_name =
+			pstrdup(RelationGetRelationName(conflict_relation->rel));
 		conflict->object_schema =
 			get_namespace_name(RelationGetNamespace(conflict_relation->rel));
 	}
@@ -710,7 +795,13 @@ bdr_make_apply_conflict(BdrConflictType conflict_type,
 
 	conflict->local_commit_time = local_commit_ts;
 
-	if (remote_tuple != NULL && bdr_conflict_logging_include_tuples)
+	/*
+	 * The remote tuple is only ever rendered by the bdr_conflict_history
+	 * sink (the serverlog line just prints the local PKEY tuple), so don't
+	 * bother materializing a copy of it unless table logging is on.
+	 */
+	if (remote_tuple != NULL && bdr_conflict_logging_include_tuples &&
+		bdr_log_conflicts_to_table)
 	{
 		conflict->remote_tuple = ExecFetchSlotHeapTupleDatum(remote_tuple);
 		conflict->remote_tuple_null = false;
@@ -23,6 +23,8 @@
 
 #include "nodes/execnodes.h"
 
+#include "port/atomics.h"
+
 #include "replication/origin.h"
 
 #include "storage/fd.h"
@@ -31,19 +33,48 @@
 #include "storage/spin.h"
 
 #include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 
 /*
  * Statistics about logical replication
  *
- * whenever this struct is changed, bdr_count_version needs to be increased so
- * on-disk values aren't reused
+ * The counters are atomics so that readers - the stats views and the
+ * periodic flush in the supervisor - always see whole values even while
+ * the owning apply worker is incrementing them. There is still only ever
+ * one writer per slot, so the writer side uses plain atomic stores, not
+ * locked read-modify-write cycles.
  */
 typedef struct BdrCountSlot
 {
 	RepOriginId	node_id;
 
-	/* we use int64 to make sure we can export to sql, there is uint64 there */
+	pg_atomic_uint64 nr_commit;
+	pg_atomic_uint64 nr_rollback;
+
+	pg_atomic_uint64 nr_insert;
+	pg_atomic_uint64 nr_insert_conflict;
+	pg_atomic_uint64 nr_update;
+	pg_atomic_uint64 nr_update_conflict;
+	pg_atomic_uint64 nr_delete;
+	pg_atomic_uint64 nr_delete_conflict;
+
+	pg_atomic_uint64 nr_disconnect;
+}	BdrCountSlot;
+
+/*
+ * On-disk representation of a BdrCountSlot.
+ *
+ * whenever this struct is changed, bdr_count_version needs to be increased so
+ * on-disk values aren't reused.  We use int64 to make sure we can export to
+ * sql, there is no uint64 there.
+ */
+typedef struct BdrCountSerializeSlot
+{
+	RepOriginId	node_id;
+
 	int64		nr_commit;
 	int64		nr_rollback;
 
@@ -55,7 +86,68 @@ typedef struct BdrCountSlot
 	int64		nr_delete_conflict;
 
 	int64		nr_disconnect;
-}	BdrCountSlot;
+}	BdrCountSerializeSlot;
+
+/*
+ * Per-peer statistics of the decoding side, living in the same shared
+ * memory segment right after the apply-side slots. Unlike BdrCountSlot
+ * these are not serialized across restarts: they exist to answer "is the
+ * bottleneck decode, filtering or the wire" while a lag is happening, and
+ * the reorder buffer's own spill counters are already in
+ * pg_stat_replication_slots.
+ */
+typedef struct BdrCountDecodeSlot
+{
+	bool		in_use;
+	BDRNodeId	peer;
+
+	pg_atomic_uint64 nr_txns;
+	pg_atomic_uint64 nr_changes;
+	pg_atomic_uint64 nr_changes_filtered_origin;
+	pg_atomic_uint64 nr_changes_filtered_relation;
+	pg_atomic_uint64 bytes_sent;
+}	BdrCountDecodeSlot;
+
+/*
+ * Per-table apply statistics, in a shared hash keyed by (database, relation)
+ * so a lagging apply worker can be traced to the table eating it without
+ * attaching a profiler. Unlike the per-node slots a table's entry can be
+ * bumped by several apply workers at once - one per peer - so these use
+ * locked fetch-and-adds rather than single-writer stores.
+ *
+ * Entries are never removed (a dropped table's numbers just stop moving)
+ * and the hash is fixed-size; once it's full further tables simply aren't
+ * tracked. Not serialized across restarts.
+ */
+typedef struct BdrCountTableKey
+{
+	Oid			dboid;
+	Oid			relid;
+}	BdrCountTableKey;
+
+typedef struct BdrCountTableEntry
+{
+	BdrCountTableKey key;
+
+	pg_atomic_uint64 nr_insert;
+	pg_atomic_uint64 nr_insert_conflict;
+	pg_atomic_uint64 nr_update;
+	pg_atomic_uint64 nr_update_conflict;
+	pg_atomic_uint64 nr_delete;
+	pg_atomic_uint64 nr_delete_conflict;
+
+	/* cumulative wall-clock apply time, only moves with bdr.track_apply_timing */
+	pg_atomic_uint64 apply_time_us;
+}	BdrCountTableEntry;
+
+/* per-backend cache of shared entry pointers, so the lock is taken once per table */
+typedef struct BdrCountTableLocalEntry
+{
+	Oid			relid;
+	BdrCountTableEntry *shared; /* NULL when the shared hash was full */
+}	BdrCountTableLocalEntry;
+
+#define BDR_COUNT_MAX_TABLES 1024
 
 /*
  * Shared memory header for the stats module.
@@ -64,6 +156,7 @@ typedef struct BdrCountControl
 {
 	LWLockId	lock;
 	BdrCountSlot slots[FLEXIBLE_ARRAY_MEMBER];
+	/* followed by bdr_count_nnodes BdrCountDecodeSlots */
 }	BdrCountControl;
 
 /*
@@ -81,7 +174,10 @@ typedef struct BdrCountSerialize
 static const uint32 bdr_count_magic = 0x5e51A7;
 
 /* everytime the stored data format changes, increase */
-static const uint32 bdr_count_version = 2;
+static const uint32 bdr_count_version = 3;
+
+/* GUC: seconds between periodic stats flushes by the supervisor, 0 disables */
+int			bdr_count_flush_interval;
 
 /* shortcut for the finding BdrCountControl in memory */
 static BdrCountControl *BdrCountCtl = NULL;
@@ -92,6 +188,13 @@ static Size bdr_count_nnodes = 0;
 /* offset in the BdrCountControl->slots "our" backend is in */
 static int	MyCountOffsetIdx = -1;
 
+/* this walsender's decode stats slot, NULL when not attached */
+static BdrCountDecodeSlot *MyDecodeSlot = NULL;
+
+/* the shared per-table stats hash and this backend's pointer cache */
+static HTAB *BdrCountTableHash = NULL;
+static HTAB *BdrCountTableLocal = NULL;
+
 static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
 static shmem_request_hook_type prev_shmem_request_hook = NULL;
 
@@ -103,10 +206,23 @@ static void bdr_count_serialize(void);
 static void bdr_count_unserialize(void);
 
 #define BDR_COUNT_STAT_COLS 12
+#define BDR_COUNT_DECODE_COLS 8
+#define BDR_COUNT_TABLE_COLS 9
 
 PGDLLEXPORT Datum pg_stat_get_bdr(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum pg_stat_get_bdr_decode(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum pg_stat_get_bdr_tables(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(pg_stat_get_bdr);
+PG_FUNCTION_INFO_V1(pg_stat_get_bdr_decode);
+PG_FUNCTION_INFO_V1(pg_stat_get_bdr_tables);
+
+/* the decode slots follow the apply-side slots in the same allocation */
+static BdrCountDecodeSlot *
+bdr_count_decode_slots(void)
+{
+	return (BdrCountDecodeSlot *) &BdrCountCtl->slots[bdr_count_nnodes];
+}
 
 static Size
 bdr_count_shmem_size(void)
@@ -115,10 +231,17 @@ bdr_count_shmem_size(void)
 
 	size = add_size(size, sizeof(BdrCountControl));
 	size = add_size(size, mul_size(bdr_count_nnodes, sizeof(BdrCountSlot)));
+	size = add_size(size, mul_size(bdr_count_nnodes, sizeof(BdrCountDecodeSlot)));
 
 	return size;
 }
 
+static Size
+bdr_count_table_shmem_size(void)
+{
+	return hash_estimate_size(BDR_COUNT_MAX_TABLES, sizeof(BdrCountTableEntry));
+}
+
 static void
 bdr_count_shmem_request(void)
 {
@@ -126,7 +249,8 @@ bdr_count_shmem_request(void)
 		prev_shmem_request_hook();
 
 	RequestAddinShmemSpace(bdr_count_shmem_size());
-	/* lock for slot acquiration */
+	RequestAddinShmemSpace(bdr_count_table_shmem_size());
+	/* lock for slot acquiration and table hash changes */
 	RequestNamedLWLockTranche("bdr_count", 1);
 }
 
@@ -159,11 +283,50 @@ bdr_count_shmem_startup(void)
 								  &found);
 	if (!found)
 	{
+		size_t		i;
+
 		/* initialize */
 		memset(BdrCountCtl, 0, bdr_count_shmem_size());
 		BdrCountCtl->lock = &(GetNamedLWLockTranche("bdr_count"))->lock;
+
+		for (i = 0; i < bdr_count_nnodes; i++)
+		{
+			BdrCountSlot *slot = &BdrCountCtl->slots[i];
+			BdrCountDecodeSlot *dslot = &bdr_count_decode_slots()[i];
+
+			pg_atomic_init_u64(&slot->nr_commit, 0);
+			pg_atomic_init_u64(&slot->nr_rollback, 0);
+			pg_atomic_init_u64(&slot->nr_insert, 0);
+			pg_atomic_init_u64(&slot->nr_insert_conflict, 0);
+			pg_atomic_init_u64(&slot->nr_update, 0);
+			pg_atomic_init_u64(&slot->nr_update_conflict, 0);
+			pg_atomic_init_u64(&slot->nr_delete, 0);
+			pg_atomic_init_u64(&slot->nr_delete_conflict, 0);
+			pg_atomic_init_u64(&slot->nr_disconnect, 0);
+
+			pg_atomic_init_u64(&dslot->nr_txns, 0);
+			pg_atomic_init_u64(&dslot->nr_changes, 0);
+			pg_atomic_init_u64(&dslot->nr_changes_filtered_origin, 0);
+			pg_atomic_init_u64(&dslot->nr_changes_filtered_relation, 0);
+			pg_atomic_init_u64(&dslot->bytes_sent, 0);
+		}
+
 		bdr_count_unserialize();
 	}
+
+	{
+		HASHCTL		hctl;
+
+		memset(&hctl, 0, sizeof(hctl));
+		hctl.keysize = sizeof(BdrCountTableKey);
+		hctl.entrysize = sizeof(BdrCountTableEntry);
+		BdrCountTableHash = ShmemInitHash("bdr_count tables",
+										  BDR_COUNT_MAX_TABLES,
+										  BDR_COUNT_MAX_TABLES,
+										  &hctl,
+										  HASH_ELEM | HASH_BLOBS);
+	}
+
 	LWLockRelease(AddinShmemInitLock);
 
 	/*
@@ -235,70 +398,320 @@ out:
 /*
  * Statistic manipulation functions.
  *
- * We assume we don't have to do any locking for *our* slot since only one
- * backend will do writing there.
+ * A peer's slot is shared between its apply worker and any parallel apply
+ * helpers it launches, so the bumps use a real fetch-and-add; a plain
+ * store of the incremented value would lose updates between the writers.
+ *
+ * Backends that drive the apply machinery without attaching to a slot
+ * first - bdr.bdr_apply_replay() in particular - simply don't count.
  */
+static inline void
+bdr_count_bump(pg_atomic_uint64 *counter, int64 add)
+{
+	pg_atomic_fetch_add_u64(counter, add);
+}
+
 void
 bdr_count_commit(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_commit++;
+	if (MyCountOffsetIdx == -1)
+		return;
+	bdr_count_bump(&BdrCountCtl->slots[MyCountOffsetIdx].nr_commit, 1);
 }
 
 void
 bdr_count_rollback(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_rollback++;
+	if (MyCountOffsetIdx == -1)
+		return;
+	bdr_count_bump(&BdrCountCtl->slots[MyCountOffsetIdx].nr_rollback, 1);
 }
 
 void
 bdr_count_insert(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_insert++;
+	if (MyCountOffsetIdx == -1)
+		return;
+	bdr_count_bump(&BdrCountCtl->slots[MyCountOffsetIdx].nr_insert, 1);
 }
 
 void
 bdr_count_insert_conflict(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_insert_conflict++;
+	if (MyCountOffsetIdx == -1)
+		return;
+	bdr_count_bump(&BdrCountCtl->slots[MyCountOffsetIdx].nr_insert_conflict, 1);
 }
 
 void
 bdr_count_update(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_update++;
+	if (MyCountOffsetIdx == -1)
+		return;
+	bdr_count_bump(&BdrCountCtl->slots[MyCountOffsetIdx].nr_update, 1);
 }
 
 void
 bdr_count_update_conflict(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_update_conflict++;
+	if (MyCountOffsetIdx == -1)
+		return;
+	bdr_count_bump(&BdrCountCtl->slots[MyCountOffsetIdx].nr_update_conflict, 1);
 }
 
 void
 bdr_count_delete(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_delete++;
+	if (MyCountOffsetIdx == -1)
+		return;
+	bdr_count_bump(&BdrCountCtl->slots[MyCountOffsetIdx].nr_delete, 1);
 }
 
 void
 bdr_count_delete_conflict(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_delete_conflict++;
+	if (MyCountOffsetIdx == -1)
+		return;
+	bdr_count_bump(&BdrCountCtl->slots[MyCountOffsetIdx].nr_delete_conflict, 1);
 }
 
 void
 bdr_count_disconnect(void)
 {
-	Assert(MyCountOffsetIdx != -1);
-	BdrCountCtl->slots[MyCountOffsetIdx].nr_disconnect++;
+	if (MyCountOffsetIdx == -1)
+		return;
+	bdr_count_bump(&BdrCountCtl->slots[MyCountOffsetIdx].nr_disconnect, 1);
+}
+
+/*
+ * Attach the calling walsender to the decode stats slot for the given
+ * peer, claiming a free one on first contact. As with the apply-side
+ * slots, only one backend decodes for a given peer at a time, so the
+ * counter bumps below don't need the lock.
+ *
+ * Running out of slots only costs us statistics, not correctness, so
+ * unlike bdr_count_set_current_node() this doesn't PANIC.
+ */
+void
+bdr_count_decode_attach(const BDRNodeId * const peer)
+{
+	size_t		i;
+	BdrCountDecodeSlot *slots = bdr_count_decode_slots();
+
+	MyDecodeSlot = NULL;
+
+	LWLockAcquire(BdrCountCtl->lock, LW_EXCLUSIVE);
+
+	for (i = 0; i < bdr_count_nnodes; i++)
+	{
+		if (slots[i].in_use && bdr_nodeid_eq(&slots[i].peer, peer))
+		{
+			MyDecodeSlot = &slots[i];
+			break;
+		}
+	}
+
+	if (MyDecodeSlot == NULL)
+	{
+		for (i = 0; i < bdr_count_nnodes; i++)
+		{
+			if (!slots[i].in_use)
+			{
+				MyDecodeSlot = &slots[i];
+				slots[i].in_use = true;
+				bdr_nodeid_cpy(&slots[i].peer, peer);
+				break;
+			}
+		}
+	}
+
+	LWLockRelease(BdrCountCtl->lock);
+
+	if (MyDecodeSlot == NULL)
+		elog(LOG, "no free bdr decode stats slot, not collecting decoding statistics");
+}
+
+void
+bdr_count_decode_txn(void)
+{
+	if (MyDecodeSlot != NULL)
+		bdr_count_bump(&MyDecodeSlot->nr_txns, 1);
+}
+
+void
+bdr_count_decode_change(void)
+{
+	if (MyDecodeSlot != NULL)
+		bdr_count_bump(&MyDecodeSlot->nr_changes, 1);
+}
+
+void
+bdr_count_decode_filtered_origin(void)
+{
+	if (MyDecodeSlot != NULL)
+		bdr_count_bump(&MyDecodeSlot->nr_changes_filtered_origin, 1);
+}
+
+void
+bdr_count_decode_filtered_relation(void)
+{
+	if (MyDecodeSlot != NULL)
+		bdr_count_bump(&MyDecodeSlot->nr_changes_filtered_relation, 1);
+}
+
+void
+bdr_count_decode_bytes(int64 nbytes)
+{
+	if (MyDecodeSlot != NULL)
+		bdr_count_bump(&MyDecodeSlot->bytes_sent, nbytes);
+}
+
+/*
+ * Look up (or create) the shared per-table stats entry for a relation in
+ * the current database, going through a backend-local pointer cache so the
+ * stats lock is only taken on first contact with a table. Shared entries
+ * are never removed, so the cached pointers stay valid.
+ *
+ * Returns NULL - remembered locally, so we don't retry per row - when the
+ * shared hash is full; running out only costs statistics.
+ */
+static BdrCountTableEntry *
+bdr_count_table_entry(Oid relid)
+{
+	BdrCountTableLocalEntry *local;
+	BdrCountTableKey key;
+	bool		found;
+
+	if (BdrCountTableLocal == NULL)
+	{
+		HASHCTL		hctl;
+
+		memset(&hctl, 0, sizeof(hctl));
+		hctl.keysize = sizeof(Oid);
+		hctl.entrysize = sizeof(BdrCountTableLocalEntry);
+		hctl.hcxt = TopMemoryContext;
+		BdrCountTableLocal = hash_create("bdr_count table cache", 32, &hctl,
+										 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	local = hash_search(BdrCountTableLocal, &relid, HASH_ENTER, &found);
+	if (found)
+		return local->shared;
+
+	key.dboid = MyDatabaseId;
+	key.relid = relid;
+
+	LWLockAcquire(BdrCountCtl->lock, LW_EXCLUSIVE);
+	local->shared = hash_search(BdrCountTableHash, &key, HASH_ENTER_NULL,
+								&found);
+	if (local->shared != NULL && !found)
+	{
+		BdrCountTableEntry *entry = local->shared;
+
+		pg_atomic_init_u64(&entry->nr_insert, 0);
+		pg_atomic_init_u64(&entry->nr_insert_conflict, 0);
+		pg_atomic_init_u64(&entry->nr_update, 0);
+		pg_atomic_init_u64(&entry->nr_update_conflict, 0);
+		pg_atomic_init_u64(&entry->nr_delete, 0);
+		pg_atomic_init_u64(&entry->nr_delete_conflict, 0);
+		pg_atomic_init_u64(&entry->apply_time_us, 0);
+	}
+	LWLockRelease(BdrCountCtl->lock);
+
+	if (local->shared == NULL)
+		elog(LOG, "no free bdr table stats entry for relation %u, not collecting per-table statistics",
+			 relid);
+
+	return local->shared;
+}
+
+/*
+ * Per-table versions of the apply counters. Like the per-peer slots these
+ * use atomic adds: apply workers for different peers bump the same table's
+ * entry concurrently.
+ */
+void
+bdr_count_table_insert(Oid relid)
+{
+	BdrCountTableEntry *entry = bdr_count_table_entry(relid);
+
+	if (entry != NULL)
+		pg_atomic_fetch_add_u64(&entry->nr_insert, 1);
+}
+
+void
+bdr_count_table_insert_conflict(Oid relid)
+{
+	BdrCountTableEntry *entry = bdr_count_table_entry(relid);
+
+	if (entry != NULL)
+		pg_atomic_fetch_add_u64(&entry->nr_insert_conflict, 1);
+}
+
+void
+bdr_count_table_update(Oid relid)
+{
+	BdrCountTableEntry *entry = bdr_count_table_entry(relid);
+
+	if (entry != NULL)
+		pg_atomic_fetch_add_u64(&entry->nr_update, 1);
+}
+
+void
+bdr_count_table_update_conflict(Oid relid)
+{
+	BdrCountTableEntry *entry = bdr_count_table_entry(relid);
+
+	if (entry != NULL)
+		pg_atomic_fetch_add_u64(&entry->nr_update_conflict, 1);
+}
+
+void
+bdr_count_table_delete(Oid relid)
+{
+	BdrCountTableEntry *entry = bdr_count_table_entry(relid);
+
+	if (entry != NULL)
+		pg_atomic_fetch_add_u64(&entry->nr_delete, 1);
+}
+
+void
+bdr_count_table_delete_conflict(Oid relid)
+{
+	BdrCountTableEntry *entry = bdr_count_table_entry(relid);
+
+	if (entry != NULL)
+		pg_atomic_fetch_add_u64(&entry->nr_delete_conflict, 1);
+}
+
+void
+bdr_count_table_apply_time(Oid relid, uint64 time_us)
+{
+	BdrCountTableEntry *entry = bdr_count_table_entry(relid);
+
+	if (entry != NULL)
+		pg_atomic_fetch_add_u64(&entry->apply_time_us, time_us);
+}
+
+/*
+ * Read one apply-side slot's counters into the plain-integer form shared
+ * by the stats view and the on-disk serialization. The atomic reads mean
+ * no value is torn; the counters are still read one at a time, so the
+ * snapshot as a whole isn't transactional - that was true before, too.
+ */
+static void
+bdr_count_snapshot_slot(BdrCountSlot *slot, BdrCountSerializeSlot *snap)
+{
+	snap->node_id = slot->node_id;
+	snap->nr_commit = (int64) pg_atomic_read_u64(&slot->nr_commit);
+	snap->nr_rollback = (int64) pg_atomic_read_u64(&slot->nr_rollback);
+	snap->nr_insert = (int64) pg_atomic_read_u64(&slot->nr_insert);
+	snap->nr_insert_conflict = (int64) pg_atomic_read_u64(&slot->nr_insert_conflict);
+	snap->nr_update = (int64) pg_atomic_read_u64(&slot->nr_update);
+	snap->nr_update_conflict = (int64) pg_atomic_read_u64(&slot->nr_update_conflict);
+	snap->nr_delete = (int64) pg_atomic_read_u64(&slot->nr_delete);
+	snap->nr_delete_conflict = (int64) pg_atomic_read_u64(&slot->nr_delete_conflict);
+	snap->nr_disconnect = (int64) pg_atomic_read_u64(&slot->nr_disconnect);
 }
 
 Datum
@@ -347,6 +760,7 @@ pg_stat_get_bdr(PG_FUNCTION_ARGS)
 		 current_offset++)
 	{
 		BdrCountSlot *slot;
+		BdrCountSerializeSlot snap;
 		char	   *riname;
 		Datum		values[BDR_COUNT_STAT_COLS];
 		bool		nulls[BDR_COUNT_STAT_COLS];
@@ -357,6 +771,8 @@ pg_stat_get_bdr(PG_FUNCTION_ARGS)
 		if (slot->node_id == InvalidRepOriginId)
 			continue;
 
+		bdr_count_snapshot_slot(slot, &snap);
+
 		memset(values, 0, sizeof(values));
 		memset(nulls, 0, sizeof(nulls));
 
@@ -365,15 +781,195 @@ pg_stat_get_bdr(PG_FUNCTION_ARGS)
 		values[ 0] = ObjectIdGetDatum(slot->node_id);
 		values[ 1] = ObjectIdGetDatum(slot->node_id);
 		values[ 2] = CStringGetTextDatum(riname);
-		values[ 3] = Int64GetDatumFast(slot->nr_commit);
-		values[ 4] = Int64GetDatumFast(slot->nr_rollback);
-		values[ 5] = Int64GetDatumFast(slot->nr_insert);
-		values[ 6] = Int64GetDatumFast(slot->nr_insert_conflict);
-		values[ 7] = Int64GetDatumFast(slot->nr_update);
-		values[ 8] = Int64GetDatumFast(slot->nr_update_conflict);
-		values[ 9] = Int64GetDatumFast(slot->nr_delete);
-		values[10] = Int64GetDatumFast(slot->nr_delete_conflict);
-		values[11] = Int64GetDatumFast(slot->nr_disconnect);
+		values[ 3] = Int64GetDatumFast(snap.nr_commit);
+		values[ 4] = Int64GetDatumFast(snap.nr_rollback);
+		values[ 5] = Int64GetDatumFast(snap.nr_insert);
+		values[ 6] = Int64GetDatumFast(snap.nr_insert_conflict);
+		values[ 7] = Int64GetDatumFast(snap.nr_update);
+		values[ 8] = Int64GetDatumFast(snap.nr_update_conflict);
+		values[ 9] = Int64GetDatumFast(snap.nr_delete);
+		values[10] = Int64GetDatumFast(snap.nr_delete_conflict);
+		values[11] = Int64GetDatumFast(snap.nr_disconnect);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+	LWLockRelease(BdrCountCtl->lock);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+Datum
+pg_stat_get_bdr_decode(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	size_t		current_offset;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("Access to pg_stat_get_bdr_decode() denied as non-superuser")));
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (tupdesc->natts != BDR_COUNT_DECODE_COLS)
+		elog(ERROR, "wrong function definition");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/* don't let a slot get claimed below us */
+	LWLockAcquire(BdrCountCtl->lock, LW_SHARED);
+
+	for (current_offset = 0; current_offset < bdr_count_nnodes;
+		 current_offset++)
+	{
+		BdrCountDecodeSlot *slot;
+		char		sysid_str[33];
+		int64		nr_txns;
+		int64		nr_changes;
+		int64		nr_changes_filtered_origin;
+		int64		nr_changes_filtered_relation;
+		int64		bytes_sent;
+		Datum		values[BDR_COUNT_DECODE_COLS];
+		bool		nulls[BDR_COUNT_DECODE_COLS];
+
+		slot = &bdr_count_decode_slots()[current_offset];
+
+		/* no stats here */
+		if (!slot->in_use)
+			continue;
+
+		nr_txns = (int64) pg_atomic_read_u64(&slot->nr_txns);
+		nr_changes = (int64) pg_atomic_read_u64(&slot->nr_changes);
+		nr_changes_filtered_origin =
+			(int64) pg_atomic_read_u64(&slot->nr_changes_filtered_origin);
+		nr_changes_filtered_relation =
+			(int64) pg_atomic_read_u64(&slot->nr_changes_filtered_relation);
+		bytes_sent = (int64) pg_atomic_read_u64(&slot->bytes_sent);
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		snprintf(sysid_str, sizeof(sysid_str), UINT64_FORMAT,
+				 slot->peer.sysid);
+
+		values[0] = CStringGetTextDatum(sysid_str);
+		values[1] = ObjectIdGetDatum(slot->peer.timeline);
+		values[2] = ObjectIdGetDatum(slot->peer.dboid);
+		values[3] = Int64GetDatumFast(nr_txns);
+		values[4] = Int64GetDatumFast(nr_changes);
+		values[5] = Int64GetDatumFast(nr_changes_filtered_origin);
+		values[6] = Int64GetDatumFast(nr_changes_filtered_relation);
+		values[7] = Int64GetDatumFast(bytes_sent);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+	LWLockRelease(BdrCountCtl->lock);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+Datum
+pg_stat_get_bdr_tables(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	HASH_SEQ_STATUS status;
+	BdrCountTableEntry *entry;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("Access to pg_stat_get_bdr_tables() denied as non-superuser")));
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (tupdesc->natts != BDR_COUNT_TABLE_COLS)
+		elog(ERROR, "wrong function definition");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/* don't let an entry get created below us */
+	LWLockAcquire(BdrCountCtl->lock, LW_SHARED);
+
+	hash_seq_init(&status, BdrCountTableHash);
+	while ((entry = hash_seq_search(&status)) != NULL)
+	{
+		int64		nr_insert;
+		int64		nr_insert_conflict;
+		int64		nr_update;
+		int64		nr_update_conflict;
+		int64		nr_delete;
+		int64		nr_delete_conflict;
+		uint64		apply_time_us;
+		Datum		values[BDR_COUNT_TABLE_COLS];
+		bool		nulls[BDR_COUNT_TABLE_COLS];
+
+		nr_insert = (int64) pg_atomic_read_u64(&entry->nr_insert);
+		nr_insert_conflict = (int64) pg_atomic_read_u64(&entry->nr_insert_conflict);
+		nr_update = (int64) pg_atomic_read_u64(&entry->nr_update);
+		nr_update_conflict = (int64) pg_atomic_read_u64(&entry->nr_update_conflict);
+		nr_delete = (int64) pg_atomic_read_u64(&entry->nr_delete);
+		nr_delete_conflict = (int64) pg_atomic_read_u64(&entry->nr_delete_conflict);
+		apply_time_us = pg_atomic_read_u64(&entry->apply_time_us);
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(entry->key.dboid);
+		values[1] = ObjectIdGetDatum(entry->key.relid);
+		values[2] = Int64GetDatumFast(nr_insert);
+		values[3] = Int64GetDatumFast(nr_insert_conflict);
+		values[4] = Int64GetDatumFast(nr_update);
+		values[5] = Int64GetDatumFast(nr_update_conflict);
+		values[6] = Int64GetDatumFast(nr_delete);
+		values[7] = Int64GetDatumFast(nr_delete_conflict);
+		/* exported in milliseconds, like pg_stat_statements timings */
+		values[8] = Float8GetDatum((double) apply_time_us / 1000.0);
 
 		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
 	}
@@ -386,6 +982,11 @@ pg_stat_get_bdr(PG_FUNCTION_ARGS)
 
 /*
  * Write the BDR stats from shared memory to a file
+ *
+ * Called at clean postmaster shutdown and periodically from the supervisor
+ * (bdr_count_maybe_flush), so the stats survive a crash with at most
+ * bdr.stats_flush_interval worth of updates lost. The tempfile-and-rename
+ * dance keeps the on-disk copy consistent even if we crash mid-write.
  */
 static void
 bdr_count_serialize(void)
@@ -395,6 +996,7 @@ bdr_count_serialize(void)
 	const char *path = "global/bdr.stat";
 	BdrCountSerialize serial;
 	Size		write_size;
+	size_t		i;
 
 	LWLockAcquire(BdrCountCtl->lock, LW_EXCLUSIVE);
 
@@ -429,18 +1031,25 @@ bdr_count_serialize(void)
 						tpath)));
 	}
 
-	/* write data */
-	write_size = sizeof(BdrCountSlot) * bdr_count_nnodes;
-	if ((write(fd, &BdrCountCtl->slots, write_size)) != write_size)
+	/* write data, one atomically-read snapshot per slot */
+	for (i = 0; i < bdr_count_nnodes; i++)
 	{
-		int		save_errno = errno;
+		BdrCountSerializeSlot snap;
 
-		CloseTransientFile(fd);
-		errno = save_errno;
-		ereport(ERROR,
-				(errcode_for_file_access(),
-				 errmsg("could not write bdr stat file data \"%s\": %m",
-						tpath)));
+		bdr_count_snapshot_slot(&BdrCountCtl->slots[i], &snap);
+
+		write_size = sizeof(snap);
+		if ((write(fd, &snap, write_size)) != write_size)
+		{
+			int		save_errno = errno;
+
+			CloseTransientFile(fd);
+			errno = save_errno;
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not write bdr stat file data \"%s\": %m",
+							tpath)));
+		}
 	}
 
 	CloseTransientFile(fd);
@@ -464,6 +1073,7 @@ bdr_count_unserialize(void)
 	const char *path = "global/bdr.stat";
 	BdrCountSerialize serial;
 	ssize_t		read_size;
+	size_t		i;
 
 	if (BdrCountCtl == NULL)
 		elog(ERROR, "cannot use bdr statistics function without loading bdr");
@@ -517,17 +1127,34 @@ bdr_count_unserialize(void)
 		goto zero_file;
 	}
 
-	/* read actual data, directly into shmem */
-	read_size = sizeof(BdrCountSlot) * serial.nr_slots;
-	if (read(fd, &BdrCountCtl->slots, read_size) != read_size)
+	/* read actual data, one serialized slot at a time */
+	for (i = 0; i < serial.nr_slots; i++)
 	{
-		int saved_errno = errno;
-		CloseTransientFile(fd);
-		errno = saved_errno;
-		ereport(ERROR,
-				(errcode_for_file_access(),
-				 errmsg("could not read bdr stat file data \"%s\": %m",
-						path)));
+		BdrCountSerializeSlot snap;
+		BdrCountSlot *slot = &BdrCountCtl->slots[i];
+
+		read_size = sizeof(snap);
+		if (read(fd, &snap, read_size) != read_size)
+		{
+			int saved_errno = errno;
+			CloseTransientFile(fd);
+			errno = saved_errno;
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read bdr stat file data \"%s\": %m",
+							path)));
+		}
+
+		slot->node_id = snap.node_id;
+		pg_atomic_write_u64(&slot->nr_commit, (uint64) snap.nr_commit);
+		pg_atomic_write_u64(&slot->nr_rollback, (uint64) snap.nr_rollback);
+		pg_atomic_write_u64(&slot->nr_insert, (uint64) snap.nr_insert);
+		pg_atomic_write_u64(&slot->nr_insert_conflict, (uint64) snap.nr_insert_conflict);
+		pg_atomic_write_u64(&slot->nr_update, (uint64) snap.nr_update);
+		pg_atomic_write_u64(&slot->nr_update_conflict, (uint64) snap.nr_update_conflict);
+		pg_atomic_write_u64(&slot->nr_delete, (uint64) snap.nr_delete);
+		pg_atomic_write_u64(&slot->nr_delete_conflict, (uint64) snap.nr_delete_conflict);
+		pg_atomic_write_u64(&slot->nr_disconnect, (uint64) snap.nr_disconnect);
 	}
 
 out:
@@ -546,3 +1173,37 @@ zero_file:
 	 */
 	bdr_count_serialize();
 }
+
+/*
+ * Flush the stats to disk if bdr.stats_flush_interval has elapsed since the
+ * last flush.
+ *
+ * Called from the supervisor's main loop. Before this the stats were only
+ * serialized at clean postmaster shutdown, so any crash threw away
+ * everything accumulated since the last restart.
+ */
+void
+bdr_count_maybe_flush(void)
+{
+	static TimestampTz last_flush = 0;
+	TimestampTz now;
+
+	if (bdr_count_flush_interval <= 0)
+		return;
+
+	now = GetCurrentTimestamp();
+
+	/* on the first call just start the clock, the stats are still young */
+	if (last_flush == 0)
+	{
+		last_flush = now;
+		return;
+	}
+
+	if (!TimestampDifferenceExceeds(last_flush, now,
+									bdr_count_flush_interval * 1000))
+		return;
+
+	bdr_count_serialize();
+	last_flush = now;
+}
@@ -23,6 +23,10 @@
 
 #include "commands/seclabel.h"
 
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+
 #include "utils/catcache.h"
 #include "utils/inval.h"
 #if PG_VERSION_NUM < 130000
@@ -47,8 +51,124 @@ typedef struct BDRDatabaseCacheEntry
 
 static HTAB *BDRDatabaseCacheHash = NULL;
 
+/*
+ * Shared copy of the per-database activation flag.
+ *
+ * Deriving the flag means scanning pg_seclabel and parsing the label's json,
+ * and every backend used to redo that on its first bdr-relevant statement.
+ * On pooler-heavy workloads, with thousands of short-lived backends a minute,
+ * that serialized everyone behind identical catalog reads. With the shared
+ * cache only the first backend after an invalidation derives the flag; the
+ * rest attach to the published value.
+ *
+ * Slots are fixed-size scalars and are never reclaimed, so readers take the
+ * spinlock briefly and copy the value out; there's no entry lifetime to
+ * manage. The per-slot generation is bumped on invalidation: a backend that
+ * started deriving the flag before the bump will fail its generation check
+ * and not publish a stale value.
+ */
+typedef struct BdrDbCacheSharedEntry
+{
+	Oid			dboid;			/* InvalidOid = unused slot */
+	uint32		gen;			/* bumped when this slot is invalidated */
+	bool		valid;
+	bool		bdr_activated;
+} BdrDbCacheSharedEntry;
+
+typedef struct BdrDbCacheSharedCtl
+{
+	slock_t		mutex;			/* protects entries */
+	BdrDbCacheSharedEntry entries[FLEXIBLE_ARRAY_MEMBER];	/* bdr_max_databases */
+} BdrDbCacheSharedCtl;
+
+static BdrDbCacheSharedCtl *bdr_dbcache_ctl = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+
 static BDRDatabaseCacheEntry * bdr_dbcache_lookup(Oid dboid, bool missing_ok);
 
+static Size
+bdr_dbcache_shmem_size(void)
+{
+	return add_size(offsetof(BdrDbCacheSharedCtl, entries),
+					mul_size(bdr_max_databases, sizeof(BdrDbCacheSharedEntry)));
+}
+
+static void
+bdr_dbcache_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(bdr_dbcache_shmem_size());
+}
+
+static void
+bdr_dbcache_shmem_startup(void)
+{
+	bool		found;
+
+	if (prev_shmem_startup_hook != NULL)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	bdr_dbcache_ctl = ShmemInitStruct("bdr_dbcache",
+									  bdr_dbcache_shmem_size(),
+									  &found);
+	if (!found)
+	{
+		memset(bdr_dbcache_ctl, 0, bdr_dbcache_shmem_size());
+		SpinLockInit(&bdr_dbcache_ctl->mutex);
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/* Needs to be called out of postmaster's shared_preload_libraries handling */
+void
+bdr_dbcache_shmem_init(void)
+{
+	Assert(process_shared_preload_libraries_in_progress);
+
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = bdr_dbcache_shmem_request;
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = bdr_dbcache_shmem_startup;
+}
+
+/*
+ * Find the shared slot for the given database, optionally claiming a free
+ * one. Caller must hold bdr_dbcache_ctl->mutex. Returns NULL if not present
+ * and (when claiming) no slot is free.
+ */
+static BdrDbCacheSharedEntry *
+bdr_dbcache_shared_slot(Oid dboid, bool claim)
+{
+	BdrDbCacheSharedEntry *free_slot = NULL;
+	int			i;
+
+	for (i = 0; i < bdr_max_databases; i++)
+	{
+		BdrDbCacheSharedEntry *slot = &bdr_dbcache_ctl->entries[i];
+
+		if (slot->dboid == dboid)
+			return slot;
+
+		if (slot->dboid == InvalidOid && free_slot == NULL)
+			free_slot = slot;
+	}
+
+	if (claim && free_slot != NULL)
+	{
+		free_slot->dboid = dboid;
+		free_slot->valid = false;
+		return free_slot;
+	}
+
+	return NULL;
+}
+
 static void
 bdr_dbcache_invalidate_entry(Datum arg, int cacheid, uint32 hashvalue)
 {
@@ -58,16 +178,63 @@ bdr_dbcache_invalidate_entry(Datum arg, int cacheid, uint32 hashvalue)
 	Assert(BDRDatabaseCacheHash != NULL);
 
 	/*
-	 * Currently we just reset all entries; it's unlikely anything more
-	 * complicated is worthwile.
+	 * A nonzero hashvalue identifies the pg_database row that changed, so
+	 * only entries whose oid hashes to it can be affected; zero means a
+	 * wholesale catalog invalidation (as sent by bdr_object_relabel) and
+	 * resets everything.
 	 */
 	hash_seq_init(&status, BDRDatabaseCacheHash);
 
 	while ((hentry = (BDRDatabaseCacheEntry *) hash_seq_search(&status)) != NULL)
 	{
-		hentry->valid = false;
+		if (hashvalue == 0 ||
+			GetSysCacheHashValue1(DATABASEOID,
+								  ObjectIdGetDatum(hentry->oid)) == hashvalue)
+			hentry->valid = false;
 	}
 
+	if (bdr_dbcache_ctl == NULL)
+		return;
+
+	if (hashvalue != 0)
+	{
+		int			i;
+
+		/*
+		 * Compute the hash comparisons outside the spinlock. Slot oids are
+		 * only ever set, never cleared, so the unlocked read is fine; the
+		 * recheck under the lock catches a slot claimed in between.
+		 */
+		for (i = 0; i < bdr_max_databases; i++)
+		{
+			Oid			dboid = bdr_dbcache_ctl->entries[i].dboid;
+
+			if (dboid == InvalidOid ||
+				GetSysCacheHashValue1(DATABASEOID,
+									  ObjectIdGetDatum(dboid)) != hashvalue)
+				continue;
+
+			SpinLockAcquire(&bdr_dbcache_ctl->mutex);
+			if (bdr_dbcache_ctl->entries[i].dboid == dboid)
+			{
+				bdr_dbcache_ctl->entries[i].gen++;
+				bdr_dbcache_ctl->entries[i].valid = false;
+			}
+			SpinLockRelease(&bdr_dbcache_ctl->mutex);
+		}
+	}
+	else
+	{
+		int			i;
+
+		SpinLockAcquire(&bdr_dbcache_ctl->mutex);
+		for (i = 0; i < bdr_max_databases; i++)
+		{
+			bdr_dbcache_ctl->entries[i].gen++;
+			bdr_dbcache_ctl->entries[i].valid = false;
+		}
+		SpinLockRelease(&bdr_dbcache_ctl->mutex);
+	}
 }
 
 static void
@@ -166,10 +333,13 @@ static BDRDatabaseCacheEntry *
 bdr_dbcache_lookup(Oid dboid, bool missing_ok)
 {
 	BDRDatabaseCacheEntry *entry;
+	BdrDbCacheSharedEntry *slot;
 	bool		found;
 	ObjectAddress object;
 	HeapTuple	dbtuple;
 	const char *label;
+	bool		have_shared = false;
+	bool		shared_activated = false;
 
 	if (BDRDatabaseCacheHash == NULL)
 		bdr_dbcache_initialize();
@@ -202,12 +372,66 @@ bdr_dbcache_lookup(Oid dboid, bool missing_ok)
 
 	ReleaseSysCache(dbtuple);
 
-	object.classId = DatabaseRelationId;
-	object.objectId = dboid;
-	object.objectSubId = 0;
+	/*
+	 * If another backend already derived the activation flag, attach to the
+	 * published value instead of redoing the pg_seclabel scan and label
+	 * parse.
+	 */
+	if (bdr_dbcache_ctl != NULL)
+	{
+		SpinLockAcquire(&bdr_dbcache_ctl->mutex);
+		slot = bdr_dbcache_shared_slot(dboid, false);
+		if (slot != NULL && slot->valid)
+		{
+			shared_activated = slot->bdr_activated;
+			have_shared = true;
+		}
+		SpinLockRelease(&bdr_dbcache_ctl->mutex);
+	}
+
+	if (have_shared)
+		entry->bdr_activated = shared_activated;
+	else
+	{
+		uint32		start_gen = 0;
+		bool		have_slot = false;
+
+		/*
+		 * Claim a shared slot before reading the catalogs and remember its
+		 * generation; if an invalidation arrives while we're reading, the
+		 * generation moves on and we won't publish the possibly-stale flag.
+		 */
+		if (bdr_dbcache_ctl != NULL)
+		{
+			SpinLockAcquire(&bdr_dbcache_ctl->mutex);
+			slot = bdr_dbcache_shared_slot(dboid, true);
+			if (slot != NULL)
+			{
+				start_gen = slot->gen;
+				have_slot = true;
+			}
+			SpinLockRelease(&bdr_dbcache_ctl->mutex);
+		}
+
+		object.classId = DatabaseRelationId;
+		object.objectId = dboid;
+		object.objectSubId = 0;
 
-	label = GetSecurityLabel(&object, "bdr");
-	bdr_parse_database_options(label, &entry->bdr_activated);
+		label = GetSecurityLabel(&object, "bdr");
+		bdr_parse_database_options(label, &entry->bdr_activated);
+
+		if (have_slot)
+		{
+			SpinLockAcquire(&bdr_dbcache_ctl->mutex);
+			slot = bdr_dbcache_shared_slot(dboid, false);
+			if (slot != NULL && slot->gen == start_gen)
+			{
+				slot->bdr_activated = entry->bdr_activated;
+				slot->valid = true;
+			}
+			SpinLockRelease(&bdr_dbcache_ctl->mutex);
+		}
+	}
 
 	entry->valid = true;
 
@@ -17,6 +17,7 @@
 
 #include "access/heapam.h"
 #include "access/table.h"
+#include "access/xact.h"
 #include "access/xlog.h"
 
 #include "catalog/catalog.h"
@@ -36,12 +37,59 @@
 #include "utils/builtins.h"
 #include "utils/guc.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 
 bool in_bdr_replicate_ddl_command = false;
 
 PGDLLEXPORT Datum bdr_replicate_ddl_command(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(bdr_replicate_ddl_command);
 
+/*
+ * Insert machinery for bdr.bdr_queued_commands, kept open across queue
+ * insertions within one top-level transaction. Opening the relation and
+ * its indexes and building executor state per queued command made the
+ * origin-side overhead of a multi-statement migration scale with the
+ * statement count; with the cache each additional statement costs one
+ * heap insert plus index maintenance.
+ *
+ * Only set up when queueing from a top-level transaction, so the entries
+ * are owned by the top-level resource owner and a subtransaction abort
+ * can't release them behind our back. The cache is torn down at
+ * (pre-)commit and simply forgotten on abort, when the transaction
+ * machinery has already released the locks, pins and memory.
+ */
+static Relation	queue_cached_rel = NULL;
+static EState  *queue_cached_estate = NULL;
+static ResultRelInfo *queue_cached_relinfo = NULL;
+static TupleTableSlot *queue_cached_slot = NULL;
+static bool		queue_xact_callback_registered = false;
+
+static void
+bdr_queue_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_PRE_COMMIT:
+			if (queue_cached_rel != NULL)
+			{
+				ExecCloseIndices(queue_cached_relinfo);
+				ExecDropSingleTupleTableSlot(queue_cached_slot);
+				FreeExecutorState(queue_cached_estate);
+				table_close(queue_cached_rel, RowExclusiveLock);
+			}
+			/* fallthrough */
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			queue_cached_rel = NULL;
+			queue_cached_estate = NULL;
+			queue_cached_relinfo = NULL;
+			queue_cached_slot = NULL;
+			break;
+		default:
+			break;
+	}
+}
+
 /*
  * bdr_queue_ddl_command
  *
@@ -53,11 +101,11 @@ bdr_queue_ddl_command(const char *command_tag, const char *command, const char *
 	EState		   *estate;
 	ResultRelInfo	   *relinfo;
 	TupleTableSlot *slot;
-	RangeVar	   *rv;
 	Relation		queuedcmds;
 	HeapTuple		newtup = NULL;
 	Datum			values[6];
 	bool			nulls[6];
+	bool			cache_usable;
 
 	elog(DEBUG2, "node %s enqueuing DDL command \"%s\" "
 		 "with search_path \"%s\"",
@@ -67,13 +115,51 @@ bdr_queue_ddl_command(const char *command_tag, const char *command, const char *
 	if (search_path == NULL)
 		search_path = "";
 
+	cache_usable = (GetCurrentTransactionNestLevel() == 1);
+
 	/* prepare bdr.bdr_queued_commands for insert */
-	rv = makeRangeVar("bdr", "bdr_queued_commands", -1);
-	queuedcmds = table_openrv(rv, RowExclusiveLock);
-	slot = MakeSingleTupleTableSlot(RelationGetDescr(queuedcmds), &TTSOpsHeapTuple);
-	estate = CreateExecutorState();
-	relinfo = bdr_create_result_rel_info(queuedcmds);
-	ExecOpenIndices(relinfo, false);
+	if (cache_usable && queue_cached_rel != NULL)
+	{
+		queuedcmds = queue_cached_rel;
+		estate = queue_cached_estate;
+		relinfo = queue_cached_relinfo;
+		slot = queue_cached_slot;
+	}
+	else
+	{
+		RangeVar   *rv;
+		MemoryContext oldcontext = NULL;
+
+		/*
+		 * When caching, everything must survive the current statement;
+		 * the transaction callback cleans it up.
+		 */
+		if (cache_usable)
+			oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+
+		rv = makeRangeVar("bdr", "bdr_queued_commands", -1);
+		queuedcmds = table_openrv(rv, RowExclusiveLock);
+		slot = MakeSingleTupleTableSlot(RelationGetDescr(queuedcmds), &TTSOpsHeapTuple);
+		estate = CreateExecutorState();
+		relinfo = bdr_create_result_rel_info(queuedcmds);
+		ExecOpenIndices(relinfo, false);
+
+		if (cache_usable)
+		{
+			MemoryContextSwitchTo(oldcontext);
+
+			queue_cached_rel = queuedcmds;
+			queue_cached_estate = estate;
+			queue_cached_relinfo = relinfo;
+			queue_cached_slot = slot;
+
+			if (!queue_xact_callback_registered)
+			{
+				RegisterXactCallback(bdr_queue_xact_callback, NULL);
+				queue_xact_callback_registered = true;
+			}
+		}
+	}
 
 	/* lsn, queued_at, perpetrator, command_tag, command */
 	MemSet(nulls, 0, sizeof(nulls));
@@ -89,9 +175,12 @@ bdr_queue_ddl_command(const char *command_tag, const char *command, const char *
 	ExecStoreHeapTuple(newtup, slot, false);
 	UserTableUpdateOpenIndexes(estate, relinfo, slot, false, false);
 
-	ExecCloseIndices(relinfo);
-	ExecDropSingleTupleTableSlot(slot);
-	table_close(queuedcmds, RowExclusiveLock);
+	if (!cache_usable)
+	{
+		ExecCloseIndices(relinfo);
+		ExecDropSingleTupleTableSlot(slot);
+		table_close(queuedcmds, RowExclusiveLock);
+	}
 }
 
 /*
@@ -239,6 +239,14 @@ bdr_start_truncate(void)
 
 /*
  * Write the list of truncated tables to the replication queue.
+ *
+ * One queue entry covers the entire originating statement: the TRUNCATE
+ * trigger fires once per affected table - including tables pulled in by
+ * CASCADE and partition recursion - and only appends to the list, so a
+ * truncate spanning hundreds of relations still queues a single
+ * multi-relation TRUNCATE here. Replaying it downstream is then one
+ * statement that acquires all its locks in the same order the origin
+ * listed them, rather than one queued statement and lock cycle per table.
  */
 void
 bdr_finish_truncate(void)
@@ -21,6 +21,7 @@
 #include "access/heapam.h"
 #include "access/tableam.h"
 #include "access/genam.h"
+#include "access/relscan.h"
 #include "access/skey.h"
 #include "access/xact.h"
 
@@ -87,6 +88,18 @@ UserTableUpdateIndexes(EState *estate, ResultRelInfo *resultRelInfo, TupleTableS
 	ExecCloseIndices(resultRelInfo);
 }
 
+/*
+ * Insert index entries for a tuple we just wrote to the heap directly.
+ *
+ * Note that for a non-HOT update there is no such thing as "only updating
+ * the indexes whose columns changed": the new row version has a new TID,
+ * so every index needs an entry pointing at it or index scans would miss
+ * the row. The cases where index maintenance legitimately can be skipped
+ * are already covered - heap_update compares the old and new tuples and
+ * produces a HOT update when no indexed column changed (we return early on
+ * those below), and summarizing-only maintenance is requested by callers
+ * via 'onlySummarizing' when the tableam reports TU_Summarizing.
+ */
 void
 UserTableUpdateOpenIndexes(EState *estate, ResultRelInfo *resultRelInfo, TupleTableSlot *slot, bool update, bool onlySummarizing)
 {
@@ -157,33 +170,57 @@ build_index_scan_keys(ResultRelInfo *relinfo, ScanKey *scan_keys, BDRTupleData *
 }
 
 /*
- * Setup a ScanKey for a search in the relation 'rel' for a tuple 'key' that
- * is setup to match 'rel' (*NOT* idxrel!).
+ * Build scan key templates for every usable (unique, non-expression) index
+ * of the relation, doing the operator class and opcode lookups once. Each
+ * row then only has to fill in its key values with
+ * refresh_index_scan_key().
  *
- * Returns whether any column contains NULLs.
+ * Returns a palloc'd array with one entry per open index; entries for
+ * unusable indexes are NULL.
  */
-bool
-build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, BDRTupleData *tup)
+ScanKey *
+build_index_scan_key_templates(ResultRelInfo *relinfo)
+{
+	ScanKey	   *scan_keys;
+	int			i;
+
+	scan_keys = palloc0(relinfo->ri_NumIndices * sizeof(ScanKeyData *));
+
+	for (i = 0; i < relinfo->ri_NumIndices; i++)
+	{
+		IndexInfo  *ii = relinfo->ri_IndexRelationInfo[i];
+
+		if (!ii->ii_Unique || ii->ii_Expressions != NIL)
+			continue;
+
+		scan_keys[i] = palloc(ii->ii_NumIndexAttrs * sizeof(ScanKeyData));
+		build_index_scan_key_template(scan_keys[i],
+									  relinfo->ri_RelationDesc,
+									  relinfo->ri_IndexRelationDescs[i]);
+	}
+
+	return scan_keys;
+}
+
+/*
+ * Set up everything about a ScanKey for an equality search in 'idxrel'
+ * except the key values, which differ per searched-for tuple and are
+ * filled in by refresh_index_scan_key().
+ */
+void
+build_index_scan_key_template(ScanKey skey, Relation rel, Relation idxrel)
 {
 	int			attoff;
 	Datum		indclassDatum;
-	Datum		indkeyDatum;
 	bool		isnull;
 	oidvector  *opclass;
-	int2vector  *indkey;
-	bool		hasnulls = false;
+	int2vector *indkey = &idxrel->rd_index->indkey;
 
 	indclassDatum = SysCacheGetAttr(INDEXRELID, idxrel->rd_indextuple,
 									Anum_pg_index_indclass, &isnull);
 	Assert(!isnull);
 	opclass = (oidvector *) DatumGetPointer(indclassDatum);
 
-	indkeyDatum = SysCacheGetAttr(INDEXRELID, idxrel->rd_indextuple,
-									Anum_pg_index_indkey, &isnull);
-	Assert(!isnull);
-	indkey = (int2vector *) DatumGetPointer(indkeyDatum);
-
-
 	for (attoff = 0; attoff < RelationGetNumberOfAttributes(idxrel); attoff++)
 	{
 		Oid			operator;
@@ -212,43 +249,112 @@ build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, BDRTupleData *
 					pkattno,
 					BTEqualStrategyNumber,
 					regop,
-					tup->values[mainattno - 1]);
+					(Datum) 0);
+	}
+}
+
+/*
+ * Fill a scan key template built by build_index_scan_key_template() with
+ * the values of the tuple 'tup', which is laid out to match the indexed
+ * relation (*NOT* idxrel!).
+ *
+ * Returns whether any key column contains NULLs.
+ */
+bool
+refresh_index_scan_key(ScanKey skey, Relation idxrel, BDRTupleData *tup)
+{
+	int			attoff;
+	int2vector *indkey = &idxrel->rd_index->indkey;
+	bool		hasnulls = false;
+
+	for (attoff = 0; attoff < RelationGetNumberOfAttributes(idxrel); attoff++)
+	{
+		int			mainattno = indkey->values[attoff];
+
+		skey[attoff].sk_argument = tup->values[mainattno - 1];
 
 		if (tup->isnull[mainattno - 1])
 		{
 			hasnulls = true;
 			skey[attoff].sk_flags |= SK_ISNULL;
 		}
+		else
+			skey[attoff].sk_flags &= ~SK_ISNULL;
 	}
 	return hasnulls;
 }
 
+/*
+ * Setup a ScanKey for a search in the relation 'rel' for a tuple 'key' that
+ * is setup to match 'rel' (*NOT* idxrel!).
+ *
+ * Returns whether any column contains NULLs.
+ */
+bool
+build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, BDRTupleData *tup)
+{
+	build_index_scan_key_template(skey, rel, idxrel);
+	return refresh_index_scan_key(skey, idxrel, tup);
+}
+
 /*
  * Search the index 'idxrel' for a tuple identified by 'skey' in 'rel'.
  *
  * If a matching tuple is found setup 'tid' to point to it and return true,
  * false is returned otherwise.
  *
+ * If 'scan_cache' is non-NULL it keeps the IndexScanDesc (and its snapshot)
+ * alive across calls: the first lookup begins the scan, later ones just
+ * refresh the snapshot and rescan, so a remote transaction touching many
+ * rows of one table pays the scan setup once rather than per row. A cached
+ * scan must be closed with index_endscan() before its relation or index is
+ * closed; the apply worker does that when releasing its relation handle.
+ * With a NULL 'scan_cache' the scan is begun and ended within this call,
+ * as before.
+ *
  * Populates 'slot' with a materialized copy of the found tuple in the memory
  * context of the passed slot.
  */
 bool
 find_pkey_tuple(ScanKey skey, BDRRelation *rel, Relation idxrel,
-				TupleTableSlot *slot, bool lock, LockTupleMode mode)
+				IndexScanDesc *scan_cache, TupleTableSlot *slot,
+				bool lock, LockTupleMode mode)
 {
 	bool		found;
 	IndexScanDesc scan;
-	SnapshotData snap;
+	Snapshot	snap;
+	SnapshotData stack_snap;
 	TransactionId xwait;
 
-	InitDirtySnapshot(snap);
+	if (scan_cache != NULL && *scan_cache != NULL)
+	{
+		scan = *scan_cache;
+		snap = scan->xs_snapshot;
+	}
+	else
+	{
+		/*
+		 * A cached scan outlives this call, so its snapshot must too;
+		 * allocate it in the caller's context alongside the scan itself.
+		 */
+		if (scan_cache != NULL)
+			snap = (Snapshot) palloc(sizeof(SnapshotData));
+		else
+			snap = &stack_snap;
+
+		scan = index_beginscan(rel->rel, idxrel,
+							   snap,
+							   RelationGetNumberOfAttributes(idxrel),
+							   0);
+
+		if (scan_cache != NULL)
+			*scan_cache = scan;
+	}
+
+	InitDirtySnapshot(*snap);
 
 retry:
 	found = false;
-	scan = index_beginscan(rel->rel, idxrel,
-						   &snap,
-						   RelationGetNumberOfAttributes(idxrel),
-						   0);
 	index_rescan(scan, skey, RelationGetNumberOfAttributes(idxrel), NULL, 0);
 
 	if (index_getnext_slot(scan, ForwardScanDirection, slot))
@@ -256,12 +362,11 @@ retry:
 		found = true;
 		ExecMaterializeSlot(slot);
 
-		xwait = TransactionIdIsValid(snap.xmin) ?  snap.xmin : snap.xmax;
+		xwait = TransactionIdIsValid(snap->xmin) ? snap->xmin : snap->xmax;
 
 		if (TransactionIdIsValid(xwait))
 		{
 			XactLockTableWait(xwait, NULL, NULL, XLTW_None);
-			index_endscan(scan);
 			goto retry;
 		}
 	}
@@ -295,7 +400,6 @@ retry:
 				ereport(LOG,
 						(errcode(ERRCODE_T_R_SERIALIZATION_FAILURE),
 						 errmsg("concurrent update, retrying")));
-				index_endscan(scan);
 				goto retry;
 			default:
 				elog(ERROR, "unexpected TM_Result after locking: %u", res);
@@ -303,11 +407,47 @@ retry:
 		}
 	}
 
-	index_endscan(scan);
+	if (scan_cache == NULL)
+		index_endscan(scan);
 
 	return found;
 }
 
+/*
+ * Issue an asynchronous read request for the heap block of the tuple
+ * identified by 'skey', without fetching the tuple itself.
+ *
+ * This is a best-effort hint used by the apply worker's readahead window to
+ * overlap I/O for upcoming pkey lookups with apply of the current change; a
+ * later find_pkey_tuple() with the same key then finds the blocks already in
+ * (or on the way into) shared buffers. We read the index leaf synchronously
+ * to learn the heap TID, which is cheap compared to the random heap fetch,
+ * and deliberately skip the lock/xwait dance - the real lookup repeats it
+ * all with full checking.
+ */
+void
+prefetch_pkey_tuple(ScanKey skey, BDRRelation *rel, Relation idxrel)
+{
+	IndexScanDesc scan;
+	SnapshotData snap;
+	ItemPointer tid;
+
+	InitDirtySnapshot(snap);
+
+	scan = index_beginscan(rel->rel, idxrel,
+						   &snap,
+						   RelationGetNumberOfAttributes(idxrel),
+						   0);
+	index_rescan(scan, skey, RelationGetNumberOfAttributes(idxrel), NULL, 0);
+
+	tid = index_getnext_tid(scan, ForwardScanDirection);
+	if (tid != NULL)
+		PrefetchBuffer(rel->rel, MAIN_FORKNUM,
+					   ItemPointerGetBlockNumber(tid));
+
+	index_endscan(scan);
+}
+
 void
 bdr_node_set_read_only_internal(char *node_name, bool read_only, bool force)
 {
@@ -382,6 +522,16 @@ bdr_node_set_read_only_internal(char *node_name, bool read_only, bool force)
 	/* now release lock again,  */
 	table_close(rel, RowExclusiveLock);
 
+	/*
+	 * Retire the cached scalars right away so backends notice the new
+	 * read-only state on their next query, rather than only once the perdb
+	 * worker gets around to rescanning. A backend that revalidates before we
+	 * commit can re-publish the old value, but the perdb worker invalidates
+	 * again after acting on bdr_connections_changed(), which bounds that
+	 * window to what it always was.
+	 */
+	bdr_nodecache_invalidate();
+
 	bdr_connections_changed(NULL);
 }
 
@@ -457,8 +607,37 @@ BdrExecutorStart(QueryDesc *queryDesc, int eflags)
 
 	read_only_node = bdr_local_node_read_only() && !bdr_permit_unsafe_commands;
 
-	/* check for concurrent global DDL locks */
-	bdr_locks_check_dml();
+	/*
+	 * Collect the relations this statement writes to or row-locks so the
+	 * DDL lock check can ignore write locks scoped to unrelated relations.
+	 */
+	{
+		List	   *target_relids = NIL;
+
+		if (plannedstmt != NULL)
+		{
+			foreach(l, plannedstmt->resultRelations)
+			{
+				RangeTblEntry *rte = rt_fetch(lfirst_int(l), plannedstmt->rtable);
+
+				target_relids = lappend_oid(target_relids, rte->relid);
+			}
+
+			foreach(l, plannedstmt->rowMarks)
+			{
+				PlanRowMark	   *rm = (PlanRowMark *) lfirst(l);
+				RangeTblEntry  *rte = rt_fetch(rm->rti, plannedstmt->rtable);
+
+				if (rte->rtekind == RTE_RELATION)
+					target_relids = lappend_oid(target_relids, rte->relid);
+			}
+		}
+
+		/* check for concurrent global DDL locks */
+		bdr_locks_check_dml(target_relids);
+
+		list_free(target_relids);
+	}
 
 	/*
 	 * Are we in bdr.replicate_ddl_command? If so, it's not safe to do DML,
@@ -91,6 +91,25 @@ static PGconn		*remote_conn = NULL;
 /* static so print_msg etc can easily use it */
 static char	   *node_name = NULL;
 
+/* how many databases to run per-database setup steps for at once (--jobs) */
+static int		init_jobs = 1;
+
+/* set in forked worker children so die() leaves cleanup to the parent */
+static bool		in_worker_child = false;
+
+/*
+ * Join state shared with the per-database worker tasks forked from main(),
+ * static so the tasks don't each need a context struct threaded through.
+ */
+static RemoteInfo  *remote_info;
+static NodeInfo		node_info;
+static char		   *local_connstr = NULL;
+static char		   *remote_connstr = NULL;
+static char		   *replication_sets = NULL;
+static char		   *remote_lsn = NULL;
+static int			apply_delay = 0;
+static bool			drop_unreplicated_dbs = false;
+
 static void signal_handler(int sig);
 static void usage(void);
 static void BDR_NORETURN finish_die();
@@ -109,6 +128,12 @@ static char *validate_replication_set_input(char *replication_sets);
 
 static void initialize_node_entry(PGconn **conn, NodeInfo *ni, char *node_name,
 								  Oid dboid, char *remote_connstr, char *local_connstr);
+static void initialize_remote_db(int dbidx);
+static void cleanup_local_db(int dbidx);
+static void drop_unreplicated_databases(void);
+static void initialize_local_db(int dbidx);
+static void run_perdb_tasks(void (*task)(int dbidx));
+static void wait_for_worker(void);
 static void remove_unwanted_files(void);
 static void remove_unwanted_data(PGconn *conn);
 static void reset_bdr_sequence_cache(PGconn *conn);
@@ -169,27 +194,20 @@ main(int argc, char **argv)
 {
 	int	i;
 	int	c;
-	RemoteInfo *remote_info;
-	NodeInfo	node_info;
 	char		restore_point_name[NAMEDATALEN];
-	char	   *remote_lsn;
 	bool		stop = false;
 	int			optindex;
-	char	   *local_connstr = NULL;
 	char	   *local_dbhost = NULL,
 			   *local_dbport = NULL,
 			   *local_dbuser = NULL;
-	char	   *remote_connstr = NULL;
 	char	   *remote_dbhost = NULL,
 			   *remote_dbport = NULL,
 			   *remote_dbuser = NULL;
 	char	   *postgresql_conf = NULL,
 			   *pg_hba_conf = NULL;
-	char	   *replication_sets = NULL;
 	bool		use_existing_data_dir;
 	int			pg_ctl_ret,
 				logfd;
-	int			apply_delay = 0;
 #define PG_CTL_CMD_BUF_SIZE 1000
 	char pg_ctl_cmd_buf[PG_CTL_CMD_BUF_SIZE];
 
@@ -201,6 +219,7 @@ main(int argc, char **argv)
 		{"remote-host", required_argument, NULL, 'h'},
 		{"remote-port", required_argument, NULL, 'p'},
 		{"remote-user", required_argument, NULL, 'U'},
+		{"jobs", required_argument, NULL, 'j'},
 		{"local-dbname", required_argument, NULL, 2},
 		{"local-host", required_argument, NULL, 3},
 		{"local-port", required_argument, NULL, 4},
@@ -210,6 +229,7 @@ main(int argc, char **argv)
 		{"hba-conf", required_argument, NULL, 7},
 		{"stop", no_argument, NULL, 's'},
 		{"replication-sets", required_argument, NULL, 8},
+		{"drop-unreplicated-databases", no_argument, NULL, 9},
 		{NULL, 0, NULL, 0}
 	};
 
@@ -232,7 +252,7 @@ main(int argc, char **argv)
 	}
 
 	/* Option parsing and validation */
-	while ((c = getopt_long(argc, argv, "D:d:h:l:n:p:sU:vy:", long_options, &optindex)) != -1)
+	while ((c = getopt_long(argc, argv, "D:d:h:j:l:n:p:sU:vy:", long_options, &optindex)) != -1)
 	{
 		switch (c)
 		{
@@ -245,6 +265,14 @@ main(int argc, char **argv)
 			case 'h':
 				remote_dbhost = pg_strdup(optarg);
 				break;
+			case 'j':
+				{
+					char *endptr = NULL;
+					init_jobs = strtol(optarg, &endptr, 10);
+					if (*endptr != '\0' || init_jobs < 1)
+						die(_("could not parse '%s' as a positive integer for jobs"), optarg);
+					break;
+				}
 			case 'l':
 				if (strchr(optarg, '\'') != NULL)
 					die(_("log file name may not contain a single quote character"));
@@ -299,6 +327,9 @@ main(int argc, char **argv)
 			case 8:
 				replication_sets = validate_replication_set_input(optarg);
 				break;
+			case 9:
+				drop_unreplicated_dbs = true;
+				break;
 			case 's':
 				stop = true;
 				break;
@@ -401,37 +432,7 @@ main(int argc, char **argv)
 	 * The remote might have multiple BDR-enabled DBs, so we
 	 * need to perform setup for each one.
 	 */
-	for (i = 0; i < remote_info->numdbs; i++)
-	{
-		char *dbname = remote_info->dbnames[i];
-		char *db_local_connstr = get_connstr(local_connstr, dbname,
-											 NULL, NULL, NULL);
-		char *db_remote_connstr = get_connstr(remote_connstr, dbname,
-											  NULL, NULL, NULL);
-
-		remote_conn = connectdb(db_remote_connstr);
-
-		/*
-		 * Create replication slots on remote node.
-		 */
-		print_msg(VERBOSITY_NORMAL,
-				  _(" %s: creating replication slot ...\n"), dbname);
-		initialize_replication_slot(remote_conn, &node_info,
-									remote_info->dboids[i]);
-
-		/*
-		 * Create node entry for future local node.
-		 */
-		print_msg(VERBOSITY_NORMAL,
-				  _(" %s: creating node entry for local node ...\n"), dbname);
-		initialize_node_entry(&remote_conn, &node_info, node_name,
-							  remote_info->dboids[i],
-							  db_remote_connstr, db_local_connstr);
-
-		/* Don't hold connection since the next step might take long time. */
-		PQfinish(remote_conn);
-		remote_conn = NULL;
-	}
+	run_perdb_tasks(initialize_remote_db);
 
 	/*
 	 * Create basebackup or use existing one
@@ -492,19 +493,16 @@ main(int argc, char **argv)
 	/*
 	 * Clean any per-node data that were copied by pg_basebackup.
 	 */
-	for (i = 0; i < remote_info->numdbs; i++)
-	{
-		char *dbname = remote_info->dbnames[i];
-		char *db_connstr = get_connstr(local_connstr, dbname,
-									   NULL, NULL, NULL);
-
-		local_conn = connectdb(db_connstr);
-
-		remove_unwanted_data(local_conn);
+	run_perdb_tasks(cleanup_local_db);
 
-		PQfinish(local_conn);
-		local_conn = NULL;
-	}
+	/*
+	 * The base backup carried every database on the source cluster, not just
+	 * the BDR-enabled ones. If asked to, drop the rest now, while the node is
+	 * still running without BDR loaded so neither DDL replication nor the
+	 * command filter get involved.
+	 */
+	if (drop_unreplicated_dbs)
+		drop_unreplicated_databases();
 
 	/* Stop Postgres so we can reset system id and start it with BDR loaded. */
 	pg_ctl_ret = run_pg_ctl("stop");
@@ -540,48 +538,7 @@ main(int argc, char **argv)
 		die(_("postgres restart with bdr enabled failed with %d. See '%s'."), pg_ctl_ret, log_file_name);
 	wait_postmaster_connection(local_connstr);
 
-	for (i = 0; i < remote_info->numdbs; i++)
-	{
-		char *dbname = remote_info->dbnames[i];
-		char *db_local_connstr = get_connstr(local_connstr, dbname,
-											 NULL, NULL, NULL);
-		char *db_remote_connstr = get_connstr(remote_connstr, dbname,
-											  NULL, NULL, NULL);
-
-		if (replication_sets == NULL)
-			replication_sets = remote_info->replication_sets[i];
-
-		local_conn = connectdb(db_local_connstr);
-
-		/*
-		 * Clean the sequence amdata cache which was copied from the remote
-		 * server verbatim but isn't valid on the new node and would cause
-		 * duplicate values being returned by the sequence on both servers.
-		 */
-		reset_bdr_sequence_cache(local_conn);
-
-		/*
-		 * Create the identifier which is setup with the position to which we
-		 * already caught up using physical replication.
-		 */
-		print_msg(VERBOSITY_VERBOSE,
-				  _(" %s: creating replication identifier ...\n"), dbname);
-		initialize_replication_identifier(local_conn, &node_info,
-										  remote_info->dboids[i], remote_lsn);
-
-		/*
-		 * And finally add the node to the cluster.
-		 */
-		print_msg(VERBOSITY_NORMAL,
-				  _(" %s: adding the database to BDR cluster ...\n"), dbname);
-		print_msg(VERBOSITY_VERBOSE,
-				  _(" %s: replication sets: %s"), dbname, replication_sets);
-		bdr_node_start(local_conn, node_name, db_remote_connstr,
-					   db_local_connstr, replication_sets, apply_delay);
-
-		PQfinish(local_conn);
-		local_conn = NULL;
-	}
+	run_perdb_tasks(initialize_local_db);
 
 	/* If user does not want the node to be running at the end, stop it. */
 	if (stop)
@@ -613,9 +570,14 @@ usage(void)
 	printf(_("                          can be either empty/non-existing directory,\n"));
 	printf(_("                          or directory populated using pg_basebackup -X stream\n"));
 	printf(_("                          command\n"));
+	printf(_("  -j, --jobs=NUM          number of databases to set up concurrently,\n"));
+	printf(_("                          default 1\n"));
 	printf(_("  -l, --log-file          log file name, default bdr_init_copy_postgres.log\n"));
 	printf(_("  -n, --node-name=NAME    name of the newly created node\n"));
 	printf(_("  --replication-sets=SETS comma separated list of replication set names to use\n"));
+	printf(_("  --drop-unreplicated-databases\n"));
+	printf(_("                          drop copied databases that aren't BDR-enabled on\n"));
+	printf(_("                          the source node\n"));
 	printf(_("  -s, --stop              stop the server once the initialization is done\n"));
 	printf(_("  -v                      increase logging verbosity\n"));
 	printf(_("\nConfiguration files override:\n"));
@@ -646,6 +608,13 @@ finish_die()
 	if (remote_conn)
 		PQfinish(remote_conn);
 
+	/*
+	 * Forked per-database workers just report failure through their exit
+	 * status; stopping the postmaster is the parent's job.
+	 */
+	if (in_worker_child)
+		exit(1);
+
 	if (get_pgpid())
 	{
 		if (!run_pg_ctl("stop -s"))
@@ -1267,6 +1236,265 @@ initialize_node_entry(PGconn **conn, NodeInfo *ni, char* node_name, Oid dboid,
 	destroyPQExpBuffer(query);
 }
 
+/*
+ * Per-database setup on the remote node: create the replication slot we'll
+ * replay from and register the future local node in bdr.bdr_nodes.
+ */
+static void
+initialize_remote_db(int dbidx)
+{
+	char *dbname = remote_info->dbnames[dbidx];
+	char *db_local_connstr = get_connstr(local_connstr, dbname,
+										 NULL, NULL, NULL);
+	char *db_remote_connstr = get_connstr(remote_connstr, dbname,
+										  NULL, NULL, NULL);
+
+	remote_conn = connectdb(db_remote_connstr);
+
+	/*
+	 * Create replication slots on remote node.
+	 */
+	print_msg(VERBOSITY_NORMAL,
+			  _(" %s: creating replication slot ...\n"), dbname);
+	initialize_replication_slot(remote_conn, &node_info,
+								remote_info->dboids[dbidx]);
+
+	/*
+	 * Create node entry for future local node.
+	 */
+	print_msg(VERBOSITY_NORMAL,
+			  _(" %s: creating node entry for local node ...\n"), dbname);
+	initialize_node_entry(&remote_conn, &node_info, node_name,
+						  remote_info->dboids[dbidx],
+						  db_remote_connstr, db_local_connstr);
+
+	/* Don't hold connection since the next step might take long time. */
+	PQfinish(remote_conn);
+	remote_conn = NULL;
+}
+
+/*
+ * Per-database cleanup of node-specific data copied by pg_basebackup.
+ */
+static void
+cleanup_local_db(int dbidx)
+{
+	char *dbname = remote_info->dbnames[dbidx];
+	char *db_connstr = get_connstr(local_connstr, dbname,
+								   NULL, NULL, NULL);
+
+	local_conn = connectdb(db_connstr);
+
+	remove_unwanted_data(local_conn);
+
+	PQfinish(local_conn);
+	local_conn = NULL;
+}
+
+/*
+ * Drop the databases that came along with the base backup but aren't
+ * BDR-enabled on the source node (--drop-unreplicated-databases).
+ *
+ * This must run while the node is up with BDR disabled: no BDR workers hold
+ * connections to the victim databases yet and the command filter isn't
+ * loaded. Template databases are kept, as is whatever database the local
+ * connection string names, since we still need it to talk to the node.
+ */
+static void
+drop_unreplicated_databases(void)
+{
+	char	   *db_connstr = get_connstr(local_connstr,
+										 remote_info->dbnames[0],
+										 NULL, NULL, NULL);
+	char	   *keep_dbname = NULL;
+	PQconninfoOption *opts;
+	PQExpBuffer		query = createPQExpBuffer();
+	PGresult	   *res;
+	int				i;
+
+	/* Whatever database the local connstr points at must survive. */
+	opts = PQconninfoParse(local_connstr, NULL);
+	if (opts != NULL)
+	{
+		PQconninfoOption *opt;
+
+		for (opt = opts; opt->keyword != NULL; opt++)
+		{
+			if (strcmp(opt->keyword, "dbname") == 0 && opt->val != NULL)
+				keep_dbname = pg_strdup(opt->val);
+		}
+		PQconninfoFree(opts);
+	}
+
+	local_conn = connectdb(db_connstr);
+
+	printfPQExpBuffer(query,
+					  "SELECT datname FROM pg_catalog.pg_database\n"
+					  " WHERE NOT datistemplate\n"
+					  "   AND datname <> current_database()\n");
+	if (keep_dbname != NULL)
+		appendPQExpBuffer(query, "   AND datname <> %s\n",
+						  PQescapeLiteral(local_conn, keep_dbname,
+										  strlen(keep_dbname)));
+	for (i = 0; i < remote_info->numdbs; i++)
+		appendPQExpBuffer(query, "   AND datname <> %s\n",
+						  PQescapeLiteral(local_conn,
+										  remote_info->dbnames[i],
+										  strlen(remote_info->dbnames[i])));
+
+	res = PQexec(local_conn, query->data);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		die(_("Could not list databases: %s\n"), PQerrorMessage(local_conn));
+
+	for (i = 0; i < PQntuples(res); i++)
+	{
+		char	   *datname = PQgetvalue(res, i, 0);
+		PGresult   *dropres;
+
+		print_msg(VERBOSITY_NORMAL,
+				  _(" %s: dropping database not replicated by BDR ...\n"),
+				  datname);
+
+		printfPQExpBuffer(query, "DROP DATABASE %s;",
+						  PQescapeIdentifier(local_conn, datname,
+											 strlen(datname)));
+		dropres = PQexec(local_conn, query->data);
+		if (PQresultStatus(dropres) != PGRES_COMMAND_OK)
+			die(_("Could not drop database \"%s\": %s\n"),
+				datname, PQerrorMessage(local_conn));
+		PQclear(dropres);
+	}
+	PQclear(res);
+	destroyPQExpBuffer(query);
+
+	PQfinish(local_conn);
+	local_conn = NULL;
+}
+
+/*
+ * Per-database setup on the local node once it's running with BDR loaded:
+ * set up the replication origin and join the database to the BDR cluster.
+ */
+static void
+initialize_local_db(int dbidx)
+{
+	char *dbname = remote_info->dbnames[dbidx];
+	char *db_local_connstr = get_connstr(local_connstr, dbname,
+										 NULL, NULL, NULL);
+	char *db_remote_connstr = get_connstr(remote_connstr, dbname,
+										  NULL, NULL, NULL);
+	char *db_replication_sets = replication_sets;
+
+	if (db_replication_sets == NULL)
+		db_replication_sets = remote_info->replication_sets[dbidx];
+
+	local_conn = connectdb(db_local_connstr);
+
+	/*
+	 * Clean the sequence amdata cache which was copied from the remote
+	 * server verbatim but isn't valid on the new node and would cause
+	 * duplicate values being returned by the sequence on both servers.
+	 */
+	reset_bdr_sequence_cache(local_conn);
+
+	/*
+	 * Create the identifier which is setup with the position to which we
+	 * already caught up using physical replication.
+	 */
+	print_msg(VERBOSITY_VERBOSE,
+			  _(" %s: creating replication identifier ...\n"), dbname);
+	initialize_replication_identifier(local_conn, &node_info,
+									  remote_info->dboids[dbidx], remote_lsn);
+
+	/*
+	 * And finally add the node to the cluster.
+	 */
+	print_msg(VERBOSITY_NORMAL,
+			  _(" %s: adding the database to BDR cluster ...\n"), dbname);
+	print_msg(VERBOSITY_VERBOSE,
+			  _(" %s: replication sets: %s"), dbname, db_replication_sets);
+	bdr_node_start(local_conn, node_name, db_remote_connstr,
+				   db_local_connstr, db_replication_sets, apply_delay);
+
+	PQfinish(local_conn);
+	local_conn = NULL;
+}
+
+/*
+ * Reap one per-database worker, dying if it reported failure. The child
+ * will already have printed the details via die().
+ */
+static void
+wait_for_worker(void)
+{
+	int			status;
+	pid_t		pid;
+
+	pid = wait(&status);
+	if (pid < 0)
+		die(_("could not wait for worker process: %s\n"), strerror(errno));
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		die(_("a per-database setup worker failed, see above for details\n"));
+}
+
+/*
+ * Run a per-database setup step for all BDR-enabled databases, working on up
+ * to init_jobs databases at once.
+ *
+ * The setup steps are dominated by round trips to the server rather than by
+ * local work, so on many-database installs running them concurrently cuts
+ * the join time roughly by the job count.
+ *
+ * Concurrency uses forked worker children so the sequential helpers above
+ * can be reused unchanged; a task that fails die()s in its child and the
+ * nonzero exit status is converted back into a die() here. With --jobs=1
+ * (the default) no children are forked at all.
+ */
+static void
+run_perdb_tasks(void (*task)(int dbidx))
+{
+	int			i;
+	int			running = 0;
+
+	for (i = 0; i < remote_info->numdbs; i++)
+	{
+		pid_t		pid;
+
+		if (init_jobs <= 1)
+		{
+			task(i);
+			continue;
+		}
+
+		if (running >= init_jobs)
+		{
+			wait_for_worker();
+			running--;
+		}
+
+		fflush(stdout);
+		pid = fork();
+		if (pid == 0)
+		{
+			in_worker_child = true;
+			task(i);
+			exit(0);
+		}
+		else if (pid < 0)
+			die(_("could not fork per-database setup worker: %s\n"),
+				strerror(errno));
+
+		running++;
+	}
+
+	while (running > 0)
+	{
+		wait_for_worker();
+		running--;
+	}
+}
+
 
 /*
  * Clean all the data that was copied from remote node but we don't
@@ -61,6 +61,8 @@
 
 
 char *bdr_temp_dump_directory = NULL;
+int bdr_init_node_parallel_jobs = 1;
+bool bdr_init_node_streaming_load = false;
 
 static void bdr_init_exec_dump_restore(BDRNodeInfo *node,
 									   char *snapshot);
@@ -318,23 +320,37 @@ bdr_init_exec_dump_restore(BDRNodeInfo *node,
 	else if (pid == 0)
 	{
 		int n = 0;
-
-		char *const argv[] = {
-			bdr_init_replica_script_path,
-			"--snapshot", snapshot,
-			"--source", origin_dsn.data,
-			"--target", local_dsn.data,
-			"--tmp-directory", tmpdir,
-			"--pg-dump-path", bdr_dump_path,
-			"--pg-restore-path", bdr_restore_path,
-			NULL
-		};
+		char jobs[12];
+		char *argv[20];
+		int argn = 0;
+
+		snprintf(jobs, sizeof(jobs), "%d", bdr_init_node_parallel_jobs);
+
+		argv[argn++] = bdr_init_replica_script_path;
+		argv[argn++] = "--snapshot";
+		argv[argn++] = snapshot;
+		argv[argn++] = "--source";
+		argv[argn++] = origin_dsn.data;
+		argv[argn++] = "--target";
+		argv[argn++] = local_dsn.data;
+		argv[argn++] = "--tmp-directory";
+		argv[argn++] = tmpdir;
+		argv[argn++] = "--jobs";
+		argv[argn++] = jobs;
+		argv[argn++] = "--pg-dump-path";
+		argv[argn++] = bdr_dump_path;
+		argv[argn++] = "--pg-restore-path";
+		argv[argn++] = bdr_restore_path;
+		if (bdr_init_node_streaming_load)
+			argv[argn++] = "--stream";
+		argv[argn] = NULL;
 
 		ereport(LOG,
-				(errmsg("Creating replica with: %s --snapshot %s --source \"%s\" --target \"%s\" --tmp-directory \"%s\", --pg-dump-path \"%s\", --pg-restore-path \"%s\"",
+				(errmsg("Creating replica with: %s --snapshot %s --source \"%s\" --target \"%s\" --tmp-directory \"%s\", --jobs %s, --pg-dump-path \"%s\", --pg-restore-path \"%s\"%s",
 						bdr_init_replica_script_path, snapshot,
 						node->init_from_dsn, node->local_dsn, tmpdir,
-						bdr_dump_path, bdr_restore_path)));
+						jobs, bdr_dump_path, bdr_restore_path,
+						bdr_init_node_streaming_load ? ", --stream" : "")));
 
 		n = execv(bdr_init_replica_script_path, argv);
 		if (n < 0)
@@ -443,8 +459,8 @@ bdr_sync_nodes(PGconn *remote_conn, BDRNodeInfo *local_node)
 
 		/* Copy remote bdr_nodes entries to the local node. */
 		bdr_copytable(remote_conn, local_conn,
-					  "COPY (SELECT * FROM bdr.bdr_nodes) TO stdout",
-					  "COPY bdr.bdr_nodes FROM stdin");
+					  "COPY (SELECT * FROM bdr.bdr_nodes) TO stdout WITH (FORMAT binary)",
+					  "COPY bdr.bdr_nodes FROM stdin WITH (FORMAT binary)");
 
 		/* Copy the local entry to remote node. */
 		initStringInfo(&query);
@@ -454,11 +470,12 @@ bdr_sync_nodes(PGconn *remote_conn, BDRNodeInfo *local_node)
 		appendStringInfo(&query,
 						 "COPY (SELECT * FROM bdr.bdr_nodes WHERE "
 							"node_sysid = '%s' AND node_timeline = '%u' "
-							"AND node_dboid = '%u') TO stdout",
+							"AND node_dboid = '%u') TO stdout WITH (FORMAT binary)",
 						 sysid_str, local_node->id.timeline, local_node->id.dboid);
 
 		bdr_copytable(local_conn, remote_conn,
-					  query.data, "COPY bdr.bdr_nodes FROM stdin");
+					  query.data,
+					  "COPY bdr.bdr_nodes FROM stdin WITH (FORMAT binary)");
 
 		/*
 		 * Copy remote connections to the local node.
@@ -467,8 +484,8 @@ bdr_sync_nodes(PGconn *remote_conn, BDRNodeInfo *local_node)
 		 * because it triggers the connect-back process on the remote node(s).
 		 */
 		bdr_copytable(remote_conn, local_conn,
-					  "COPY (SELECT * FROM bdr.bdr_connections) TO stdout",
-					  "COPY bdr.bdr_connections FROM stdin");
+					  "COPY (SELECT * FROM bdr.bdr_connections) TO stdout WITH (FORMAT binary)",
+					  "COPY bdr.bdr_connections FROM stdin WITH (FORMAT binary)");
 
 		/* Save changes. */
 		res = PQexec(remote_conn, "COMMIT");
@@ -544,12 +561,31 @@ bdr_insert_remote_conninfo(PGconn *conn, BdrConnectionConfig *myconfig)
 #undef INTERNAL_NODE_JOIN_NPARAMS
 }
 
+/*
+ * Per-peer state for a CREATE_REPLICATION_SLOT dispatched by
+ * bdr_init_make_other_slots() whose reply hasn't been collected yet.
+ */
+typedef struct BdrPendingSlotCreation
+{
+	BdrConnectionConfig *cfg;
+	PGconn	   *conn;
+	NameData	slot_name;
+	BDRNodeId	remote;
+	char	   *remote_repident_name;
+} BdrPendingSlotCreation;
+
 /*
  * Find all connections other than our own using the copy of
  * bdr.bdr_connections that we acquired from the remote server during
  * apply. Apply workers won't be started yet, we're just making the
  * slots.
  *
+ * The slots are created concurrently: each CREATE_REPLICATION_SLOT waits
+ * for a consistent decoding snapshot to build on its peer, which on a busy
+ * node can take a long while, so the commands are all dispatched before any
+ * reply is collected and the total wait is bounded by the slowest peer
+ * instead of the sum of all of them.
+ *
  * If the slot already exists from a prior attempt we'll leave it
  * alone. It'll be advanced when we start replaying from it anyway,
  * and it's guaranteed to retain more than the WAL we need.
@@ -558,8 +594,13 @@ static void
 bdr_init_make_other_slots()
 {
 	List	   *configs;
+	List	   *pending = NIL;
 	ListCell   *lc;
 	MemoryContext old_context;
+	NameData	appname;
+	BDRNodeId	myid;
+
+	bdr_make_my_nodeid(&myid);
 
 	Assert(!IsTransactionState());
 	StartTransactionCommand();
@@ -568,51 +609,98 @@ bdr_init_make_other_slots()
 	MemoryContextSwitchTo(old_context);
 	CommitTransactionCommand();
 
+	snprintf(NameStr(appname), NAMEDATALEN, "%s:mkslot",
+			 bdr_get_my_cached_node_name());
+
+	/* First pass: connect everywhere and dispatch the slot commands */
 	foreach(lc, configs)
 	{
 		BdrConnectionConfig *cfg = lfirst(lc);
-		PGconn *conn;
-		NameData slot_name;
-		BDRNodeId remote, myid;
+		BdrPendingSlotCreation *pend;
 		RepOriginId replication_identifier;
-		char *snapshot;
-
-		bdr_make_my_nodeid(&myid);
+		bool		tx_started = false;
 
 		if (bdr_nodeid_eq(&cfg->remote_node, &myid))
 		{
 			/* Don't make a slot pointing to ourselves */
-			continue;
 			bdr_free_connection_config(cfg);
+			continue;
 		}
 
-		conn = bdr_establish_connection_and_slot(cfg->dsn, "mkslot", &slot_name,
-				&remote, &replication_identifier, &snapshot);
+		pend = palloc0(sizeof(BdrPendingSlotCreation));
+		pend->cfg = cfg;
+		pend->conn = bdr_connect(cfg->dsn, &appname, &pend->remote);
 
 		/* Ensure the slot points to the node the conn info says it should */
-		if (!bdr_nodeid_eq(&cfg->remote_node, &remote))
+		if (!bdr_nodeid_eq(&cfg->remote_node, &pend->remote))
 		{
 			ereport(ERROR,
 					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
 					 errmsg("System identification mismatch between connection and slot"),
 					 errdetail("Connection for "BDR_NODEID_FORMAT_WITHNAME" resulted in slot on node "BDR_NODEID_FORMAT_WITHNAME" instead of expected node",
 							   BDR_NODEID_FORMAT_WITHNAME_ARGS(cfg->remote_node),
-							   BDR_NODEID_FORMAT_WITHNAME_ARGS(remote))));
+							   BDR_NODEID_FORMAT_WITHNAME_ARGS(pend->remote))));
+		}
+
+		bdr_slot_name(&pend->slot_name, &myid, pend->remote.dboid);
+		pend->remote_repident_name = bdr_replident_name(&pend->remote, myid.dboid);
+		Assert(pend->remote_repident_name != NULL);
+
+		if (!IsTransactionState())
+		{
+			tx_started = true;
+			StartTransactionCommand();
 		}
+		replication_identifier = replorigin_by_name(pend->remote_repident_name, true);
+		if (tx_started)
+			CommitTransactionCommand();
+
+		if (OidIsValid(replication_identifier))
+		{
+			/* Slot and identifier survive from a prior attempt, nothing to do */
+			elog(DEBUG2, "Ensured existence of slot %s on "BDR_NODEID_FORMAT_WITHNAME,
+						 NameStr(pend->slot_name), BDR_NODEID_FORMAT_WITHNAME_ARGS(pend->remote));
+
+			PQfinish(pend->conn);
+			pfree(pend->remote_repident_name);
+			bdr_free_connection_config(cfg);
+			pfree(pend);
+			continue;
+		}
+
+		elog(DEBUG1, "Creating new slot %s", NameStr(pend->slot_name));
+		bdr_create_slot_send(pend->conn, &pend->slot_name);
+
+		pending = lappend(pending, pend);
+	}
+
+	/*
+	 * Second pass: collect the replies. Collecting in dispatch order is
+	 * fine; a peer that finishes out of turn just has its reply sitting in
+	 * the connection buffer by the time we get to it.
+	 */
+	foreach(lc, pending)
+	{
+		BdrPendingSlotCreation *pend = lfirst(lc);
+		RepOriginId replication_identifier;
 
 		/* We don't require the snapshot IDs here */
-		if (snapshot != NULL)
-			pfree(snapshot);
+		bdr_create_slot_finish(pend->conn, &pend->slot_name,
+							   pend->remote_repident_name,
+							   &replication_identifier, NULL);
 
 		/* No replication for now, just close the connection */
-		PQfinish(conn);
+		PQfinish(pend->conn);
 
 		elog(DEBUG2, "Ensured existence of slot %s on "BDR_NODEID_FORMAT_WITHNAME,
-					 NameStr(slot_name), BDR_NODEID_FORMAT_WITHNAME_ARGS(remote));
+					 NameStr(pend->slot_name), BDR_NODEID_FORMAT_WITHNAME_ARGS(pend->remote));
 
-		bdr_free_connection_config(cfg);
+		pfree(pend->remote_repident_name);
+		bdr_free_connection_config(pend->cfg);
+		pfree(pend);
 	}
 
+	list_free(pending);
 	list_free(configs);
 }
 
@@ -860,7 +948,7 @@ bdr_wait_for_local_node_ready()
 
 		rc = WaitLatch(&MyProc->procLatch,
 					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-					   1000, PG_WAIT_EXTENSION);
+					   1000, WAIT_EVENT_LOGICAL_SYNC_STATE_CHANGE);
 
 		ResetLatch(&MyProc->procLatch);
 
@@ -1012,10 +1100,11 @@ bdr_init_replica(BDRNodeInfo *local_node)
 				 * slot re-creation, dump/apply, etc, and pick up where we do
 				 * catchup.
 				 *
-				 * We won't know what the original catchup target point is, but we
-				 * can just catch up to whatever xlog position the server is
-				 * currently at, it's guaranteed to be later than the target
-				 * position.
+				 * If the previous attempt got far enough to record its catchup
+				 * target in our bdr.bdr_nodes entry we'll resume toward that
+				 * same position; otherwise we catch up to whatever xlog
+				 * position the server is currently at, which is guaranteed to
+				 * be later than the original target position.
 				 */
 				elog(DEBUG2, "dump applied, need to continue catchup");
 				break;
@@ -1181,9 +1270,25 @@ bdr_init_replica(BDRNodeInfo *local_node)
 			/*
 			 * Enter catchup mode and wait until we've replayed up to the LSN
 			 * the remote was at when we started catchup.
+			 *
+			 * If an earlier, interrupted attempt already recorded a target in
+			 * our bdr.bdr_nodes entry, resume toward that same position;
+			 * everything past it will be replayed by the regular per-node
+			 * apply workers once init completes. Otherwise compute the target
+			 * from the remote's current position and persist it so a restart
+			 * doesn't have to chase the remote's ever-advancing insert
+			 * position from scratch.
 			 */
-			elog(DEBUG3, "getting LSN to replay to in catchup mode");
-			min_remote_lsn = bdr_get_remote_lsn(nonrepl_init_conn);
+			min_remote_lsn = bdr_nodes_get_local_init_catchup_lsn();
+			if (min_remote_lsn == InvalidXLogRecPtr)
+			{
+				elog(DEBUG3, "getting LSN to replay to in catchup mode");
+				min_remote_lsn = bdr_get_remote_lsn(nonrepl_init_conn);
+				bdr_nodes_set_local_init_catchup_lsn(min_remote_lsn);
+			}
+			else
+				elog(DEBUG1, "resuming catchup to previously recorded target %X/%X",
+					 (uint32) (min_remote_lsn >> 32), (uint32) min_remote_lsn);
 
 			/*
 			 * Catchup cannot complete if there isn't at least one remote transaction
@@ -1209,9 +1314,10 @@ bdr_init_replica(BDRNodeInfo *local_node)
 			free_remote_node_info(&ri);
 
 			/*
-			 * We're done with catchup. The next phase is inserting our
-			 * conninfo, so set status=o
+			 * We're done with catchup; drop the recorded target. The next
+			 * phase is inserting our conninfo, so set status=o
 			 */
+			bdr_nodes_set_local_init_catchup_lsn(InvalidXLogRecPtr);
 			status = BDR_NODE_STATUS_CREATING_OUTBOUND_SLOTS;
 			bdr_nodes_set_local_status(status, BDR_NODE_STATUS_CATCHUP);
 			elog(DEBUG1, "catchup worker finished, requesting slot creation");
@@ -1416,7 +1522,7 @@ bdr_catchup_to_lsn(remote_node_info *ri, XLogRecPtr target_lsn)
 			int rc;
 			rc = WaitLatch(&MyProc->procLatch,
 						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-						   1000L, PG_WAIT_EXTENSION);
+						   1000L, WAIT_EVENT_BGWORKER_STARTUP);
 
 			ResetLatch(&MyProc->procLatch);
 
@@ -154,6 +154,7 @@
 
 #include "bdr_locks.h"
 #include "bdr_messaging.h"
+#include "bdr_probes.h"
 
 #include "fmgr.h"
 #include "funcapi.h"
@@ -169,11 +170,18 @@
 
 #include "commands/dbcommands.h"
 #include "catalog/indexing.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
 
 #include "executor/executor.h"
 
 #include "libpq/pqformat.h"
 
+#include "nodes/makefuncs.h"
+
+#include "port/atomics.h"
+
 #include "replication/message.h"
 #include "replication/origin.h"
 #include "replication/slot.h"
@@ -185,23 +193,35 @@
 #include "storage/procarray.h"
 #include "storage/shmem.h"
 #include "storage/sinvaladt.h"
+#include "storage/spin.h"
 
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/pg_lsn.h"
 #include "utils/rel.h"
 #include "utils/guc.h"
 #include "utils/snapmgr.h"
+#include "utils/timestamp.h"
 #include "pgstat.h"
 
 #define LOCKTRACE "DDL LOCK TRACE: "
 
+/*
+ * Number of log2(ms) buckets in the cumulative lock response latency
+ * histograms; bucket i counts responses that took less than 2^i ms, the
+ * final bucket everything slower.
+ */
+#define BDR_LOCK_LATENCY_BUCKETS 12
+
 extern Datum bdr_ddl_lock_info(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(bdr_ddl_lock_info);
 
 /* GUCs */
 bool bdr_permit_ddl_locking = false;
+bool bdr_relation_ddl_locks = false;
 /* -1 means use max_standby_streaming_delay */
 int bdr_max_ddl_lock_delay = -1;
 /* -1 means use lock_timeout/statement_timeout */
@@ -234,6 +254,12 @@ typedef struct BdrLocksDBState {
 	/* db this slot is reserved for */
 	Oid			dboid;
 
+	/*
+	 * Lock guarding this database's state, so lock traffic in one database
+	 * doesn't serialize against every other BDR-enabled database.
+	 */
+	LWLockId	lock;
+
 	/* number of nodes we're connected to */
 	int			nnodes;
 
@@ -246,6 +272,14 @@ typedef struct BdrLocksDBState {
 	 */
 	int			lockcount;
 
+	/*
+	 * Mirror of (lockcount > 0), maintained at every lockcount transition.
+	 * bdr_locks_check_dml() reads it without taking the per-database
+	 * lock, so the common no-lock-held case on the DML hot path costs a
+	 * single atomic read instead of an LWLock acquire/release.
+	 */
+	pg_atomic_uint32 lock_active;
+
 	/*
 	 * If the lock is held by a peer, the node ID of the peer.
 	 * InvalidRepOriginId represents the local node, like usual.
@@ -260,6 +294,15 @@ typedef struct BdrLocksDBState {
 	/* Type of lock held or being acquired */
 	BDRLockType	lock_type;
 
+	/*
+	 * Local oid of the relation a write lock is scoped to, or InvalidOid for
+	 * a whole-database lock. Only ever set when bdr.relation_ddl_locks is in
+	 * use; the scope is not persisted in bdr_global_locks, so a lock
+	 * reacquired after a restart reverts to whole-database, which is merely
+	 * stricter.
+	 */
+	Oid			lock_relid;
+
 	/*
 	 * Progress of lock acquisition. We need this so that if we set lock_type
 	 * then rollback a subxact, or if we start a lock upgrade, we know we're
@@ -276,11 +319,39 @@ typedef struct BdrLocksDBState {
 	XLogRecPtr	replay_confirmed_lsn;
 
 	Latch	   *requestor;
+
+	/*
+	 * Latch of the process draining conflicting local transactions for a
+	 * peer's write lock, so writing backends can wake it the moment their
+	 * transaction ends. Only valid while lock_state is
+	 * BDR_LOCKSTATE_PEER_CANCEL_XACTS.
+	 */
+	Latch	   *cancel_waiter;
+
+	/*
+	 * Acquisition timing, surfaced by bdr.bdr_locks. acquire_sent_at is when
+	 * this node last broadcast an acquire request, replay_requested_at when
+	 * it last asked peers to confirm replay. The last_* fields record the
+	 * most recent peer response; while an acquisition is stalled, whichever
+	 * node hasn't overwritten them yet is the laggard. The histograms
+	 * accumulate response latencies in log2(ms) buckets for the life of the
+	 * postmaster.
+	 */
+	TimestampTz	acquire_sent_at;
+	TimestampTz	replay_requested_at;
+	BDRNodeId	last_confirm_node;
+	int64		last_confirm_ms;
+	BDRNodeId	last_replay_node;
+	int64		last_replay_ms;
+	int64		confirm_latency_hist[BDR_LOCK_LATENCY_BUCKETS];
+	int64		replay_latency_hist[BDR_LOCK_LATENCY_BUCKETS];
+
 	slist_head	waiters;		/* list of waiting PGPROCs */
 } BdrLocksDBState;
 
 typedef struct BdrLocksCtl {
-	LWLockId			lock;
+	/* guards allocation of dbstate slots, not their contents */
+	LWLockId			allocation_lock;
 	BdrLocksDBState    *dbstate;
 	BDRLockWaiter	   *waiters;
 } BdrLocksCtl;
@@ -299,6 +370,11 @@ static void bdr_lock_state_xact_callback(XactEvent event, void *arg);
 
 static BdrLocksDBState * bdr_locks_find_database(Oid dbid, bool create);
 static void bdr_locks_find_my_database(bool create);
+static void bdr_locks_update_lock_active(void);
+static void bdr_locks_record_latency(TimestampTz sent_at,
+									 const BDRNodeId * const node,
+									 int64 *hist, BDRNodeId *last_node,
+									 int64 *last_ms);
 
 static char *bdr_lock_state_to_name(BDRLockState lock_state);
 
@@ -307,6 +383,7 @@ static void bdr_send_confirm_lock(void);
 
 static void bdr_locks_addwaiter(PGPROC *proc);
 static void bdr_locks_on_unlock(void);
+static void register_dml_end_xact_callback(void);
 static int ddl_lock_log_level(int);
 static void register_holder_xact_callback(void);
 static void register_state_xact_callback(void);
@@ -357,10 +434,22 @@ bdr_locks_shmem_startup(void)
 									&found);
 	if (!found)
 	{
+		LWLockPadded *locks = GetNamedLWLockTranche("bdr_locks");
+		int		i;
+
 		memset(bdr_locks_ctl, 0, bdr_locks_shmem_size());
-		bdr_locks_ctl->lock = &(GetNamedLWLockTranche("bdr_locks")->lock);
+		/* lock 0 guards slot allocation, locks 1..n are per-database */
+		bdr_locks_ctl->allocation_lock = &locks[0].lock;
 		bdr_locks_ctl->dbstate = (BdrLocksDBState *) (bdr_locks_ctl + 1);
 		bdr_locks_ctl->waiters = (BDRLockWaiter *) (bdr_locks_ctl->dbstate + bdr_max_databases);
+
+		for (i = 0; i < bdr_max_databases; i++)
+		{
+			bdr_locks_ctl->dbstate[i].lock = &locks[i + 1].lock;
+			pg_atomic_init_u32(&bdr_locks_ctl->dbstate[i].lock_active, 0);
+			bdr_locks_ctl->dbstate[i].last_confirm_ms = -1;
+			bdr_locks_ctl->dbstate[i].last_replay_ms = -1;
+		}
 	}
 	LWLockRelease(AddinShmemInitLock);
 }
@@ -372,7 +461,8 @@ bdr_locks_shmem_request(void)
 		prev_shmem_request_hook();
 
 	RequestAddinShmemSpace(bdr_locks_shmem_size());
-	RequestNamedLWLockTranche("bdr_locks", 1);
+	/* one lock for slot allocation plus one per database */
+	RequestNamedLWLockTranche("bdr_locks", bdr_max_databases + 1);
 }
 
 /* Needs to be called from a shared_preload_library _PG_init() */
@@ -482,6 +572,9 @@ ddl_lock_log_level(int ddl_lock_trace_level)
 
 /*
  * Find, and create if necessary, the lock state entry for dboid.
+ *
+ * The allocation lock serializes slot claiming; each backend does this once
+ * and caches the result in bdr_my_locks_database.
  */
 static BdrLocksDBState*
 bdr_locks_find_database(Oid dboid, bool create)
@@ -489,6 +582,8 @@ bdr_locks_find_database(Oid dboid, bool create)
 	int off;
 	int free_off = -1;
 
+	LWLockAcquire(bdr_locks_ctl->allocation_lock, LW_EXCLUSIVE);
+
 	for(off = 0; off < bdr_max_databases; off++)
 	{
 		BdrLocksDBState *db = &bdr_locks_ctl->dbstate[off];
@@ -496,6 +591,7 @@ bdr_locks_find_database(Oid dboid, bool create)
 		if (db->in_use && db->dboid == MyDatabaseId)
 		{
 			bdr_my_locks_database = db;
+			LWLockRelease(bdr_locks_ctl->allocation_lock);
 			return db;
 
 		}
@@ -516,9 +612,16 @@ bdr_locks_find_database(Oid dboid, bool create)
 	if (free_off != -1)
 	{
 		BdrLocksDBState *db = &bdr_locks_ctl->dbstate[free_off];
+		LWLockId	db_lock = db->lock;
+
 		memset(db, 0, sizeof(BdrLocksDBState));
+		db->lock = db_lock;
+		pg_atomic_init_u32(&db->lock_active, 0);
+		db->last_confirm_ms = -1;
+		db->last_replay_ms = -1;
 		db->dboid = MyDatabaseId;
 		db->in_use = true;
+		LWLockRelease(bdr_locks_ctl->allocation_lock);
 		return db;
 	}
 
@@ -541,6 +644,50 @@ bdr_locks_find_my_database(bool create)
 	Assert(bdr_my_locks_database != NULL);
 }
 
+/*
+ * Resynchronize the lock-free fast-path flag read by bdr_locks_check_dml()
+ * with lockcount. Must be called after every lockcount transition. The
+ * caller normally holds the per-database lock; the exception is per-db
+ * startup lock reacquisition, which runs before locked_and_loaded is set so
+ * no DML can race it.
+ */
+static void
+bdr_locks_update_lock_active(void)
+{
+	pg_atomic_write_u32(&bdr_my_locks_database->lock_active,
+						bdr_my_locks_database->lockcount > 0 ? 1 : 0);
+}
+
+/*
+ * Record one peer response latency against the given histogram and
+ * last-response fields. Caller must hold the per-database lock in exclusive
+ * mode. sent_at may be 0 if the request predates this node's restart (shmem
+ * state comes back cold); such responses aren't counted.
+ */
+static void
+bdr_locks_record_latency(TimestampTz sent_at, const BDRNodeId * const node,
+						 int64 *hist, BDRNodeId *last_node, int64 *last_ms)
+{
+	long		secs;
+	int			usecs;
+	int64		ms;
+	int			bucket = 0;
+
+	if (sent_at == 0)
+		return;
+
+	TimestampDifference(sent_at, GetCurrentTimestamp(), &secs, &usecs);
+	ms = secs * INT64CONST(1000) + usecs / 1000;
+
+	while (bucket < BDR_LOCK_LATENCY_BUCKETS - 1 &&
+		   ms >= (INT64CONST(1) << bucket))
+		bucket++;
+	hist[bucket]++;
+
+	bdr_nodeid_cpy(last_node, node);
+	*last_ms = ms;
+}
+
 /*
  * This node has just started up. Init its local state and send a startup
  * announcement message.
@@ -577,6 +724,12 @@ bdr_locks_startup(void)
 
 	initStringInfo(&s);
 
+	/*
+	 * The startup message and any replay-confirm requests for locks being
+	 * reacquired below can go out as a single WAL message.
+	 */
+	bdr_message_batch_begin();
+
 	/*
 	 * Send restart message causing all other backends to release global locks
 	 * possibly held by us. We don't necessarily remember sending the request
@@ -642,6 +795,7 @@ bdr_locks_startup(void)
 		{
 			bdr_my_locks_database->lock_holder = node_id;
 			bdr_my_locks_database->lockcount++;
+			bdr_locks_update_lock_active();
 			bdr_my_locks_database->lock_type = lock_type;
 			bdr_my_locks_database->lock_state = BDR_LOCKSTATE_PEER_CONFIRMED;
 			/* A remote node might have held the local lock before restart */
@@ -662,6 +816,7 @@ bdr_locks_startup(void)
 
 			bdr_my_locks_database->lock_holder = node_id;
 			bdr_my_locks_database->lockcount++;
+			bdr_locks_update_lock_active();
 			bdr_my_locks_database->lock_type = lock_type;
 			bdr_my_locks_database->lock_state = BDR_LOCKSTATE_PEER_CATCHUP;
 			bdr_my_locks_database->replay_confirmed = 0;
@@ -673,6 +828,8 @@ bdr_locks_startup(void)
 			elog(PANIC, "unknown lockstate '%s'", state);
 	}
 
+	bdr_message_batch_end();
+
 	systable_endscan(scan);
 	UnregisterSnapshot(snap);
 	table_close(rel, NoLock);
@@ -696,7 +853,7 @@ bdr_locks_set_nnodes(int nnodes)
 	Assert(bdr_my_locks_database != NULL);
 	Assert(nnodes >= 0);
 
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 	if (bdr_my_locks_database->nnodes < nnodes && bdr_my_locks_database->nnodes > 0 && !bdr_my_locks_database->lockcount)
 	{
 		/*
@@ -726,7 +883,7 @@ bdr_locks_set_nnodes(int nnodes)
 				 errhint("this should only happen during an upgrade from an older BDR version")));
 	}
 	bdr_my_locks_database->nnodes = nnodes;
-	LWLockRelease(bdr_locks_ctl->lock);
+	LWLockRelease(bdr_my_locks_database->lock);
 }
 
 /*
@@ -743,6 +900,8 @@ bdr_locks_process_message(int msg_type, bool transactional, XLogRecPtr lsn,
 
 	Assert(CurrentMemoryContext == MessageContext);
 
+	BDR_TRACE_LOCKS_MESSAGE(msg_type, transactional);
+
 	if (msg_type == BDR_MESSAGE_START)
 	{
 		bdr_locks_process_remote_startup(origin);
@@ -750,12 +909,20 @@ bdr_locks_process_message(int msg_type, bool transactional, XLogRecPtr lsn,
 	else if (msg_type == BDR_MESSAGE_ACQUIRE_LOCK)
 	{
 		int			lock_type;
+		const char *nspname = NULL;
+		const char *relname = NULL;
 
 		if (message->cursor == message->len) 		/* Old proto */
 			lock_type = BDR_LOCK_WRITE;
 		else
 			lock_type = pq_getmsgint(message, 4);
-		bdr_process_acquire_ddl_lock(origin, lock_type);
+		/* Optional relation scope; absent from unscoped and old-proto locks */
+		if (message->cursor < message->len)
+		{
+			nspname = pq_getmsgstring(message);
+			relname = pq_getmsgstring(message);
+		}
+		bdr_process_acquire_ddl_lock(origin, lock_type, nspname, relname);
 	}
 	else if (msg_type == BDR_MESSAGE_RELEASE_LOCK)
 	{
@@ -848,11 +1015,12 @@ bdr_lock_holder_xact_callback(XactEvent event, void *arg)
 		bdr_send_nodeid(&s, &myid, false);
 		bdr_send_message(&s, false);
 
-		LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+		LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 		if (bdr_my_locks_database->lockcount > 0)
 		{
 			Assert(bdr_my_locks_database->lock_state > BDR_LOCKSTATE_NOLOCK);
 			bdr_my_locks_database->lockcount--;
+			bdr_locks_update_lock_active();
 		}
 		else
 			elog(WARNING, "Releasing unacquired global lock");
@@ -861,6 +1029,7 @@ bdr_lock_holder_xact_callback(XactEvent event, void *arg)
 		Assert(bdr_my_locks_database->lock_holder_local_pid == MyProcPid);
 		bdr_my_locks_database->lock_holder_local_pid = 0;
 		bdr_my_locks_database->lock_type = BDR_LOCK_NOLOCK;
+		bdr_my_locks_database->lock_relid = InvalidOid;
 		bdr_my_locks_database->lock_state = BDR_LOCKSTATE_NOLOCK;
 		bdr_my_locks_database->replay_confirmed = 0;
 		bdr_my_locks_database->replay_confirmed_lsn = InvalidXLogRecPtr;
@@ -871,7 +1040,7 @@ bdr_lock_holder_xact_callback(XactEvent event, void *arg)
 		if (bdr_my_locks_database->lockcount == 0)
 			 bdr_locks_on_unlock();
 
-		LWLockRelease(bdr_locks_ctl->lock);
+		LWLockRelease(bdr_my_locks_database->lock);
 	}
 }
 
@@ -887,6 +1056,44 @@ register_holder_xact_callback(void)
 	}
 }
 
+/*
+ * Callback run at transaction end in every backend that has done BDR-checked
+ * writes. If an apply worker is waiting for conflicting local transactions to
+ * drain before granting a peer's write lock, wake it so the lock state
+ * advances as soon as the last writer exits instead of after a poll interval.
+ */
+static void
+bdr_dml_end_xact_callback(XactEvent event, void *arg)
+{
+	if (event != XACT_EVENT_COMMIT && event != XACT_EVENT_ABORT)
+		return;
+
+	if (bdr_locks_ctl == NULL || bdr_my_locks_database == NULL)
+		return;
+
+	/* cheap gate: no global lock activity at all */
+	if (pg_atomic_read_u32(&bdr_my_locks_database->lock_active) == 0)
+		return;
+
+	LWLockAcquire(bdr_my_locks_database->lock, LW_SHARED);
+	if (bdr_my_locks_database->lock_state == BDR_LOCKSTATE_PEER_CANCEL_XACTS &&
+		bdr_my_locks_database->cancel_waiter != NULL)
+		SetLatch(bdr_my_locks_database->cancel_waiter);
+	LWLockRelease(bdr_my_locks_database->lock);
+}
+
+static void
+register_dml_end_xact_callback(void)
+{
+	static bool registered;
+
+	if (!registered)
+	{
+		RegisterXactCallback(bdr_dml_end_xact_callback, NULL);
+		registered = true;
+	}
+}
+
 /*
  * Callback to update shmem state after we change global ddl lock state in
  * bdr_global_locks. Only called from apply worker and perdb worker.
@@ -900,7 +1107,7 @@ bdr_lock_state_xact_callback(XactEvent event, void *arg)
 
 	if (event == XACT_EVENT_COMMIT && bdr_lock_state_xact_callback_info.pending)
 	{
-		Assert(LWLockHeldByMe((bdr_locks_ctl->lock)));
+		Assert(LWLockHeldByMe((bdr_my_locks_database->lock)));
 		bdr_my_locks_database->lock_state
 			= bdr_lock_state_xact_callback_info.commit_pending_lock_state;
 		bdr_lock_state_xact_callback_info.pending = false;
@@ -949,11 +1156,21 @@ locks_begin_scan(Relation rel, Snapshot snap, const BDRNodeId * const node)
  *
  * Called from a user backend when the command filter spots a DDL attempt; runs
  * in the user backend.
+ *
+ * If the command targets a single relation the caller may pass it in, and
+ * with bdr.relation_ddl_locks enabled a write lock is then scoped to that
+ * relation: peers only block DML against it instead of the whole database.
+ * The scope never affects inter-node lock exclusion, only which local DML
+ * the peers' bdr_locks_check_dml() admits while the lock is held.
  */
 void
-bdr_acquire_ddl_lock(BDRLockType lock_type)
+bdr_acquire_ddl_lock(BDRLockType lock_type, RangeVar *relation)
 {
 	StringInfoData s;
+	Oid			scope_relid = InvalidOid;
+	char	   *scope_nspname = NULL;
+	char	   *scope_relname = NULL;
+	TimestampTz	canceltime;
 
 	Assert(IsTransactionState());
 	/* Not called from within a BDR worker */
@@ -974,14 +1191,60 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 	Assert((bdr_my_locks_database->lock_type == BDR_LOCK_NOLOCK && bdr_my_locks_database->lockcount == 0 && !this_xact_acquired_lock)
 		   || (bdr_my_locks_database->lock_type > BDR_LOCK_NOLOCK && bdr_my_locks_database->lockcount == 1));
 
-	/* No need to do anything if already holding requested lock. */
+	/*
+	 * Work out whether we can scope a write lock to a single relation. Only
+	 * plain tables qualify; for partitioned tables and partitions DML
+	 * against one relation of the hierarchy can touch others, so those get
+	 * a whole-database lock as before.
+	 */
+	if (bdr_relation_ddl_locks && relation != NULL &&
+		lock_type >= BDR_LOCK_WRITE)
+	{
+		scope_relid = RangeVarGetRelid(relation, NoLock, true);
+
+		if (OidIsValid(scope_relid) &&
+			get_rel_relkind(scope_relid) == RELKIND_RELATION &&
+			!get_rel_relispartition(scope_relid))
+		{
+			/*
+			 * Relation oids differ between nodes, so the scope travels by
+			 * name and each peer resolves it locally.
+			 */
+			scope_nspname = get_namespace_name(get_rel_namespace(scope_relid));
+			scope_relname = get_rel_name(scope_relid);
+		}
+		else
+			scope_relid = InvalidOid;
+	}
+
+	/*
+	 * No need to do anything if already holding the requested lock with a
+	 * scope that covers this command. Scope only matters at write strength;
+	 * any held lock excludes other nodes' DDL regardless of scope.
+	 */
 	if (this_xact_acquired_lock &&
-		bdr_my_locks_database->lock_type >= lock_type)
+		bdr_my_locks_database->lock_type >= lock_type &&
+		(lock_type < BDR_LOCK_WRITE ||
+		 bdr_my_locks_database->lock_relid == InvalidOid ||
+		 (OidIsValid(scope_relid) &&
+		  bdr_my_locks_database->lock_relid == scope_relid)))
 	{
 		Assert(bdr_my_locks_database->lock_holder_local_pid == MyProcPid);
 		return;
 	}
 
+	/*
+	 * Re-acquiring in the same transaction, whether upgrading the strength
+	 * or touching a second relation, always widens to a whole-database
+	 * lock; peers treat it like a lock upgrade.
+	 */
+	if (this_xact_acquired_lock)
+	{
+		scope_relid = InvalidOid;
+		scope_nspname = NULL;
+		scope_relname = NULL;
+	}
+
 	/*
 	 * If this is the first time in current transaction that we are trying to
 	 * acquire DDL lock, do the sanity checking first.
@@ -1031,7 +1294,7 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 	/* register an XactCallback to release the lock */
 	register_holder_xact_callback();
 
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 
 	/* check whether the lock can actually be acquired */
 	if (!this_xact_acquired_lock && bdr_my_locks_database->lockcount > 0)
@@ -1059,7 +1322,7 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 
 	/*
 	 * There should be nobody waiting to be notified if the DDL lock isn't
-	 * held, and now we hold bdr_locks_ctl->lock and know the lock is free.
+	 * held, and now we hold bdr_my_locks_database->lock and know the lock is free.
 	 */
 	Assert(slist_is_empty(&bdr_my_locks_database->waiters));
 
@@ -1068,12 +1331,21 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 	bdr_prepare_message(&s, BDR_MESSAGE_ACQUIRE_LOCK);
 	/* Add lock type */
 	pq_sendint(&s, lock_type, 4);
+	/*
+	 * Optional relation scope. Old peers stop reading after the lock type
+	 * and simply treat the lock as whole-database, which is stricter.
+	 */
+	if (OidIsValid(scope_relid))
+	{
+		pq_sendstring(&s, scope_nspname);
+		pq_sendstring(&s, scope_relname);
+	}
 
 	START_CRIT_SECTION();
 
 	/*
 	 * NB: We need to setup the shmem state as if we'd have already acquired
-	 * the lock before we release the LWLock on bdr_locks_ctl->lock. Otherwise
+	 * the lock before we release the LWLock on bdr_my_locks_database->lock. Otherwise
 	 * concurrent transactions could acquire the lock, and we wouldn't send a
 	 * release message when we fail to fully acquire the lock.
 	 *
@@ -1093,6 +1365,7 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 		Assert(bdr_my_locks_database->lock_state == BDR_LOCKSTATE_NOLOCK);
 
 		bdr_my_locks_database->lockcount++;
+		bdr_locks_update_lock_active();
 		this_xact_acquired_lock = true;
 		Assert(bdr_my_locks_database->lock_holder_local_pid == 0);
 		bdr_my_locks_database->lock_holder_local_pid = MyProcPid;
@@ -1109,14 +1382,21 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 	Assert(bdr_my_locks_database->lock_holder_local_pid == MyProcPid);
 	bdr_my_locks_database->requestor = &MyProc->procLatch;
 	bdr_my_locks_database->lock_type = lock_type;
+	bdr_my_locks_database->lock_relid = scope_relid;
 	bdr_my_locks_database->lock_state = BDR_LOCKSTATE_ACQUIRE_TALLY_CONFIRMATIONS;
 
+	/* Reset per-acquisition timing before the request goes out */
+	bdr_my_locks_database->acquire_sent_at = GetCurrentTimestamp();
+	bdr_my_locks_database->replay_requested_at = 0;
+	bdr_my_locks_database->last_confirm_ms = -1;
+	bdr_my_locks_database->last_replay_ms = -1;
+
 	/* lock looks to be free, try to acquire it */
 	bdr_send_message(&s, false);
 
 	END_CRIT_SECTION();
 
-	LWLockRelease(bdr_locks_ctl->lock);
+	LWLockRelease(bdr_my_locks_database->lock);
 
 	/* ---
 	 * Now wait for standbys to ack ddl lock
@@ -1126,13 +1406,28 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 		LOCKTRACE "sent DDL lock mode %s request for "BDR_NODEID_FORMAT_WITHNAME"), waiting for confirmation",
 		bdr_lock_type_to_name(lock_type), BDR_LOCALID_FORMAT_WITHNAME_ARGS);
 
+	/*
+	 * Don't wait for confirmations forever; a single lagging or unreachable
+	 * peer would otherwise hold this session (and everything queued behind
+	 * its locks) open indefinitely. On timeout the ERROR aborts the
+	 * transaction, and the holder xact callback sends the release message
+	 * that cleans up the in-flight acquisition on all peers.
+	 */
+	if (bdr_ddl_lock_timeout > 0 || LockTimeout > 0)
+		canceltime = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+			bdr_ddl_lock_timeout > 0 ? bdr_ddl_lock_timeout : LockTimeout);
+	else
+		TIMESTAMP_NOEND(canceltime);
+
 	while (true)
 	{
 		int rc;
+		int nconfirmed;
+		int nnodes;
 
 		ResetLatch(&MyProc->procLatch);
 
-		LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+		LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 
 		/*
 		 * check for confirmations in shared memory.
@@ -1153,14 +1448,27 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 		/* wait till all have given their consent */
 		if (bdr_my_locks_database->acquire_confirmed >= bdr_my_locks_database->nnodes)
 		{
-			LWLockRelease(bdr_locks_ctl->lock);
+			LWLockRelease(bdr_my_locks_database->lock);
 			break;
 		}
-		LWLockRelease(bdr_locks_ctl->lock);
+		nconfirmed = bdr_my_locks_database->acquire_confirmed;
+		nnodes = bdr_my_locks_database->nnodes;
+		LWLockRelease(bdr_my_locks_database->lock);
+
+		if (!TIMESTAMP_IS_NOEND(canceltime) &&
+			GetCurrentTimestamp() >= canceltime)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_LOCK_NOT_AVAILABLE),
+					 errmsg("could not acquire global lock within the configured timeout"),
+					 errdetail("Only %d of %d peer nodes confirmed the lock before the deadline.",
+							   nconfirmed, nnodes),
+					 errhint("Check bdr.pg_stat_bdr for lagging peers, or raise bdr.bdr_ddl_lock_timeout.")));
+		}
 
 		rc = WaitLatch(&MyProc->procLatch,
 					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-					   10000L, PG_WAIT_EXTENSION);
+					   10000L, WAIT_EVENT_SYNC_REP);
 
 		/* emergency bailout if postmaster has died */
 		if (rc & WL_POSTMASTER_DEATH)
@@ -1169,7 +1477,7 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 		CHECK_FOR_INTERRUPTS();
 	}
 
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 
 	/* TODO: recheck it's ours */
 	bdr_my_locks_database->acquire_confirmed = 0;
@@ -1182,7 +1490,7 @@ bdr_acquire_ddl_lock(BDRLockType lock_type)
 		LOCKTRACE "DDL lock acquired in mode mode %s for "BDR_NODEID_FORMAT_WITHNAME,
 		bdr_lock_type_to_name(lock_type), BDR_LOCALID_FORMAT_WITHNAME_ARGS);
 
-	LWLockRelease(bdr_locks_ctl->lock);
+	LWLockRelease(bdr_my_locks_database->lock);
 }
 
 Datum
@@ -1194,7 +1502,7 @@ bdr_acquire_global_lock_sql(PG_FUNCTION_ARGS)
 		ereport(WARNING,
 				(errmsg("bdr.skip_ddl_locking is set, ignoring explicit bdr.acquire_global_lock(...) call")));
 	else
-		bdr_acquire_ddl_lock(bdr_lock_name_to_type(mode));
+		bdr_acquire_ddl_lock(bdr_lock_name_to_type(mode), NULL);
 
 	PG_RETURN_VOID();
 }
@@ -1245,12 +1553,18 @@ cancel_conflicting_transactions(void)
 	VirtualTransactionId *conflict;
 	TimestampTz		killtime,
 					canceltime;
-	int				waittime = 1000;
+	int				waittime = 10;
 
 
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 	bdr_my_locks_database->lock_state = BDR_LOCKSTATE_PEER_CANCEL_XACTS;
-	LWLockRelease(bdr_locks_ctl->lock);
+
+	/*
+	 * Let writing backends wake us from their end-of-xact callback so we
+	 * notice drained transactions immediately rather than at the next poll.
+	 */
+	bdr_my_locks_database->cancel_waiter = &MyProc->procLatch;
+	LWLockRelease(bdr_my_locks_database->lock);
 
 	killtime = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
 		bdr_max_ddl_lock_delay > 0 ?
@@ -1286,16 +1600,24 @@ cancel_conflicting_transactions(void)
 		if (!TIMESTAMP_IS_NOEND(canceltime) &&
 			GetCurrentTimestamp() < canceltime)
 		{
+			LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
+			bdr_my_locks_database->cancel_waiter = NULL;
+			LWLockRelease(bdr_my_locks_database->lock);
 			return false;
 		}
 		else if (GetCurrentTimestamp() < killtime)
 		{
 			int	rc;
 
-			/* Increasing backoff interval for wait time with limit of 1s */
+			/*
+			 * Increasing backoff interval for wait time with limit of 1s.
+			 * Writing backends set our latch as their transactions end, so
+			 * the timeout is only a fallback for writers that never went
+			 * through the executor hook.
+			 */
 			waittime *= 2;
-			if (waittime > 1000000)
-				waittime = 1000000;
+			if (waittime > 1000)
+				waittime = 1000;
 
 			rc = WaitLatch(&MyProc->procLatch,
 						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
@@ -1326,6 +1648,10 @@ cancel_conflicting_transactions(void)
 		}
 	}
 
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
+	bdr_my_locks_database->cancel_waiter = NULL;
+	LWLockRelease(bdr_my_locks_database->lock);
+
 	return true;
 }
 
@@ -1341,7 +1667,7 @@ bdr_request_replay_confirmation(void)
 	bdr_prepare_message(&s, BDR_MESSAGE_REQUEST_REPLAY_CONFIRM);
 	pq_sendint64(&s, wait_for_lsn);
 
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 
 	/*
 	 * We only do catchup in write-mode locking after cancelling conflicting
@@ -1356,8 +1682,9 @@ bdr_request_replay_confirmation(void)
 
 	bdr_my_locks_database->replay_confirmed = 0;
 	bdr_my_locks_database->replay_confirmed_lsn = wait_for_lsn;
+	bdr_my_locks_database->replay_requested_at = GetCurrentTimestamp();
 	bdr_my_locks_database->lock_state = BDR_LOCKSTATE_PEER_CATCHUP;
-	LWLockRelease(bdr_locks_ctl->lock);
+	LWLockRelease(bdr_my_locks_database->lock);
 }
 
 /*
@@ -1366,7 +1693,8 @@ bdr_request_replay_confirmation(void)
  * Runs in the apply worker.
  */
 void
-bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type)
+bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type,
+							 const char *nspname, const char *relname)
 {
 	StringInfoData	s;
 	const char *lock_name = bdr_lock_type_to_name(lock_type);
@@ -1390,9 +1718,9 @@ bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type
 
 	/*
 	 * To prevent two concurrent apply workers from granting the DDL lock at
-	 * the same time, lock out the control segment.
+	 * the same time, take this database's lock state LWLock.
 	 */
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 
 	if (bdr_my_locks_database->lockcount == 0)
 	{
@@ -1400,6 +1728,7 @@ bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type
 		Datum	values[10];
 		bool	nulls[10];
 		HeapTuple tup;
+		Oid		scoped_relid = InvalidOid;
 
 		/*
 		 * No previous DDL lock found. Start acquiring it.
@@ -1413,6 +1742,16 @@ bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type
 		old_ctx = CurrentMemoryContext;
 		StartTransactionCommand();
 
+		/*
+		 * Resolve a relation-scoped lock request to our local oid. If the
+		 * relation doesn't exist here (DDL creating it may still be in
+		 * flight), fall back to a whole-database lock, which is stricter.
+		 */
+		if (relname != NULL)
+			scoped_relid = RangeVarGetRelid(makeRangeVar((char *) nspname,
+														 (char *) relname, -1),
+											NoLock, true);
+
 		memset(nulls, 0, sizeof(nulls));
 
 		rel = table_open(BdrLocksRelid, RowExclusiveLock);
@@ -1454,7 +1793,7 @@ bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type
 			if (geterrcode() == ERRCODE_UNIQUE_VIOLATION)
 			{
 			    /*
-				 * Shouldn't happen since we take the control segment lock before checking
+				 * Shouldn't happen since we take the per-database lock before checking
 				 * lockcount, and increment lockcount before releasing it.
 				 */
 				elog(WARNING,
@@ -1471,9 +1810,11 @@ bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type
 
 		/* setup ddl lock */
 		bdr_my_locks_database->lockcount++;
+		bdr_locks_update_lock_active();
 		bdr_my_locks_database->lock_type = lock_type;
+		bdr_my_locks_database->lock_relid = scoped_relid;
 		bdr_my_locks_database->lock_holder = replorigin_session_origin;
-		LWLockRelease(bdr_locks_ctl->lock);
+		LWLockRelease(bdr_my_locks_database->lock);
 
 		if (lock_type >= BDR_LOCK_WRITE)
 		{
@@ -1481,6 +1822,12 @@ bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type
 			 * Now kill all local processes that are still writing. We can't just
 			 * prevent them from writing via the acquired lock as they are still
 			 * running.
+			 *
+			 * For a relation-scoped lock we could in principle spare
+			 * transactions that never touch the target relation, but we
+			 * can't tell which those are, so cancel conservatively. New
+			 * transactions are admitted per relation by
+			 * bdr_locks_check_dml().
 			 */
 			elog(ddl_lock_log_level(DDL_LOCK_TRACE_PEERS),
 				 LOCKTRACE "terminating any local processes that conflict with the global lock");
@@ -1513,17 +1860,24 @@ bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type
 
 			elog(ddl_lock_log_level(DDL_LOCK_TRACE_DEBUG),
 				 LOCKTRACE "non-conflicting lock requested, logging confirmation of this node's acquisition of global lock");
-			LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+			LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 			bdr_send_confirm_lock();
-			LWLockRelease(bdr_locks_ctl->lock);
+			LWLockRelease(bdr_my_locks_database->lock);
 		}
 		elog(ddl_lock_log_level(DDL_LOCK_TRACE_ACQUIRE_RELEASE),
 			 LOCKTRACE "global lock granted to remote node "BDR_NODEID_FORMAT_WITHNAME,
 			 BDR_NODEID_FORMAT_WITHNAME_ARGS(*node));
 	}
 	else if (bdr_my_locks_database->lock_holder == replorigin_session_origin &&
-			 lock_type > bdr_my_locks_database->lock_type)
+			 (lock_type > bdr_my_locks_database->lock_type ||
+			  (lock_type == bdr_my_locks_database->lock_type &&
+			   OidIsValid(bdr_my_locks_database->lock_relid))))
 	{
+		/*
+		 * A strength upgrade from the current holder, or the holder widening
+		 * a relation-scoped lock to the whole database; both follow the same
+		 * re-acquisition protocol.
+		 */
 		Relation	rel;
 		SysScanDesc	scan;
 		Snapshot	snap;
@@ -1583,7 +1937,7 @@ bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type
 		CommitTransactionCommand();
 		(void) MemoryContextSwitchTo(old_ctx);
 
-		LWLockRelease(bdr_locks_ctl->lock);
+		LWLockRelease(bdr_my_locks_database->lock);
 
 		if (lock_type >= BDR_LOCK_WRITE)
 		{
@@ -1601,10 +1955,11 @@ bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type
 				goto decline;
 			}
 
-			/* update inmemory lock state */
-			LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+			/* update inmemory lock state; re-acquisition is always unscoped */
+			LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 			bdr_my_locks_database->lock_type = lock_type;
-			LWLockRelease(bdr_locks_ctl->lock);
+			bdr_my_locks_database->lock_relid = InvalidOid;
+			LWLockRelease(bdr_my_locks_database->lock);
 
 			/*
 			 * We now have to wait till all our local pending changes have been
@@ -1626,14 +1981,15 @@ bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type
 			 * transactions can be just confirmed immediatelly.
 			 */
 
-			/* update inmemory lock state */
-			LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+			/* update inmemory lock state; re-acquisition is always unscoped */
+			LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 			bdr_my_locks_database->lock_type = lock_type;
+			bdr_my_locks_database->lock_relid = InvalidOid;
 
 			elog(ddl_lock_log_level(DDL_LOCK_TRACE_DEBUG),
 				 LOCKTRACE "non-conflicting lock requested, logging confirmation of this node's acquisition of global lock");
 			bdr_send_confirm_lock();
-			LWLockRelease(bdr_locks_ctl->lock);
+			LWLockRelease(bdr_my_locks_database->lock);
 		}
 
 		elog(ddl_lock_log_level(DDL_LOCK_TRACE_DEBUG),
@@ -1644,7 +2000,7 @@ bdr_process_acquire_ddl_lock(const BDRNodeId * const node, BDRLockType lock_type
 	{
 		BDRNodeId replay_node;
 
-		LWLockRelease(bdr_locks_ctl->lock);
+		LWLockRelease(bdr_my_locks_database->lock);
 decline:
 		ereport(ddl_lock_log_level(DDL_LOCK_TRACE_ACQUIRE_RELEASE),
 				(errmsg(LOCKTRACE "declining remote global lock request, this node is already locked by origin=%u at level %s",
@@ -1716,7 +2072,7 @@ bdr_locks_node_parted(BDRNodeId *node)
 	 * do table scans etc we can avoid by taking a quick look at shmem
 	 * first.
 	 */
-	LWLockAcquire(bdr_locks_ctl->lock, LW_SHARED);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_SHARED);
 	if (bdr_my_locks_database->lock_type > BDR_LOCK_NOLOCK)
 	{
 		StartTransactionCommand();
@@ -1731,7 +2087,7 @@ bdr_locks_node_parted(BDRNodeId *node)
 
 		elog(INFO, "XXX target peer holds lock: %d", peer_holds_lock);
 	}
-	LWLockRelease(bdr_locks_ctl->lock);
+	LWLockRelease(bdr_my_locks_database->lock);
 
 	if (peer_holds_lock)
 	{
@@ -1831,7 +2187,7 @@ bdr_locks_release_local_ddl_lock(const BDRNodeId * const lock)
 		return;
 	}
 
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 
 	Assert(found);
 	Assert(bdr_my_locks_database->lockcount > 0);
@@ -1846,8 +2202,10 @@ bdr_locks_release_local_ddl_lock(const BDRNodeId * const lock)
 
 	Assert(bdr_my_locks_database->lock_state == BDR_LOCKSTATE_NOLOCK);
 	bdr_my_locks_database->lockcount--;
+	bdr_locks_update_lock_active();
 	bdr_my_locks_database->lock_holder = InvalidRepOriginId;
 	bdr_my_locks_database->lock_type = BDR_LOCK_NOLOCK;
+	bdr_my_locks_database->lock_relid = InvalidOid;
 	bdr_my_locks_database->replay_confirmed = 0;
 	bdr_my_locks_database->replay_confirmed_lsn = InvalidXLogRecPtr;
 	bdr_my_locks_database->requestor = NULL;
@@ -1858,7 +2216,7 @@ bdr_locks_release_local_ddl_lock(const BDRNodeId * const lock)
 	Assert(bdr_my_locks_database->lockcount == 0);
 	bdr_locks_on_unlock();
 
-	LWLockRelease(bdr_locks_ctl->lock);
+	LWLockRelease(bdr_my_locks_database->lock);
 
 	elog(ddl_lock_log_level(DDL_LOCK_TRACE_DEBUG),
 		 LOCKTRACE "global lock released locally");
@@ -1898,8 +2256,12 @@ bdr_process_confirm_ddl_lock(const BDRNodeId * const origin, const BDRNodeId * c
 		return;
 	}
 
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 	bdr_my_locks_database->acquire_confirmed++;
+	bdr_locks_record_latency(bdr_my_locks_database->acquire_sent_at, origin,
+							 bdr_my_locks_database->confirm_latency_hist,
+							 &bdr_my_locks_database->last_confirm_node,
+							 &bdr_my_locks_database->last_confirm_ms);
 	latch = bdr_my_locks_database->requestor;
 
 	elog(ddl_lock_log_level(DDL_LOCK_TRACE_DEBUG),
@@ -1907,7 +2269,7 @@ bdr_process_confirm_ddl_lock(const BDRNodeId * const origin, const BDRNodeId * c
 		 bdr_my_locks_database->acquire_confirmed, bdr_my_locks_database->nnodes,
 		 BDR_NODEID_FORMAT_WITHNAME_ARGS(*origin));
 
-	LWLockRelease(bdr_locks_ctl->lock);
+	LWLockRelease(bdr_my_locks_database->lock);
 
 	if(latch)
 		SetLatch(latch);
@@ -1940,10 +2302,10 @@ bdr_process_decline_ddl_lock(const BDRNodeId * const origin, const BDRNodeId * c
 		return;
 	}
 
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 	bdr_my_locks_database->acquire_declined++;
 	latch = bdr_my_locks_database->requestor;
-	LWLockRelease(bdr_locks_ctl->lock);
+	LWLockRelease(bdr_my_locks_database->lock);
 	if(latch)
 		SetLatch(latch);
 
@@ -2000,7 +2362,7 @@ bdr_send_confirm_lock(void)
 
 	initStringInfo(&s);
 
-	Assert(LWLockHeldByMe(bdr_locks_ctl->lock));
+	Assert(LWLockHeldByMe(bdr_my_locks_database->lock));
 
 	bdr_my_locks_database->replay_confirmed = 0;
 	bdr_my_locks_database->replay_confirmed_lsn = InvalidXLogRecPtr;
@@ -2093,7 +2455,7 @@ bdr_process_replay_confirm(const BDRNodeId * const node, XLogRecPtr request_lsn)
 
 	bdr_locks_find_my_database(false);
 
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 	elog(ddl_lock_log_level(DDL_LOCK_TRACE_DEBUG),
 		 LOCKTRACE "processing replay confirmation from node "BDR_NODEID_FORMAT_WITHNAME" for request %X/%X at %X/%X",
 		 BDR_NODEID_FORMAT_WITHNAME_ARGS(*node),
@@ -2106,6 +2468,11 @@ bdr_process_replay_confirm(const BDRNodeId * const node, XLogRecPtr request_lsn)
 	if (bdr_my_locks_database->replay_confirmed_lsn == request_lsn)
 	{
 		bdr_my_locks_database->replay_confirmed++;
+		bdr_locks_record_latency(bdr_my_locks_database->replay_requested_at,
+								 node,
+								 bdr_my_locks_database->replay_latency_hist,
+								 &bdr_my_locks_database->last_replay_node,
+								 &bdr_my_locks_database->last_replay_ms);
 
 		elog(ddl_lock_log_level(DDL_LOCK_TRACE_DEBUG),
 			 LOCKTRACE "confirming replay %d/%d",
@@ -2127,7 +2494,109 @@ bdr_process_replay_confirm(const BDRNodeId * const node, XLogRecPtr request_lsn)
 			 LOCKTRACE "sent confirmation of successful global lock acquisition");
 	}
 
-	LWLockRelease(bdr_locks_ctl->lock);
+	LWLockRelease(bdr_my_locks_database->lock);
+}
+
+/*
+ * While we hold a peer's write lock in catchup state we are waiting for every
+ * other node to confirm it has replayed our WAL past replay_confirmed_lsn.
+ * The peers' apply workers already report their applied position through the
+ * walsender feedback channel, which lands in our replication slots'
+ * confirmed_flush, so we can often observe catchup completion locally well
+ * before the explicit BDR_MESSAGE_REPLAY_CONFIRM replies make it around the
+ * mesh. The message-based path keeps running unchanged and whichever
+ * completes first wins; bdr_send_confirm_lock() clears replay_confirmed_lsn
+ * under the control lock so the loser becomes a no-op.
+ *
+ * Returns true if a catchup is still pending, so the caller knows to poll
+ * again soon. Runs in the per-db worker, outside any transaction.
+ */
+bool
+bdr_locks_poll_catchup(void)
+{
+	XLogRecPtr	wait_lsn;
+	XLogRecPtr	min_applied = InvalidXLogRecPtr;
+	int			nslots = 0;
+	int			nnodes;
+	int			i;
+
+	if (bdr_locks_ctl == NULL || bdr_my_locks_database == NULL)
+		return false;
+
+	LWLockAcquire(bdr_my_locks_database->lock, LW_SHARED);
+	if (bdr_my_locks_database->lock_state != BDR_LOCKSTATE_PEER_CATCHUP)
+	{
+		LWLockRelease(bdr_my_locks_database->lock);
+		return false;
+	}
+	wait_lsn = bdr_my_locks_database->replay_confirmed_lsn;
+	nnodes = bdr_my_locks_database->nnodes;
+	LWLockRelease(bdr_my_locks_database->lock);
+
+	if (wait_lsn == InvalidXLogRecPtr || nnodes <= 0)
+		return false;
+
+	/*
+	 * Find the applied position of every peer as reported via feedback into
+	 * our local BDR slots for this database.
+	 */
+	LWLockAcquire(ReplicationSlotControlLock, LW_SHARED);
+	for (i = 0; i < max_replication_slots; i++)
+	{
+		ReplicationSlot *slot = &ReplicationSlotCtl->replication_slots[i];
+		Oid			slot_dboid;
+		BDRNodeId	peer;
+		NameData	slotname;
+		NameData	replication_name;
+		XLogRecPtr	confirmed;
+
+		if (!slot->in_use)
+			continue;
+
+		SpinLockAcquire(&slot->mutex);
+		slot_dboid = slot->data.database;
+		slotname = slot->data.name;
+		confirmed = slot->data.confirmed_flush;
+		SpinLockRelease(&slot->mutex);
+
+		if (slot_dboid != MyDatabaseId)
+			continue;
+
+		/* Only consider slots following the BDR naming convention */
+		if (sscanf(NameStr(slotname), BDR_SLOT_NAME_FORMAT,
+				   &slot_dboid, &peer.sysid, &peer.timeline, &peer.dboid,
+				   NameStr(replication_name)) != 4)
+			continue;
+
+		nslots++;
+		if (min_applied == InvalidXLogRecPtr || confirmed < min_applied)
+			min_applied = confirmed;
+	}
+	LWLockRelease(ReplicationSlotControlLock);
+
+	/*
+	 * Only conclude catchup if we can account for every peer; with fewer
+	 * slots than nodes (a peer that hasn't connected yet) the explicit
+	 * replay-confirm messages remain the only authority.
+	 */
+	if (nslots < nnodes || min_applied == InvalidXLogRecPtr ||
+		min_applied < wait_lsn)
+		return true;
+
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
+	if (bdr_my_locks_database->lock_state == BDR_LOCKSTATE_PEER_CATCHUP &&
+		bdr_my_locks_database->replay_confirmed_lsn == wait_lsn)
+	{
+		elog(ddl_lock_log_level(DDL_LOCK_TRACE_DEBUG),
+			 LOCKTRACE "catchup to %X/%X observed via slot feedback from all %d peers, confirming global lock",
+			 (uint32) (wait_lsn >> 32), (uint32) wait_lsn, nnodes);
+
+		bdr_my_locks_database->replay_confirmed = nnodes;
+		bdr_send_confirm_lock();
+	}
+	LWLockRelease(bdr_my_locks_database->lock);
+
+	return false;
 }
 
 /*
@@ -2171,15 +2640,17 @@ bdr_locks_process_remote_startup(const BDRNodeId * const node)
 		simple_heap_delete(rel, &tuple->t_self);
 		bdr_locks_set_commit_pending_state(BDR_LOCKSTATE_NOLOCK);
 
-		LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+		LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 		if (bdr_my_locks_database->lockcount == 0)
 			elog(WARNING, "bdr_global_locks row exists without corresponding in memory state");
 		else
 		{
 			Assert(bdr_my_locks_database->lock_state > BDR_LOCKSTATE_NOLOCK);
 			bdr_my_locks_database->lockcount--;
+			bdr_locks_update_lock_active();
 			bdr_my_locks_database->lock_holder = InvalidRepOriginId;
 			bdr_my_locks_database->lock_type = BDR_LOCK_NOLOCK;
+			bdr_my_locks_database->lock_relid = InvalidOid;
 			bdr_my_locks_database->replay_confirmed = 0;
 			bdr_my_locks_database->replay_confirmed_lsn = InvalidXLogRecPtr;
 		}
@@ -2187,17 +2658,17 @@ bdr_locks_process_remote_startup(const BDRNodeId * const node)
 		if (bdr_my_locks_database->lockcount == 0)
 			 bdr_locks_on_unlock();
 
-		LWLockRelease(bdr_locks_ctl->lock);
+		LWLockRelease(bdr_my_locks_database->lock);
 	}
 
 	systable_endscan(scan);
 	UnregisterSnapshot(snap);
 	table_close(rel, NoLock);
-	/* Lock the shmem control segment for the state change */
-	LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+	/* Take the per-database lock for the state change */
+	LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 	CommitTransactionCommand();
 	(void) MemoryContextSwitchTo(old_ctx);
-	LWLockRelease(bdr_locks_ctl->lock);
+	LWLockRelease(bdr_my_locks_database->lock);
 }
 
 /*
@@ -2211,7 +2682,7 @@ bdr_locks_peer_has_lock(BDRLockType min_mode)
 {
 	bool lock_held_by_peer;
 
-	Assert(LWLockHeldByMe(bdr_locks_ctl->lock));
+	Assert(LWLockHeldByMe(bdr_my_locks_database->lock));
 
 	lock_held_by_peer = !this_xact_acquired_lock &&
 						bdr_my_locks_database->lockcount > 0 &&
@@ -2240,21 +2711,46 @@ bdr_locks_peer_has_lock(BDRLockType min_mode)
 	return lock_held_by_peer;
 }
 
+/*
+ * Does a relation-scoped write lock leave the given statement's target
+ * relations unaffected? Unscoped locks and statements whose targets the
+ * caller couldn't enumerate always conflict.
+ */
+static bool
+bdr_locks_scope_excludes(Oid scope_relid, List *target_relids)
+{
+	if (!OidIsValid(scope_relid) || target_relids == NIL)
+		return false;
+
+	return !list_member_oid(target_relids, scope_relid);
+}
+
 /*
  * Function for checking if there is no conflicting BDR lock.
  *
  * Should be caled from ExecutorStart_hook.
+ *
+ * target_relids is the list of relations the statement writes to or locks,
+ * so a write lock scoped to some other relation doesn't block it; NIL means
+ * the targets are unknown and any write lock blocks.
  */
 void
-bdr_locks_check_dml(void)
+bdr_locks_check_dml(List *target_relids)
 {
 	bool lock_held_by_peer;
+	Oid	 scope_relid;
 
 	if (bdr_skip_ddl_locking)
 		return;
 
 	bdr_locks_find_my_database(false);
 
+	/*
+	 * Make sure this backend wakes any pending conflicting-transaction
+	 * drain when its transaction ends.
+	 */
+	register_dml_end_xact_callback();
+
 	/*
 	 * The bdr is still starting up and hasn't loaded locks, wait for it.
 	 * The statement_timeout will kill us if necessary.
@@ -2267,6 +2763,18 @@ bdr_locks_check_dml(void)
 		pg_usleep(10000L);
 	}
 
+	/*
+	 * Fast path: no global lock is held or being acquired by anyone, which
+	 * is the overwhelmingly common case. The flag is kept in sync at every
+	 * lockcount transition, so a single atomic read suffices and we avoid
+	 * hammering the per-database LWLock from every writing backend. If
+	 * we race against a concurrent acquisition the acquirer must still
+	 * cancel or wait out already-running xacts, exactly as if we'd taken
+	 * the LWLock a moment before it did.
+	 */
+	if (pg_atomic_read_u32(&bdr_my_locks_database->lock_active) == 0)
+		return;
+
 	/*
 	 * Is this database locked against user initiated dml by another node?
 	 *
@@ -2277,9 +2785,14 @@ bdr_locks_check_dml(void)
 	 * fail to get the lock, another node that acquires our local lock will
 	 * deal with any running xacts then.
 	 */
-	LWLockAcquire(bdr_locks_ctl->lock, LW_SHARED);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_SHARED);
 	lock_held_by_peer = bdr_locks_peer_has_lock(BDR_LOCK_WRITE);
-	LWLockRelease(bdr_locks_ctl->lock);
+	scope_relid = bdr_my_locks_database->lock_relid;
+	LWLockRelease(bdr_my_locks_database->lock);
+
+	if (lock_held_by_peer &&
+		bdr_locks_scope_excludes(scope_relid, target_relids))
+		lock_held_by_peer = false;
 
 	/*
 	 * We can race against concurrent lock release here, but at worst we'll
@@ -2295,9 +2808,9 @@ bdr_locks_check_dml(void)
 		 *
 		 * LW lock guards against concurrent waiters list manipulation.
 		 */
-		LWLockAcquire(bdr_locks_ctl->lock, LW_EXCLUSIVE);
+		LWLockAcquire(bdr_my_locks_database->lock, LW_EXCLUSIVE);
 		bdr_locks_addwaiter(MyProc);
-		LWLockRelease(bdr_locks_ctl->lock);
+		LWLockRelease(bdr_my_locks_database->lock);
 
 		if (bdr_ddl_lock_timeout > 0 || LockTimeout > 0)
 			canceltime = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
@@ -2311,7 +2824,7 @@ bdr_locks_check_dml(void)
 			int rc;
 
 			if (!TIMESTAMP_IS_NOEND(canceltime) &&
-				GetCurrentTimestamp() < canceltime)
+				GetCurrentTimestamp() >= canceltime)
 			{
 				ereport(ERROR,
 						(errcode(ERRCODE_LOCK_NOT_AVAILABLE),
@@ -2320,9 +2833,15 @@ bdr_locks_check_dml(void)
 
 			CHECK_FOR_INTERRUPTS();
 
-			LWLockAcquire(bdr_locks_ctl->lock, LW_SHARED);
+			LWLockAcquire(bdr_my_locks_database->lock, LW_SHARED);
 			lock_held_by_peer = bdr_locks_peer_has_lock(BDR_LOCK_WRITE);
-			LWLockRelease(bdr_locks_ctl->lock);
+			scope_relid = bdr_my_locks_database->lock_relid;
+			LWLockRelease(bdr_my_locks_database->lock);
+
+			/* the scope may have widened while we waited, so recheck it */
+			if (lock_held_by_peer &&
+				bdr_locks_scope_excludes(scope_relid, target_relids))
+				lock_held_by_peer = false;
 
 			if (!lock_held_by_peer)
 				break;
@@ -2397,10 +2916,27 @@ bdr_lock_state_to_name(BDRLockState lock_state)
 	}
 }
 
+/*
+ * Build an int8[] from one of the cumulative latency histograms for
+ * bdr_ddl_lock_info().
+ */
+static ArrayType *
+bdr_lock_latency_hist_array(const int64 *hist)
+{
+	Datum		elems[BDR_LOCK_LATENCY_BUCKETS];
+	int			i;
+
+	for (i = 0; i < BDR_LOCK_LATENCY_BUCKETS; i++)
+		elems[i] = Int64GetDatum(hist[i]);
+
+	return construct_array(elems, BDR_LOCK_LATENCY_BUCKETS, INT8OID,
+						   sizeof(int64), FLOAT8PASSBYVAL, TYPALIGN_DOUBLE);
+}
+
 Datum
 bdr_ddl_lock_info(PG_FUNCTION_ARGS)
 {
-#define BDR_DDL_LOCK_INFO_NFIELDS 13
+#define BDR_DDL_LOCK_INFO_NFIELDS 24
 	BdrLocksDBState state;
 	BDRNodeId	locknodeid, myid;
 	char		sysid_str[33];
@@ -2422,9 +2958,9 @@ bdr_ddl_lock_info(PG_FUNCTION_ARGS)
 
 	bdr_locks_find_my_database(false);
 
-	LWLockAcquire(bdr_locks_ctl->lock, LW_SHARED);
+	LWLockAcquire(bdr_my_locks_database->lock, LW_SHARED);
 	memcpy(&state, bdr_my_locks_database, sizeof(BdrLocksDBState));
-	LWLockRelease(bdr_locks_ctl->lock);
+	LWLockRelease(bdr_my_locks_database->lock);
 
 	if (!state.in_use)
 		/* shouldn't happen */
@@ -2494,6 +3030,57 @@ bdr_ddl_lock_info(PG_FUNCTION_ARGS)
 	else
 		isnull[field++] = true;
 
+	/*
+	 * Acquisition timing: when the current/last acquire request went out,
+	 * the most recent peer to confirm it (and to confirm replay, for write
+	 * locks) with the observed latency, and the cumulative log2(ms) latency
+	 * histograms. The last_* fields are how you find the lagging node while
+	 * an acquisition is stalled: everyone who's answered has overwritten
+	 * them, so watch which peers show up and who never does.
+	 */
+	if (state.acquire_sent_at != 0)
+		values[field] = TimestampTzGetDatum(state.acquire_sent_at);
+	else
+		isnull[field] = true;
+	field++;
+
+	if (state.last_confirm_ms >= 0)
+	{
+		snprintf(sysid_str, sizeof(sysid_str), UINT64_FORMAT,
+				 state.last_confirm_node.sysid);
+		values[field++] = CStringGetTextDatum(sysid_str);
+		values[field++] = ObjectIdGetDatum(state.last_confirm_node.timeline);
+		values[field++] = ObjectIdGetDatum(state.last_confirm_node.dboid);
+		values[field++] = Int64GetDatum(state.last_confirm_ms);
+	}
+	else
+	{
+		int end;
+		for (end = field + 4; field < end; field++)
+			isnull[field] = true;
+	}
+
+	if (state.last_replay_ms >= 0)
+	{
+		snprintf(sysid_str, sizeof(sysid_str), UINT64_FORMAT,
+				 state.last_replay_node.sysid);
+		values[field++] = CStringGetTextDatum(sysid_str);
+		values[field++] = ObjectIdGetDatum(state.last_replay_node.timeline);
+		values[field++] = ObjectIdGetDatum(state.last_replay_node.dboid);
+		values[field++] = Int64GetDatum(state.last_replay_ms);
+	}
+	else
+	{
+		int end;
+		for (end = field + 4; field < end; field++)
+			isnull[field] = true;
+	}
+
+	values[field++] =
+		PointerGetDatum(bdr_lock_latency_hist_array(state.confirm_latency_hist));
+	values[field++] =
+		PointerGetDatum(bdr_lock_latency_hist_array(state.replay_latency_hist));
+
 	Assert(field == BDR_DDL_LOCK_INFO_NFIELDS);
 
 	returnTuple = heap_form_tuple(tupleDesc, values, isnull);
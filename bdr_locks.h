@@ -19,9 +19,11 @@ typedef enum BDRLockType
 
 void bdr_locks_startup(void);
 void bdr_locks_set_nnodes(int nnodes);
-void bdr_acquire_ddl_lock(BDRLockType lock_type);
+bool bdr_locks_poll_catchup(void);
+void bdr_acquire_ddl_lock(BDRLockType lock_type, RangeVar *relation);
 void bdr_process_acquire_ddl_lock(const BDRNodeId * const node,
-								  BDRLockType lock_type);
+								  BDRLockType lock_type,
+								  const char *nspname, const char *relname);
 void bdr_process_release_ddl_lock(const BDRNodeId * const origin, const BDRNodeId * const lock);
 void bdr_process_confirm_ddl_lock(const BDRNodeId * const origin,  const BDRNodeId * const lock,
 								  BDRLockType lock_type);
@@ -16,6 +16,28 @@
  * handle WAL message sending/receiving and dispatch, quorum counting, etc is
  * centralized here.
  *
+ * Sending control messages through WAL looks like needless latency - a
+ * write, a decode and an apply per message - and the idea of a direct
+ * peer-to-peer channel for the "non-durable" ones comes up regularly. It
+ * doesn't work, for three reasons worth recording:
+ *
+ * - Ordering is the payload. A REPLAY_CONFIRM means "everything you sent
+ *   before this point has been applied here" precisely because it is
+ *   emitted into our WAL behind the changes it confirms and consumed from
+ *   our stream in order. Delivered out of band it confirms nothing.
+ *
+ * - Responses are counted, not just observed. Lock acquire/decline
+ *   handling increments per-request counters exactly once per peer; a
+ *   second channel needs exactly-once delivery across both paths (and
+ *   across crashes of either end) to keep the quorum arithmetic right.
+ *
+ * - Several messages are deliberately transactional: CONFIRM_LOCK must
+ *   commit or vanish together with the bdr_global_locks state change it
+ *   announces (see bdr_send_confirm_lock).
+ *
+ * What can be done cheaply is reducing per-message overhead on the WAL
+ * path itself; see the message batching below.
+ *
  * -------------------------------------------------------------------------
  */
 #include "postgres.h"
@@ -95,9 +117,47 @@ bdr_process_remote_message(StringInfo s)
 		 BDR_NODEID_FORMAT_WITHNAME_ARGS(origin_node),
 		 (uint32) (lsn >> 32), (uint32) lsn);
 
+	if (msg_type == BDR_MESSAGE_BATCH)
+	{
+		int		nmessages;
+		int		i;
+
+		/*
+		 * A batch carries several ordinary messages, each framed with its
+		 * own length, type and origin. Unpack and dispatch them in order;
+		 * they all share the enclosing WAL message's lsn.
+		 */
+		nmessages = pq_getmsgint(&message, 4);
+
+		for (i = 0; i < nmessages; i++)
+		{
+			StringInfoData sub;
+			int			sub_type;
+			BDRNodeId	sub_origin;
+
+			initStringInfo(&sub);
+			sub.len = pq_getmsgint(&message, 4);
+			sub.data = (char *) pq_getmsgbytes(&message, sub.len);
+
+			sub_type = pq_getmsgint(&sub, 4);
+			bdr_getmsg_nodeid(&sub, &sub_origin, true);
+
+			elog(DEBUG1, "received batched message type %s (%d of %d) from "BDR_NODEID_FORMAT_WITHNAME,
+				 bdr_message_type_str(sub_type), i + 1, nmessages,
+				 BDR_NODEID_FORMAT_WITHNAME_ARGS(sub_origin));
+
+			if (!bdr_locks_process_message(sub_type, transactional, lsn,
+										   &sub_origin, &sub))
+				elog(WARNING, "unhandled BDR message of type %s in batch",
+					 bdr_message_type_str(sub_type));
+		}
+
+		goto done;
+	}
+
 	if (bdr_locks_process_message(msg_type, transactional, lsn, &origin_node, &message))
 		goto done;
-	
+
 	elog(WARNING, "unhandled BDR message of type %s", bdr_message_type_str(msg_type));
 
 	resetStringInfo(&message);
@@ -142,10 +202,103 @@ bdr_prepare_message(StringInfo s, BdrMessageType message_type)
 	/* caller's data will follow */
 }
 
+/*
+ * Batching of outbound messages.
+ *
+ * Lock negotiation and startup recovery can emit flurries of small
+ * messages back to back; logged individually each one is its own WAL
+ * record with its own XLogFlush(), and every peer gets a separate decode
+ * wakeup per record. Between bdr_message_batch_begin() and
+ * bdr_message_batch_end(), bdr_send_message() instead queues the framed
+ * messages and they go out as one BDR_MESSAGE_BATCH WAL message with a
+ * single flush, unpacked again in bdr_process_remote_message().
+ *
+ * A batch that ends up containing a single message is sent in the plain
+ * un-batched format, so the new framing only ever goes to peers when
+ * there's actually something to coalesce.
+ */
+static StringInfoData msg_batch_buf;
+static int	msg_batch_count = 0;
+static bool msg_batch_active = false;
+static bool msg_batch_transactional = false;
+
+static void
+bdr_message_batch_flush(void)
+{
+	XLogRecPtr	lsn;
+
+	if (msg_batch_count == 0)
+		return;
+
+	if (msg_batch_count == 1)
+	{
+		/* strip our length framing and send the one message as usual */
+		lsn = LogLogicalMessage(BDR_LOGICAL_MSG_PREFIX,
+								msg_batch_buf.data + 4, msg_batch_buf.len - 4,
+								msg_batch_transactional);
+	}
+	else
+	{
+		StringInfoData out;
+
+		initStringInfo(&out);
+		bdr_prepare_message(&out, BDR_MESSAGE_BATCH);
+		pq_sendint(&out, msg_batch_count, 4);
+		appendBinaryStringInfo(&out, msg_batch_buf.data, msg_batch_buf.len);
+
+		elog(DEBUG2, "sending batch of %d messages", msg_batch_count);
+
+		lsn = LogLogicalMessage(BDR_LOGICAL_MSG_PREFIX, out.data, out.len,
+								msg_batch_transactional);
+		pfree(out.data);
+	}
+
+	XLogFlush(lsn);
+
+	msg_batch_count = 0;
+	resetStringInfo(&msg_batch_buf);
+}
+
+/*
+ * Start coalescing subsequent bdr_send_message() calls into one WAL
+ * message. Batches must be closed with bdr_message_batch_end() before the
+ * caller waits for any reaction from peers, since nothing is written out
+ * until then.
+ */
+void
+bdr_message_batch_begin(void)
+{
+	Assert(!msg_batch_active);
+
+	if (msg_batch_buf.data == NULL)
+	{
+		MemoryContext old_context = MemoryContextSwitchTo(TopMemoryContext);
+
+		initStringInfo(&msg_batch_buf);
+		MemoryContextSwitchTo(old_context);
+	}
+
+	msg_batch_active = true;
+	msg_batch_count = 0;
+	resetStringInfo(&msg_batch_buf);
+}
+
+/*
+ * Close the current batch and write out anything queued in it.
+ */
+void
+bdr_message_batch_end(void)
+{
+	Assert(msg_batch_active);
+
+	bdr_message_batch_flush();
+	msg_batch_active = false;
+}
+
 /*
  * Send a WAL message previously prepared with bdr_prepare_message,
  * after using pq_send functions to add message-specific payload.
- * 
+ *
  * The StringInfo is reset automatically and may be re-used
  * for another message.
  */
@@ -154,6 +307,28 @@ bdr_send_message(StringInfo s, bool transactional)
 {
 	XLogRecPtr lsn;
 
+	if (msg_batch_active)
+	{
+		/*
+		 * Transactional and non-transactional messages can't share a WAL
+		 * record; close out the queued ones if the flag changes.
+		 */
+		if (msg_batch_count > 0 && transactional != msg_batch_transactional)
+			bdr_message_batch_flush();
+
+		msg_batch_transactional = transactional;
+
+		pq_sendint(&msg_batch_buf, s->len, 4);
+		pq_sendbytes(&msg_batch_buf, s->data, s->len);
+		msg_batch_count++;
+
+		elog(DEBUG3, "queued prepared message %p into batch (%d pending)",
+			 (void*)s, msg_batch_count);
+
+		resetStringInfo(s);
+		return;
+	}
+
 	lsn = LogLogicalMessage(BDR_LOGICAL_MSG_PREFIX, s->data, s->len, transactional);
 	XLogFlush(lsn);
 
@@ -185,6 +360,8 @@ char* bdr_message_type_str(BdrMessageType message_type)
 			return "BDR_MESSAGE_REQUEST_REPLAY_CONFIRM";
 		case BDR_MESSAGE_REPLAY_CONFIRM:
 			return "BDR_MESSAGE_REPLAY_CONFIRM";
+		case BDR_MESSAGE_BATCH:
+			return "BDR_MESSAGE_BATCH";
 	}
 	elog(ERROR, "unhandled BdrMessageType %d", message_type);
 }
@@ -13,14 +13,26 @@ typedef enum BdrMessageType
 	BDR_MESSAGE_DECLINE_LOCK = 4,
 	/* Replay confirmations */
 	BDR_MESSAGE_REQUEST_REPLAY_CONFIRM = 5,
-	BDR_MESSAGE_REPLAY_CONFIRM = 6
+	BDR_MESSAGE_REPLAY_CONFIRM = 6,
 	/* Node part/join */
 
+	/* Several coalesced messages in one WAL message */
+	BDR_MESSAGE_BATCH = 7
+
 } BdrMessageType;
 
+/*
+ * Lowest peer version that understands BDR_MESSAGE_BATCH. The walsender
+ * unwraps batches into individual messages for older clients; see
+ * pg_decode_message().
+ */
+#define BDR_MESSAGE_BATCH_MIN_VERSION_NUM 20200
+
 extern void bdr_process_remote_message(StringInfo s);
 extern void bdr_prepare_message(StringInfo s, BdrMessageType message_type);
 extern void bdr_send_message(StringInfo s, bool transactional);
+extern void bdr_message_batch_begin(void);
+extern void bdr_message_batch_end(void);
 
 extern char* bdr_message_type_str(BdrMessageType message_type);
 
@@ -15,11 +15,14 @@
 #include "postgres.h"
 
 #include "fmgr.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 
 #include "replication/slot.h"
 
+#include "utils/builtins.h"
 #include "utils/pg_lsn.h"
+#include "utils/timestamp.h"
 
 #include "storage/ipc.h"
 #include "storage/proc.h"
@@ -29,6 +32,11 @@
 #include "bdr.h"
 
 PG_FUNCTION_INFO_V1(bdr_wait_slot_confirm_lsn);
+PG_FUNCTION_INFO_V1(bdr_node_lag);
+PG_FUNCTION_INFO_V1(bdr_apply_action_histogram);
+
+#define BDR_NODE_LAG_COLS 8
+#define BDR_ACTION_HIST_COLS 6
 
 /*
  * Wait for the confirmed_flush_lsn of the specified slot, or all logical slots
@@ -97,7 +105,7 @@ bdr_wait_slot_confirm_lsn(PG_FUNCTION_ARGS)
 
 		rc = WaitLatch(&MyProc->procLatch,
 					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-					   1000, PG_WAIT_EXTENSION);
+					   1000, WAIT_EVENT_SYNC_REP);
 
         ResetLatch(&MyProc->procLatch);
 
@@ -110,3 +118,224 @@ bdr_wait_slot_confirm_lsn(PG_FUNCTION_ARGS)
 
 	PG_RETURN_VOID();
 }
+
+/*
+ * Report the replay lag of this database's apply workers from the progress
+ * they publish in shared memory: the remote commit timestamp of the last
+ * applied transaction, how far the applied position trails the last
+ * received one, and the recent apply rate. Cheap enough for a monitoring
+ * system to poll every few seconds - no catalog or slot access, just a
+ * walk of the worker array.
+ *
+ * The progress fields are atomics written by the apply workers without the
+ * worker control lock; the lock here only keeps slots from being recycled
+ * under the scan.
+ */
+Datum
+bdr_node_lag(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	int			i;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (tupdesc->natts != BDR_NODE_LAG_COLS)
+		elog(ERROR, "wrong function definition");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	LWLockAcquire(BdrWorkerCtl->lock, LW_SHARED);
+	for (i = 0; i < bdr_max_workers; i++)
+	{
+		BdrWorker  *w = &BdrWorkerCtl->slots[i];
+		BdrApplyWorker *apply;
+		char		sysid_str[33];
+		XLogRecPtr	applied;
+		XLogRecPtr	received;
+		TimestampTz	committs;
+		int64		lag_bytes;
+		int64		apply_rate;
+		Datum		values[BDR_NODE_LAG_COLS];
+		bool		nulls[BDR_NODE_LAG_COLS];
+
+		if (w->worker_type != BDR_WORKER_APPLY)
+			continue;
+
+		apply = &w->data.apply;
+		if (apply->dboid != MyDatabaseId)
+			continue;
+
+		applied = (XLogRecPtr) pg_atomic_read_u64(&apply->last_applied_lsn);
+		received = (XLogRecPtr) pg_atomic_read_u64(&apply->received_lsn);
+		committs = (TimestampTz) pg_atomic_read_u64(&apply->last_applied_committs);
+		apply_rate = (int64) pg_atomic_read_u64(&apply->apply_rate);
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		snprintf(sysid_str, sizeof(sysid_str), UINT64_FORMAT,
+				 apply->remote_node.sysid);
+
+		values[0] = CStringGetTextDatum(sysid_str);
+		values[1] = ObjectIdGetDatum(apply->remote_node.timeline);
+		values[2] = ObjectIdGetDatum(apply->remote_node.dboid);
+
+		if (applied != InvalidXLogRecPtr)
+			values[3] = LSNGetDatum(applied);
+		else
+			nulls[3] = true;
+
+		if (received != InvalidXLogRecPtr)
+			values[4] = LSNGetDatum(received);
+		else
+			nulls[4] = true;
+
+		if (applied != InvalidXLogRecPtr && received != InvalidXLogRecPtr)
+		{
+			/* a keepalive can put received momentarily behind applied */
+			lag_bytes = received > applied ? (int64) (received - applied) : 0;
+			values[5] = Int64GetDatumFast(lag_bytes);
+		}
+		else
+			nulls[5] = true;
+
+		if (committs != 0)
+			values[6] = TimestampTzGetDatum(committs);
+		else
+			nulls[6] = true;
+
+		values[7] = Int64GetDatumFast(apply_rate);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+	LWLockRelease(BdrWorkerCtl->lock);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * Dump the apply workers' per-action latency histograms, one row per
+ * non-empty bucket. le_us is the bucket's exclusive upper bound in
+ * microseconds (NULL for the unbounded top bucket), so the output loads
+ * straight into prometheus-style histogram tooling.
+ */
+Datum
+bdr_apply_action_histogram(PG_FUNCTION_ARGS)
+{
+	static const char *const action_names[BDR_APPLY_HIST_ACTIONS] = {
+		"begin", "insert", "update", "delete", "commit", "other"
+	};
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	int			i;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (tupdesc->natts != BDR_ACTION_HIST_COLS)
+		elog(ERROR, "wrong function definition");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	LWLockAcquire(BdrWorkerCtl->lock, LW_SHARED);
+	for (i = 0; i < bdr_max_workers; i++)
+	{
+		BdrWorker  *w = &BdrWorkerCtl->slots[i];
+		BdrApplyWorker *apply;
+		char		sysid_str[33];
+		int			action;
+		int			bucket;
+
+		if (w->worker_type != BDR_WORKER_APPLY)
+			continue;
+
+		apply = &w->data.apply;
+		if (apply->dboid != MyDatabaseId)
+			continue;
+
+		snprintf(sysid_str, sizeof(sysid_str), UINT64_FORMAT,
+				 apply->remote_node.sysid);
+
+		for (action = 0; action < BDR_APPLY_HIST_ACTIONS; action++)
+		{
+			for (bucket = 0; bucket < BDR_APPLY_HIST_BUCKETS; bucket++)
+			{
+				int64		count;
+				int64		le_us;
+				Datum		values[BDR_ACTION_HIST_COLS];
+				bool		nulls[BDR_ACTION_HIST_COLS];
+
+				count = (int64) pg_atomic_read_u64(&apply->action_hist[action][bucket]);
+				if (count == 0)
+					continue;
+
+				memset(values, 0, sizeof(values));
+				memset(nulls, 0, sizeof(nulls));
+
+				values[0] = CStringGetTextDatum(sysid_str);
+				values[1] = ObjectIdGetDatum(apply->remote_node.timeline);
+				values[2] = ObjectIdGetDatum(apply->remote_node.dboid);
+				values[3] = CStringGetTextDatum(action_names[action]);
+
+				if (bucket < BDR_APPLY_HIST_BUCKETS - 1)
+				{
+					le_us = INT64CONST(1) << bucket;
+					values[4] = Int64GetDatumFast(le_us);
+				}
+				else
+					nulls[4] = true;
+
+				values[5] = Int64GetDatumFast(count);
+
+				tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+			}
+		}
+	}
+	LWLockRelease(BdrWorkerCtl->lock);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
@@ -21,6 +21,10 @@
 #include "common/hashfn.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
 #include "utils/catcache.h"
 #include "utils/inval.h"
 #include "utils/memutils.h"
@@ -42,6 +46,141 @@ static const char * remote_node_name = NULL;
 
 static HTAB *BDRNodeCacheHash = NULL;
 
+/*
+ * Shared cache of the local node's hot bdr.bdr_nodes scalars, one entry per
+ * BDR-enabled database.
+ *
+ * The per-backend cache above holds the full node rows, including strings,
+ * which can't live in shared memory - but the lookups on the executor and
+ * command-filter hot paths only need status, read_only and seq_id of the
+ * local node. Keeping those in a versioned shared entry means a node status
+ * change makes a single backend rescan bdr.bdr_nodes and republish the
+ * scalars, while everyone else revalidates with one generation comparison
+ * instead of each rescanning the catalog.
+ */
+typedef struct BdrNodeScalarEntry
+{
+	Oid			dboid;			/* InvalidOid = unused slot */
+	uint32		version;		/* generation the scalars were read at */
+	bool		has_node;		/* is there a bdr_nodes row for this db? */
+	char		status;
+	bool		read_only;
+	int32		seq_id;
+} BdrNodeScalarEntry;
+
+typedef struct BdrNodeScalarCtl
+{
+	slock_t		mutex;			/* protects entries */
+	pg_atomic_uint32 generation;	/* bumped by bdr_nodecache_invalidate */
+	BdrNodeScalarEntry entries[FLEXIBLE_ARRAY_MEMBER];	/* bdr_max_databases */
+} BdrNodeScalarCtl;
+
+static BdrNodeScalarCtl *bdr_nodecache_ctl = NULL;
+
+/*
+ * Backend-local copy of our database's shared scalar entry, stamped with the
+ * generation it was read at. While the generation is unchanged - i.e. no node
+ * anywhere changed status or read-only state - the per-query lookups done by
+ * the executor and command-filter hooks cost one atomic read and a branch,
+ * not even the shared cache's spinlock.
+ */
+static Oid		scalar_cache_dboid = InvalidOid;
+static uint32	scalar_cache_version = 0;	/* 0 matches no generation */
+static bool		scalar_cache_has_node = false;
+static char		scalar_cache_status = '\0';
+static bool		scalar_cache_read_only = false;
+static int32	scalar_cache_seq_id = -1;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+
+static Size
+bdr_nodecache_shmem_size(void)
+{
+	return add_size(offsetof(BdrNodeScalarCtl, entries),
+					mul_size(bdr_max_databases, sizeof(BdrNodeScalarEntry)));
+}
+
+static void
+bdr_nodecache_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(bdr_nodecache_shmem_size());
+}
+
+static void
+bdr_nodecache_shmem_startup(void)
+{
+	bool		found;
+
+	if (prev_shmem_startup_hook != NULL)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	bdr_nodecache_ctl = ShmemInitStruct("bdr_nodecache",
+										bdr_nodecache_shmem_size(),
+										&found);
+	if (!found)
+	{
+		memset(bdr_nodecache_ctl, 0, bdr_nodecache_shmem_size());
+		SpinLockInit(&bdr_nodecache_ctl->mutex);
+
+		/*
+		 * Starts at 1 so a zeroed per-slot version can never read as
+		 * current.
+		 */
+		pg_atomic_init_u32(&bdr_nodecache_ctl->generation, 1);
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/* Needs to be called out of postmaster's shared_preload_libraries handling */
+void
+bdr_nodecache_shmem_init(void)
+{
+	Assert(process_shared_preload_libraries_in_progress);
+
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = bdr_nodecache_shmem_request;
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = bdr_nodecache_shmem_startup;
+}
+
+/*
+ * Find the shared scalar slot for the given database, optionally claiming a
+ * free one. Caller must hold bdr_nodecache_ctl->mutex. Returns NULL if not
+ * present and (when claiming) no slot is free.
+ */
+static BdrNodeScalarEntry *
+bdr_nodecache_shared_slot(Oid dboid, bool claim)
+{
+	BdrNodeScalarEntry *free_slot = NULL;
+	int			i;
+
+	for (i = 0; i < bdr_max_databases; i++)
+	{
+		BdrNodeScalarEntry *slot = &bdr_nodecache_ctl->entries[i];
+
+		if (slot->dboid == dboid)
+			return slot;
+
+		if (slot->dboid == InvalidOid && free_slot == NULL)
+			free_slot = slot;
+	}
+
+	if (claim && free_slot != NULL)
+	{
+		free_slot->dboid = dboid;
+		free_slot->version = 0; /* not current in any generation */
+		return free_slot;
+	}
+
+	return NULL;
+}
+
 /*
  * Because PostgreSQL does not have enought relation lookup functions.
  */
@@ -67,6 +206,13 @@ bdr_get_relname_relid(const char *nspname, const char *relname)
 void
 bdr_nodecache_invalidate(void)
 {
+	/*
+	 * Retire the current generation of shared scalar entries; backends
+	 * revalidate against the new generation on their next lookup.
+	 */
+	if (bdr_nodecache_ctl != NULL)
+		pg_atomic_fetch_add_u32(&bdr_nodecache_ctl->generation, 1);
+
 	CacheInvalidateRelcacheByRelid(bdr_get_relname_relid("bdr", "bdr_nodes"));
 }
 
@@ -92,6 +238,9 @@ bdr_nodecache_invalidate_callback(Datum arg, Oid relid)
 		{
 			entry->valid = false;
 		}
+
+		/* the timeshard sequence nodeid cache is derived from this table */
+		global_seq_invalidate_nodeid();
 	}
 }
 
@@ -235,34 +384,140 @@ bdr_local_node_name(void)
 	return node->name;
 }
 
-bool
-bdr_local_node_read_only(void)
+/*
+ * Fetch the local node's hot scalars, via the shared cache when it holds a
+ * current entry and otherwise with a fresh bdr.bdr_nodes read whose result
+ * is republished to the shared slot for everyone else.
+ *
+ * Returns false (with zeroed outputs) if the local database has no
+ * bdr.bdr_nodes row.
+ *
+ * A txn must be active.
+ */
+static bool
+bdr_local_node_scalars(char *status, bool *read_only, int32 *seq_id)
 {
 	BDRNodeId		nodeid;
-	BDRNodeInfo	   *node;
+	BDRNodeInfo	   *nodeinfo;
+	BdrNodeScalarEntry *slot;
+	uint32			gen = 0;
+	bool			has_node;
+
+	Assert(IsTransactionState());
+
+	*status = '\0';
+	*read_only = false;
+	*seq_id = -1;
+
+	if (bdr_nodecache_ctl != NULL)
+	{
+		gen = pg_atomic_read_u32(&bdr_nodecache_ctl->generation);
+
+		/* common case: our local copy is still current */
+		if (scalar_cache_version == gen && scalar_cache_dboid == MyDatabaseId)
+		{
+			if (scalar_cache_has_node)
+			{
+				*status = scalar_cache_status;
+				*read_only = scalar_cache_read_only;
+				*seq_id = scalar_cache_seq_id;
+			}
+			return scalar_cache_has_node;
+		}
 
+		SpinLockAcquire(&bdr_nodecache_ctl->mutex);
+		slot = bdr_nodecache_shared_slot(MyDatabaseId, false);
+		if (slot != NULL && slot->version == gen)
+		{
+			has_node = slot->has_node;
+			if (has_node)
+			{
+				*status = slot->status;
+				*read_only = slot->read_only;
+				*seq_id = slot->seq_id;
+			}
+			SpinLockRelease(&bdr_nodecache_ctl->mutex);
+
+			scalar_cache_dboid = MyDatabaseId;
+			scalar_cache_has_node = has_node;
+			scalar_cache_status = *status;
+			scalar_cache_read_only = *read_only;
+			scalar_cache_seq_id = *seq_id;
+			scalar_cache_version = gen;
+
+			return has_node;
+		}
+		SpinLockRelease(&bdr_nodecache_ctl->mutex);
+	}
+
+	/*
+	 * Stale or missing shared entry; read the catalog directly rather than
+	 * through the backend-local cache, so the scalars we publish are at
+	 * least as fresh as the generation we stamp them with.
+	 */
 	bdr_make_my_nodeid(&nodeid);
-	node = bdr_nodecache_lookup(&nodeid, true);
+	nodeinfo = bdr_nodes_get_local_info(&nodeid);
 
-	if (node == NULL)
-		return false;
+	has_node = nodeinfo != NULL;
+	if (has_node)
+	{
+		*status = nodeinfo->status;
+		*read_only = nodeinfo->read_only;
+		*seq_id = nodeinfo->seq_id;
+		bdr_bdr_node_free(nodeinfo);
+	}
+
+	if (bdr_nodecache_ctl != NULL)
+	{
+		SpinLockAcquire(&bdr_nodecache_ctl->mutex);
+		slot = bdr_nodecache_shared_slot(MyDatabaseId, true);
+		if (slot != NULL)
+		{
+			slot->has_node = has_node;
+			slot->status = *status;
+			slot->read_only = *read_only;
+			slot->seq_id = *seq_id;
+			slot->version = gen;
+		}
+		SpinLockRelease(&bdr_nodecache_ctl->mutex);
+
+		/*
+		 * Our catalog read is at least as fresh as 'gen' even if no shared
+		 * slot was free, so the local copy may be stamped unconditionally.
+		 */
+		scalar_cache_dboid = MyDatabaseId;
+		scalar_cache_has_node = has_node;
+		scalar_cache_status = *status;
+		scalar_cache_read_only = *read_only;
+		scalar_cache_seq_id = *seq_id;
+		scalar_cache_version = gen;
+	}
 
-	return node->read_only;
+	return has_node;
+}
+
+bool
+bdr_local_node_read_only(void)
+{
+	char		status;
+	bool		read_only;
+	int32		seq_id;
+
+	(void) bdr_local_node_scalars(&status, &read_only, &seq_id);
+
+	return read_only;
 }
 
 char
 bdr_local_node_status(void)
 {
-	BDRNodeId		nodeid;
-	BDRNodeInfo	   *node;
-
-	bdr_make_my_nodeid(&nodeid);
-	node = bdr_nodecache_lookup(&nodeid, true);
+	char		status;
+	bool		read_only;
+	int32		seq_id;
 
-	if (node == NULL)
-		return '\0';
+	(void) bdr_local_node_scalars(&status, &read_only, &seq_id);
 
-	return node->status;
+	return status;
 }
 
 /*
@@ -272,16 +527,32 @@ bdr_local_node_status(void)
 int32
 bdr_local_node_seq_id(void)
 {
-	BDRNodeId		nodeid;
-	BDRNodeInfo	   *node;
+	char		status;
+	bool		read_only;
+	int32		seq_id;
 
-	bdr_make_my_nodeid(&nodeid);
-	node = bdr_nodecache_lookup(&nodeid, true);
+	(void) bdr_local_node_scalars(&status, &read_only, &seq_id);
 
-	if (node == NULL)
-		return -1;
+	return seq_id;
+}
+
+/*
+ * Look up a node's status through the nodecache, rather than with a fresh
+ * scan of bdr.bdr_nodes via SPI the way bdr_nodes_get_local_status() does.
+ * Used by the startup checks of workers, where the cache is typically cold,
+ * so the point is dodging the parse/plan/execute cycle rather than the
+ * catalog read itself.
+ *
+ * Returns BDR_NODE_STATUS_NONE if the node has no bdr_nodes row.
+ *
+ * A txn must be active.
+ */
+BdrNodeStatus
+bdr_nodeid_status(const BDRNodeId * const node)
+{
+	BDRNodeInfo *nodeinfo = bdr_nodecache_lookup(node, true);
 
-	return node->seq_id;
+	return nodeinfo == NULL ? BDR_NODE_STATUS_NONE : (BdrNodeStatus) nodeinfo->status;
 }
 
 /*
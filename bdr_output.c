@@ -17,8 +17,17 @@
 #include <unistd.h>
 #include <dirent.h>
 
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
 #include "bdr.h"
 #include "bdr_internal.h"
+#include "bdr_messaging.h"
+#include "bdr_probes.h"
 #include "miscadmin.h"
 
 #include "access/detoast.h"
@@ -36,6 +45,8 @@
 
 #include "commands/dbcommands.h"
 
+#include "common/hashfn.h"
+
 #include "executor/spi.h"
 
 #include "libpq/pqformat.h"
@@ -56,6 +67,7 @@
 #include "storage/proc.h"
 
 #include "utils/builtins.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
@@ -76,6 +88,15 @@ typedef struct
 
 	bool allow_binary_protocol;
 	bool allow_sendrecv_protocol;
+
+	/*
+	 * When a version difference rules out allow_sendrecv_protocol
+	 * wholesale, clients that negotiated the sendrecv_stable_types startup
+	 * option still get send/recv format for the builtin types whose binary
+	 * representation is known not to change across the major versions we
+	 * support; everything else falls back to text as before.
+	 */
+	bool allow_sendrecv_stable;
 	bool int_datetime_mismatch;
 	bool forward_changesets;
 
@@ -92,6 +113,7 @@ typedef struct
 	bool client_float4_byval;
 	bool client_float8_byval;
 	bool client_int_datetime;
+	bool client_sendrecv_stable_types;
 	char *client_db_encoding;
 	Oid bdr_schema_oid;
 	Oid bdr_conflict_handlers_reloid;
@@ -100,6 +122,79 @@ typedef struct
 
 	int num_replication_sets;
 	char **replication_sets;
+
+	/*
+	 * Bulk insert-run streaming, negotiated with the insert_runs startup
+	 * option. Runs of consecutive INSERTs into one relation are sent with
+	 * the relation header once ('S'), then header-less rows ('R'), then a
+	 * trailer ('E'), much like a COPY stream.
+	 */
+	/*
+	 * Relation metadata caching, negotiated with the relmeta_cache startup
+	 * option. Change messages then carry only our 4-byte relation oid as a
+	 * compact relation ID; the namespace and relation names are sent once
+	 * per decoding session in an 'r' message before the relation's first
+	 * change, and resent after relcache invalidation.
+	 */
+	bool allow_relmeta_cache;
+
+	/*
+	 * Compact tuple framing, negotiated with the compact_tuples startup
+	 * option. Tuples are sent as 'C' instead of 'T': a varint attribute
+	 * count, a null bitmap instead of per-column 'n' markers, and varint
+	 * datum lengths instead of fixed 4-byte ones. For narrow rows the
+	 * framing shrinks from five bytes per column to roughly two.
+	 */
+	bool compact_tuples;
+
+	bool allow_insert_runs;
+	bool insert_run_open;
+	Oid insert_run_relid;
+	Oid insert_last_relid;
+
+	/*
+	 * Deferred BEGIN. With replication sets and origin filtering many
+	 * decoded transactions forward no changes at all, so the 'B' message is
+	 * held back until the first forwarded change or transactional message.
+	 * Transactions that turn out to be empty are suppressed entirely; the
+	 * walsender is just told to keep progress updates flowing.
+	 */
+	bool begin_pending;
+	ReorderBufferTXN *begin_pending_txn;
+
+	/*
+	 * Streaming of large in-progress transactions, negotiated with the
+	 * streaming startup option. When enabled the reorder buffer hands us
+	 * transactions over logical_decoding_work_mem before they commit,
+	 * instead of spilling them to disk, and we ship them in 'b' ... 'e'
+	 * bracketed segments of 'x' messages finished by 'a'/'c'.
+	 */
+	bool allow_streaming;
+
+	/*
+	 * Sharded decoding, negotiated with the shard_count/shard_number
+	 * startup options. When shard_count > 1 this connection forwards only
+	 * the relations hashing into its shard, so a peer can spread the
+	 * decoding of one origin over several slots; every relation
+	 * deterministically belongs to exactly one shard.
+	 */
+	uint32 shard_count;
+	uint32 shard_number;
+
+	/*
+	 * Compression of the outgoing stream, negotiated with the compression
+	 * startup option. Each message payload is replaced by its uncompressed
+	 * length followed by the compressed bytes; with zstd all messages of a
+	 * decoding session share one streaming context, so the many small
+	 * per-change messages benefit from history built up over the whole
+	 * stream instead of being compressed in isolation.
+	 */
+	BdrCompressionType compression;
+	int			msg_start;
+	StringInfoData compress_buf;
+#ifdef USE_ZSTD
+	ZSTD_CStream *zstd_out;
+#endif
 } BdrOutputData;
 
 /* These must be available to pg_dlsym() */
@@ -122,6 +217,28 @@ static void pg_decode_message(LogicalDecodingContext *ctx,
 							  Size sz,
 							  const char *message);
 
+static void pg_decode_stream_start(LogicalDecodingContext *ctx,
+								   ReorderBufferTXN *txn);
+static void pg_decode_stream_stop(LogicalDecodingContext *ctx,
+								  ReorderBufferTXN *txn);
+static void pg_decode_stream_abort(LogicalDecodingContext *ctx,
+								   ReorderBufferTXN *txn,
+								   XLogRecPtr abort_lsn);
+static void pg_decode_stream_commit(LogicalDecodingContext *ctx,
+									ReorderBufferTXN *txn,
+									XLogRecPtr commit_lsn);
+static void pg_decode_stream_change(LogicalDecodingContext *ctx,
+									ReorderBufferTXN *txn,
+									Relation relation,
+									ReorderBufferChange *change);
+static void pg_decode_stream_message(LogicalDecodingContext *ctx,
+									 ReorderBufferTXN *txn,
+									 XLogRecPtr message_lsn,
+									 bool transactional,
+									 const char *prefix,
+									 Size sz,
+									 const char *message);
+
 #if PG_VERSION_NUM < 90600
 /*
  * We need an adapter from 9.6's logical messages to those in 9.4bdr, which lack
@@ -140,8 +257,19 @@ static void pg_decode_message_94bdr(LogicalDecodingContext *ctx,
 #endif /* PG_VERSION_NUM < 90600 */
 
 /* private prototypes */
-static void write_rel(StringInfo out, Relation rel);
-static void write_tuple(BdrOutputData *data, StringInfo out, Relation rel,
+static void write_rel(BdrOutputData *data, StringInfo out, Relation rel);
+static void write_rel_names(StringInfo out, Relation rel);
+static void relmeta_cache_init(void);
+static void maybe_send_relmeta(LogicalDecodingContext *ctx,
+							   BdrOutputData *data, Relation rel);
+static void write_change(BdrOutputData *data, StringInfo out, BDRRelation *rel,
+						 ReorderBufferChange *change);
+static void end_insert_run(LogicalDecodingContext *ctx, BdrOutputData *data);
+static void send_pending_begin(LogicalDecodingContext *ctx, BdrOutputData *data);
+static void write_insert_run_change(LogicalDecodingContext *ctx,
+									BdrOutputData *data, BDRRelation *rel,
+									ReorderBufferChange *change);
+static void write_tuple(BdrOutputData *data, StringInfo out, BDRRelation *rel,
 						HeapTuple tuple);
 
 static void pglReorderBufferCleanSerializedTXNs(const char *slotname);
@@ -161,6 +289,12 @@ _PG_output_plugin_init(OutputPluginCallbacks *cb)
 #else
 	cb->message_cb = pg_decode_message;
 #endif
+	cb->stream_start_cb = pg_decode_stream_start;
+	cb->stream_stop_cb = pg_decode_stream_stop;
+	cb->stream_abort_cb = pg_decode_stream_abort;
+	cb->stream_commit_cb = pg_decode_stream_commit;
+	cb->stream_change_cb = pg_decode_stream_change;
+	cb->stream_message_cb = pg_decode_stream_message;
 	cb->shutdown_cb = pg_decode_shutdown;
 }
 
@@ -485,6 +619,8 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt, bool i
 	bdr_parse_slot_name(NameStr(MyReplicationSlot->data.name),
 						&data->remote_node, &local_dboid);
 
+	bdr_count_decode_attach(&data->remote_node);
+
 	/* parse options passed in by the client */
 
 	foreach(option, ctx->output_plugin_options)
@@ -519,10 +655,57 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt, bool i
 			bdr_parse_bool(elem, &data->client_float8_byval);
 		else if (strcmp(elem->defname, "integer_datetimes") == 0)
 			bdr_parse_bool(elem, &data->client_int_datetime);
+		else if (strcmp(elem->defname, "sendrecv_stable_types") == 0)
+			bdr_parse_bool(elem, &data->client_sendrecv_stable_types);
 		else if (strcmp(elem->defname, "db_encoding") == 0)
 			data->client_db_encoding = pstrdup(strVal(elem->arg));
 		else if (strcmp(elem->defname, "forward_changesets") == 0)
 			bdr_parse_bool(elem, &data->forward_changesets);
+		else if (strcmp(elem->defname, "insert_runs") == 0)
+			bdr_parse_bool(elem, &data->allow_insert_runs);
+		else if (strcmp(elem->defname, "relmeta_cache") == 0)
+			bdr_parse_bool(elem, &data->allow_relmeta_cache);
+		else if (strcmp(elem->defname, "compact_tuples") == 0)
+			bdr_parse_bool(elem, &data->compact_tuples);
+		else if (strcmp(elem->defname, "streaming") == 0)
+			bdr_parse_bool(elem, &data->allow_streaming);
+		else if (strcmp(elem->defname, "shard_count") == 0)
+			bdr_parse_uint32(elem, &data->shard_count);
+		else if (strcmp(elem->defname, "shard_number") == 0)
+			bdr_parse_uint32(elem, &data->shard_number);
+		else if (strcmp(elem->defname, "compression") == 0)
+		{
+			char	   *method = NULL;
+
+			bdr_parse_str(elem, &method);
+
+			if (strcmp(method, "none") == 0)
+				data->compression = BDR_COMPRESSION_NONE;
+			else if (strcmp(method, "lz4") == 0)
+			{
+#ifdef USE_LZ4
+				data->compression = BDR_COMPRESSION_LZ4;
+#else
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("lz4 compression is not supported by this build")));
+#endif
+			}
+			else if (strcmp(method, "zstd") == 0)
+			{
+#ifdef USE_ZSTD
+				data->compression = BDR_COMPRESSION_ZSTD;
+#else
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("zstd compression is not supported by this build")));
+#endif
+			}
+			else
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("unknown compression method \"%s\"", method)));
+		}
 		else if (strcmp(elem->defname, "unidirectional") == 0)
 		{
 			bool is_unidirectional;
@@ -586,6 +769,42 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt, bool i
 		}
 	}
 
+	/*
+	 * Only stream in-progress transactions to clients that negotiated it;
+	 * everyone else gets them spilled and sent whole at commit, as before.
+	 */
+	ctx->streaming &= data->allow_streaming;
+
+	if (data->shard_count > 1 && data->shard_number >= data->shard_count)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("shard_number %u out of range for shard_count %u",
+						data->shard_number, data->shard_count)));
+
+	if (data->allow_relmeta_cache)
+		relmeta_cache_init();
+
+	if (data->compression != BDR_COMPRESSION_NONE)
+	{
+		/*
+		 * The staging buffer is reused across messages and only ever
+		 * grows, so steady state does no allocation at all. It must live
+		 * as long as data itself: data->context is reset after every
+		 * change and would pull it out from under us.
+		 */
+		initStringInfo(&data->compress_buf);
+
+#ifdef USE_ZSTD
+		if (data->compression == BDR_COMPRESSION_ZSTD)
+		{
+			data->zstd_out = ZSTD_createCStream();
+			if (data->zstd_out == NULL)
+				elog(ERROR, "out of memory");
+			ZSTD_initCStream(data->zstd_out, ZSTD_CLEVEL_DEFAULT);
+		}
+#endif
+	}
+
 	if (bdr_check_lsn_mismatch)
 		start_lsn_sanity_check(ctx, &data->remote_node, remote_insert_lsn);
 
@@ -715,8 +934,21 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt, bool i
 		 * if there are known incompatibilities.
 		 */
 		if (data->client_pg_version / 100 != PG_VERSION_NUM / 100)
+		{
 			data->allow_sendrecv_protocol = false;
 
+			/*
+			 * Clients that negotiated it still get send/recv for the builtin
+			 * types whose wire format is stable across major versions; see
+			 * bdr_type_sendrecv_stable(). That covers the common numeric,
+			 * timestamp etc. columns whose text conversion dominates apply
+			 * CPU, without betting on unaudited types.
+			 */
+			data->allow_sendrecv_stable = data->client_sendrecv_stable_types;
+			if (data->allow_sendrecv_stable)
+				elog(LOG, "restricting send/recv protocol to stable-format types because of version difference");
+		}
+
 		bdr_maintain_schema(false);
 
 		data->bdr_schema_oid = get_namespace_oid("bdr", true);
@@ -790,6 +1022,16 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt, bool i
 static void
 pg_decode_shutdown(LogicalDecodingContext * ctx)
 {
+#ifdef USE_ZSTD
+	BdrOutputData *data = ctx->output_plugin_private;
+
+	if (data->zstd_out != NULL)
+	{
+		ZSTD_freeCStream(data->zstd_out);
+		data->zstd_out = NULL;
+	}
+#endif
+
 	bdrorigincache_destroy();
 
 	/* release and free slot */
@@ -832,11 +1074,26 @@ should_forward_change(LogicalDecodingContext *ctx, BdrOutputData *data,
 		return false;
 
 	/*
-	 * Quite ugly, but there's no neat way right now: Flush replication set
-	 * configuration from bdr's relcache.
+	 * Quite ugly, but there's no neat way right now: Flush the computed
+	 * replication set configuration from bdr's relcache. Entries stay valid;
+	 * only the cached per-set action masks and per-relation settings derived
+	 * from them are recomputed.
 	 */
 	if (RelationGetRelid(r->rel) == BdrReplicationSetConfigRelid)
-		BDRRelcacheHashInvalidateCallback(0, InvalidOid);
+		BDRRelcacheInvalidateReplicationSetConfig();
+
+	/*
+	 * Sharded decoding: only forward the relations hashing into this
+	 * connection's shard. The hash is over the origin-side oid, so a
+	 * relation's changes always travel over the same slot and replay in
+	 * order there. Note this deliberately covers the bdr schema too:
+	 * queued DDL must arrive exactly once, on whichever shard owns the
+	 * queue table.
+	 */
+	if (data->shard_count > 1 &&
+		hash_uint32((uint32) RelationGetRelid(r->rel)) % data->shard_count !=
+		data->shard_number)
+		return false;
 
 	/* always replicate other stuff in the bdr schema */
 	if (r->rel->rd_rel->relnamespace == data->bdr_schema_oid)
@@ -861,6 +1118,116 @@ should_forward_change(LogicalDecodingContext *ctx, BdrOutputData *data,
 	}
 }
 
+/*
+ * Wrappers around OutputPluginPrepareWrite()/OutputPluginWrite() that all
+ * message emission goes through.
+ *
+ * When compression was negotiated, bdr_prepare_write() remembers where our
+ * payload starts in ctx->out (the walsender puts its own framing in front,
+ * which must stay uncompressed) and bdr_write() rewrites the payload as its
+ * uncompressed length followed by the compressed bytes before handing the
+ * message over. Without compression they are straight pass-throughs.
+ */
+static void
+bdr_prepare_write(LogicalDecodingContext *ctx)
+{
+	BdrOutputData *data = ctx->output_plugin_private;
+
+	OutputPluginPrepareWrite(ctx, true);
+	data->msg_start = ctx->out->len;
+}
+
+static void
+bdr_compress_message(LogicalDecodingContext *ctx, BdrOutputData *data)
+{
+	StringInfo	out = ctx->out;
+	StringInfo	staging = &data->compress_buf;
+	int			rawlen = out->len - data->msg_start;
+
+	/*
+	 * Compress out of the output buffer into the reusable staging buffer,
+	 * then copy back only the compressed bytes. The compressed form is
+	 * (nearly always) the smaller of the two, so this direction keeps the
+	 * extra memcpy per message as small as possible; the datum bytes
+	 * themselves were written into ctx->out directly and are never staged
+	 * uncompressed.
+	 */
+	resetStringInfo(staging);
+
+	if (data->compression == BDR_COMPRESSION_LZ4)
+	{
+#ifdef USE_LZ4
+		int			bound = LZ4_compressBound(rawlen);
+		int			clen;
+
+		enlargeStringInfo(staging, bound);
+		clen = LZ4_compress_default(out->data + data->msg_start,
+									staging->data, rawlen, bound);
+		if (clen <= 0)
+			elog(ERROR, "lz4 compression of a %d byte message failed",
+				 rawlen);
+		staging->len = clen;
+#endif
+	}
+	else
+	{
+#ifdef USE_ZSTD
+		ZSTD_inBuffer in;
+
+		Assert(data->compression == BDR_COMPRESSION_ZSTD);
+
+		in.src = out->data + data->msg_start;
+		in.size = rawlen;
+		in.pos = 0;
+
+		/*
+		 * ZSTD_e_flush makes the frame boundary fall on the message
+		 * boundary, so the downstream can decompress each message as it
+		 * arrives while the shared context keeps its history.
+		 */
+		for (;;)
+		{
+			ZSTD_outBuffer zout;
+			size_t		res;
+
+			enlargeStringInfo(staging, ZSTD_CStreamOutSize());
+
+			zout.dst = staging->data + staging->len;
+			zout.size = staging->maxlen - staging->len - 1;
+			zout.pos = 0;
+
+			res = ZSTD_compressStream2(data->zstd_out, &zout, &in,
+									   ZSTD_e_flush);
+			if (ZSTD_isError(res))
+				elog(ERROR, "zstd compression failed: %s",
+					 ZSTD_getErrorName(res));
+			staging->len += zout.pos;
+
+			if (res == 0 && in.pos == in.size)
+				break;
+		}
+#endif
+	}
+
+	out->len = data->msg_start;
+	pq_sendint(out, rawlen, 4);
+	appendBinaryStringInfo(out, staging->data, staging->len);
+}
+
+static void
+bdr_write(LogicalDecodingContext *ctx)
+{
+	BdrOutputData *data = ctx->output_plugin_private;
+
+	if (data->compression != BDR_COMPRESSION_NONE)
+		bdr_compress_message(ctx, data);
+
+	/* what actually goes on the wire, i.e. after compression */
+	bdr_count_decode_bytes(ctx->out->len - data->msg_start);
+
+	OutputPluginWrite(ctx, true);
+}
+
 /*
  * BEGIN callback
  *
@@ -871,14 +1238,49 @@ void
 pg_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 {
 	BdrOutputData *data = ctx->output_plugin_private;
-	int flags = 0;
 
 	AssertVariableIsOfType(&pg_decode_begin_txn, LogicalDecodeBeginCB);
 
 	if (!should_forward_changeset(ctx, txn->origin_id))
 		return;
 
-	OutputPluginPrepareWrite(ctx, true);
+	/*
+	 * Don't send anything yet. With replication sets and origin filtering
+	 * many transactions forward no changes at all; the BEGIN is emitted by
+	 * send_pending_begin() once the first forwarded change or transactional
+	 * message shows up, and transactions that stay empty are suppressed in
+	 * pg_decode_commit_txn().
+	 */
+	data->begin_pending = true;
+	data->begin_pending_txn = txn;
+
+	/* insert runs never span transactions */
+	data->insert_run_open = false;
+	data->insert_run_relid = InvalidOid;
+	data->insert_last_relid = InvalidOid;
+	return;
+}
+
+/*
+ * Emit the deferred BEGIN for the transaction being replayed, if it hasn't
+ * gone out yet. Must be called before anything belonging to the transaction
+ * is put on the wire.
+ */
+static void
+send_pending_begin(LogicalDecodingContext *ctx, BdrOutputData *data)
+{
+	ReorderBufferTXN *txn = data->begin_pending_txn;
+	int flags = 0;
+
+	if (!data->begin_pending)
+		return;
+
+	data->begin_pending = false;
+	data->begin_pending_txn = NULL;
+
+	bdr_count_decode_txn();
+
+	bdr_prepare_write(ctx);
 	pq_sendbyte(ctx->out, 'B');		/* BEGIN */
 
 
@@ -920,8 +1322,77 @@ pg_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 		pq_sendint64(ctx->out, txn->origin_lsn);
 	}
 
-	OutputPluginWrite(ctx, true);
-	return;
+	bdr_write(ctx);
+}
+
+/*
+ * Close an open insert run by sending its trailer, if there is one.
+ *
+ * Must be called before emitting anything that is not a further row of the
+ * run: another action, a message, or the transaction's commit.
+ */
+static void
+end_insert_run(LogicalDecodingContext *ctx, BdrOutputData *data)
+{
+	data->insert_last_relid = InvalidOid;
+
+	if (!data->insert_run_open)
+		return;
+
+	bdr_prepare_write(ctx);
+	pq_sendbyte(ctx->out, 'E');		/* end of insert run */
+	bdr_write(ctx);
+
+	data->insert_run_open = false;
+	data->insert_run_relid = InvalidOid;
+}
+
+/*
+ * Send an INSERT while insert runs are negotiated.
+ *
+ * The first insert into a relation is sent as a plain 'I' action; only when
+ * a second consecutive insert into the same relation shows up do we open a
+ * run ('S' carrying the relation identity once) and switch to header-less
+ * 'R' row messages, so single-row transactions don't pay for the framing.
+ * The downstream applies the whole run through its multi-insert batch.
+ */
+static void
+write_insert_run_change(LogicalDecodingContext *ctx, BdrOutputData *data,
+						BDRRelation *rel, ReorderBufferChange *change)
+{
+	Oid			relid = RelationGetRelid(rel->rel);
+
+	if (data->insert_run_open && data->insert_run_relid != relid)
+		end_insert_run(ctx, data);
+
+	if (!data->insert_run_open && data->insert_last_relid == relid)
+	{
+		/* second consecutive insert into this relation, open a run */
+		bdr_prepare_write(ctx);
+		pq_sendbyte(ctx->out, 'S');	/* start of insert run */
+		write_rel(data, ctx->out, rel->rel);
+		bdr_write(ctx);
+
+		data->insert_run_open = true;
+		data->insert_run_relid = relid;
+	}
+
+	bdr_prepare_write(ctx);
+	if (data->insert_run_open)
+	{
+		pq_sendbyte(ctx->out, 'R');	/* row within the current run */
+		write_tuple(data, ctx->out, rel, &change->data.tp.newtuple->tuple);
+	}
+	else
+	{
+		pq_sendbyte(ctx->out, 'I');	/* action INSERT */
+		write_rel(data, ctx->out, rel->rel);
+		pq_sendbyte(ctx->out, 'N');	/* new tuple follows */
+		write_tuple(data, ctx->out, rel, &change->data.tp.newtuple->tuple);
+
+		data->insert_last_relid = relid;
+	}
+	bdr_write(ctx);
 }
 
 /*
@@ -942,11 +1413,31 @@ pg_decode_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 					 XLogRecPtr commit_lsn)
 {
 	int flags = 0;
+	BdrOutputData *data = ctx->output_plugin_private;
 
 	if (!should_forward_changeset(ctx, txn->origin_id))
 		return;
 
-	OutputPluginPrepareWrite(ctx, true);
+	/*
+	 * Nothing of this transaction was forwarded, so don't send an empty
+	 * BEGIN/COMMIT pair the downstream would have to receive, apply and
+	 * advance its origin over. Do tell the walsender, so it keeps the
+	 * downstream's feedback and lag tracking flowing with a periodic
+	 * position update instead.
+	 */
+	if (data->begin_pending)
+	{
+		Assert(data->begin_pending_txn == txn);
+		Assert(!data->insert_run_open);
+		data->begin_pending = false;
+		data->begin_pending_txn = NULL;
+		OutputPluginUpdateProgress(ctx, true);
+		return;
+	}
+
+	end_insert_run(ctx, data);
+
+	bdr_prepare_write(ctx);
 	pq_sendbyte(ctx->out, 'C');		/* sending COMMIT */
 
 	/* send the flags field its self */
@@ -960,7 +1451,7 @@ pg_decode_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	pq_sendint64(ctx->out, txn->end_lsn);
 	pq_sendint64(ctx->out, txn->xact_time.commit_time);
 
-	OutputPluginWrite(ctx, true);
+	bdr_write(ctx);
 }
 
 void
@@ -971,6 +1462,19 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	MemoryContext old;
 	BDRRelation *bdr_relation;
 
+	BDR_TRACE_DECODE_CHANGE(change->action, RelationGetRelid(relation));
+
+	/*
+	 * Skip changes on relations our replication sets are already known to
+	 * exclude entirely before opening and locking anything; with sparse
+	 * sets that's the common case in this loop.
+	 */
+	if (bdr_relation_excluded_cached(RelationGetRelid(relation)))
+	{
+		bdr_count_decode_filtered_relation();
+		return;
+	}
+
 	bdr_relation = bdr_heap_open(RelationGetRelid(relation), AccessShareLock);
 
 	data = ctx->output_plugin_private;
@@ -979,50 +1483,241 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	old = MemoryContextSwitchTo(data->context);
 
 	if (!should_forward_changeset(ctx, txn->origin_id))
+	{
+		bdr_count_decode_filtered_origin();
 		goto skip;
+	}
 
 	if (!should_forward_change(ctx, data, bdr_relation, change->action))
+	{
+		bdr_count_decode_filtered_relation();
 		goto skip;
+	}
 
-	OutputPluginPrepareWrite(ctx, true);
+	bdr_count_decode_change();
+
+	send_pending_begin(ctx, data);
+
+	maybe_send_relmeta(ctx, data, relation);
 
+	if (data->allow_insert_runs &&
+		change->action == REORDER_BUFFER_CHANGE_INSERT &&
+		RelationGetNamespace(relation) != data->bdr_schema_oid)
+	{
+		/*
+		 * Relations in the bdr schema keep the plain 'I' path; their apply
+		 * has ordered side effects (queued DDL and drops) and may not be
+		 * deferred into a batch downstream.
+		 */
+		write_insert_run_change(ctx, data, bdr_relation, change);
+		goto skip;
+	}
+
+	/* any other action terminates a run of inserts */
+	end_insert_run(ctx, data);
+
+	bdr_prepare_write(ctx);
+	write_change(data, ctx->out, bdr_relation, change);
+	bdr_write(ctx);
+
+skip:
+	MemoryContextSwitchTo(old);
+	MemoryContextReset(data->context);
+
+	bdr_heap_close(bdr_relation, NoLock);
+}
+
+/*
+ * Write one INSERT/UPDATE/DELETE action body to the output stream.
+ */
+static void
+write_change(BdrOutputData *data, StringInfo out, BDRRelation *rel,
+			 ReorderBufferChange *change)
+{
 	switch (change->action)
 	{
 		case REORDER_BUFFER_CHANGE_INSERT:
-			pq_sendbyte(ctx->out, 'I');		/* action INSERT */
-			write_rel(ctx->out, relation);
-			pq_sendbyte(ctx->out, 'N');		/* new tuple follows */
-			write_tuple(data, ctx->out, relation, &change->data.tp.newtuple->tuple);
+			pq_sendbyte(out, 'I');		/* action INSERT */
+			write_rel(data, out, rel->rel);
+			pq_sendbyte(out, 'N');		/* new tuple follows */
+			write_tuple(data, out, rel, &change->data.tp.newtuple->tuple);
 			break;
 		case REORDER_BUFFER_CHANGE_UPDATE:
-			pq_sendbyte(ctx->out, 'U');		/* action UPDATE */
-			write_rel(ctx->out, relation);
+			pq_sendbyte(out, 'U');		/* action UPDATE */
+			write_rel(data, out, rel->rel);
 			if (change->data.tp.oldtuple != NULL)
 			{
-				pq_sendbyte(ctx->out, 'K');	/* old key follows */
-				write_tuple(data, ctx->out, relation,
+				pq_sendbyte(out, 'K');	/* old key follows */
+				write_tuple(data, out, rel,
 							&change->data.tp.oldtuple->tuple);
 			}
-			pq_sendbyte(ctx->out, 'N');		/* new tuple follows */
-			write_tuple(data, ctx->out, relation,
+			pq_sendbyte(out, 'N');		/* new tuple follows */
+			write_tuple(data, out, rel,
 						&change->data.tp.newtuple->tuple);
 			break;
 		case REORDER_BUFFER_CHANGE_DELETE:
-			pq_sendbyte(ctx->out, 'D');		/* action DELETE */
-			write_rel(ctx->out, relation);
+			pq_sendbyte(out, 'D');		/* action DELETE */
+			write_rel(data, out, rel->rel);
 			if (change->data.tp.oldtuple != NULL)
 			{
-				pq_sendbyte(ctx->out, 'K');	/* old key follows */
-				write_tuple(data, ctx->out, relation,
+				pq_sendbyte(out, 'K');	/* old key follows */
+				write_tuple(data, out, rel,
 							&change->data.tp.oldtuple->tuple);
 			}
 			else
-				pq_sendbyte(ctx->out, 'E');	/* empty */
+				pq_sendbyte(out, 'E');	/* empty */
 			break;
 		default:
 			Assert(false);
 	}
-	OutputPluginWrite(ctx, true);
+}
+
+/*
+ * In-progress transaction streaming.
+ *
+ * A streamed transaction arrives downstream as one or more 'b' ... 'e'
+ * bracketed segments of 'x' change messages, possibly interleaved with
+ * segments of other streamed transactions, and is finished off by either
+ * an 'a' (abort) or a 'c' (commit). Since no 'B' was ever sent for it,
+ * the 'c' message carries everything 'B' and 'C' normally would.
+ *
+ * If you change any of these you must also change the corresponding code
+ * in bdr_apply.c.
+ */
+static void
+pg_decode_stream_start(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
+{
+	if (!should_forward_changeset(ctx, txn->origin_id))
+		return;
+
+	bdr_prepare_write(ctx);
+	pq_sendbyte(ctx->out, 'b');		/* stream segment start */
+	pq_sendint(ctx->out, txn->xid, 4);
+	/* first segment of this transaction? */
+	pq_sendbyte(ctx->out, rbtxn_is_streamed(txn) ? 0 : 1);
+	bdr_write(ctx);
+}
+
+static void
+pg_decode_stream_stop(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
+{
+	if (!should_forward_changeset(ctx, txn->origin_id))
+		return;
+
+	bdr_prepare_write(ctx);
+	pq_sendbyte(ctx->out, 'e');		/* stream segment end */
+	bdr_write(ctx);
+}
+
+static void
+pg_decode_stream_abort(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+					   XLogRecPtr abort_lsn)
+{
+	/* for subtransaction aborts txn is the subxact, not the toplevel */
+	ReorderBufferTXN *toptxn = rbtxn_is_known_subxact(txn) ? txn->toptxn : txn;
+
+	if (!should_forward_changeset(ctx, toptxn->origin_id))
+		return;
+
+	bdr_prepare_write(ctx);
+	pq_sendbyte(ctx->out, 'a');		/* streamed transaction abort */
+	pq_sendint(ctx->out, toptxn->xid, 4);
+	pq_sendint(ctx->out, txn->xid, 4);
+	bdr_write(ctx);
+}
+
+static void
+pg_decode_stream_commit(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+						XLogRecPtr commit_lsn)
+{
+	BdrOutputData *data = ctx->output_plugin_private;
+	int flags = 0;
+
+	if (!should_forward_changeset(ctx, txn->origin_id))
+		return;
+
+	bdr_count_decode_txn();
+
+	bdr_prepare_write(ctx);
+	pq_sendbyte(ctx->out, 'c');		/* streamed transaction commit */
+	pq_sendint(ctx->out, txn->xid, 4);
+
+	/* see pg_decode_begin_txn */
+	if (data->forward_changesets)
+		flags |= BDR_OUTPUT_TRANSACTION_HAS_ORIGIN;
+
+	pq_sendint(ctx->out, flags, 4);
+
+	/* fixed fields, as in pg_decode_commit_txn */
+	Assert(commit_lsn == txn->final_lsn);
+	pq_sendint64(ctx->out, commit_lsn);
+	Assert(txn->end_lsn != InvalidXLogRecPtr);
+	pq_sendint64(ctx->out, txn->end_lsn);
+	pq_sendint64(ctx->out, txn->xact_time.commit_time);
+
+	if (flags & BDR_OUTPUT_TRANSACTION_HAS_ORIGIN)
+	{
+		BDRNodeId	origin;
+
+		bdr_fetch_sysid_via_node_id(txn->origin_id, &origin);
+
+		bdr_send_nodeid(ctx->out, &origin, false);
+		pq_sendint64(ctx->out, txn->origin_lsn);
+	}
+
+	bdr_write(ctx);
+}
+
+static void
+pg_decode_stream_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+						Relation relation, ReorderBufferChange *change)
+{
+	BdrOutputData *data;
+	MemoryContext old;
+	BDRRelation *bdr_relation;
+
+	BDR_TRACE_DECODE_CHANGE(change->action, RelationGetRelid(relation));
+
+	/*
+	 * Skip changes on relations our replication sets are already known to
+	 * exclude entirely before opening and locking anything; with sparse
+	 * sets that's the common case in this loop.
+	 */
+	if (bdr_relation_excluded_cached(RelationGetRelid(relation)))
+	{
+		bdr_count_decode_filtered_relation();
+		return;
+	}
+
+	bdr_relation = bdr_heap_open(RelationGetRelid(relation), AccessShareLock);
+
+	data = ctx->output_plugin_private;
+
+	/* Avoid leaking memory by using and resetting our own context */
+	old = MemoryContextSwitchTo(data->context);
+
+	if (!should_forward_changeset(ctx, txn->origin_id))
+	{
+		bdr_count_decode_filtered_origin();
+		goto skip;
+	}
+
+	if (!should_forward_change(ctx, data, bdr_relation, change->action))
+	{
+		bdr_count_decode_filtered_relation();
+		goto skip;
+	}
+
+	bdr_count_decode_change();
+
+	maybe_send_relmeta(ctx, data, relation);
+
+	bdr_prepare_write(ctx);
+	pq_sendbyte(ctx->out, 'x');		/* streamed change */
+	/* the change's (sub)transaction, for abort handling downstream */
+	pq_sendint(ctx->out, change->txn->xid, 4);
+	write_change(data, ctx->out, bdr_relation, change);
+	bdr_write(ctx);
 
 skip:
 	MemoryContextSwitchTo(old);
@@ -1031,11 +1726,133 @@ skip:
 	bdr_heap_close(bdr_relation, NoLock);
 }
 
+static void
+pg_decode_stream_message(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+						 XLogRecPtr lsn, bool transactional,
+						 const char *prefix, Size sz, const char *message)
+{
+	if (strcmp(prefix, BDR_LOGICAL_MSG_PREFIX) != 0)
+		return;
+
+	/*
+	 * Non-transactional messages don't belong to the streamed transaction;
+	 * send them the ordinary way.
+	 */
+	if (!transactional)
+	{
+		pg_decode_message(ctx, txn, lsn, transactional, prefix, sz, message);
+		return;
+	}
+
+	bdr_prepare_write(ctx);
+	pq_sendbyte(ctx->out, 'x');		/* streamed change */
+	pq_sendint(ctx->out, txn->xid, 4);
+	pq_sendbyte(ctx->out, 'M');		/* message follows */
+	pq_sendbyte(ctx->out, transactional);
+	pq_sendint64(ctx->out, lsn);
+	pq_sendint(ctx->out, sz, 4);
+	pq_sendbytes(ctx->out, message, sz);
+	bdr_write(ctx);
+}
+
+/*
+ * Which relations this decoding session has already described to the client
+ * with an 'r' metadata message. Entries whose sent flag was cleared by the
+ * relcache invalidation callback are described again before their next
+ * change. Static because the invalidation callback registration outlives
+ * the decoding session.
+ */
+typedef struct BdrRelMetaCacheEntry
+{
+	Oid			relid;
+	bool		sent;
+} BdrRelMetaCacheEntry;
+
+static HTAB *BdrRelMetaCache = NULL;
+static bool relmeta_cache_callback_registered = false;
+
+static void
+relmeta_cache_invalidation_cb(Datum arg, Oid relid)
+{
+	BdrRelMetaCacheEntry *entry;
+
+	if (BdrRelMetaCache == NULL)
+		return;
+
+	/* InvalidOid signals a complete cache reset */
+	if (relid == InvalidOid)
+	{
+		HASH_SEQ_STATUS status;
+
+		hash_seq_init(&status, BdrRelMetaCache);
+		while ((entry = hash_seq_search(&status)) != NULL)
+			entry->sent = false;
+	}
+	else if ((entry = hash_search(BdrRelMetaCache, &relid,
+								  HASH_FIND, NULL)) != NULL)
+		entry->sent = false;
+}
+
+static void
+relmeta_cache_init(void)
+{
+	HASHCTL		ctl;
+
+	/* a previous decoding session's cache means nothing to this client */
+	if (BdrRelMetaCache != NULL)
+		hash_destroy(BdrRelMetaCache);
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(BdrRelMetaCacheEntry);
+	ctl.hcxt = CacheMemoryContext;
+
+	BdrRelMetaCache = hash_create("bdr output relation metadata", 32, &ctl,
+								  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	if (!relmeta_cache_callback_registered)
+	{
+		CacheRegisterRelcacheCallback(relmeta_cache_invalidation_cb,
+									  (Datum) 0);
+		relmeta_cache_callback_registered = true;
+	}
+}
+
+/*
+ * Send an 'r' message describing the relation if this session hasn't done
+ * so yet (or its last description was invalidated). Must be sent as its
+ * own message before the change referring to the relation, so call this
+ * before OutputPluginPrepareWrite() of the change.
+ */
+static void
+maybe_send_relmeta(LogicalDecodingContext *ctx, BdrOutputData *data,
+				   Relation rel)
+{
+	Oid			relid = RelationGetRelid(rel);
+	BdrRelMetaCacheEntry *entry;
+	bool		found;
+
+	if (!data->allow_relmeta_cache)
+		return;
+
+	entry = hash_search(BdrRelMetaCache, &relid, HASH_ENTER, &found);
+	if (found && entry->sent)
+		return;
+
+	bdr_prepare_write(ctx);
+	pq_sendbyte(ctx->out, 'r');			/* relation metadata */
+	pq_sendint(ctx->out, relid, 4);		/* compact relation ID */
+	write_rel_names(ctx->out, rel);
+	bdr_write(ctx);
+
+	entry->sent = true;
+}
+
 /*
  * Write schema.relation to the output stream.
  */
 static void
-write_rel(StringInfo out, Relation rel)
+write_rel_names(StringInfo out, Relation rel)
 {
 	const char *nspname;
 	int64		nspnamelen;
@@ -1058,12 +1875,106 @@ write_rel(StringInfo out, Relation rel)
 	appendBinaryStringInfo(out, relname, relnamelen);
 }
 
+/*
+ * Identify the relation a change applies to, either by compact relation ID
+ * (when metadata caching is negotiated; the names went out in an earlier
+ * 'r' message) or by schema.relation as before.
+ */
+static void
+write_rel(BdrOutputData *data, StringInfo out, Relation rel)
+{
+	if (data->allow_relmeta_cache)
+		pq_sendint(out, RelationGetRelid(rel), 4);
+	else
+		write_rel_names(out, rel);
+}
+
+/*
+ * Does this builtin type have a send/recv wire format we know to be stable
+ * across the major versions we can replicate between?
+ *
+ * Used to salvage send/recv transfer for the common column types when a
+ * client on another major version negotiated sendrecv_stable_types; keep
+ * this list conservative, anything not on it just falls back to text.
+ */
+static bool
+bdr_type_sendrecv_stable(Oid typid)
+{
+	switch (typid)
+	{
+		case BOOLOID:
+		case CHAROID:
+		case NAMEOID:
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case OIDOID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+		case MONEYOID:
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+		case BYTEAOID:
+		case DATEOID:
+		case TIMEOID:
+		case TIMETZOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+		case INTERVALOID:
+		case UUIDOID:
+		case INETOID:
+		case CIDROID:
+		case MACADDROID:
+		case BITOID:
+		case VARBITOID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Return the attribute's type I/O cache slot with the decoding-side fields
+ * filled in, doing the pg_type syscache lookup and the output/send function
+ * lookups only on first contact with the column.
+ */
+static BDRAttrIOCache *
+get_attr_io_cache(BDRRelation *rel, Form_pg_attribute att, int attoff)
+{
+	BDRAttrIOCache *io = bdr_relation_att_io_cache(rel, attoff);
+
+	if (!io->type_cached)
+	{
+		HeapTuple	typtup;
+		Form_pg_type typclass;
+
+		typtup = SearchSysCache1(TYPEOID, ObjectIdGetDatum(att->atttypid));
+		if (!HeapTupleIsValid(typtup))
+			elog(ERROR, "cache lookup failed for type %u", att->atttypid);
+		typclass = (Form_pg_type) GETSTRUCT(typtup);
+
+		io->typtype = typclass->typtype;
+		io->typelem = typclass->typelem;
+		io->has_recv = OidIsValid(typclass->typreceive);
+		if (OidIsValid(typclass->typsend))
+			fmgr_info_cxt(typclass->typsend, &io->send_fn, CacheMemoryContext);
+		fmgr_info_cxt(typclass->typoutput, &io->out_fn, CacheMemoryContext);
+
+		ReleaseSysCache(typtup);
+		io->type_cached = true;
+	}
+
+	return io;
+}
+
 /*
  * Make the executive decision about which protocol to use.
  */
 static void
 decide_datum_transfer(BdrOutputData *data,
-					  Form_pg_attribute att, Form_pg_type typclass,
+					  Form_pg_attribute att, BDRAttrIOCache *io,
 					  bool *use_binary, bool *use_sendrecv)
 {
 	/* always disallow fancyness if there's type representation mismatches */
@@ -1078,9 +1989,9 @@ decide_datum_transfer(BdrOutputData *data,
 	 * Use the binary protocol, if allowed, for builtin & plain datatypes.
 	 */
 	else if (data->allow_binary_protocol &&
-		typclass->typtype == 'b' &&
+		io->typtype == 'b' &&
 		att->atttypid < FirstNormalObjectId &&
-		typclass->typelem == InvalidOid)
+		io->typelem == InvalidOid)
 	{
 		*use_binary = true;
 	}
@@ -1090,36 +2001,49 @@ decide_datum_transfer(BdrOutputData *data,
 	 * XXX: we can't use send/recv for array or composite types for now due to
 	 * the embedded oids.
 	 */
-	else if (data->allow_sendrecv_protocol &&
-			 OidIsValid(typclass->typreceive) &&
-			 (att->atttypid < FirstNormalObjectId || typclass->typtype != 'c') &&
-			 (att->atttypid < FirstNormalObjectId || typclass->typelem == InvalidOid))
+	else if ((data->allow_sendrecv_protocol ||
+			  (data->allow_sendrecv_stable &&
+			   bdr_type_sendrecv_stable(att->atttypid))) &&
+			 io->has_recv &&
+			 (att->atttypid < FirstNormalObjectId || io->typtype != 'c') &&
+			 (att->atttypid < FirstNormalObjectId || io->typelem == InvalidOid))
 	{
 		*use_sendrecv = true;
 	}
 }
 
+/*
+ * Write one datum length: a varint in the compact tuple format, fixed four
+ * bytes in the original one.
+ */
+static inline void
+write_att_len(StringInfo out, bool compact, uint32 len)
+{
+	if (compact)
+		bdr_sendvarint(out, len);
+	else
+		pq_sendint(out, len, 4);
+}
+
 /*
  * Write a tuple to the outputstream, in the most efficient format possible.
+ *
+ * Datum bytes go straight into the (pre-enlarged) output buffer, which the
+ * walsender hands to the protocol layer without another plugin-side copy;
+ * only the send/output-function paths unavoidably materialize their fmgr
+ * result before appending it.
  */
 static void
-write_tuple(BdrOutputData *data, StringInfo out, Relation rel,
+write_tuple(BdrOutputData *data, StringInfo out, BDRRelation *rel,
 			HeapTuple tuple)
 {
 	TupleDesc	desc;
 	Datum		values[MaxTupleAttributeNumber];
 	bool		isnull[MaxTupleAttributeNumber];
+	bool		compact = data->compact_tuples;
 	int			i;
 
-	desc = RelationGetDescr(rel);
-
-	pq_sendbyte(out, 'T');			/* tuple follows */
-
-	pq_sendint(out, desc->natts, 4);		/* number of attributes */
-
-	/* try to allocate enough memory from the get go */
-	enlargeStringInfo(out, tuple->t_len +
-					  desc->natts * ( 1 + 4));
+	desc = RelationGetDescr(rel->rel);
 
 	/*
 	 * XXX: should this prove to be a relevant bottleneck, it might be
@@ -1128,10 +2052,37 @@ write_tuple(BdrOutputData *data, StringInfo out, Relation rel,
 	 */
 	heap_deform_tuple(tuple, desc, values, isnull);
 
+	if (compact)
+	{
+		uint8		bitmap[(MaxTupleAttributeNumber + 7) / 8];
+		int			bitmaplen = (desc->natts + 7) / 8;
+
+		pq_sendbyte(out, 'C');	/* compact tuple follows */
+		bdr_sendvarint(out, desc->natts);
+
+		/* null bitmap: set bits mark null (or dropped) columns */
+		memset(bitmap, 0, bitmaplen);
+		for (i = 0; i < desc->natts; i++)
+		{
+			if (isnull[i] || desc->attrs[i].attisdropped)
+				bitmap[i / 8] |= 1 << (i % 8);
+		}
+		appendBinaryStringInfo(out, (char *) bitmap, bitmaplen);
+	}
+	else
+	{
+		pq_sendbyte(out, 'T');	/* tuple follows */
+
+		pq_sendint(out, desc->natts, 4);	/* number of attributes */
+	}
+
+	/* try to allocate enough memory from the get go */
+	enlargeStringInfo(out, tuple->t_len +
+					  desc->natts * ( 1 + 4));
+
 	for (i = 0; i < desc->natts; i++)
 	{
-		HeapTuple	typtup;
-		Form_pg_type typclass;
+		BDRAttrIOCache *io;
 
 		Form_pg_attribute att = &desc->attrs[i];
 
@@ -1140,21 +2091,28 @@ write_tuple(BdrOutputData *data, StringInfo out, Relation rel,
 
 		if (isnull[i] || att->attisdropped)
 		{
-			pq_sendbyte(out, 'n');	/* null column */
+			/* compact tuples carry nulls in the bitmap alone */
+			if (!compact)
+				pq_sendbyte(out, 'n');	/* null column */
 			continue;
 		}
 		else if (att->attlen == -1 && VARATT_IS_EXTERNAL_ONDISK(values[i]))
 		{
+			/*
+			 * An on-disk toast pointer can only reach us for a column the
+			 * transaction left untouched: changed toast data is reassembled
+			 * from its WAL chunks by the reorder buffer before we're called.
+			 * Ship a reuse-local-value marker instead of the (potentially
+			 * multi-MB) datum; the apply side keeps its existing value when
+			 * building the replacement tuple.
+			 */
 			pq_sendbyte(out, 'u');	/* unchanged toast column */
 			continue;
 		}
 
-		typtup = SearchSysCache1(TYPEOID, ObjectIdGetDatum(att->atttypid));
-		if (!HeapTupleIsValid(typtup))
-			elog(ERROR, "cache lookup failed for type %u", att->atttypid);
-		typclass = (Form_pg_type) GETSTRUCT(typtup);
+		io = get_attr_io_cache(rel, att, i);
 
-		decide_datum_transfer(data, att, typclass, &use_binary, &use_sendrecv);
+		decide_datum_transfer(data, att, io, &use_binary, &use_sendrecv);
 
 		if (use_binary)
 		{
@@ -1163,7 +2121,7 @@ write_tuple(BdrOutputData *data, StringInfo out, Relation rel,
 			/* pass by value */
 			if (att->attbyval)
 			{
-				pq_sendint(out, att->attlen, 4); /* length */
+				write_att_len(out, compact, att->attlen); /* length */
 
 				enlargeStringInfo(out, att->attlen);
 				store_att_byval(out->data + out->len, values[i], att->attlen);
@@ -1173,7 +2131,7 @@ write_tuple(BdrOutputData *data, StringInfo out, Relation rel,
 			/* fixed length non-varlena pass-by-reference type */
 			else if (att->attlen > 0)
 			{
-				pq_sendint(out, att->attlen, 4); /* length */
+				write_att_len(out, compact, att->attlen); /* length */
 
 				appendBinaryStringInfo(out, DatumGetPointer(values[i]),
 									   att->attlen);
@@ -1193,7 +2151,7 @@ write_tuple(BdrOutputData *data, StringInfo out, Relation rel,
 
 				Assert(!VARATT_IS_EXTERNAL(data));
 
-				pq_sendint(out, VARSIZE_ANY(data), 4); /* length */
+				write_att_len(out, compact, VARSIZE_ANY(data)); /* length */
 
 				appendBinaryStringInfo(out, data,
 									   VARSIZE_ANY(data));
@@ -1209,11 +2167,10 @@ write_tuple(BdrOutputData *data, StringInfo out, Relation rel,
 
 			pq_sendbyte(out, 's');	/* 'send' data follows */
 
-			outputbytes =
-				OidSendFunctionCall(typclass->typsend, values[i]);
+			outputbytes = SendFunctionCall(&io->send_fn, values[i]);
 
 			len = VARSIZE(outputbytes) - VARHDRSZ;
-			pq_sendint(out, len, 4); /* length */
+			write_att_len(out, compact, len); /* length */
 			pq_sendbytes(out, VARDATA(outputbytes), len); /* data */
 			pfree(outputbytes);
 		}
@@ -1224,15 +2181,12 @@ write_tuple(BdrOutputData *data, StringInfo out, Relation rel,
 
 			pq_sendbyte(out, 't');	/* 'text' data follows */
 
-			outputstr =
-				OidOutputFunctionCall(typclass->typoutput, values[i]);
+			outputstr = OutputFunctionCall(&io->out_fn, values[i]);
 			len = strlen(outputstr) + 1;
-			pq_sendint(out, len, 4); /* length */
+			write_att_len(out, compact, len); /* length */
 			appendBinaryStringInfo(out, outputstr, len); /* data */
 			pfree(outputstr);
 		}
-
-		ReleaseSysCache(typtup);
 	}
 }
 
@@ -1244,19 +2198,82 @@ pg_decode_message(LogicalDecodingContext *ctx,
 {
 	if (strcmp(prefix, BDR_LOGICAL_MSG_PREFIX) == 0)
 	{
-		OutputPluginPrepareWrite(ctx, true);
+		BdrOutputData *data = ctx->output_plugin_private;
+
+		/* a transactional message belongs to the transaction being replayed */
+		if (transactional)
+			send_pending_begin(ctx, data);
+
+		end_insert_run(ctx, data);
+
+		/*
+		 * Peers older than BDR_MESSAGE_BATCH know nothing of the batch
+		 * framing and would drop the whole message - and with it counted
+		 * lock/replay-confirm responses, wedging the DDL lock protocol.
+		 * Unwrap batches for such clients here and forward the contained
+		 * messages as individual frames; each sub-message is a complete
+		 * message body, so an old peer sees exactly the bytes a
+		 * non-batching sender would have produced. This also covers old
+		 * peers that connect later and replay a batch already in our WAL,
+		 * which no send-time gating could.
+		 */
+		if (data->client_bdr_version < BDR_MESSAGE_BATCH_MIN_VERSION_NUM &&
+			sz >= 4)
+		{
+			StringInfoData s;
+			BDRNodeId	origin;
+
+			s.data = (char *) message;
+			s.len = sz;
+			s.maxlen = -1;
+			s.cursor = 0;
+
+			if (pq_getmsgint(&s, 4) == BDR_MESSAGE_BATCH)
+			{
+				int			nmessages;
+				int			i;
+
+				bdr_getmsg_nodeid(&s, &origin, true);
+				nmessages = pq_getmsgint(&s, 4);
+
+				for (i = 0; i < nmessages; i++)
+				{
+					int			sub_len = pq_getmsgint(&s, 4);
+					const char *sub = pq_getmsgbytes(&s, sub_len);
+
+					bdr_prepare_write(ctx);
+					pq_sendbyte(ctx->out, 'M');	/* message follows */
+					pq_sendbyte(ctx->out, transactional);
+					pq_sendint64(ctx->out, lsn);
+					pq_sendint(ctx->out, sub_len, 4);
+					pq_sendbytes(ctx->out, sub, sub_len);
+					bdr_write(ctx);
+				}
+
+				return;
+			}
+		}
+
+		bdr_prepare_write(ctx);
 		pq_sendbyte(ctx->out, 'M');	/* message follows */
 		pq_sendbyte(ctx->out, transactional);
 		pq_sendint64(ctx->out, lsn);
 		pq_sendint(ctx->out, sz, 4);
 		pq_sendbytes(ctx->out, message, sz);
-		OutputPluginWrite(ctx, true);
+		bdr_write(ctx);
 	}
 }
 
 /*
  * Clone of ReorderBufferCleanSerializedTXNs; see
  * https://www.postgresql.org/message-id/CAMsr+YHdX=XECbZshDZ2CZNWGTyw-taYBnzqVfx4JzM4ExP5xg@mail.gmail.com
+ *
+ * Note that the spill files themselves are written, formatted and re-read
+ * entirely by core's reorderbuffer.c; the output plugin only ever touches
+ * them here, to clean up leftovers. Within BDR the lever against spill
+ * volume is streaming in-progress transactions (negotiated at startup
+ * above), which keeps large transactions out of the spill path altogether
+ * on new enough peers.
  */
 static void
 pglReorderBufferCleanSerializedTXNs(const char *slotname)
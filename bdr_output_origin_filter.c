@@ -13,15 +13,20 @@
  */
 #include "postgres.h"
 
+#include "access/heapam.h"
+#include "access/table.h"
+#include "access/tableam.h"
 #include "access/xact.h"
 
 #include "catalog/namespace.h"
+#include "catalog/pg_replication_origin.h"
 
 #include "nodes/parsenodes.h"
 
 #include "replication/logical.h"
 #include "replication/origin.h"
 
+#include "utils/builtins.h"
 #include "utils/inval.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
@@ -44,6 +49,7 @@ static int InvalidBdrOriginCacheCnt = 0;
 
 static BdrOriginCacheEntry *bdrorigincache_get_node(RepOriginId origin);
 static void bdr_lookup_origin(RepOriginId origin_id, BdrOriginCacheEntry *entry);
+static void bdrorigincache_preload(void);
 
 /*
  * Invalidation of the origin cache for when an origin is dropped or
@@ -62,12 +68,22 @@ bdrorigincache_invalidation_cb(Datum arg, int cacheid, uint32 hash_value)
 	 * We can't immediately delete entries as invalidations can
 	 * arrive while we're in the middle of using one. So we must
 	 * mark it invalid and purge it later.
+	 *
+	 * The message carries the syscache hash of the origin it is about, so
+	 * only the matching entry needs to go; everything else stays valid and
+	 * topology changes no longer force every walsender to rebuild its
+	 * whole cache. hash_value == 0 means a wholesale reset.
 	 */
 	hash_seq_init(&status, BdrOriginCache);
 	while ((hentry = (struct BdrOriginCacheEntry *) hash_seq_search(&status)) != NULL)
 	{
-	    hentry->is_valid = false;
-	    InvalidBdrOriginCacheCnt++;
+		if (hash_value != 0 &&
+			GetSysCacheHashValue1(REPLORIGIDENT,
+								  ObjectIdGetDatum((Oid) hentry->origin)) != hash_value)
+			continue;
+
+		hentry->is_valid = false;
+		InvalidBdrOriginCacheCnt++;
 	}
 }
 
@@ -121,6 +137,60 @@ bdrorigincache_init(MemoryContext decoding_context)
 		CacheRegisterSyscacheCallback(REPLORIGIDENT,
 			bdrorigincache_invalidation_cb, (Datum)0);
 	}
+
+	/*
+	 * Warm the cache from pg_replication_origin in one scan so the first
+	 * transaction of each origin doesn't pay a lookup in the middle of
+	 * decoding. Origins created later still fall back to the lazy path.
+	 */
+	bdrorigincache_preload();
+}
+
+/*
+ * Fill the cache from pg_replication_origin wholesale.
+ */
+static void
+bdrorigincache_preload(void)
+{
+	bool		txn_started = false;
+	Relation	rel;
+	TableScanDesc scan;
+	HeapTuple	tuple;
+	MemoryContext old_mctx;
+
+	if (!IsTransactionState())
+	{
+		StartTransactionCommand();
+		txn_started = true;
+	}
+
+	rel = table_open(ReplicationOriginRelationId, AccessShareLock);
+	scan = table_beginscan_catalog(rel, 0, NULL);
+
+	while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Form_pg_replication_origin form =
+			(Form_pg_replication_origin) GETSTRUCT(tuple);
+		RepOriginId origin = (RepOriginId) form->roident;
+		BdrOriginCacheEntry *hentry;
+		bool		found;
+
+		old_mctx = MemoryContextSwitchTo(TopMemoryContext);
+		hentry = (BdrOriginCacheEntry *) hash_search(BdrOriginCache,
+													 &origin,
+													 HASH_ENTER, &found);
+		(void) MemoryContextSwitchTo(old_mctx);
+
+		hentry->is_bdr_peer =
+			strncmp(text_to_cstring(&form->roname), "bdr_", 4) == 0;
+		hentry->is_valid = true;
+	}
+
+	table_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	if (txn_started)
+		CommitTransactionCommand();
 }
 
 /*
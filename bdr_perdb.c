@@ -44,6 +44,7 @@
 #include "utils/memutils.h"
 #include "utils/snapmgr.h"
 #include "utils/regproc.h"
+#include "utils/timestamp.h"
 
 PGDLLEXPORT Datum bdr_get_apply_pid(PG_FUNCTION_ARGS);
 
@@ -56,6 +57,13 @@ static bool xacthook_connections_changed = false;
 
 static bool is_perdb_worker = true;
 
+/*
+ * Earliest time an idle-detached apply worker for this database is due to be
+ * relaunched, or 0 if none is pending. Maintained by bdr_maintain_db_workers()
+ * and used by the main loop to cap its sleep. See bdr.apply_idle_exit_timeout.
+ */
+static TimestampTz next_idle_relaunch = 0;
+
 bool
 IsBdrPerdbWorker(void)
 {
@@ -134,6 +142,19 @@ find_apply_worker_slot(const BDRNodeId * const remote, BdrWorker **worker_found)
 	return found;
 }
 
+/*
+ * Snapshot of the apply worker slots belonging to this database, taken with
+ * a single locked pass over the worker array so that reconciling the
+ * bdr_connections rows against it doesn't rescan shared memory under the
+ * lock once per row. Slot addresses are stable for the life of the segment,
+ * so keeping pointers is safe.
+ */
+typedef struct BdrApplyWorkerRef
+{
+	BDRNodeId	remote_node;
+	BdrWorker  *worker;
+} BdrApplyWorkerRef;
+
 static void
 bdr_perdb_xact_callback(XactEvent event, void *arg)
 {
@@ -174,8 +195,11 @@ bdr_perdb_xact_callback(XactEvent event, void *arg)
 					/*
 					 * Per-db worker doesn't exist, ask the supervisor to check for
 					 * changes and register new per-db workers for labeled
-					 * databases.
+					 * databases. The generation bump is what marks this as a
+					 * real rescan request; the latch on its own could've been
+					 * set by anything.
 					 */
+					BdrWorkerCtl->perdb_rescan_generation++;
 					if (BdrWorkerCtl->supervisor_latch)
 						SetLatch(BdrWorkerCtl->supervisor_latch);
 				}
@@ -244,6 +268,8 @@ bdr_maintain_db_workers(void)
 	List			   *nodes_to_forget = NIL;
 	ListCell		   *lcparted;
 	ListCell		   *lcforget;
+	BdrApplyWorkerRef  *worker_refs;
+	int					nworker_refs;
 
 	bdr_make_my_nodeid(&myid);
 
@@ -266,6 +292,9 @@ bdr_maintain_db_workers(void)
 	snprintf(sysid_str, sizeof(sysid_str), UINT64_FORMAT, myid.sysid);
 	sysid_str[sizeof(sysid_str)-1] = '\0';
 
+	/* recomputed below from any slots still waiting out their idle period */
+	next_idle_relaunch = 0;
+
 	elog(DEBUG2, "launching apply workers");
 
 	/*
@@ -288,7 +317,7 @@ bdr_maintain_db_workers(void)
 	SPI_connect();
 	PushActiveSnapshot(GetTransactionSnapshot());
 
-	our_status = bdr_nodes_get_local_status(&myid);
+	our_status = bdr_nodeid_status(&myid);
 
 	/*
 	 * First check whether any existing processes to/from this database need
@@ -372,6 +401,22 @@ bdr_maintain_db_workers(void)
 			if (w->worker_type == BDR_WORKER_PERDB)
 				continue;
 
+			/*
+			 * An idle-detached apply worker has no process to kill; free the
+			 * slot it left behind so we don't relaunch it for a dead node.
+			 */
+			if (w->worker_type == BDR_WORKER_APPLY &&
+				w->worker_proc == NULL &&
+				w->data.apply.idle_until != 0 &&
+				((our_status == BDR_NODE_STATUS_KILLED &&
+				  w->data.apply.dboid == node->dboid) ||
+				 bdr_nodeid_eq(&w->data.apply.remote_node, node)))
+			{
+				w->worker_type = BDR_WORKER_EMPTY_SLOT;
+				memset(w, 0, sizeof(BdrWorker));
+				continue;
+			}
+
 			/* unconnected slot */
 			if (w->worker_proc == NULL)
 				continue;
@@ -536,6 +581,31 @@ bdr_maintain_db_workers(void)
 	SPI_connect();
 	PushActiveSnapshot(GetTransactionSnapshot());
 
+	/*
+	 * Collect the apply workers already registered for this database in one
+	 * locked pass. We're the only process that registers apply workers for
+	 * our database, so the snapshot can only be missing workers we register
+	 * further down in this same pass, and the connection rows are DISTINCT
+	 * on the remote id, so nothing registered here is looked up again.
+	 */
+	nworker_refs = 0;
+	worker_refs = palloc(bdr_max_workers * sizeof(BdrApplyWorkerRef));
+	LWLockAcquire(BdrWorkerCtl->lock, LW_SHARED);
+	for (i = 0; i < bdr_max_workers; i++)
+	{
+		BdrWorker  *w = &BdrWorkerCtl->slots[i];
+
+		if (w->worker_type == BDR_WORKER_APPLY &&
+			w->data.apply.dboid == MyDatabaseId)
+		{
+			bdr_nodeid_cpy(&worker_refs[nworker_refs].remote_node,
+						   &w->data.apply.remote_node);
+			worker_refs[nworker_refs].worker = w;
+			nworker_refs++;
+		}
+	}
+	LWLockRelease(BdrWorkerCtl->lock);
+
 	/*
 	 * Look up connection entries for all nodes other than our own.
 	 *
@@ -589,6 +659,7 @@ bdr_maintain_db_workers(void)
 		BackgroundWorkerHandle *bgw_handle;
 		HeapTuple				tuple;
 		uint32					slot;
+		int						wr;
 		uint32					worker_arg;
 		BdrWorker			   *worker;
 		BdrApplyWorker		   *apply;
@@ -667,24 +738,115 @@ bdr_maintain_db_workers(void)
 		if (node_status == BDR_NODE_STATUS_READY)
 			nnodes++;
 
-		LWLockAcquire(BdrWorkerCtl->lock, LW_EXCLUSIVE);
-
 		/*
 		 * Is there already a worker registered for this connection?
 		 */
-		if (find_apply_worker_slot(&target, &worker) != -1)
+		worker = NULL;
+		for (wr = 0; wr < nworker_refs; wr++)
+		{
+			if (bdr_nodeid_eq(&worker_refs[wr].remote_node, &target))
+			{
+				worker = worker_refs[wr].worker;
+				break;
+			}
+		}
+
+		if (worker != NULL)
 		{
-			elog(DEBUG2, "Skipping registration of worker for node "BDR_NODEID_FORMAT" on db oid=%u: already registered",
-				 BDR_NODEID_FORMAT_ARGS(target), myid.dboid);
+			bool		relaunch = false;
+
+			/*
+			 * A worker that detached because its connection was idle left
+			 * its slot behind with idle_until set, and its bgworker was
+			 * unregistered; it's our job to start a new bgworker for the
+			 * slot when that time comes around. See
+			 * bdr.apply_idle_exit_timeout.
+			 */
+			LWLockAcquire(BdrWorkerCtl->lock, LW_EXCLUSIVE);
+			if (worker->data.apply.idle_until != 0)
+			{
+				/*
+				 * The detaching worker sets idle_until before its shmem exit
+				 * callback clears worker_proc, so a slot can look due while
+				 * the old process is still on its way out; keep it on the
+				 * wakeup schedule and pick it up on the next pass.
+				 */
+				if (worker->worker_proc == NULL &&
+					GetCurrentTimestamp() >= worker->data.apply.idle_until)
+				{
+					worker->data.apply.idle_until = 0;
+					relaunch = true;
+				}
+				else if (next_idle_relaunch == 0 ||
+						 worker->data.apply.idle_until < next_idle_relaunch)
+					next_idle_relaunch = worker->data.apply.idle_until;
+			}
+			LWLockRelease(BdrWorkerCtl->lock);
+
+			if (!relaunch)
+			{
+				elog(DEBUG2, "Skipping registration of worker for node "BDR_NODEID_FORMAT" on db oid=%u: already registered",
+					 BDR_NODEID_FORMAT_ARGS(target), myid.dboid);
+
+				/*
+				 * Notify the worker that its config could have changed.
+				 *
+				 * The latch is assigned after the worker starts, so it might be
+				 * unset if the worker slot was created but it's still in early
+				 * startup. If that's the case it hasn't read its config yet
+				 * anyway, so we don't have to set the latch. Setting a latch
+				 * belonging to a dead or replaced process is safe, so this
+				 * doesn't need the lock.
+				 */
+				if (worker->data.apply.proclatch != NULL)
+					SetLatch(worker->data.apply.proclatch);
+
+				continue;
+			}
 
 			/*
-			 * Notify the worker that its config could have changed.
-			 *
-			 * The latch is assigned after the worker starts, so it might be
-			 * unset if the worker slot was created but it's still in early
-			 * startup. If that's the case it hasn't read its config yet
-			 * anyway, so we don't have to set the latch.
+			 * Register a fresh bgworker for the detached worker's existing
+			 * slot. It keeps its replay origin and settings; if the peer is
+			 * still quiet the new worker will just detach again once the
+			 * idle timeout passes.
 			 */
+			slot = (uint32) (worker - BdrWorkerCtl->slots);
+
+			snprintf(bgw.bgw_name, BGW_MAXLEN,
+					 "bdr apply %s to %s",
+					 bdr_nodeid_name(&target, true),
+					 bdr_nodeid_name(&myid, true));
+			snprintf(bgw.bgw_type, BGW_MAXLEN, "bdr apply worker");
+
+			Assert(slot <= UINT16_MAX);
+			worker_arg = (((uint32)BdrWorkerCtl->worker_generation) << 16) | (uint32)slot;
+			bgw.bgw_main_arg = Int32GetDatum(worker_arg);
+
+			if (!RegisterDynamicBackgroundWorker(&bgw, &bgw_handle))
+			{
+				/* put the slot back to sleep; we'll retry on the next pass */
+				LWLockAcquire(BdrWorkerCtl->lock, LW_EXCLUSIVE);
+				worker->data.apply.idle_until = GetCurrentTimestamp();
+				LWLockRelease(BdrWorkerCtl->lock);
+
+				ereport(ERROR,
+						(errmsg("bdr: Failed to register apply worker for "BDR_NODEID_FORMAT,
+								BDR_NODEID_FORMAT_ARGS(target))));
+			}
+
+			elog(DEBUG2, "relaunched idle-detached apply worker for "BDR_NODEID_FORMAT,
+				 BDR_NODEID_FORMAT_ARGS(target));
+
+			continue;
+		}
+
+		/* We're going to register a new worker for this connection */
+
+		LWLockAcquire(BdrWorkerCtl->lock, LW_EXCLUSIVE);
+
+		/* recheck under the lock, in case the snapshot missed it somehow */
+		if (find_apply_worker_slot(&target, &worker) != -1)
+		{
 			if (worker->data.apply.proclatch != NULL)
 				SetLatch(worker->data.apply.proclatch);
 
@@ -692,8 +854,6 @@ bdr_maintain_db_workers(void)
 			continue;
 		}
 
-		/* We're going to register a new worker for this connection */
-
 		/* Set the display name in 'ps' etc */
 		snprintf(bgw.bgw_name, BGW_MAXLEN,
 				 "bdr apply %s to %s",
@@ -896,6 +1056,8 @@ bdr_perdb_worker_main(Datum main_arg)
 
 	while (!got_SIGTERM)
 	{
+		bool	catchup_pending;
+
 		wait = true;
 
 		if (got_SIGHUP)
@@ -918,6 +1080,15 @@ bdr_perdb_worker_main(Datum main_arg)
 		/* check all bdr sequences for used up chunks */
 		bdr_sequencer_fill_sequences();
 
+		/*
+		 * If a peer's global write lock is waiting for the other nodes to
+		 * catch up, watch our replication slots' feedback positions so the
+		 * lock can be confirmed without waiting for the explicit
+		 * replay-confirm message round. While one is pending we poll on a
+		 * short timeout instead of the normal long sleep.
+		 */
+		catchup_pending = bdr_locks_poll_catchup();
+
 		pgstat_report_activity(STATE_IDLE, NULL);
 
 		/*
@@ -932,9 +1103,26 @@ bdr_perdb_worker_main(Datum main_arg)
 		 */
 		if (wait)
 		{
+			long		timeout = catchup_pending ? 200L : 180000L;
+
+			/*
+			 * If an idle-detached apply worker falls due for relaunch before
+			 * the normal sleep would end, wake up for it.
+			 */
+			if (next_idle_relaunch != 0)
+			{
+				long	secs;
+				int		usecs;
+
+				TimestampDifference(GetCurrentTimestamp(), next_idle_relaunch,
+									&secs, &usecs);
+				timeout = Min(timeout, secs * 1000L + usecs / 1000 + 1);
+			}
+
 			rc = WaitLatch(&MyProc->procLatch,
 						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-						   180000L, PG_WAIT_EXTENSION);
+						   timeout,
+						   WAIT_EVENT_LOGICAL_LAUNCHER_MAIN);
 
 			ResetLatch(&MyProc->procLatch);
 
@@ -950,6 +1138,12 @@ bdr_perdb_worker_main(Datum main_arg)
 				 */
 				bdr_maintain_db_workers();
 			}
+			else if (next_idle_relaunch != 0 &&
+					 GetCurrentTimestamp() >= next_idle_relaunch)
+			{
+				/* an idle-detached apply worker is due back */
+				bdr_maintain_db_workers();
+			}
 		}
 	}
 
@@ -0,0 +1,54 @@
+/* -------------------------------------------------------------------------
+ *
+ * bdr_probes.h
+ *		Statically defined tracepoints (USDT) on BDR's replication hot paths
+ *
+ * Copyright (C) 2017, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		bdr_probes.h
+ *
+ * -------------------------------------------------------------------------
+ */
+#ifndef BDR_PROBES_H
+#define BDR_PROBES_H
+
+/*
+ * These markers give perf/bpftrace/systemtap stable attachment points at
+ * the interesting seams - transaction begin/commit on the apply side,
+ * conflict resolution, global lock messages and change emission in the
+ * output plugin - instead of function-offset probes that break with every
+ * release.
+ *
+ * They're only compiled in when the server was built with --enable-dtrace
+ * (the same switch that enables the core TRACE_POSTGRESQL_* probes, which
+ * guarantees <sys/sdt.h> is available). A disabled probe site is a single
+ * nop instruction, so the markers stay in production builds for free;
+ * without ENABLE_DTRACE they vanish entirely.
+ */
+#ifdef ENABLE_DTRACE
+
+#include <sys/sdt.h>
+
+#define BDR_TRACE_APPLY_TXN_START(remote_xid, commit_afterend_lsn) \
+	DTRACE_PROBE2(bdr, apply__txn__start, (remote_xid), (commit_afterend_lsn))
+#define BDR_TRACE_APPLY_TXN_COMMIT(commit_afterend_lsn) \
+	DTRACE_PROBE1(bdr, apply__txn__commit, (commit_afterend_lsn))
+#define BDR_TRACE_CONFLICT_RESOLVED(conflict_type, resolution) \
+	DTRACE_PROBE2(bdr, conflict__resolved, (conflict_type), (resolution))
+#define BDR_TRACE_LOCKS_MESSAGE(msg_type, transactional) \
+	DTRACE_PROBE2(bdr, locks__message, (msg_type), (transactional))
+#define BDR_TRACE_DECODE_CHANGE(change_action, relid) \
+	DTRACE_PROBE2(bdr, decode__change, (change_action), (relid))
+
+#else							/* !ENABLE_DTRACE */
+
+#define BDR_TRACE_APPLY_TXN_START(remote_xid, commit_afterend_lsn) ((void) 0)
+#define BDR_TRACE_APPLY_TXN_COMMIT(commit_afterend_lsn) ((void) 0)
+#define BDR_TRACE_CONFLICT_RESOLVED(conflict_type, resolution) ((void) 0)
+#define BDR_TRACE_LOCKS_MESSAGE(msg_type, transactional) ((void) 0)
+#define BDR_TRACE_DECODE_CHANGE(change_action, relid) ((void) 0)
+
+#endif							/* ENABLE_DTRACE */
+
+#endif							/* BDR_PROBES_H */
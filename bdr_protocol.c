@@ -57,3 +57,42 @@ bdr_sendint64(int64 i, char *buf)
 	n32 = htonl(n32);
 	memcpy(&buf[4], &n32, 4);
 }
+
+/*
+ * Unsigned LEB128-style variable-length integers, used by the compact
+ * tuple format: seven payload bits per byte, low-order group first, high
+ * bit set on every byte but the last. Small values -- attribute counts
+ * and the lengths of narrow datums -- take a single byte instead of four.
+ */
+void
+bdr_sendvarint(StringInfo s, uint32 val)
+{
+	while (val >= 0x80)
+	{
+		pq_sendbyte(s, (val & 0x7f) | 0x80);
+		val >>= 7;
+	}
+	pq_sendbyte(s, val);
+}
+
+uint32
+bdr_getmsgvarint(StringInfo message)
+{
+	uint32		val = 0;
+	int			shift = 0;
+
+	for (;;)
+	{
+		uint8		b = pq_getmsgbyte(message);
+
+		val |= (uint32) (b & 0x7f) << shift;
+		if ((b & 0x80) == 0)
+			break;
+		shift += 7;
+		if (shift > 28)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROTOCOL_VIOLATION),
+					 errmsg("malformed variable-length integer")));
+	}
+	return val;
+}
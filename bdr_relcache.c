@@ -41,15 +41,55 @@
 
 static HTAB *BDRRelcacheHash = NULL;
 
+/*
+ * Memoized security label parse results, keyed by a hash of the label text.
+ *
+ * Parsing a label means a jsonb conversion, an iterator walk and set name
+ * validation, and it used to run on every BDRRelation rebuild. On
+ * invalidation-heavy workloads (temp tables, frequent DDL) entries are
+ * rebuilt constantly, while the set of distinct label texts stays tiny -
+ * most tables share the same few replication set configurations. The parse
+ * is a pure function of the label text, so its result can be memoized
+ * forever: a rebuild that sees a known label copies a fixed-layout struct
+ * instead of running the string parser.
+ *
+ * Relations borrow the memo's set name array rather than copying it (marked
+ * with sets_interned), which is safe precisely because entries are never
+ * removed. On the off chance two distinct labels hash alike, the second one
+ * just isn't memoized and keeps parsing the slow way.
+ */
+typedef struct BdrParsedRelOptions
+{
+	uint32		labelhash;		/* hash key, needs to be first */
+	char	   *label;			/* full label text, for collision checks */
+	bool		conflict_free;
+	int			num_replication_sets;
+	char	  **replication_sets;	/* sorted, owned by the memo */
+} BdrParsedRelOptions;
+
+static HTAB *BDRRelOptsParseHash = NULL;
+
 static void
 BDRRelcacheHashInvalidateEntry(BDRRelation *entry)
 {
 	int i;
+	size_t j;
 
 	if (entry->conflict_handlers)
+	{
+		for (j = 0; j < entry->conflict_handlers_len; j++)
+		{
+			if (entry->conflict_handlers[j].handler_retdesc)
+				FreeTupleDesc(entry->conflict_handlers[j].handler_retdesc);
+		}
+
 		pfree(entry->conflict_handlers);
+	}
+
+	if (entry->att_io_cache)
+		pfree(entry->att_io_cache);
 
-	if (entry->num_replication_sets > 0)
+	if (!entry->sets_interned && entry->num_replication_sets > 0)
 	{
 		for (i = 0; i < entry->num_replication_sets; i++)
 			pfree(entry->replication_sets[i]);
@@ -171,6 +211,72 @@ bdr_validate_replication_set_name(const char *name,
 	}
 }
 
+/*
+ * Record a successfully parsed label in the memo, copying the relation's
+ * parse results into memo-owned memory. The copies are made before the hash
+ * entry is created so an out-of-memory error can't leave a half-built entry
+ * behind.
+ */
+static void
+bdr_relopts_memoize(const char *label, uint32 labelhash, BDRRelation *rel)
+{
+	BdrParsedRelOptions *parsed;
+	char	   *labelcopy;
+	char	  **sets = NULL;
+	bool		found;
+	int			i;
+
+	if (BDRRelOptsParseHash == NULL)
+	{
+		HASHCTL		ctl;
+
+		/* Make sure we've initialized CacheMemoryContext. */
+		if (CacheMemoryContext == NULL)
+			CreateCacheMemoryContext();
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(uint32);
+		ctl.entrysize = sizeof(BdrParsedRelOptions);
+		ctl.hash = tag_hash;
+		ctl.hcxt = CacheMemoryContext;
+
+		BDRRelOptsParseHash = hash_create("BDR relation label parse memo",
+										  32, &ctl,
+										  HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+	}
+
+	labelcopy = MemoryContextStrdup(CacheMemoryContext, label);
+
+	if (rel->num_replication_sets > 0)
+	{
+		sets = MemoryContextAlloc(CacheMemoryContext,
+								  sizeof(char *) * rel->num_replication_sets);
+		for (i = 0; i < rel->num_replication_sets; i++)
+			sets[i] = MemoryContextStrdup(CacheMemoryContext,
+										  rel->replication_sets[i]);
+	}
+
+	parsed = hash_search(BDRRelOptsParseHash, (void *) &labelhash,
+						 HASH_ENTER, &found);
+	if (found)
+	{
+		/* hash collision with a different label; keep the incumbent */
+		if (sets != NULL)
+		{
+			for (i = 0; i < rel->num_replication_sets; i++)
+				pfree(sets[i]);
+			pfree(sets);
+		}
+		pfree(labelcopy);
+		return;
+	}
+
+	parsed->label = labelcopy;
+	parsed->conflict_free = rel->conflict_free;
+	parsed->num_replication_sets = rel->num_replication_sets;
+	parsed->replication_sets = sets;
+}
+
 void
 bdr_parse_relation_options(const char *label, BDRRelation *rel)
 {
@@ -178,12 +284,35 @@ bdr_parse_relation_options(const char *label, BDRRelation *rel)
 	JsonbValue	v;
 	int			r;
 	bool		parsing_sets = false;
+	bool		parsing_conflict_free = false;
 	int			level = 0;
 	Jsonb	*data = NULL;
+	uint32		labelhash;
 
 	if (label == NULL)
 		return;
 
+	labelhash = hash_bytes((const unsigned char *) label, strlen(label));
+
+	if (BDRRelOptsParseHash != NULL)
+	{
+		BdrParsedRelOptions *parsed;
+
+		parsed = hash_search(BDRRelOptsParseHash, (void *) &labelhash,
+							 HASH_FIND, NULL);
+		if (parsed != NULL && strcmp(parsed->label, label) == 0)
+		{
+			if (rel != NULL)
+			{
+				rel->conflict_free = parsed->conflict_free;
+				rel->num_replication_sets = parsed->num_replication_sets;
+				rel->replication_sets = parsed->replication_sets;
+				rel->sets_interned = true;
+			}
+			return;
+		}
+	}
+
 	data = DatumGetJsonbP(
 		DirectFunctionCall1(jsonb_in, CStringGetDatum(label)));
 
@@ -195,17 +324,30 @@ bdr_parse_relation_options(const char *label, BDRRelation *rel)
 	{
 		if (level == 0 && r != WJB_BEGIN_OBJECT)
 			elog(ERROR, "root element needs to be an object");
-		else if (level == 0 && it->nElems > 1)
-			elog(ERROR, "only 'sets' allowed on root level");
 		else if (level == 1 && r == WJB_KEY)
 		{
-			if (strncmp(v.val.string.val, "sets", v.val.string.len) != 0)
+			if (strncmp(v.val.string.val, "sets", v.val.string.len) == 0)
+			{
+				parsing_sets = true;
+
+				if (rel != NULL)
+					rel->num_replication_sets = 0;
+			}
+			else if (strncmp(v.val.string.val, "conflict_free",
+							 v.val.string.len) == 0)
+				parsing_conflict_free = true;
+			else
 				elog(ERROR, "unexpected key: %s",
 					 pnstrdup(v.val.string.val, v.val.string.len));
-			parsing_sets = true;
+		}
+		else if (parsing_conflict_free)
+		{
+			if (r != WJB_VALUE || v.type != jbvBool)
+				elog(ERROR, "conflict_free requires a boolean value");
 
 			if (rel != NULL)
-				rel->num_replication_sets = 0;
+				rel->conflict_free = v.val.boolean;
+			parsing_conflict_free = false;
 		}
 		else if (r == WJB_BEGIN_ARRAY || r == WJB_BEGIN_OBJECT)
 		{
@@ -256,6 +398,60 @@ bdr_parse_relation_options(const char *label, BDRRelation *rel)
 				  sizeof(char *), pg_qsort_strcmp);
 	}
 
+	if (rel != NULL)
+		bdr_relopts_memoize(label, labelhash, rel);
+}
+
+/*
+ * Return the BDRAttrIOCache slot for the attribute with offset 'attoff'
+ * (zero based), allocating the per-relation array on first use. The array
+ * lives in CacheMemoryContext and is released when the entry is
+ * invalidated, so callers must fill their part lazily every time they find
+ * their valid-flag unset.
+ */
+BDRAttrIOCache *
+bdr_relation_att_io_cache(BDRRelation *rel, int attoff)
+{
+	if (rel->att_io_cache == NULL)
+		rel->att_io_cache = (BDRAttrIOCache *)
+			MemoryContextAllocZero(CacheMemoryContext,
+								   RelationGetDescr(rel->rel)->natts *
+								   sizeof(BDRAttrIOCache));
+
+	Assert(attoff >= 0 && attoff < RelationGetDescr(rel->rel)->natts);
+
+	return &rel->att_io_cache[attoff];
+}
+
+/*
+ * Cheap decode-path filter: report whether cached state already proves
+ * that no action on this relation is forwarded to the current client,
+ * without opening or locking anything.
+ *
+ * This only ever returns true once a change on the relation has gone
+ * through should_forward_change() and had its replication set membership
+ * computed against the client's set list; until then, and again after any
+ * invalidation, we conservatively return false and let the regular path
+ * do its work. With sparse replication sets that makes all but the first
+ * change to an excluded table a single hash probe instead of a relation
+ * open, a lock and a security label parse.
+ */
+bool
+bdr_relation_excluded_cached(Oid reloid)
+{
+	BDRRelation *entry;
+
+	if (BDRRelcacheHash == NULL)
+		return false;
+
+	entry = hash_search(BDRRelcacheHash, (void *) &reloid,
+						HASH_FIND, NULL);
+
+	return entry != NULL && entry->valid &&
+		entry->computed_repl_valid &&
+		!entry->computed_repl_insert &&
+		!entry->computed_repl_update &&
+		!entry->computed_repl_delete;
 }
 
 BDRRelation *
@@ -370,42 +566,147 @@ replset_lookup(Relation rel, const char *cname)
 }
 
 /*
- * Compute whether modifications to this relation should be replicated or not
- * and cache the result in the relation descriptor.
+ * Which actions a replication set forwards, as a bitmask so the per-change
+ * filtering path reduces to bitmap tests.
+ */
+#define BDR_REPSET_REPLICATE_INSERT	0x01
+#define BDR_REPSET_REPLICATE_UPDATE	0x02
+#define BDR_REPSET_REPLICATE_DELETE	0x04
+#define BDR_REPSET_REPLICATE_ALL \
+	(BDR_REPSET_REPLICATE_INSERT | BDR_REPSET_REPLICATE_UPDATE | \
+	 BDR_REPSET_REPLICATE_DELETE)
+
+/* how many configured sets computed_set_membership can describe */
+#define BDR_MAX_INTERNED_REPSETS	64
+
+/*
+ * Per-decoding-session cache of each configured replication set's action
+ * mask, indexed by the set's position in the session's sorted set list.
+ * Those positions double as the bit numbers in computed_set_membership, so
+ * once a relation's membership bitmap is built, recomputing its replication
+ * settings is a pure bitmap walk with no catalog access.
  *
- * NB: This can only sensibly used from inside logical decoding as we require
- * a constant set of 'to be replicated' sets to be passed in - which happens
- * to be what we need for logical decoding. As there really isn't another need
- * for this functionality so far...
- * Another reason restricting this to backends in decoding is that we
- * currently can't invalidate the cache correctly otherwise.
+ * The configured set list is constant for the life of a decoding session
+ * (see bdr_heap_compute_replication_settings), so the masks only need
+ * rebuilding when bdr_replication_set_config itself changes.
  */
-void
-bdr_heap_compute_replication_settings(BDRRelation *r,
-									  int		   conf_num_replication_sets,
-									  char		 **conf_replication_sets)
+static int		repset_mask_count = -1;
+static uint8   *repset_masks = NULL;
+
+/*
+ * Build the action mask for every configured replication set with a single
+ * scan of bdr_replication_set_config, rather than one lookup per set and
+ * relation.
+ */
+static void
+bdr_build_repset_masks(int conf_num_replication_sets,
+					   char **conf_replication_sets)
 {
-	int i;
+	Relation	repl_sets;
+	SysScanDesc	scan;
+	HeapTuple	tuple;
+	TupleDesc	desc;
 
-	Assert(MyReplicationSlot); /* in decoding */
+	if (repset_masks != NULL)
+	{
+		pfree(repset_masks);
+		repset_masks = NULL;
+	}
 
-	Assert(!r->computed_repl_valid);
+	repset_masks = MemoryContextAlloc(CacheMemoryContext,
+							Max(conf_num_replication_sets, 1) * sizeof(uint8));
 
-	/* Implicit "replicate everything" configuration */
-	if (conf_num_replication_sets == -1)
+	/* Sets with no bdr_replication_set_config row replicate everything. */
+	memset(repset_masks, BDR_REPSET_REPLICATE_ALL,
+		   Max(conf_num_replication_sets, 1) * sizeof(uint8));
+
+	repl_sets = table_open(BdrReplicationSetConfigRelid, AccessShareLock);
+	desc = RelationGetDescr(repl_sets);
+
+	scan = systable_beginscan(repl_sets, 0, true, NULL, 0, NULL);
+
+	while ((tuple = systable_getnext(scan)) != NULL)
 	{
-		r->computed_repl_insert = true;
-		r->computed_repl_update = true;
-		r->computed_repl_delete = true;
+		bool		isnull;
+		Name		setname;
+		uint8		mask = 0;
+		int			i;
 
-		r->computed_repl_valid = true;
+		setname = DatumGetName(fastgetattr(tuple, 1, desc, &isnull));
+
+		for (i = 0; i < conf_num_replication_sets; i++)
+		{
+			if (strcmp(NameStr(*setname), conf_replication_sets[i]) == 0)
+				break;
+		}
+
+		/* not a set this session replicates */
+		if (i == conf_num_replication_sets)
+			continue;
+
+		if (DatumGetBool(fastgetattr(tuple, 2, desc, &isnull)))
+			mask |= BDR_REPSET_REPLICATE_INSERT;
+
+		if (DatumGetBool(fastgetattr(tuple, 3, desc, &isnull)))
+			mask |= BDR_REPSET_REPLICATE_UPDATE;
+
+		if (DatumGetBool(fastgetattr(tuple, 4, desc, &isnull)))
+			mask |= BDR_REPSET_REPLICATE_DELETE;
+
+		repset_masks[i] = mask;
+	}
+
+	systable_endscan(scan);
+	table_close(repl_sets, AccessShareLock);
+
+	repset_mask_count = conf_num_replication_sets;
+}
+
+/*
+ * bdr_replication_set_config changed: throw away the cached action masks
+ * and every relation's computed replication settings, but keep the entries
+ * themselves - and in particular their membership bitmaps - valid, since
+ * membership comes from the relations' own options. The next change on each
+ * relation recomputes its settings from the rebuilt masks without reopening
+ * the relation or reparsing its security label.
+ */
+void
+BDRRelcacheInvalidateReplicationSetConfig(void)
+{
+	HASH_SEQ_STATUS status;
+	BDRRelation *entry;
+
+	repset_mask_count = -1;
+
+	if (BDRRelcacheHash == NULL)
 		return;
+
+	hash_seq_init(&status, BDRRelcacheHash);
+
+	while ((entry = (BDRRelation *) hash_seq_search(&status)) != NULL)
+	{
+		entry->computed_repl_valid = false;
 	}
+}
+
+/*
+ * Fallback for sessions configured with more replication sets than the
+ * membership bitmap has bits: look each set up in
+ * bdr_replication_set_config individually, as the compute path always used
+ * to.
+ */
+static void
+bdr_heap_compute_replication_settings_slow(BDRRelation *r,
+										   int conf_num_replication_sets,
+										   char **conf_replication_sets)
+{
+	int i;
+
+	/* may be recomputing after a config change, so don't OR into old state */
+	r->computed_repl_insert = false;
+	r->computed_repl_update = false;
+	r->computed_repl_delete = false;
 
-	/*
-	 * Build the union of all replicated actions across all configured
-	 * replication sets.
-	 */
 	for (i = 0; i < conf_num_replication_sets; i++)
 	{
 		Relation repl_sets;
@@ -454,3 +755,84 @@ bdr_heap_compute_replication_settings(BDRRelation *r,
 
 	r->computed_repl_valid = true;
 }
+
+/*
+ * Compute whether modifications to this relation should be replicated or not
+ * and cache the result in the relation descriptor.
+ *
+ * The relation's membership in the session's configured sets is interned as
+ * a bitmap the first time through; after that, recomputation (e.g. after a
+ * bdr_replication_set_config change) just ORs the cached per-set action
+ * masks of the sets the relation belongs to.
+ *
+ * NB: This can only sensibly used from inside logical decoding as we require
+ * a constant set of 'to be replicated' sets to be passed in - which happens
+ * to be what we need for logical decoding. As there really isn't another need
+ * for this functionality so far...
+ * Another reason restricting this to backends in decoding is that we
+ * currently can't invalidate the cache correctly otherwise.
+ */
+void
+bdr_heap_compute_replication_settings(BDRRelation *r,
+									  int		   conf_num_replication_sets,
+									  char		 **conf_replication_sets)
+{
+	int			i;
+	uint8		mask = 0;
+
+	Assert(MyReplicationSlot); /* in decoding */
+
+	Assert(!r->computed_repl_valid);
+
+	/* Implicit "replicate everything" configuration */
+	if (conf_num_replication_sets == -1)
+	{
+		r->computed_repl_insert = true;
+		r->computed_repl_update = true;
+		r->computed_repl_delete = true;
+
+		r->computed_repl_valid = true;
+		return;
+	}
+
+	if (conf_num_replication_sets > BDR_MAX_INTERNED_REPSETS)
+	{
+		bdr_heap_compute_replication_settings_slow(r,
+												   conf_num_replication_sets,
+												   conf_replication_sets);
+		return;
+	}
+
+	if (repset_mask_count != conf_num_replication_sets)
+		bdr_build_repset_masks(conf_num_replication_sets,
+							   conf_replication_sets);
+
+	if (!r->computed_membership_valid)
+	{
+		r->computed_set_membership = 0;
+
+		for (i = 0; i < conf_num_replication_sets; i++)
+		{
+			if (relation_in_replication_set(r, conf_replication_sets[i]))
+				r->computed_set_membership |= UINT64CONST(1) << i;
+		}
+
+		r->computed_membership_valid = true;
+	}
+
+	/*
+	 * Build the union of all replicated actions across all configured
+	 * replication sets the relation is a member of.
+	 */
+	for (i = 0; i < conf_num_replication_sets; i++)
+	{
+		if (r->computed_set_membership & (UINT64CONST(1) << i))
+			mask |= repset_masks[i];
+	}
+
+	r->computed_repl_insert = (mask & BDR_REPSET_REPLICATE_INSERT) != 0;
+	r->computed_repl_update = (mask & BDR_REPSET_REPLICATE_UPDATE) != 0;
+	r->computed_repl_delete = (mask & BDR_REPSET_REPLICATE_DELETE) != 0;
+
+	r->computed_repl_valid = true;
+}
@@ -48,12 +48,28 @@
 #include "storage/lmgr.h"
 #include "storage/proc.h"
 #include "storage/sinvaladt.h"
+#include "storage/spin.h"
+
+/* capacity of a sequencer slot's pending-refill list */
+#define BDR_SEQ_PENDING_REFILLS 128
 
 typedef struct BdrSequencerSlot
 {
 	Oid			database_oid;
 	int			nnodes;
 	Latch	   *proclatch;
+
+	/*
+	 * Sequences flagged by allocating backends as needing chunks pulled in,
+	 * so a sequencer cycle only visits those instead of reading every global
+	 * sequence in the database. scan_all requests a full scan instead; it's
+	 * set at sequencer startup (wakeups from before then weren't recorded)
+	 * and when the list overflows.
+	 */
+	slock_t		mutex;
+	bool		scan_all;
+	int			npending;
+	Oid			pending[BDR_SEQ_PENDING_REFILLS];
 } BdrSequencerSlot;
 
 typedef struct BdrSequencerControl
@@ -107,7 +123,9 @@ const char *start_elections_sql =
 "                AND max_val.seqname = seq.relname\n"
 "        ), 0), (SELECT start_value FROM pg_sequence_parameters(seq.oid)))\n"
 "        AS current_max,\n"
-"        seq.cache_chunks\n"
+"        seq.cache_chunks,\n"
+"        bdr_internal_sequence_chunk_size(pg_namespace.nspname::text,\n"
+"                                         seq.relname::text) AS chunk_size\n"
 "    FROM\n"
 "        (SELECT\n"
 "            pg_class.oid,\n"
@@ -148,11 +166,13 @@ const char *start_elections_sql =
 "        seqschema,\n"
 "        seqname,\n"
 "        current_max,\n"
+"        chunk_size,\n"
 "        generate_series(\n"
 "            current_max,\n"
-"            -- 10000 is the chunk size, -1 is to get < instead <= out of generate_series\n"
-"            current_max + 10000 * (cache_chunks - open_seq_chunks) - 1,\n"
-"            10000) chunk_start\n"
+"            -- chunk_size comes from the sequencer's consumption tracking,\n"
+"            -- -1 is to get < instead <= out of generate_series\n"
+"            current_max + chunk_size * (cache_chunks - open_seq_chunks) - 1,\n"
+"            chunk_size) chunk_start\n"
 "    FROM to_be_updated_sequences\n"
 "    LIMIT 500\n"
 "),\n"
@@ -187,7 +207,7 @@ const char *start_elections_sql =
 "        true AS open,\n"
 "        seqschema,\n"
 "        seqname,\n"
-"        int8range(chunk_start, chunk_start + 10000) AS seqrange\n"
+"        int8range(chunk_start, chunk_start + chunk_size) AS seqrange\n"
 "    FROM to_be_inserted_chunks\n"
 "    RETURNING\n"
 "        seqschema,\n"
@@ -217,7 +237,7 @@ const char *start_elections_sql =
 "    false AS confirmed,\n"
 "    false AS in_use,\n"
 "    false AS emptied,\n"
-"    int8range(chunk_start, chunk_start + 10000)\n"
+"    int8range(chunk_start, chunk_start + chunk_size)\n"
 "FROM to_be_inserted_chunks\n"
 "-- force evaluation \n"
 "WHERE (SELECT count(*) FROM inserted_chunks) >= 0\n"
@@ -448,6 +468,8 @@ bdr_sequencer_shmem_startup(void)
 									  &found);
 	if (!found)
 	{
+		size_t		off;
+
 		/* initialize */
 		memset(BdrSequencerCtl, 0, bdr_sequencer_shmem_size());
 		/*
@@ -456,6 +478,9 @@ bdr_sequencer_shmem_startup(void)
 		 * worker later.
 		 */
 		BdrSequencerCtl->next_slot = 0;
+
+		for (off = 0; off < bdr_seq_nsequencers; off++)
+			SpinLockInit(&BdrSequencerCtl->slots[off].mutex);
 	}
 	LWLockRelease(AddinShmemInitLock);
 
@@ -529,6 +554,45 @@ bdr_sequencer_wakeup(void)
 	}
 }
 
+/*
+ * Flag a sequence as needing new chunks pulled in, so the next sequencer
+ * cycle visits just the flagged sequences instead of scanning every global
+ * sequence in the database. This only records which sequence to look at;
+ * callers that want a prompt refill still need to wake the sequencer.
+ */
+void
+bdr_sequencer_note_refill(Oid seqoid)
+{
+	size_t off;
+
+	if (BdrSequencerCtl == NULL)
+		return;
+
+	for (off = 0; off < bdr_seq_nsequencers; off++)
+	{
+		BdrSequencerSlot *slot = &BdrSequencerCtl->slots[off];
+		int			i;
+
+		if (slot->database_oid != MyDatabaseId)
+			continue;
+
+		SpinLockAcquire(&slot->mutex);
+		for (i = 0; i < slot->npending; i++)
+		{
+			if (slot->pending[i] == seqoid)
+				break;
+		}
+		if (i == slot->npending)
+		{
+			if (slot->npending < BDR_SEQ_PENDING_REFILLS)
+				slot->pending[slot->npending++] = seqoid;
+			else
+				slot->scan_all = true;
+		}
+		SpinLockRelease(&slot->mutex);
+	}
+}
+
 static void
 bdr_sequence_xact_callback(XactEvent event, void *arg)
 {
@@ -588,6 +652,10 @@ bdr_sequencer_init(int new_seq_slot, int nnodes)
 	slot->database_oid = MyDatabaseId;
 	slot->proclatch = &MyProc->procLatch;
 	slot->nnodes = nnodes;
+
+	/* start with a full scan; wakeups from before now weren't recorded */
+	slot->scan_all = true;
+	slot->npending = 0;
 }
 
 /*
@@ -803,6 +871,35 @@ bdr_sequencer_tally(void)
 
 	elog(DEBUG1, "tallied %d elections", SPI_processed);
 
+	/*
+	 * Chunks confirmed by this tally are usable right away; flag their
+	 * sequences so the following fill pass visits them without a full scan.
+	 * This is also what pulls the first chunks into a newly created
+	 * sequence, which has never been touched by an allocating backend.
+	 */
+	{
+		uint64		row;
+
+		for (row = 0; row < SPI_processed; row++)
+		{
+			HeapTuple	tup = SPI_tuptable->vals[row];
+			TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+			char	   *status = SPI_getvalue(tup, tupdesc, 4);
+			Oid			nspoid;
+			Oid			seqoid;
+
+			if (strcmp(status, "success") != 0)
+				continue;
+
+			nspoid = get_namespace_oid(SPI_getvalue(tup, tupdesc, 1), true);
+			if (!OidIsValid(nspoid))
+				continue;
+			seqoid = get_relname_relid(SPI_getvalue(tup, tupdesc, 2), nspoid);
+			if (OidIsValid(seqoid))
+				bdr_sequencer_note_refill(seqoid);
+		}
+	}
+
 	PopActiveSnapshot();
 	SPI_finish();
 	CommitTransactionCommand();
@@ -823,6 +920,115 @@ bdr_sequence_value_cmp(const void *a, const void *b)
 	return 1;
 }
 
+/*
+ * Per-sequence consumption tracking, local to the sequencer worker, used to
+ * size the chunks the next election round requests. Sequences that burn
+ * through their chunks quickly get proportionally larger ranges so they need
+ * elections rarely; slow ones stay at the minimum so little is stranded if
+ * the node parts. Rates are estimated from how often the sequence pulls a
+ * fresh chunk, which is the only demand signal the sequencer sees.
+ */
+#define BDR_SEQ_CHUNK_MIN_SIZE		10000
+#define BDR_SEQ_CHUNK_MAX_SIZE		1000000
+/* aim for roughly one chunk pull per sequence per this many seconds */
+#define BDR_SEQ_CHUNK_TARGET_SECS	600
+
+typedef struct BdrSeqRateEntry
+{
+	Oid			seqoid;
+	TimestampTz	last_grant;
+	double		rate;			/* values consumed per second, smoothed */
+} BdrSeqRateEntry;
+
+static HTAB *bdr_seq_rate_hash = NULL;
+
+static void
+bdr_sequencer_track_grant(Oid seqoid, int64 nvalues)
+{
+	BdrSeqRateEntry *entry;
+	bool		found;
+	TimestampTz	now = GetCurrentTimestamp();
+
+	if (bdr_seq_rate_hash == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(BdrSeqRateEntry);
+		bdr_seq_rate_hash = hash_create("bdr sequence consumption", 64, &ctl,
+										HASH_ELEM | HASH_BLOBS);
+	}
+
+	entry = hash_search(bdr_seq_rate_hash, &seqoid, HASH_ENTER, &found);
+	if (!found)
+	{
+		/* first grant observed; no interval to derive a rate from yet */
+		entry->last_grant = now;
+		entry->rate = 0.0;
+	}
+	else
+	{
+		double		elapsed;
+		double		sample;
+
+		elapsed = (now - entry->last_grant) / 1000000.0;
+		sample = nvalues / Max(elapsed, 0.001);
+
+		/* smooth, giving half the weight to the newest observation */
+		if (entry->rate == 0.0)
+			entry->rate = sample;
+		else
+			entry->rate = (entry->rate + sample) / 2.0;
+		entry->last_grant = now;
+	}
+}
+
+static int64
+bdr_sequencer_next_chunk_size(Oid seqoid)
+{
+	BdrSeqRateEntry *entry;
+	int64		size;
+
+	if (bdr_seq_rate_hash == NULL || !OidIsValid(seqoid))
+		return BDR_SEQ_CHUNK_MIN_SIZE;
+
+	entry = hash_search(bdr_seq_rate_hash, &seqoid, HASH_FIND, NULL);
+	if (entry == NULL || entry->rate == 0.0)
+		return BDR_SEQ_CHUNK_MIN_SIZE;
+
+	size = (int64) (entry->rate * BDR_SEQ_CHUNK_TARGET_SECS);
+	if (size < BDR_SEQ_CHUNK_MIN_SIZE)
+		size = BDR_SEQ_CHUNK_MIN_SIZE;
+	if (size > BDR_SEQ_CHUNK_MAX_SIZE)
+		size = BDR_SEQ_CHUNK_MAX_SIZE;
+
+	return size;
+}
+
+PGDLLEXPORT Datum bdr_internal_sequence_chunk_size(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(bdr_internal_sequence_chunk_size);
+
+/*
+ * SQL-callable hook for start_elections_sql: returns the chunk size the
+ * current process would request for the given sequence. Only the sequencer
+ * worker has consumption state; everywhere else this returns the minimum.
+ */
+Datum
+bdr_internal_sequence_chunk_size(PG_FUNCTION_ARGS)
+{
+	char	   *nspname = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	char	   *relname = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	Oid			nspoid = get_namespace_oid(nspname, true);
+	Oid			seqoid = InvalidOid;
+
+	if (OidIsValid(nspoid))
+		seqoid = get_relname_relid(relname, nspoid);
+
+	PG_RETURN_INT64(bdr_sequencer_next_chunk_size(seqoid));
+}
+
 /*
  * Replace a single (uninitialized or used up) chunk by a free one. Mark the
  * new chunk from bdr_sequence_values as in_use.
@@ -907,6 +1113,8 @@ bdr_sequencer_fill_chunk(Oid seqoid, char *seqschema, char *seqname,
 		curval->next_value = lower;
 		curval->end_value = upper;
 
+		bdr_sequencer_track_grant(seqoid, upper - lower);
+
 		success = true;
 	}
 	SPI_finish();
@@ -970,7 +1178,15 @@ bdr_sequencer_fill_sequence(Oid seqoid, char *seqschema, char *seqname)
 			if (bdr_sequencer_fill_chunk(seqoid, seqschema, seqname, curval))
 				acquired_new = true;
 			else
+			{
+				/*
+				 * No confirmed chunk was available. Keep the sequence
+				 * flagged so the next cycle retries once its elections
+				 * have finished.
+				 */
+				bdr_sequencer_note_refill(seqoid);
 				break;
+			}
 		}
 		curval++;
 	}
@@ -1050,6 +1266,10 @@ done_with_sequence:
  * some. This should be called after tallying (so we have a better chance to
  * have enough chunks) but before starting new elections since we might use up
  * existing chunks.
+ *
+ * Normally only the sequences flagged through bdr_sequencer_note_refill()
+ * since the last cycle are visited; a full scan of every global sequence
+ * only happens when the slot asks for one (startup, pending-list overflow).
  */
 void
 bdr_sequencer_fill_sequences(void)
@@ -1057,6 +1277,25 @@ bdr_sequencer_fill_sequences(void)
 	static SPIPlanPtr plan;
 	Portal		cursor;
 	int			total = 0;
+	BdrSequencerSlot *slot = &BdrSequencerCtl->slots[seq_slot];
+	bool		scan_all;
+	int			npending;
+	Oid			pending[BDR_SEQ_PENDING_REFILLS];
+
+	/*
+	 * Grab and clear the pending list up front; anything flagged after this
+	 * point is handled by the next cycle.
+	 */
+	SpinLockAcquire(&slot->mutex);
+	scan_all = slot->scan_all;
+	npending = slot->npending;
+	memcpy(pending, slot->pending, sizeof(Oid) * npending);
+	slot->scan_all = false;
+	slot->npending = 0;
+	SpinLockRelease(&slot->mutex);
+
+	if (!scan_all && npending == 0)
+		return;
 
 	StartTransactionCommand();
 	SPI_connect();
@@ -1064,41 +1303,63 @@ bdr_sequencer_fill_sequences(void)
 	bdr_sequencer_lock();
 	PushActiveSnapshot(GetTransactionSnapshot());
 
-	if (plan == NULL)
-	{
-		plan = SPI_prepare(fill_sequences_sql, 0, NULL);
-		SPI_keepplan(plan);
-	}
-
 	SetCurrentStatementStartTimestamp();
 	pgstat_report_activity(STATE_RUNNING, "fill_sequences");
 
-	cursor = SPI_cursor_open("seq", plan, NULL, NULL, 0);
+	if (!scan_all)
+	{
+		int			i;
 
-	SPI_cursor_fetch(cursor, true, 1);
+		for (i = 0; i < npending; i++)
+		{
+			char	   *seqname = get_rel_name(pending[i]);
+			char	   *seqschema;
 
-	while (SPI_processed > 0)
-	{
-		HeapTuple   tup = SPI_tuptable->vals[0];
-		bool		isnull;
-		Datum		seqoid;
-		Datum		seqschema;
-		Datum		seqname;
+			/* sequence dropped since it was flagged? */
+			if (seqname == NULL)
+				continue;
+			seqschema = get_namespace_name(get_rel_namespace(pending[i]));
 
-		seqoid = SPI_getbinval(tup, SPI_tuptable->tupdesc, 1, &isnull);
-		Assert(!isnull);
-		seqschema = SPI_getbinval(tup, SPI_tuptable->tupdesc, 2, &isnull);
-		Assert(!isnull);
-		seqname = SPI_getbinval(tup, SPI_tuptable->tupdesc, 3, &isnull);
-		Assert(!isnull);
+			bdr_sequencer_fill_sequence(pending[i], seqschema, seqname);
+
+			total += 1;
+		}
+	}
+	else
+	{
+		if (plan == NULL)
+		{
+			plan = SPI_prepare(fill_sequences_sql, 0, NULL);
+			SPI_keepplan(plan);
+		}
 
-		bdr_sequencer_fill_sequence(DatumGetObjectId(seqoid),
-									NameStr(*DatumGetName(seqschema)),
-									NameStr(*DatumGetName(seqname)));
+		cursor = SPI_cursor_open("seq", plan, NULL, NULL, 0);
 
 		SPI_cursor_fetch(cursor, true, 1);
 
-		total += 1;
+		while (SPI_processed > 0)
+		{
+			HeapTuple   tup = SPI_tuptable->vals[0];
+			bool		isnull;
+			Datum		seqoid;
+			Datum		seqschema;
+			Datum		seqname;
+
+			seqoid = SPI_getbinval(tup, SPI_tuptable->tupdesc, 1, &isnull);
+			Assert(!isnull);
+			seqschema = SPI_getbinval(tup, SPI_tuptable->tupdesc, 2, &isnull);
+			Assert(!isnull);
+			seqname = SPI_getbinval(tup, SPI_tuptable->tupdesc, 3, &isnull);
+			Assert(!isnull);
+
+			bdr_sequencer_fill_sequence(DatumGetObjectId(seqoid),
+										NameStr(*DatumGetName(seqschema)),
+										NameStr(*DatumGetName(seqname)));
+
+			SPI_cursor_fetch(cursor, true, 1);
+
+			total += 1;
+		}
 	}
 
 	PopActiveSnapshot();
@@ -1106,7 +1367,8 @@ bdr_sequencer_fill_sequences(void)
 	CommitTransactionCommand();
 	pgstat_report_stat(false);
 
-	elog(DEBUG1, "checked %d sequences for filling", total);
+	elog(DEBUG1, "checked %d sequences for filling%s", total,
+		 scan_all ? "" : " (targeted)");
 }
 
 
@@ -1220,6 +1482,30 @@ retry:
 		break;
 	}
 
+	/*
+	 * Proactively nudge the sequencer when the values remaining across all
+	 * cached chunks fall below the configured watermark, so a fresh voting
+	 * round can start (and hopefully finish) before we run completely dry
+	 * and callers stall in the retry loop below. Consumption state only
+	 * lives in the sequence tuple, so this is the one place it can be
+	 * observed cheaply.
+	 */
+	if (result != 0 && bdr_sequence_refill_watermark > 0)
+	{
+		int64		remaining = 0;
+
+		curval = (BdrSequenceValues *) VARDATA_ANY(DatumGetByteaP(values));
+		for (i = 0; i < 10; i++)
+		{
+			if (curval->end_value > curval->next_value)
+				remaining += curval->end_value - curval->next_value;
+			curval++;
+		}
+
+		if (remaining < bdr_sequence_refill_watermark)
+			wakeup = true;
+	}
+
 	/*
 	 * XXX: This is hacky and only works with current bdr-pg but we'll need
 	 * sequence rewrite to do things properly anyway so we'll live with it
@@ -1230,6 +1516,7 @@ retry:
 		ItemId		lp;
 		int			rc;
 
+		bdr_sequencer_note_refill(RelationGetRelid(seqrel));
 		bdr_sequencer_wakeup();
 		CHECK_FOR_INTERRUPTS();
 
@@ -1276,14 +1563,24 @@ retry:
 
 	if (wakeup)
 	{
+		bdr_sequencer_note_refill(RelationGetRelid(seqrel));
 		bdr_sequencer_wakeup();
 		bdr_schedule_eoxact_sequencer_wakeup();
 	}
 
 	next = result + log - 1;
 
+	/*
+	 * Hand the whole fetched batch to the backend-local cache. With CACHE n
+	 * on the sequence, nextval() serves the next n - 1 calls straight from
+	 * SeqTable without re-entering here, so concurrent sessions only
+	 * serialize on the sequence buffer lock once per batch instead of on
+	 * every value. Cached values are consumed from the chunk either way, so
+	 * crash behaviour matches local sequences: cached-but-unused values are
+	 * simply lost.
+	 */
 	elm->last = result;
-	elm->cached = result;
+	elm->cached = last;
 	elm->last_valid = true;
 
 	/* ready to change the on-disk (or really, in-buffer) tuple */
@@ -1315,9 +1612,9 @@ retry:
 	}
 
 	/* Now update sequence tuple to the intended final state */
-	seq->last_value = elm->last; /* last fetched number */
+	seq->last_value = elm->cached; /* last fetched number */
 	seq->is_called = true;
-	seq->log_cnt = log-1; /* how much is logged */
+	seq->log_cnt = next - last; /* how much is logged beyond that */
 
 	result = elm->last;
 
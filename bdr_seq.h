@@ -30,6 +30,7 @@ extern bool bdr_sequencer_start_elections(void);
 extern void bdr_sequencer_fill_sequences(void);
 
 extern void bdr_sequencer_wakeup(void);
+extern void bdr_sequencer_note_refill(Oid seqoid);
 extern void bdr_schedule_eoxact_sequencer_wakeup(void);
 
 extern int bdr_sequencer_get_next_free_slot(void);
@@ -65,6 +66,7 @@ inline static bool bdr_sequencer_start_elections(void) { return false; };
 inline static void bdr_sequencer_fill_sequences(void) { };
 
 inline static void bdr_sequencer_wakeup(void) { };
+inline static void bdr_sequencer_note_refill(Oid seqoid) { };
 inline static void bdr_schedule_eoxact_sequencer_wakeup(void) { };
 
 inline static int bdr_sequencer_get_next_free_slot(void) { return -1; };
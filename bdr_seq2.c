@@ -37,11 +37,16 @@
 #define MAX_SEQ_ID		((1 << SEQUENCE_BITS) - 1)
 #define MAX_TIMESTAMP	(((int64)1 << TIMESTAMP_BITS) - 1)
 
-/* Cache for nodeid so we don't have to read it for every nextval call. */
-static int16	seq_nodeid = -1;
+/*
+ * Cache for the node id so we don't have to read it for every nextval call.
+ * The shifted form is what actually gets ORed into the result; it's computed
+ * (and range-checked) once at cache fill so the per-call path is just a
+ * comparison. Invalidated from bdr_nodecache when bdr.bdr_nodes changes.
+ */
+static int64	seq_nodeid_shifted = 0;
 static Oid	seq_nodeid_dboid = InvalidOid;
 
-static int16 global_seq_get_nodeid(void);
+static int64 global_seq_get_nodeid_shifted(void);
 
 Datum global_seq_nextval_oid(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(global_seq_nextval_oid);
@@ -67,7 +72,7 @@ global_seq_nextval_oid(PG_FUNCTION_ARGS)
 	Oid		seqoid = PG_GETARG_OID(0);
 	Datum	sequenced;
 	int64	sequence;
-	int64	nodeid;
+	int64	nodeid_shifted;
 	int64	timestamp;
 	int64	res;
 	const int64 seq_ts_epoch = 529111339634; /* Oct 7, 2016, when this code was written, in ms */
@@ -85,7 +90,7 @@ global_seq_nextval_oid(PG_FUNCTION_ARGS)
 
 	/* timestamp is in milliseconds */
 	timestamp = (current_ts/1000) - seq_ts_epoch;
-	nodeid = global_seq_get_nodeid();
+	nodeid_shifted = global_seq_get_nodeid_shifted();
 	sequenced = DirectFunctionCall1(nextval_oid, seqoid);
 	sequence = DatumGetInt64(sequenced) % MAX_SEQ_ID;
 
@@ -98,9 +103,6 @@ global_seq_nextval_oid(PG_FUNCTION_ARGS)
 		elog(ERROR, "cannot generate sequence, timestamp "UINT64_FORMAT" out of range 0 .. "UINT64_FORMAT,
 			timestamp, MAX_TIMESTAMP);
 
-	if (nodeid < 0 || nodeid > MAX_NODE_ID)
-		elog(ERROR, "nodeid must be in range 0 .. %d", MAX_NODE_ID);
-
 	if (sequence < 0)
 		ereport(ERROR,
 				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
@@ -114,7 +116,7 @@ global_seq_nextval_oid(PG_FUNCTION_ARGS)
 	Assert(TIMESTAMP_BITS + NODEID_BITS + SEQUENCE_BITS == 64);
 
 	res = (timestamp << (64 - TIMESTAMP_BITS)) |
-		  (nodeid << (64 - TIMESTAMP_BITS - NODEID_BITS)) |
+		  nodeid_shifted |
 		  sequence;
 
 	PG_RETURN_INT64(res);
@@ -142,16 +144,30 @@ global_seq_read_nodeid(void)
 }
 
 /*
- * Get sequence nodeid with caching.
+ * Get the pre-shifted sequence nodeid with caching. The range check lives in
+ * global_seq_read_nodeid(), so values coming out of the cache need no
+ * per-call validation.
  */
-static int16
-global_seq_get_nodeid(void)
+static int64
+global_seq_get_nodeid_shifted(void)
 {
 	if (seq_nodeid_dboid != MyDatabaseId)
 	{
-		seq_nodeid = global_seq_read_nodeid();
+		seq_nodeid_shifted = ((int64) global_seq_read_nodeid())
+			<< (64 - TIMESTAMP_BITS - NODEID_BITS);
 		seq_nodeid_dboid = MyDatabaseId;
 	}
 
-	return seq_nodeid;
+	return seq_nodeid_shifted;
+}
+
+/*
+ * Forget the cached nodeid; called from the nodecache invalidation callback
+ * when bdr.bdr_nodes changes, so a reassigned node_seq_id is picked up
+ * without reconnecting.
+ */
+void
+global_seq_invalidate_nodeid(void)
+{
+	seq_nodeid_dboid = InvalidOid;
 }
@@ -17,3 +17,13 @@ bdr_internal_sequence_reset_cache(PG_FUNCTION_ARGS)
 {
 	elog(ERROR, "BDR global sequences not available");
 }
+
+PGDLLEXPORT Datum bdr_internal_sequence_chunk_size(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(bdr_internal_sequence_chunk_size);
+
+Datum
+bdr_internal_sequence_chunk_size(PG_FUNCTION_ARGS)
+{
+	elog(ERROR, "BDR global sequences not available");
+}
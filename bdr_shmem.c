@@ -70,6 +70,10 @@ bdr_shmem_init(void)
 	bdr_sequencer_shmem_init(bdr_max_databases);
 
 	bdr_locks_shmem_init();
+
+	bdr_nodecache_shmem_init();
+
+	bdr_dbcache_shmem_init();
 }
 
 /*
@@ -232,18 +236,45 @@ bdr_worker_shmem_startup(void)
 BdrWorker*
 bdr_worker_shmem_alloc(BdrWorkerType worker_type, uint32 *ctl_idx)
 {
-	int i;
+	int off;
 
 	Assert(LWLockHeldByMe(BdrWorkerCtl->lock));
-	for (i = 0; i < bdr_max_workers; i++)
+
+	/*
+	 * Start scanning at the free-slot hint rather than at the array start.
+	 * The hint points at the most recently freed slot (or just past the most
+	 * recently allocated one), so a worker restart cycle - free followed by
+	 * re-alloc - normally finds its slot on the first probe instead of
+	 * walking all the occupied slots under the lock. The hint is only an
+	 * optimisation; if it's stale we simply keep scanning, wrapping around.
+	 */
+	for (off = 0; off < bdr_max_workers; off++)
 	{
+		int			i = (BdrWorkerCtl->first_free_hint + off) % bdr_max_workers;
 		BdrWorker *new_entry = &BdrWorkerCtl->slots[i];
+
 		if (new_entry->worker_type == BDR_WORKER_EMPTY_SLOT)
 		{
 			memset(new_entry, 0, sizeof(BdrWorker));
 			new_entry->worker_type = worker_type;
+			if (worker_type == BDR_WORKER_APPLY)
+			{
+				int			action;
+				int			bucket;
+
+				/* the published replay progress is read without the lock */
+				pg_atomic_init_u64(&new_entry->data.apply.last_applied_lsn, 0);
+				pg_atomic_init_u64(&new_entry->data.apply.last_applied_committs, 0);
+				pg_atomic_init_u64(&new_entry->data.apply.received_lsn, 0);
+				pg_atomic_init_u64(&new_entry->data.apply.apply_rate, 0);
+
+				for (action = 0; action < BDR_APPLY_HIST_ACTIONS; action++)
+					for (bucket = 0; bucket < BDR_APPLY_HIST_BUCKETS; bucket++)
+						pg_atomic_init_u64(&new_entry->data.apply.action_hist[action][bucket], 0);
+			}
 			if (ctl_idx)
 				*ctl_idx = i;
+			BdrWorkerCtl->first_free_hint = (i + 1) % bdr_max_workers;
 			return new_entry;
 		}
 	}
@@ -288,6 +319,9 @@ bdr_worker_shmem_free(BdrWorker* worker, BackgroundWorkerHandle *handle)
 		worker->worker_type = BDR_WORKER_EMPTY_SLOT;
 		/* and for good measure, zero it so problems are seen immediately */
 		memset(worker, 0, sizeof(BdrWorker));
+
+		/* point the allocator straight at the slot we just vacated */
+		BdrWorkerCtl->first_free_hint = worker - BdrWorkerCtl->slots;
 	}
 	LWLockRelease(BdrWorkerCtl->lock);
 }
@@ -341,6 +341,8 @@ bdr_get_supervisordb_oid(bool missingok)
 void
 bdr_supervisor_worker_main(Datum main_arg)
 {
+	uint32		rescan_generation;
+
 	Assert(DatumGetInt32(main_arg) == 0);
 	Assert(IsBackgroundWorker);
 
@@ -410,21 +412,40 @@ bdr_supervisor_worker_main(Datum main_arg)
 	/* mark as idle, before starting to loop */
 	pgstat_report_activity(STATE_IDLE, NULL);
 
+	/*
+	 * Read the rescan request generation before the initial scan, so a
+	 * request that lands while we're scanning still looks new afterwards
+	 * (its SetLatch will wake us and the generations won't match).
+	 */
+	LWLockAcquire(BdrWorkerCtl->lock, LW_SHARED);
+	rescan_generation = BdrWorkerCtl->perdb_rescan_generation;
+	LWLockRelease(BdrWorkerCtl->lock);
+
 	bdr_supervisor_rescan_dbs();
 
 	while (!got_SIGTERM)
 	{
 		int rc;
+		long timeout = 180000L;
 
 		/*
-		 * After startup the supervisor doesn't currently have anything to do,
-		 * so it can just go to sleep on its latch. It could exit after running
-		 * startup, but we're expecting to need it to do other things down the
-		 * track, so might as well keep it alive...
+		 * Wake up often enough to do the periodic stats flush; the
+		 * interval is checked in bdr_count_maybe_flush() itself, so
+		 * spurious wakeups are cheap.
+		 */
+		if (bdr_count_flush_interval > 0)
+			timeout = Min(timeout, (long) bdr_count_flush_interval * 1000);
+
+		/*
+		 * After startup the supervisor has little to do of its own, so it
+		 * can just go to sleep on its latch, waking up for the periodic
+		 * stats flush. It could exit after running startup, but we're
+		 * expecting to need it to do other things down the track, so might
+		 * as well keep it alive...
 		 */
 		rc = WaitLatch(&MyProc->procLatch,
 					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-					   180000L, PG_WAIT_EXTENSION);
+					   timeout, WAIT_EVENT_LOGICAL_LAUNCHER_MAIN);
 
 		ResetLatch(&MyProc->procLatch);
 
@@ -440,12 +461,28 @@ bdr_supervisor_worker_main(Datum main_arg)
 
 		if (rc & WL_LATCH_SET)
 		{
+			uint32		cur_generation;
+
+			LWLockAcquire(BdrWorkerCtl->lock, LW_SHARED);
+			cur_generation = BdrWorkerCtl->perdb_rescan_generation;
+			LWLockRelease(BdrWorkerCtl->lock);
+
 			/*
 			 * We've been asked to launch new perdb workers if there are any
-			 * changes to security labels.
+			 * changes to security labels. Only crawl pg_shseclabel when
+			 * someone actually requested a rescan, though - our latch also
+			 * gets set by signals and other events that have nothing to do
+			 * with label changes.
 			 */
-			bdr_supervisor_rescan_dbs();
+			if (cur_generation != rescan_generation)
+			{
+				rescan_generation = cur_generation;
+				bdr_supervisor_rescan_dbs();
+			}
 		}
+
+		/* flush the shared stats counters to disk now and then */
+		bdr_count_maybe_flush();
 	}
 
 	proc_exit(0);
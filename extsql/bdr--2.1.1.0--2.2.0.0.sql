@@ -0,0 +1,307 @@
+--\echo Use "CREATE EXTENSION bdr" to load this file. \quit
+--
+-- Adds bdr.table_set_conflict_free(), which declares a table free of
+-- cross-node write conflicts (e.g. a single designated writer per table)
+-- so that apply can skip conflict detection for it entirely.
+--
+
+SET LOCAL bdr.permit_unsafe_ddl_commands = true;
+SET LOCAL bdr.skip_ddl_replication = true;
+SET LOCAL search_path = bdr;
+
+CREATE FUNCTION bdr.table_set_conflict_free(p_relation regclass, p_conflict_free boolean)
+  RETURNS void
+  VOLATILE
+  LANGUAGE 'plpgsql'
+  SET bdr.permit_unsafe_ddl_commands = true
+  SET search_path = ''
+  AS $$
+DECLARE
+    v_label json;
+BEGIN
+    -- emulate STRICT for p_relation parameter
+    IF p_relation IS NULL THEN
+        RETURN;
+    END IF;
+
+    -- query current label
+    SELECT label::json INTO v_label
+    FROM pg_catalog.pg_seclabel
+    WHERE provider = 'bdr'
+        AND classoid = 'pg_class'::regclass
+        AND objoid = p_relation;
+
+    -- replace old 'conflict_free' parameter with new value; false simply
+    -- removes the key
+    SELECT json_object_agg(key, value) INTO v_label
+    FROM (
+        SELECT key, value
+        FROM json_each(v_label)
+        WHERE key <> 'conflict_free'
+      UNION ALL
+        SELECT
+            'conflict_free', to_json(p_conflict_free)
+        WHERE p_conflict_free
+    ) d;
+
+    -- and now set the appropriate label
+    PERFORM bdr.bdr_replicate_ddl_command(format('SECURITY LABEL FOR bdr ON TABLE %s IS %L', p_relation, v_label)) ;
+END;
+$$;
+
+COMMENT ON FUNCTION bdr.table_set_conflict_free(regclass, boolean)
+IS 'Declare a table free of cross-node write conflicts so apply skips conflict detection for it; only safe if at most one node ever writes the table';
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
+
+SET LOCAL bdr.permit_unsafe_ddl_commands = true;
+SET LOCAL bdr.skip_ddl_replication = true;
+SET LOCAL search_path = bdr;
+
+CREATE FUNCTION bdr.pg_stat_get_bdr_decode(
+    OUT peer_sysid text,
+    OUT peer_timeline oid,
+    OUT peer_dboid oid,
+    OUT nr_txns int8,
+    OUT nr_changes int8,
+    OUT nr_changes_filtered_origin int8,
+    OUT nr_changes_filtered_relation int8,
+    OUT bytes_sent int8
+)
+RETURNS SETOF record
+LANGUAGE C
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION bdr.pg_stat_get_bdr_decode() FROM PUBLIC;
+
+COMMENT ON FUNCTION bdr.pg_stat_get_bdr_decode()
+IS 'Per-peer statistics of the decoding (sending) side of replication';
+
+CREATE VIEW bdr.pg_stat_bdr_decode AS SELECT * FROM bdr.pg_stat_get_bdr_decode();
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
+
+SET LOCAL bdr.permit_unsafe_ddl_commands = true;
+SET LOCAL bdr.skip_ddl_replication = true;
+SET LOCAL search_path = bdr;
+
+-- Rebuild bdr.global_lock_info() with acquisition timing columns; the
+-- return type changes, so the function and its dependent view must be
+-- recreated.
+DROP VIEW bdr.bdr_locks;
+DROP FUNCTION bdr.global_lock_info();
+
+CREATE FUNCTION bdr.global_lock_info(
+	OUT owner_replorigin oid,
+	OUT owner_sysid text,
+	OUT owner_timeline oid,
+	OUT owner_dboid oid,
+	OUT lock_mode text,
+	OUT lock_state text,
+	OUT owner_local_pid integer,
+	/* rest is lower level diagnostic stuff */
+	OUT lockcount integer,
+	OUT npeers integer,
+	OUT npeers_confirmed integer,
+	OUT npeers_declined integer,
+	OUT npeers_replayed integer,
+	OUT replay_upto	pg_lsn,
+	/* acquisition timing */
+	OUT acquire_sent_at timestamptz,
+	OUT last_confirm_sysid text,
+	OUT last_confirm_timeline oid,
+	OUT last_confirm_dboid oid,
+	OUT last_confirm_ms int8,
+	OUT last_replay_sysid text,
+	OUT last_replay_timeline oid,
+	OUT last_replay_dboid oid,
+	OUT last_replay_ms int8,
+	OUT confirm_latency_histogram int8[],
+	OUT replay_latency_histogram int8[])
+RETURNS record VOLATILE
+LANGUAGE c AS 'MODULE_PATHNAME','bdr_ddl_lock_info';
+
+COMMENT ON FUNCTION bdr.global_lock_info() IS
+'backing function for bdr.bdr_locks view';
+
+CREATE VIEW bdr.bdr_locks AS
+SELECT
+ owner_replorigin = 0 AS owner_is_my_node,
+ owner_sysid, owner_timeline, owner_dboid,
+ (SELECT node_name FROM bdr.bdr_nodes WHERE (node_sysid,node_timeline,node_dboid) = (owner_sysid, owner_timeline, owner_dboid)) AS owner_node_name,
+ lock_mode, lock_state, owner_local_pid,
+ coalesce(owner_local_pid = pg_backend_pid(),'f') AS owner_is_my_backend,
+ owner_replorigin,
+ lockcount, npeers, npeers_confirmed, npeers_declined, npeers_replayed,
+ replay_upto,
+ acquire_sent_at,
+ (SELECT node_name FROM bdr.bdr_nodes WHERE (node_sysid,node_timeline,node_dboid) = (last_confirm_sysid, last_confirm_timeline, last_confirm_dboid)) AS last_confirm_node_name,
+ last_confirm_ms,
+ (SELECT node_name FROM bdr.bdr_nodes WHERE (node_sysid,node_timeline,node_dboid) = (last_replay_sysid, last_replay_timeline, last_replay_dboid)) AS last_replay_node_name,
+ last_replay_ms,
+ confirm_latency_histogram, replay_latency_histogram
+FROM bdr.global_lock_info();
+
+COMMENT ON VIEW bdr.bdr_locks IS
+'diagnostic information on BDR global locking state, see manual';
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
+
+SET LOCAL bdr.permit_unsafe_ddl_commands = true;
+SET LOCAL bdr.skip_ddl_replication = true;
+SET LOCAL search_path = bdr;
+
+CREATE FUNCTION bdr.bdr_internal_sequence_chunk_size(
+    p_seqschema text,
+    p_seqname text)
+RETURNS int8 VOLATILE
+LANGUAGE c AS 'MODULE_PATHNAME','bdr_internal_sequence_chunk_size';
+
+REVOKE ALL ON FUNCTION bdr.bdr_internal_sequence_chunk_size(text, text) FROM PUBLIC;
+
+COMMENT ON FUNCTION bdr.bdr_internal_sequence_chunk_size(text, text)
+IS 'internal: chunk size the sequencer requests for a global sequence, sized from its observed consumption rate';
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
+
+SET LOCAL bdr.permit_unsafe_ddl_commands = true;
+SET LOCAL bdr.skip_ddl_replication = true;
+SET LOCAL search_path = bdr;
+
+-- Catchup target recorded while a joining node replays in catchup mode, so
+-- a restarted per-db worker resumes toward the original target instead of
+-- chasing the join target's current position. NULL except during init.
+ALTER TABLE bdr.bdr_nodes ADD COLUMN node_init_catchup_lsn pg_lsn;
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
+
+SET LOCAL bdr.permit_unsafe_ddl_commands = true;
+SET LOCAL bdr.skip_ddl_replication = true;
+SET LOCAL search_path = bdr;
+
+CREATE FUNCTION pg_stat_get_bdr_tables(
+    OUT datid oid,
+    OUT relid oid,
+    OUT nr_insert int8,
+    OUT nr_insert_conflict int8,
+    OUT nr_update int8,
+    OUT nr_update_conflict int8,
+    OUT nr_delete int8,
+    OUT nr_delete_conflict int8,
+    OUT apply_time double precision
+)
+RETURNS SETOF record
+LANGUAGE C
+AS 'MODULE_PATHNAME';
+
+REVOKE ALL ON FUNCTION pg_stat_get_bdr_tables() FROM PUBLIC;
+
+CREATE VIEW pg_stat_bdr_tables AS
+  SELECT * FROM pg_stat_get_bdr_tables()
+   WHERE datid = (SELECT oid FROM pg_catalog.pg_database
+                   WHERE datname = pg_catalog.current_database());
+
+COMMENT ON VIEW bdr.pg_stat_bdr_tables IS
+'per-table apply row/conflict counts and (with bdr.track_apply_timing) cumulative apply time';
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
+
+SET LOCAL bdr.permit_unsafe_ddl_commands = true;
+SET LOCAL bdr.skip_ddl_replication = true;
+SET LOCAL search_path = bdr;
+
+CREATE FUNCTION bdr_node_lag(
+    OUT peer_sysid text,
+    OUT peer_timeline oid,
+    OUT peer_dboid oid,
+    OUT last_applied_lsn pg_lsn,
+    OUT received_lsn pg_lsn,
+    OUT lag_bytes int8,
+    OUT last_applied_committs timestamptz,
+    OUT apply_rate int8
+)
+RETURNS SETOF record
+LANGUAGE C
+AS 'MODULE_PATHNAME','bdr_node_lag';
+
+REVOKE ALL ON FUNCTION bdr_node_lag() FROM PUBLIC;
+
+COMMENT ON FUNCTION bdr.bdr_node_lag()
+IS 'per-peer replay lag of this database''s apply workers: last applied position and remote commit time, bytes behind the received position, and recent apply rate in bytes/sec';
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
+
+SET LOCAL bdr.permit_unsafe_ddl_commands = true;
+SET LOCAL bdr.skip_ddl_replication = true;
+SET LOCAL search_path = bdr;
+
+CREATE FUNCTION bdr_apply_action_histogram(
+    OUT peer_sysid text,
+    OUT peer_timeline oid,
+    OUT peer_dboid oid,
+    OUT action text,
+    OUT le_us int8,
+    OUT nr_actions int8
+)
+RETURNS SETOF record
+LANGUAGE C
+AS 'MODULE_PATHNAME','bdr_apply_action_histogram';
+
+REVOKE ALL ON FUNCTION bdr_apply_action_histogram() FROM PUBLIC;
+
+COMMENT ON FUNCTION bdr.bdr_apply_action_histogram()
+IS 'latency histograms of replayed actions per peer; le_us is each bucket''s exclusive upper bound in microseconds, NULL for the top bucket';
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
+
+SET LOCAL bdr.permit_unsafe_ddl_commands = true;
+SET LOCAL bdr.skip_ddl_replication = true;
+SET LOCAL search_path = bdr;
+
+CREATE FUNCTION bdr_apply_replay(path text)
+RETURNS void
+LANGUAGE C
+AS 'MODULE_PATHNAME','bdr_apply_replay';
+
+REVOKE ALL ON FUNCTION bdr_apply_replay(text) FROM PUBLIC;
+
+COMMENT ON FUNCTION bdr.bdr_apply_replay(text)
+IS 'benchmark helper: replay a change stream captured with bdr.apply_capture_path through the apply machinery in a background worker; per-action timings are written to the server log';
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
+
+SET LOCAL bdr.permit_unsafe_ddl_commands = true;
+SET LOCAL bdr.skip_ddl_replication = true;
+SET LOCAL search_path = bdr;
+
+CREATE FUNCTION bdr_table_resync(relation regclass, dsn text, row_threshold integer DEFAULT 1000)
+RETURNS bigint
+LANGUAGE C
+AS 'MODULE_PATHNAME','bdr_table_resync';
+
+REVOKE ALL ON FUNCTION bdr_table_resync(regclass, text, integer) FROM PUBLIC;
+
+COMMENT ON FUNCTION bdr.bdr_table_resync(regclass, text, integer)
+IS 'repair a diverged table against the copy on the peer at dsn by comparing primary-key range checksums and re-copying only the differing rows; returns the number of rows repaired';
+
+RESET bdr.permit_unsafe_ddl_commands;
+RESET bdr.skip_ddl_replication;
+RESET search_path;
@@ -85,6 +85,16 @@ _ZstdCStreamParams(pg_compress_specification compress)
 								   ZSTD_c_enableLongDistanceMatching,
 								   compress.long_distance, "long");
 
+	/*
+	 * Use zstd's own worker threads to parallelize compression of a single
+	 * stream.  The workers never call back into our code, so this is safe to
+	 * combine with pg_dump's parallel workers.  Fails cleanly if libzstd was
+	 * built without multithreading support.
+	 */
+	if (compress.options & PG_COMPRESSION_OPTION_WORKERS)
+		_Zstd_CCtx_setParam_or_die(cstream, ZSTD_c_nbWorkers,
+								   compress.workers, "workers");
+
 	return cstream;
 }
 
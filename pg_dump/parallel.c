@@ -1103,21 +1103,35 @@ ParallelBackupEnd(ArchiveHandle *AH, ParallelState *pstate)
  * buildWorkerCommand: format a command string to send to a worker.
  *
  * The string is built in the caller-supplied buffer of size buflen.
+ *
+ * For a chunked restore (chunkCount > 1) the command carries the worker's
+ * chunk number and the total chunk count; a plain restore keeps the old
+ * command format.
  */
 static void
 buildWorkerCommand(ArchiveHandle *AH, TocEntry *te, T_Action act,
+				   int chunkNo, int chunkCount,
 				   char *buf, int buflen)
 {
 	if (act == ACT_DUMP)
 		snprintf(buf, buflen, "DUMP %d", te->dumpId);
 	else if (act == ACT_RESTORE)
-		snprintf(buf, buflen, "RESTORE %d", te->dumpId);
+	{
+		if (chunkCount > 1)
+			snprintf(buf, buflen, "RESTORE %d CHUNK %d/%d",
+					 te->dumpId, chunkNo, chunkCount);
+		else
+			snprintf(buf, buflen, "RESTORE %d", te->dumpId);
+	}
 	else
 		Assert(false);
 }
 
 /*
  * parseWorkerCommand: interpret a command string in a worker.
+ *
+ * Sets AH->restoreChunkNo/restoreChunkCount for the duration of a chunked
+ * restore job; the caller must reset them once the job is done.
  */
 static void
 parseWorkerCommand(ArchiveHandle *AH, TocEntry **te, T_Action *act,
@@ -1136,9 +1150,23 @@ parseWorkerCommand(ArchiveHandle *AH, TocEntry **te, T_Action *act,
 	}
 	else if (messageStartsWith(msg, "RESTORE "))
 	{
+		int			chunkNo;
+		int			chunkCount;
+
 		*act = ACT_RESTORE;
-		sscanf(msg, "RESTORE %d%n", &dumpId, &nBytes);
-		Assert(nBytes == strlen(msg));
+		if (sscanf(msg, "RESTORE %d CHUNK %d/%d%n",
+				   &dumpId, &chunkNo, &chunkCount, &nBytes) == 3 &&
+			nBytes == strlen(msg))
+		{
+			Assert(chunkCount > 1 && chunkNo >= 0 && chunkNo < chunkCount);
+			AH->restoreChunkNo = chunkNo;
+			AH->restoreChunkCount = chunkCount;
+		}
+		else
+		{
+			sscanf(msg, "RESTORE %d%n", &dumpId, &nBytes);
+			Assert(nBytes == strlen(msg));
+		}
 		*te = getTocEntryByDumpId(AH, dumpId);
 		Assert(*te != NULL);
 	}
@@ -1208,6 +1236,25 @@ DispatchJobForTocEntry(ArchiveHandle *AH,
 					   T_Action act,
 					   ParallelCompletionPtr callback,
 					   void *callback_data)
+{
+	DispatchJobForTocEntryChunk(AH, pstate, te, act, 0, 1,
+								callback, callback_data);
+}
+
+/*
+ * As DispatchJobForTocEntry, but dispatch one chunk of a table-data item
+ * that is being restored as several concurrent sub-jobs. The callback is
+ * invoked once per chunk.
+ */
+void
+DispatchJobForTocEntryChunk(ArchiveHandle *AH,
+							ParallelState *pstate,
+							TocEntry *te,
+							T_Action act,
+							int chunkNo,
+							int chunkCount,
+							ParallelCompletionPtr callback,
+							void *callback_data)
 {
 	int			worker;
 	char		buf[256];
@@ -1217,7 +1264,7 @@ DispatchJobForTocEntry(ArchiveHandle *AH,
 		WaitForWorkers(AH, pstate, WFW_ONE_IDLE);
 
 	/* Construct and send command string */
-	buildWorkerCommand(AH, te, act, buf, sizeof(buf));
+	buildWorkerCommand(AH, te, act, chunkNo, chunkCount, buf, sizeof(buf));
 
 	sendMessageToWorker(pstate, worker, buf);
 
@@ -1364,6 +1411,10 @@ WaitForCommands(ArchiveHandle *AH, int pipefd[2])
 		{
 			/* Perform the restore command */
 			status = (AH->WorkerJobRestorePtr) (AH, te);
+
+			/* Chunk settings apply to a single job only */
+			AH->restoreChunkNo = 0;
+			AH->restoreChunkCount = 0;
 		}
 		else
 			Assert(false);
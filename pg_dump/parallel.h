@@ -78,6 +78,14 @@ extern void DispatchJobForTocEntry(ArchiveHandle *AH,
 								   T_Action act,
 								   ParallelCompletionPtr callback,
 								   void *callback_data);
+extern void DispatchJobForTocEntryChunk(ArchiveHandle *AH,
+										ParallelState *pstate,
+										TocEntry *te,
+										T_Action act,
+										int chunkNo,
+										int chunkCount,
+										ParallelCompletionPtr callback,
+										void *callback_data);
 extern void ParallelBackupEnd(ArchiveHandle *AH, ParallelState *pstate);
 
 extern void set_archive_cancel_info(ArchiveHandle *AH, PGconn *conn);
@@ -116,6 +116,9 @@ static void ready_list_insert(ParallelReadyList *ready_list, TocEntry *te);
 static void ready_list_remove(ParallelReadyList *ready_list, int i);
 static void ready_list_sort(ParallelReadyList *ready_list);
 static int	TocEntrySizeCompare(const void *p1, const void *p2);
+static int	plan_restore_chunks(ArchiveHandle *AH, TocEntry *te,
+								ParallelState *pstate,
+								ParallelReadyList *ready_list);
 static void move_to_ready_list(TocEntry *pending_list,
 							   ParallelReadyList *ready_list,
 							   RestorePass pass);
@@ -912,9 +915,15 @@ restore_toc_entry(ArchiveHandle *AH, TocEntry *te, bool is_parallel)
 					 * boundaries, risking deadlock and/or loss of previously
 					 * loaded data.  (We assume that all partitions of a
 					 * partitioned table will be treated the same way.)
+					 *
+					 * Nor when this item is being restored as one of several
+					 * concurrent chunks: the TRUNCATE would serialize the
+					 * chunks on its ACCESS EXCLUSIVE lock and then wipe the
+					 * rows the other chunks had already loaded.
 					 */
 					use_truncate = is_parallel && te->created &&
-						!is_load_via_partition_root(te);
+						!is_load_via_partition_root(te) &&
+						AH->restoreChunkCount <= 1;
 
 					if (use_truncate)
 					{
@@ -4091,9 +4100,37 @@ restore_toc_entries_parallel(ArchiveHandle *AH, ParallelState *pstate,
 						next_work_item->dumpId,
 						next_work_item->desc, next_work_item->tag);
 
-			/* Dispatch to some worker */
-			DispatchJobForTocEntry(AH, pstate, next_work_item, ACT_RESTORE,
-								   mark_restore_job_done, &ready_list);
+			/*
+			 * An oversized table-data item may be split over several idle
+			 * workers, so one giant table doesn't leave the rest of the crew
+			 * idling while a single worker grinds through it.
+			 */
+			next_work_item->chunkCount =
+				plan_restore_chunks(AH, next_work_item, pstate, &ready_list);
+			next_work_item->chunksDone = 0;
+
+			if (next_work_item->chunkCount > 1)
+			{
+				int			chunkno;
+
+				pg_log_info("splitting item %d %s %s into %d chunks",
+							next_work_item->dumpId,
+							next_work_item->desc, next_work_item->tag,
+							next_work_item->chunkCount);
+
+				for (chunkno = 0; chunkno < next_work_item->chunkCount; chunkno++)
+					DispatchJobForTocEntryChunk(AH, pstate, next_work_item,
+												ACT_RESTORE, chunkno,
+												next_work_item->chunkCount,
+												mark_restore_job_done,
+												&ready_list);
+			}
+			else
+			{
+				/* Dispatch to some worker */
+				DispatchJobForTocEntry(AH, pstate, next_work_item, ACT_RESTORE,
+									   mark_restore_job_done, &ready_list);
+			}
 		}
 		else if (IsEveryWorkerIdle(pstate))
 		{
@@ -4375,6 +4412,56 @@ move_to_ready_list(TocEntry *pending_list,
  * items currently running.  Items in the ready_list are known to have
  * no remaining dependencies, but we have to check for lock conflicts.
  */
+/*
+ * Don't split table-data items into chunks smaller than this many bytes of
+ * (estimated) data; for small items the per-chunk COPY setup and the
+ * redundant re-reading of the data file would eat the gain.
+ */
+#define RESTORE_CHUNK_MIN_SIZE (64 * 1024 * 1024)
+
+/*
+ * Decide how many concurrent chunks to restore a just-popped work item in.
+ *
+ * Chunking applies only to COPY-based table data read from a directory
+ * archive; each chunk streams the shared data file and forwards only its
+ * share of the rows (see putCopyDataFiltered). It's worthwhile when the
+ * item is large and there are idle workers beyond what the other ready
+ * items could use - typically at the tail of a restore, when one giant
+ * table is all that's left and would otherwise run on a single worker.
+ */
+static int
+plan_restore_chunks(ArchiveHandle *AH, TocEntry *te, ParallelState *pstate,
+					ParallelReadyList *ready_list)
+{
+	int			idle_workers = 0;
+	int			nready;
+	int			nchunks;
+	int			k;
+
+	if (AH->format != archDirectory)
+		return 1;
+	if (strcmp(te->desc, "TABLE DATA") != 0 || te->copyStmt == NULL)
+		return 1;
+	if (te->dataLength < (pgoff_t) RESTORE_CHUNK_MIN_SIZE * 2)
+		return 1;
+
+	for (k = 0; k < pstate->numWorkers; k++)
+	{
+		if (pstate->te[k] == NULL)
+			idle_workers++;
+	}
+
+	/* leave a worker for each other ready item */
+	nready = ready_list->last_te - ready_list->first_te + 1;
+	nchunks = idle_workers - nready;
+
+	/* and no point in making chunks smaller than the size floor */
+	if ((pgoff_t) nchunks > te->dataLength / RESTORE_CHUNK_MIN_SIZE)
+		nchunks = (int) (te->dataLength / RESTORE_CHUNK_MIN_SIZE);
+
+	return Max(nchunks, 1);
+}
+
 static TocEntry *
 pop_next_work_item(ParallelReadyList *ready_list,
 				   ParallelState *pstate)
@@ -4479,6 +4566,14 @@ mark_restore_job_done(ArchiveHandle *AH,
 		pg_fatal("worker process failed: exit code %d",
 				 status);
 
+	/*
+	 * For an item restored as several concurrent chunks, hold back the
+	 * dependency bookkeeping until the last chunk is in; the item's
+	 * dependents (indexes, constraints) need all of its rows.
+	 */
+	if (++te->chunksDone < te->chunkCount)
+		return;
+
 	reduce_dependencies(AH, te, ready_list);
 }
 
@@ -4513,6 +4608,8 @@ fix_dependencies(ArchiveHandle *AH)
 		te->nRevDeps = 0;
 		te->pending_prev = NULL;
 		te->pending_next = NULL;
+		te->chunkCount = 1;
+		te->chunksDone = 0;
 	}
 
 	/*
@@ -292,6 +292,21 @@ struct _archiveHandle
 	ArchiverOutput outputKind;	/* Flag for what we're currently writing */
 	bool		pgCopyIn;		/* Currently in libpq 'COPY IN' mode. */
 
+	/*
+	 * Chunked restore of a table-data item (parallel restore only).  When
+	 * restoreChunkCount > 1, this worker is restoring one of several
+	 * concurrent sub-jobs for the same TOC entry and only forwards the COPY
+	 * data rows belonging to its chunk; see putCopyDataFiltered().
+	 */
+	int			restoreChunkNo; /* this worker's chunk, 0-based */
+	int			restoreChunkCount;	/* total chunks; <= 1 means whole item */
+	uint64		chunkLineNo;	/* COPY data rows seen so far */
+	bool		chunkInLine;	/* mid-row; keep current disposition */
+	bool		chunkLineDrop;	/* dropping the current row? */
+	bool		chunkPendingBackslash;	/* row began with lone '\\' at end of
+										 * the previous buffer */
+	bool		chunkSawEOD;	/* saw the \. end-of-data marker */
+
 	int			loFd;
 	bool		writingLO;
 	int			loCount;		/* # of LOs restored */
@@ -373,6 +388,8 @@ struct _tocEntry
 	int			nRevDeps;		/* number of such dependencies */
 	DumpId	   *lockDeps;		/* dumpIds of objects this one needs lock on */
 	int			nLockDeps;		/* number of such dependencies */
+	int			chunkCount;		/* number of concurrent sub-jobs dispatched */
+	int			chunksDone;		/* number of sub-jobs finished so far */
 };
 
 extern int	parallel_restore(ArchiveHandle *AH, TocEntry *te);
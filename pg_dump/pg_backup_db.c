@@ -345,6 +345,13 @@ ExecuteSqlCommand(ArchiveHandle *AH, const char *qry, const char *desc)
 		case PGRES_COPY_IN:
 			/* Assume this is an expected result */
 			AH->pgCopyIn = true;
+
+			/* reset the row filter state for a chunked restore */
+			AH->chunkLineNo = 0;
+			AH->chunkInLine = false;
+			AH->chunkLineDrop = false;
+			AH->chunkPendingBackslash = false;
+			AH->chunkSawEOD = false;
 			break;
 		default:
 			/* trouble */
@@ -438,6 +445,101 @@ ExecuteSimpleCommands(ArchiveHandle *AH, const char *buf, size_t bufLen)
 }
 
 
+/*
+ * Push a piece of COPY data at libpq, fatal on failure.
+ */
+static void
+putCopyData(ArchiveHandle *AH, const char *buf, size_t bufLen)
+{
+	if (PQputCopyData(AH->connection, buf, bufLen) <= 0)
+		pg_fatal("error returned by PQputCopyData: %s",
+				 PQerrorMessage(AH->connection));
+}
+
+/*
+ * Forward COPY data for a chunked table-data restore, keeping only the rows
+ * that belong to this worker's chunk.
+ *
+ * Every worker restoring a chunk streams the whole data file but sends only
+ * every restoreChunkCount'th row, offset by its chunk number, so the chunks
+ * partition the rows exactly without anyone needing to know the row count up
+ * front. The redundant client-side reading is cheap next to the server-side
+ * parsing and insertion being spread across the workers.
+ *
+ * COPY text data escapes embedded newlines and backslashes, so a raw
+ * newline always ends a row and the only row starting with a bare
+ * backslash-dot is the end-of-data marker. From the marker on, the data is
+ * passed through unfiltered by every chunk; the server stops reading at the
+ * marker anyway.
+ *
+ * The data arrives in bufferloads with arbitrary boundaries, so the current
+ * row's disposition, and a possible undecidable lone trailing backslash,
+ * carry over in AH between calls.
+ */
+static void
+putCopyDataFiltered(ArchiveHandle *AH, const char *buf, size_t bufLen)
+{
+	const char *ptr = buf;
+	const char *end = buf + bufLen;
+
+	if (AH->chunkSawEOD)
+	{
+		putCopyData(AH, ptr, end - ptr);
+		return;
+	}
+
+	while (ptr < end)
+	{
+		const char *eol;
+		size_t		len;
+
+		if (!AH->chunkInLine)
+		{
+			/* Decide what to do with the row starting here. */
+			bool		continued_backslash = AH->chunkPendingBackslash;
+
+			AH->chunkPendingBackslash = false;
+
+			if (!continued_backslash && ptr[0] == '\\' && ptr + 1 == end)
+			{
+				/* can't tell a data row from the \. marker yet */
+				AH->chunkPendingBackslash = true;
+				return;
+			}
+
+			if ((continued_backslash && ptr[0] == '.') ||
+				(!continued_backslash && ptr[0] == '\\' && ptr[1] == '.'))
+			{
+				/* the end-of-data marker, and anything after, goes through */
+				AH->chunkSawEOD = true;
+				if (continued_backslash)
+					putCopyData(AH, "\\", 1);
+				putCopyData(AH, ptr, end - ptr);
+				return;
+			}
+
+			AH->chunkLineDrop =
+				(AH->chunkLineNo % AH->restoreChunkCount) !=
+				(uint64) AH->restoreChunkNo;
+			AH->chunkLineNo++;
+			AH->chunkInLine = true;
+
+			if (continued_backslash && !AH->chunkLineDrop)
+				putCopyData(AH, "\\", 1);
+		}
+
+		eol = memchr(ptr, '\n', end - ptr);
+		len = eol ? (size_t) (eol + 1 - ptr) : (size_t) (end - ptr);
+
+		if (!AH->chunkLineDrop)
+			putCopyData(AH, ptr, len);
+
+		ptr += len;
+		if (eol)
+			AH->chunkInLine = false;
+	}
+}
+
 /*
  * Implement ahwrite() for direct-to-DB restore
  */
@@ -455,10 +557,13 @@ ExecuteSqlCommandBuf(Archive *AHX, const char *buf, size_t bufLen)
 		 * mode; this allows us to behave reasonably when trying to continue
 		 * after an error in a COPY command.
 		 */
-		if (AH->pgCopyIn &&
-			PQputCopyData(AH->connection, buf, bufLen) <= 0)
-			pg_fatal("error returned by PQputCopyData: %s",
-					 PQerrorMessage(AH->connection));
+		if (AH->pgCopyIn)
+		{
+			if (AH->restoreChunkCount > 1)
+				putCopyDataFiltered(AH, buf, bufLen);
+			else
+				putCopyData(AH, buf, bufLen);
+		}
 	}
 	else if (AH->outputKind == OUTPUT_OTHERDATA)
 	{
@@ -757,13 +757,20 @@ main(int argc, char **argv)
 		pg_fatal("%s", error_detail);
 
 	/*
-	 * Disable support for zstd workers for now - these are based on
-	 * threading, and it's unclear how it interacts with parallel dumps on
-	 * platforms where that relies on threads too (e.g. Windows).
+	 * Disable support for zstd workers on Windows for now - these are based
+	 * on threading, and it's unclear how it interacts with parallel dumps,
+	 * which rely on threads there too.  Elsewhere parallel dump uses
+	 * processes and zstd's worker threads never call back into our code, so
+	 * the two compose fine.
 	 */
+#ifdef WIN32
 	if (compression_spec.options & PG_COMPRESSION_OPTION_WORKERS)
+	{
 		pg_log_warning("compression option \"%s\" is not currently supported by pg_dump",
 					   "workers");
+		compression_spec.options &= ~PG_COMPRESSION_OPTION_WORKERS;
+	}
+#endif
 
 	/*
 	 * If emitting an archive format, we always want to emit a DATABASE item,
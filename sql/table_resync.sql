@@ -0,0 +1,76 @@
+-- bdr.bdr_table_resync: repair a diverged table against the copy on a peer
+\c postgres
+
+BEGIN;
+SET LOCAL bdr.permit_ddl_locking = true;
+SELECT bdr.bdr_replicate_ddl_command($$
+	CREATE TABLE public.resync_tbl (
+		id integer primary key,
+		val text
+	);
+	CREATE TABLE public.resync_nopk (
+		id integer
+	);
+	CREATE TABLE public.resync_multipk (
+		a integer,
+		b integer,
+		primary key (a, b)
+	);
+	CREATE VIEW public.resync_view AS SELECT * FROM public.resync_tbl;
+$$);
+COMMIT;
+
+INSERT INTO resync_tbl(id, val) SELECT x, 'val-' || x FROM generate_series(1, 100) x;
+
+SELECT bdr.wait_slot_confirm_lsn(NULL,NULL);
+
+\c regression
+
+SELECT count(*) FROM resync_tbl;
+
+-- sanity checks; these all fail before the peer connection is attempted
+SELECT bdr.bdr_table_resync('resync_tbl', 'dbname=postgres', 0);
+SELECT bdr.bdr_table_resync('resync_view', 'dbname=postgres');
+SELECT bdr.bdr_table_resync('resync_nopk', 'dbname=postgres');
+SELECT bdr.bdr_table_resync('resync_multipk', 'dbname=postgres');
+
+-- diverge the local copy without replicating the damage
+\c "dbname=regression options='-c bdr.do_not_replicate=on'"
+
+UPDATE resync_tbl SET val = 'corrupted' WHERE id IN (3, 57);
+DELETE FROM resync_tbl WHERE id = 20;
+INSERT INTO resync_tbl(id, val) VALUES (1000, 'local-only');
+
+\c regression
+
+SELECT id, val FROM resync_tbl WHERE id IN (3, 20, 57, 1000) ORDER BY id;
+
+-- repair against the pristine copy with a small row_threshold so the
+-- range-splitting path gets exercised: two rewritten rows, one re-inserted
+-- row and one local-only row deleted makes four repairs
+SELECT bdr.bdr_table_resync('resync_tbl', 'dbname=postgres', 10);
+
+SELECT count(*) FROM resync_tbl;
+SELECT id, val FROM resync_tbl WHERE id IN (3, 20, 57, 1000) ORDER BY id;
+
+-- a second pass finds nothing left to repair
+SELECT bdr.bdr_table_resync('resync_tbl', 'dbname=postgres');
+
+-- the repairs are ordinary writes, so the source stays as it was once
+-- they replay there
+SELECT bdr.wait_slot_confirm_lsn(NULL,NULL);
+
+\c postgres
+
+SELECT count(*) FROM resync_tbl;
+SELECT id, val FROM resync_tbl WHERE id IN (3, 20, 57, 1000) ORDER BY id;
+
+BEGIN;
+SET LOCAL bdr.permit_ddl_locking = true;
+SELECT bdr.bdr_replicate_ddl_command($$
+	DROP VIEW public.resync_view;
+	DROP TABLE public.resync_tbl;
+	DROP TABLE public.resync_nopk;
+	DROP TABLE public.resync_multipk;
+$$);
+COMMIT;
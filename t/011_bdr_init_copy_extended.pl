@@ -21,6 +21,10 @@ my $node_a = get_new_node('node-a');
 initandstart_node($node_a, $bdr_test_dbname, extra_init_opts => { has_archiving => 1 });
 create_bdr_group($node_a);
 
+# An extra database BDR doesn't replicate. The physical copy brings it along
+# and --drop-unreplicated-databases should remove it from the new node.
+$node_a->safe_psql('postgres', 'CREATE DATABASE unreplicated_db');
+
 my $backup_name = 'a_back1';
 $node_a->backup_fs_hot($backup_name);
 
@@ -67,7 +71,8 @@ command_ok(
         '-d', $node_a->connstr($bdr_test_dbname),
         '--local-dbname', $bdr_test_dbname,
         '--local-port', $node_b->port,
-        '--log-file', $node_b->logfile . "_initcopy"
+        '--log-file', $node_b->logfile . "_initcopy",
+        '--drop-unreplicated-databases'
     ],
 	'bdr_init_copy succeeds');
 
@@ -95,6 +100,19 @@ is($node_a->safe_psql($bdr_test_dbname, 'SELECT a FROM initialdata ORDER BY a'),
 	"1\n2",
 	'Initial data copied');
 
+is($node_b->safe_psql($bdr_test_dbname,
+	q[SELECT 1 FROM pg_database WHERE datname = 'unreplicated_db']),
+	'', 'unreplicated database was dropped on the copy');
+is($node_a->safe_psql($bdr_test_dbname,
+	q[SELECT 1 FROM pg_database WHERE datname = 'unreplicated_db']),
+	'1', 'unreplicated database still exists on the source');
+is($node_b->safe_psql($bdr_test_dbname,
+	q[SELECT count(*) FROM pg_database WHERE datistemplate]),
+	'2', 'template databases survived the drop');
+is($node_b->safe_psql($bdr_test_dbname,
+	q[SELECT 1 FROM pg_database WHERE datname = current_database()]),
+	'1', 'replicated database survived the drop');
+
 # OK, BDR should be up.
 #
 # TODO reuse everything after here instead of copying it from t/010
@@ -0,0 +1,153 @@
+#!/usr/bin/env perl
+#
+# Multi-node replication benchmark harness. Not a regression test - run it
+# via "make bench", not prove's default t/*.pl glob.
+#
+# Brings up an N-node BDR mesh with the same orchestration the TAP tests
+# use, drives pgbench write load against the first node, and samples
+# replication lag from the peer slots while the load runs. Afterwards it
+# measures how long the peers take to fully catch up and how long a global
+# DDL lock round trip takes under no load, then writes a machine-readable
+# JSON report so runs can be diffed between releases.
+#
+# Tunables (environment):
+#   BDR_BENCH_NODES    number of mesh nodes         (default 3)
+#   BDR_BENCH_SCALE    pgbench scale factor         (default 10)
+#   BDR_BENCH_CLIENTS  pgbench clients/threads      (default 8)
+#   BDR_BENCH_RUNTIME  pgbench duration in seconds  (default 60)
+#   BDR_BENCH_REPORT   report path                  (default $TESTDIR/bdr_bench_report.json)
+#
+use strict;
+use warnings;
+use lib "t/";
+use Cwd;
+use Config;
+use PostgresNode;
+use TestLib;
+use Test::More;
+use Time::HiRes qw(time sleep);
+use utils::nodemanagement;
+use utils::concurrent;
+
+my $n_nodes = $ENV{BDR_BENCH_NODES}   // 3;
+my $scale   = $ENV{BDR_BENCH_SCALE}   // 10;
+my $clients = $ENV{BDR_BENCH_CLIENTS} // 8;
+my $runtime = $ENV{BDR_BENCH_RUNTIME} // 60;
+my $report  = $ENV{BDR_BENCH_REPORT}
+    // (($ENV{TESTDIR} // 'tmp_check') . '/bdr_bench_report.json');
+
+die "BDR_BENCH_NODES must be at least 2" if $n_nodes < 2;
+
+# Bring up the mesh. pgbench must be initialized before BDR comes up since
+# we don't support transparent DDL replication; the joining nodes get the
+# schema via the join dump.
+my $node_0 = get_new_node('bench_node_0');
+initandstart_node($node_0);
+pgbench_init($node_0, $scale);
+create_bdr_group($node_0);
+
+my @nodes = ($node_0);
+for my $nodeid (1 .. $n_nodes - 1) {
+    my $node_n = get_new_node("bench_node_$nodeid");
+    initandstart_logicaljoin_node($node_n, $node_0);
+    push @nodes, $node_n;
+}
+
+note "mesh of $n_nodes nodes is up, running pgbench for ${runtime}s with $clients clients";
+
+# Drive write load on node 0 and sample peer slot lag once a second. The
+# confirmed flush position of a peer's slot only advances once the peer has
+# flushed the applied data, so the distance from the current WAL insert
+# position is the end-to-end replication lag in bytes.
+my $lag_query = q[
+    SELECT node_name, pg_wal_lsn_diff(pg_current_wal_lsn(), slot_confirmed_lsn)
+    FROM bdr.bdr_node_slots
+    WHERE slot_confirmed_lsn IS NOT NULL
+];
+
+# Like utils::concurrent::pgbench_start, but keeps hold of stdout so we can
+# report the tps figure afterwards.
+my ($pgbench_out, $pgbench_err) = ('', '');
+my $pgbench_handle = IPC::Run::start(
+    ['pgbench', '-n', '-T', $runtime, '-j', $clients, '-c', $clients,
+     '-d', $node_0->connstr($bdr_test_dbname)],
+    '>', \$pgbench_out, '2>', \$pgbench_err);
+
+my %lag_samples;
+my $bench_start = time();
+while (time() - $bench_start < $runtime) {
+    sleep(1);
+    foreach my $row (split /\n/, $node_0->safe_psql($bdr_test_dbname, $lag_query)) {
+        my ($node_name, $lag_bytes) = split /\|/, $row;
+        push @{ $lag_samples{$node_name} }, $lag_bytes;
+    }
+}
+
+$pgbench_handle->finish;
+is($pgbench_handle->full_result(0), 0, 'pgbench exited without error');
+
+my ($tps) = $pgbench_out =~ /tps = ([\d.]+)/;
+$tps //= 0;
+
+# How long do the peers need to drain the remaining queue once the load
+# stops?
+my $catchup_start = time();
+$node_0->safe_psql($bdr_test_dbname,
+    'SELECT bdr.wait_slot_confirm_lsn(NULL, NULL)');
+my $catchup_s = time() - $catchup_start;
+pass('peers caught up after load');
+
+# Global DDL lock round-trip latency on the quiesced mesh: each sample
+# replicates a trivial DDL command, which acquires and releases the lock
+# across all nodes.
+my @ddl_ms;
+for my $i (1 .. 5) {
+    my $ddl_start = time();
+    exec_ddl($node_0,
+        qq{COMMENT ON TABLE public.pgbench_accounts IS 'bdr_bench $i';});
+    push @ddl_ms, (time() - $ddl_start) * 1000.0;
+}
+pass('ddl lock round trips completed');
+
+# Report
+sub percentile {
+    my ($samples, $p) = @_;
+    my @sorted = sort { $a <=> $b } @$samples;
+    return 0 if !@sorted;
+    return $sorted[int($p / 100.0 * $#sorted + 0.5)];
+}
+
+my @lag_json;
+foreach my $node_name (sort keys %lag_samples) {
+    my $s = $lag_samples{$node_name};
+    push @lag_json, sprintf(
+        '    "%s": {"p50": %d, "p90": %d, "p99": %d, "max": %d, "samples": %d}',
+        $node_name,
+        percentile($s, 50), percentile($s, 90), percentile($s, 99),
+        percentile($s, 100), scalar(@$s));
+}
+
+open(my $fh, '>', $report) or die "can't write report $report: $!";
+printf $fh <<'EOJ',
+{
+  "nodes": %d,
+  "scale": %d,
+  "clients": %d,
+  "runtime_s": %d,
+  "tps": %.2f,
+  "catchup_s": %.3f,
+  "ddl_lock_ms": {"p50": %.1f, "max": %.1f},
+  "lag_bytes": {
+%s
+  }
+}
+EOJ
+    $n_nodes, $scale, $clients, $runtime, $tps, $catchup_s,
+    percentile(\@ddl_ms, 50), percentile(\@ddl_ms, 100),
+    join(",\n", @lag_json);
+close($fh);
+
+note "benchmark report written to $report";
+
+stop_nodes(\@nodes);
+done_testing();